@@ -0,0 +1,32 @@
+// Replays AtlasManager::defragment() moves on the device copy of the atlas.
+// One work group per move, work items stride over the bytes of each row.
+// Moves run in no particular order. AtlasManager::defragment() only returns
+// moves whose rectangles are disjoint from each other's sources and
+// destinations: page moves and in-page moves never share a call.
+
+// font/atlas_manager.hpp
+struct AtlasMove {
+    uint src_x, src_y;
+    uint dst_x, dst_y;
+    uint width, height;
+};
+
+__kernel void copy_atlas_rects(
+    __global uchar* texels,
+    const uint pitch,     // bytes per row
+    const uint channels,  // bytes per texel
+    __global const struct AtlasMove* moves)
+{
+    const struct AtlasMove move = moves[get_group_id(1)];
+    const uint bytes = move.width * channels;
+
+    for (uint y = 0; y < move.height; ++y) {
+        __global const uchar* src =
+            texels + (move.src_y + y) * pitch + move.src_x * channels;
+        __global uchar* dst =
+            texels + (move.dst_y + y) * pitch + move.dst_x * channels;
+        for (uint i = get_local_id(0); i < bytes; i += get_local_size(0)) {
+            dst[i] = src[i];
+        }
+    }
+}
@@ -6,9 +6,9 @@ struct Mesh {
 }; 
 
 
+// whether the boxes overlap; touching counts
 bool contains(const global struct AABB* node, const global struct AABB* aabb) {
-    // TODO
-    return false;
+    return all(node->min <= aabb->max) && all(node->max >= aabb->min);
 }
 
 __kernel void cull(
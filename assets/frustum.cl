@@ -1,4 +1,10 @@
 
+// Work-group size the local scan is sized for; the host launches at most
+// this many items per group (see Autotuner).
+#ifndef WG_SIZE
+#define WG_SIZE 256
+#endif
+
 struct AABB {
     float3 min;
     float3 max;
@@ -80,15 +86,17 @@ __kernel void create_index_buffer(
     const uint lid = get_local_id(0);
     const uint lsize = get_local_size(0);
 
+    // culled nodes still take part in the scan: every item of the group has
+    // to reach the barriers below
     const __global struct Node* node = &nodes[gid];
-    if (!intersects_aabb_frustum(node->box, *frustum))
-        return;
+    const uint num_items =
+        intersects_aabb_frustum(node->box, *frustum) ? node->num_Items : 0;
 
     /* ---------------------------
        1) LOCAL COUNT (per thread)
        --------------------------- */
     uint my_count = 0;
-    for (uint i = 0; i < node->num_Items; ++i) {
+    for (uint i = 0; i < num_items; ++i) {
         const __global struct Mesh* mesh = &meshes[node->items[i]];
         my_count += mesh->num_triangles * 3;
     }
@@ -96,7 +104,7 @@ __kernel void create_index_buffer(
     /* ---------------------------
        2) WORKGROUP SCAN
        --------------------------- */
-    __local uint l_counts[256];   // must >= local size
+    __local uint l_counts[WG_SIZE];   // must >= local size
     l_counts[lid] = my_count;
     barrier(CLK_LOCAL_MEM_FENCE);
 
@@ -125,7 +133,7 @@ __kernel void create_index_buffer(
        --------------------------- */
     uint write_pos = wg_base + my_offset;
 
-    for (uint i = 0; i < node->num_Items; ++i) {
+    for (uint i = 0; i < num_items; ++i) {
         const __global struct Mesh* mesh = &meshes[node->items[i]];
         for (uint t = 0; t < mesh->num_triangles; ++t) {
             const __global struct Triangle* tri = &mesh->triangles[t];
@@ -0,0 +1,61 @@
+// Instanced glyph quads, one work item per glyph. The CPU path in
+// font/quads.cpp computes the same values; both round to nearest even.
+
+#define QUAD_SUBPIXEL 8.0f
+
+// font/atlas.hpp
+struct AtlasGlyph {
+    float2 bearing;  // px, y up
+    float2 size;
+    ushort u0, v0, u1, v1;
+};
+
+// cl/GlyphQuads.hpp
+struct Label {
+    float2 origin;
+    float scale;
+    uint color;
+};
+
+// font/quads.hpp, 20 bytes: no vector members so nothing gets padded
+struct GlyphQuad {
+    short x, y;
+    ushort width, height;
+    ushort u0, v0, u1, v1;
+    uint color;
+};
+
+__kernel void build_glyph_quads(
+    __global const float* x,
+    __global const float* y,
+    __global const uint* entry,
+    __global const uint* label,
+    __global const struct Label* labels,
+    __global const struct AtlasGlyph* entries,
+    __global struct GlyphQuad* quads,
+    const uint count)
+{
+    const uint i = get_global_id(0);
+    if (i >= count) {
+        return;
+    }
+
+    const struct AtlasGlyph g = entries[entry[i]];
+    const struct Label l = labels[label[i]];
+    const float s = l.scale * QUAD_SUBPIXEL;
+
+    const float x0 = l.origin.x * QUAD_SUBPIXEL + (x[i] + g.bearing.x) * s;
+    const float y0 = l.origin.y * QUAD_SUBPIXEL + (y[i] - g.bearing.y) * s;
+
+    struct GlyphQuad q;
+    q.x = convert_short_sat_rte(x0);
+    q.y = convert_short_sat_rte(y0);
+    q.width = convert_ushort_sat_rte(g.size.x * s);
+    q.height = convert_ushort_sat_rte(g.size.y * s);
+    q.u0 = g.u0;
+    q.v0 = g.v0;
+    q.u1 = g.u1;
+    q.v1 = g.v1;
+    q.color = l.color;
+    quads[i] = q;
+}
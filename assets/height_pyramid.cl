@@ -0,0 +1,191 @@
+#include "AABB.h"
+
+// Pyramid of height bounds over the terrain grid, mirrored by
+// ReferenceHeightPyramid() in cl/HeightPyramid.hpp. A cell of level L spans
+// `leaf << L` quads per side, from texel x0 to x1 = min(x0 + span, width - 1)
+// inclusive; x = (min, max, error), w unused. The error is how far the
+// heights inside may be from the cell drawn as one bilinear patch over its
+// corners, which is what LOD selection compares against.
+
+// bit identical to the host, which does not fuse either
+#pragma OPENCL FP_CONTRACT OFF
+
+__constant sampler_t pyramid_samp =
+    CLK_NORMALIZED_COORDS_FALSE |
+    CLK_ADDRESS_CLAMP_TO_EDGE |
+    CLK_FILTER_NEAREST;
+
+static float height_at(read_only image2d_t image, int x, int y)
+{
+    return read_imagef(image, pyramid_samp, (int2)(x, y)).x;
+}
+
+static float lerp_height(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+// corners of the cell spanning [x0, x1] x [y0, y1]
+struct Patch {
+    int x0, y0, x1, y1;
+    float h00, h10, h01, h11;
+};
+
+static struct Patch make_patch(read_only image2d_t image, int2 cell, int span)
+{
+    struct Patch p;
+    p.x0 = cell.x * span;
+    p.y0 = cell.y * span;
+    p.x1 = min(p.x0 + span, (int)get_image_width(image) - 1);
+    p.y1 = min(p.y0 + span, (int)get_image_height(image) - 1);
+    p.h00 = height_at(image, p.x0, p.y0);
+    p.h10 = height_at(image, p.x1, p.y0);
+    p.h01 = height_at(image, p.x0, p.y1);
+    p.h11 = height_at(image, p.x1, p.y1);
+    return p;
+}
+
+static float patch_deviation(struct Patch p, float h, int x, int y)
+{
+    const float tx = p.x1 > p.x0 ? (float)(x - p.x0) / (float)(p.x1 - p.x0)
+                                 : 0.0f;
+    const float ty = p.y1 > p.y0 ? (float)(y - p.y0) / (float)(p.y1 - p.y0)
+                                 : 0.0f;
+    const float top = lerp_height(p.h00, p.h10, tx);
+    const float bottom = lerp_height(p.h01, p.h11, tx);
+    return fabs(h - lerp_height(top, bottom, ty));
+}
+
+/**
+ * Level 0 straight from the heightmap, one item per leaf cell: exact bounds
+ * and error over its (leaf + 1)^2 texels. Level 0 starts the pyramid.
+ * Global size: cells.
+ */
+__kernel void height_bounds_leaf(read_only image2d_t image,
+                                 __global float4* out,
+                                 uint2 cells,
+                                 int leaf)
+{
+    const int2 cell = (int2)(get_global_id(0), get_global_id(1));
+    if (cell.x >= cells.x || cell.y >= cells.y)
+        return;
+
+    const struct Patch p = make_patch(image, cell, leaf);
+    float lo = MAXFLOAT, hi = -MAXFLOAT, error = 0.0f;
+    for (int y = p.y0; y <= p.y1; ++y) {
+        for (int x = p.x0; x <= p.x1; ++x) {
+            const float h = height_at(image, x, y);
+            lo = fmin(lo, h);
+            hi = fmax(hi, h);
+            error = fmax(error, patch_deviation(p, h, x, y));
+        }
+    }
+    out[cell.y * cells.x + cell.x] = (float4)(lo, hi, error, 0.0f);
+}
+
+/**
+ * One level from the one below, both in the pyramid buffer at the given
+ * cell offsets: bounds of up to four children, and as error
+ * the largest child error plus the largest deviation of the children's
+ * corners from this cell's patch. The children's patches differ from it by
+ * a bilinear function, which peaks at their corners, so the bound holds.
+ * Global size: cells.
+ */
+__kernel void height_bounds_reduce(read_only image2d_t image,
+                                   __global float4* pyramid,
+                                   uint child_offset,
+                                   uint2 child_cells,
+                                   uint offset,
+                                   uint2 cells,
+                                   int span)
+{
+    const int2 cell = (int2)(get_global_id(0), get_global_id(1));
+    if (cell.x >= cells.x || cell.y >= cells.y)
+        return;
+
+    float lo = MAXFLOAT, hi = -MAXFLOAT, child_error = 0.0f;
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+            const int2 child = cell * 2 + (int2)(i, j);
+            if (child.x >= child_cells.x || child.y >= child_cells.y)
+                continue;
+            const float4 b = pyramid[child_offset + child.y * child_cells.x +
+                                     child.x];
+            lo = fmin(lo, b.x);
+            hi = fmax(hi, b.y);
+            child_error = fmax(child_error, b.z);
+        }
+    }
+
+    const struct Patch p = make_patch(image, cell, span);
+    const int xs[3] = {p.x0, min(p.x0 + span / 2, p.x1), p.x1};
+    const int ys[3] = {p.y0, min(p.y0 + span / 2, p.y1), p.y1};
+    float deviation = 0.0f;
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 3; ++i) {
+            const float h = height_at(image, xs[i], ys[j]);
+            deviation = fmax(deviation, patch_deviation(p, h, xs[i], ys[j]));
+        }
+    }
+    pyramid[offset + cell.y * cells.x + cell.x] =
+        (float4)(lo, hi, child_error + deviation, 0.0f);
+}
+
+/**
+ * Boxes of a complete quadtree stored breadth first (children of node i at
+ * 4i + 1 .. 4i + 4, in Morton order) from the pyramid: depth d reads level
+ * top - d. x and y are in Vertex::position units, 0..1 over the map.
+ * Nodes past the map get an empty, inverted box; items are left alone.
+ * Global size: number of nodes.
+ */
+__kernel void fill_node_boxes(__global const float4* pyramid,
+                              __global const uint* level_offsets,
+                              uint2 leaf_cells,
+                              uint top,
+                              int leaf,
+                              uint2 image_size,
+                              __global struct Node* nodes,
+                              uint num_nodes)
+{
+    const uint index = get_global_id(0);
+    if (index >= num_nodes)
+        return;
+
+    uint depth = 0, first = 0, count = 1;
+    while (index >= first + count) {
+        first += count;
+        count *= 4;
+        ++depth;
+    }
+
+    // the path from the root, two bits per level, is the Morton code
+    uint code = index - first;
+    uint2 cell = (uint2)(0, 0);
+    for (uint bit = 0; code; ++bit, code >>= 2) {
+        cell.x |= (code & 1) << bit;
+        cell.y |= ((code >> 1) & 1) << bit;
+    }
+
+    const uint level = top - depth;
+    const uint2 cells = (leaf_cells + (1u << level) - 1) >> level;
+    __global struct Node* node = &nodes[index];
+    if (cell.x < cells.x && cell.y < cells.y) {
+        const float4 b = pyramid[level_offsets[level] + cell.y * cells.x +
+                                 cell.x];
+        const uint span = (uint)leaf << level;
+        const uint2 lo = cell * span;
+        const uint2 hi = min(lo + span, image_size - 1);
+        node->box.min = (float3)((float)lo.x / image_size.x,
+                                 (float)lo.y / image_size.y, b.x);
+        node->box.max = (float3)((float)hi.x / image_size.x,
+                                 (float)hi.y / image_size.y, b.y);
+    } else {
+        node->box.min = (float3)(MAXFLOAT);
+        node->box.max = (float3)(-MAXFLOAT);
+    }
+
+    const bool inner = depth < top;
+    for (uint c = 0; c < 4; ++c)
+        node->children[c] = inner ? index * 4 + 1 + c : 0;
+    node->num_children = inner ? 4 : 0;
+}
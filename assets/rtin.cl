@@ -0,0 +1,89 @@
+// Error map of a right-triangulated irregular network (RTIN) over a
+// (2^k + 1)^2 height grid, mirrored by ComputeRtinErrors() in cl/Rtin.cpp.
+//
+// Every vertex but the corners is the midpoint of the hypotenuse of one or
+// two triangles of the hierarchy. Its error is how far the height there is
+// from the hypotenuse, or the error of the children's midpoints if larger.
+// The host runs one pass per level from fine to coarse: edge midpoints of
+// half length d, then square centres of half size d, then d * 2. Each
+// vertex gathers from its children, so no two items write the same value.
+
+// bit identical to the host, which does not fuse either
+#pragma OPENCL FP_CONTRACT OFF
+
+static float interpolation_error(__global const float* heights, uint size,
+                                 int2 m, int2 a, int2 b)
+{
+    const float h = heights[m.y * size + m.x];
+    const float ha = heights[a.y * size + a.x];
+    const float hb = heights[b.y * size + b.x];
+    return fabs(h - 0.5f * (ha + hb));
+}
+
+/**
+ * Centres of the squares of side 2d; squares alternate between the two
+ * diagonals like a checkerboard, the whole grid using the main diagonal.
+ * The children's midpoints are the four edge midpoints of the square.
+ * Global size: ((size - 1) / 2d, (size - 1) / 2d).
+ */
+__kernel void rtin_square_errors(__global const float* heights,
+                                 __global float* errors,
+                                 uint size,
+                                 int d)
+{
+    const int i = get_global_id(0);
+    const int j = get_global_id(1);
+    const int2 m = (int2)(d + 2 * d * i, d + 2 * d * j);
+
+    const bool main_diagonal = ((i + j) & 1) == 0;
+    const int2 a = m + (main_diagonal ? (int2)(-d, -d) : (int2)(-d, d));
+    const int2 b = m + (main_diagonal ? (int2)(d, d) : (int2)(d, -d));
+
+    float error = interpolation_error(heights, size, m, a, b);
+    error = fmax(error, errors[m.y * size + m.x - d]);
+    error = fmax(error, errors[m.y * size + m.x + d]);
+    error = fmax(error, errors[(m.y - d) * size + m.x]);
+    error = fmax(error, errors[(m.y + d) * size + m.x]);
+    errors[m.y * size + m.x] = error;
+}
+
+/**
+ * Midpoints of horizontal (z == 0) and vertical (z == 1) edges of length
+ * 2d. The right angles of their triangles lie d to either side, where the
+ * grid has room; the children's midpoints are square centres of half size
+ * d / 2, none for d == 1.
+ * Global size: ((size - 1) / 2d + 1, (size - 1) / 2d + 1, 2).
+ */
+__kernel void rtin_edge_errors(__global const float* heights,
+                               __global float* errors,
+                               uint size,
+                               int d)
+{
+    const int n = (size - 1) / (2 * d);
+    const bool vertical = get_global_id(2) == 1;
+    const int along = get_global_id(vertical ? 1 : 0);
+    const int across = get_global_id(vertical ? 0 : 1);
+    if (along >= n)
+        return;
+
+    // along the edge and across it
+    const int2 u = vertical ? (int2)(0, 1) : (int2)(1, 0);
+    const int2 v = vertical ? (int2)(1, 0) : (int2)(0, 1);
+    const int2 m = u * (d + 2 * d * along) + v * (2 * d * across);
+
+    float error = interpolation_error(heights, size, m, m - u * d, m + u * d);
+    if (d > 1) {
+        const int h = d / 2;
+        for (int side = -1; side <= 1; side += 2) {
+            const int2 c = m + v * (side * d);
+            if (c.x > (int)size - 1 || c.y > (int)size - 1 || c.x < 0 ||
+                c.y < 0)
+                continue;
+            const int2 l = m + v * (side * h) - u * h;
+            const int2 r = m + v * (side * h) + u * h;
+            error = fmax(error, errors[l.y * size + l.x]);
+            error = fmax(error, errors[r.y * size + r.x]);
+        }
+    }
+    errors[m.y * size + m.x] = error;
+}
@@ -0,0 +1,162 @@
+// Composites text from an SDF/MSDF/MTSDF atlas, one work group per 16x16
+// tile, one work item per pixel. Quads and tile lists are prepared on the
+// host (PrepareSdfText in font/sdf.cpp); the math mirrors CompositeTile there.
+
+#define TILE 16
+
+// font/sdf.hpp
+struct SdfQuad {
+    float2 origin;
+    float2 inv_size;
+    float2 uv0;
+    float2 uv_size;
+    float scale;
+    uint style;
+    uint fill;
+    uint padding;
+};
+
+struct SdfStyle {
+    float2 inv_x;
+    float2 inv_y;
+    float2 offset;
+    float2 shadow_shift;
+    uint outline_color;
+    uint shadow_color;
+    float outline_width;
+    float shadow_softness;
+};
+
+static float4 unpack_premultiplied(uint c) {
+    const float4 v = (float4)(c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF,
+                              c >> 24) / 255.0f;
+    return (float4)(v.xyz * v.w, v.w);
+}
+
+static float texel(__global const uchar* atlas, int2 size, int channels,
+                   int x, int y, int c) {
+    x = clamp(x, 0, size.x - 1);
+    y = clamp(y, 0, size.y - 1);
+    return atlas[(y * size.x + x) * channels + c];
+}
+
+static float median3(float a, float b, float c) {
+    return max(min(a, b), min(max(a, b), c));
+}
+
+// {median, true distance} in 0..1
+static float2 sample_sdf(__global const uchar* atlas, int2 size, int channels,
+                         float2 t) {
+    const float2 p = t - 0.5f;
+    const float2 base = floor(p);
+    const float2 f = p - base;
+    const int x = (int)base.x;
+    const int y = (int)base.y;
+
+    float c[4];
+    for (int i = 0; i < channels; ++i) {
+        const float t00 = texel(atlas, size, channels, x, y, i);
+        const float t10 = texel(atlas, size, channels, x + 1, y, i);
+        const float t01 = texel(atlas, size, channels, x, y + 1, i);
+        const float t11 = texel(atlas, size, channels, x + 1, y + 1, i);
+        const float top = t00 + (t10 - t00) * f.x;
+        const float bottom = t01 + (t11 - t01) * f.x;
+        c[i] = (top + (bottom - top) * f.y) / 255.0f;
+    }
+
+    if (channels == 1) {
+        return (float2)(c[0], c[0]);
+    }
+    const float m = median3(c[0], c[1], c[2]);
+    return (float2)(m, channels == 4 ? c[3] : m);
+}
+
+// signed distances in image pixels, false outside the quad
+static bool quad_distance(__global const struct SdfQuad* quad,
+                          float2 q,
+                          __global const uchar* atlas, int2 size,
+                          int channels, float range, float2* d) {
+    const float2 local = (q - quad->origin) * quad->inv_size;
+    if (local.x < 0.0f || local.y < 0.0f || local.x > 1.0f || local.y > 1.0f) {
+        return false;
+    }
+    const float2 s = sample_sdf(atlas, size, channels,
+                                quad->uv0 + local * quad->uv_size);
+    *d = (s - 0.5f) * range * quad->scale;
+    return true;
+}
+
+static float4 blend(float4 acc, float d, float add, float mul, float4 color) {
+    const float coverage = clamp((d + add) * mul + 0.5f, 0.0f, 1.0f);
+    return color * coverage + acc * (1.0f - color.w * coverage);
+}
+
+__kernel void composite_sdf_text(
+    __global const struct SdfQuad* quads,
+    __global const struct SdfStyle* styles,
+    __global const uint* tile_offsets,
+    __global const uint* tile_quads,
+    __global const uchar* atlas,
+    const int2 atlas_size,
+    const int channels,
+    const float distance_range,
+    __global uchar4* target,
+    const uint2 image)
+{
+    const uint x = get_global_id(0);
+    const uint y = get_global_id(1);
+    if (x >= image.x || y >= image.y) {
+        return;
+    }
+
+    const uint tile = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+    const uint begin = tile_offsets[tile];
+    const uint end = tile_offsets[tile + 1];
+    if (begin == end) {
+        return;
+    }
+
+    __global uchar4* pixel = target + y * image.x + x;
+    float4 acc = convert_float4(*pixel) / 255.0f;
+    const float2 center = (float2)(x + 0.5f, y + 0.5f);
+
+    // all shadows first, so no shadow darkens a neighbouring glyph's fill
+    for (uint i = begin; i < end; ++i) {
+        __global const struct SdfQuad* quad = quads + tile_quads[i];
+        __global const struct SdfStyle* style = styles + quad->style;
+        if (style->shadow_color == 0) {
+            continue;
+        }
+
+        const float2 p = center - style->offset;
+        const float2 q = style->inv_x * p.x + style->inv_y * p.y -
+                         style->shadow_shift;
+        float2 d;
+        if (quad_distance(quad, q, atlas, atlas_size, channels,
+                          distance_range, &d)) {
+            const float width = max(style->shadow_softness * quad->scale, 1.0f);
+            acc = blend(acc, d.y, style->outline_width * quad->scale,
+                        1.0f / width, unpack_premultiplied(style->shadow_color));
+        }
+    }
+
+    for (uint i = begin; i < end; ++i) {
+        __global const struct SdfQuad* quad = quads + tile_quads[i];
+        __global const struct SdfStyle* style = styles + quad->style;
+
+        const float2 p = center - style->offset;
+        const float2 q = style->inv_x * p.x + style->inv_y * p.y;
+        float2 d;
+        if (!quad_distance(quad, q, atlas, atlas_size, channels,
+                           distance_range, &d)) {
+            continue;
+        }
+        if (style->outline_color != 0) {
+            acc = blend(acc, d.y, style->outline_width * quad->scale, 1.0f,
+                        unpack_premultiplied(style->outline_color));
+        }
+        acc = blend(acc, d.x, 0.0f, 1.0f, unpack_premultiplied(quad->fill));
+    }
+
+    *pixel = convert_uchar4_sat_rte(acc * 255.0f);
+}
@@ -21,6 +21,65 @@ struct Triangle {
     uint vertices[3];
 };
 
+///-- normals
+
+// Side of the square tile calculate_surface_normal loads into local memory;
+// the work group has to be NORMAL_TILE x NORMAL_TILE.
+#ifndef NORMAL_TILE
+#define NORMAL_TILE 16
+#endif
+
+#define NORMAL_HALO_TILE (NORMAL_TILE + 2)
+
+// borders repeat the edge texel, so edge normals stay flat rather than
+// dropping off to zero height
+__constant sampler_t edge_samp =
+    CLK_NORMALIZED_COORDS_FALSE |
+    CLK_ADDRESS_CLAMP_TO_EDGE |
+    CLK_FILTER_NEAREST;
+
+// Sobel normal from the 3x3 heights around a texel, row major, in the space
+// of Vertex::position where x and y span 0..1 over the map. Mirrored by
+// SobelNormal() in cl/TerrainNormals.hpp.
+static float3 sobel_normal(const float h[9], float2 size)
+{
+    const float gx = (h[2] + 2.0f * h[5] + h[8]) - (h[0] + 2.0f * h[3] + h[6]);
+    const float gy = (h[6] + 2.0f * h[7] + h[8]) - (h[0] + 2.0f * h[1] + h[2]);
+
+    // the kernel sums weigh 8, over two texels: / 8 gives height per texel
+    return normalize((float3)(-gx * size.x * 0.125f,
+                              -gy * size.y * 0.125f,
+                              1.0f));
+}
+
+// Octahedral encoding as two snorm16 in one uint, x in the low half. Mirrored
+// by OctEncode() in cl/TerrainNormals.hpp.
+static uint oct_encode(float3 n)
+{
+    n /= fabs(n.x) + fabs(n.y) + fabs(n.z);
+    float2 p = n.xy;
+    if (n.z < 0.0f) {
+        p = (1.0f - fabs(n.yx)) *
+            (float2)(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    const short2 q = convert_short2_sat_rte(clamp(p, -1.0f, 1.0f) * 32767.0f);
+    return (uint)as_ushort(q.x) | ((uint)as_ushort(q.y) << 16);
+}
+
+// Inverse of oct_encode. Mirrored by OctDecode() in cl/TerrainNormals.hpp.
+static float3 oct_decode(uint packed)
+{
+    const short2 q = (short2)(as_short((ushort)(packed & 0xFFFF)),
+                              as_short((ushort)(packed >> 16)));
+    const float2 p = convert_float2(q) / 32767.0f;
+    float3 n = (float3)(p, 1.0f - fabs(p.x) - fabs(p.y));
+    if (n.z < 0.0f) {
+        n.x = (1.0f - fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+
 
 uint get_vertex_id(uint width, int2 coord) {
     return coord.x + coord.y * width;
@@ -29,11 +88,13 @@ uint get_vertex_id(uint width, int2 coord) {
 // TODO: 
 // input: heightmap
 // output: vbo
+// Normals come from calculate_surface_normal, which must have run first.
 __kernel void calculate_geometry(
     __global const float* a,
     __global const float* b,
     __global struct Vertex* out,
-    read_only image2d_t image)
+    read_only image2d_t image,
+    __global const uint* normals)
 {
 
     const uint width = get_image_width(image);
@@ -60,13 +121,18 @@ __kernel void calculate_geometry(
             continue;
         }
 
-        float4 rgba = read_imagef(image, samp, (int2)(x, y));
+        float4 rgba = read_imagef(image, samp, coord);
         float z = rgba.x;
 
-        vertex[i].position = (float3)(coord.x / width, coord.y / height, z);
-        vertex[i].texCoord = (float2)(coord.x / width, coord.y / height);
+        // 0..1 over the map; integer division would truncate to 0
+        const float2 uv = (float2)((float)coord.x / width,
+                                   (float)coord.y / height);
+        vertex[i].position = (float3)(uv, z);
+        vertex[i].texCoord = uv;
+        vertex[i].normal = oct_decode(normals[coord.y * width + coord.x]);
 
-        int gid = get_global_id(0) * 4 + i;
+        // four corners per texel, row major over the whole grid
+        const uint gid = (y * width + x) * 4 + i;
         out[gid] = vertex[i];
     }
 
@@ -82,12 +148,44 @@ __kernel void calculate_geometry(
     triangles[1].vertices[1] = get_vertex_id(width, coords[3]);
     triangles[1].vertices[2] = get_vertex_id(width, coords[2]);
 
-    
-    // TODO: calculate surface normal
 }
 
-__kernel void calculate_surface_normal(__global struct Vertex* out,
-                                       image2d_t image)
+/**
+ * Oct-encoded normal per heightmap texel (see oct_encode), row major. Each
+ * work group loads its tile plus a one texel halo into local memory once, so
+ * every texel is read from the image about 1.3 times instead of 9.
+ * The grid is rounded up to whole tiles; the extra items only help loading.
+ */
+__kernel __attribute__((reqd_work_group_size(NORMAL_TILE, NORMAL_TILE, 1)))
+void calculate_surface_normal(__global uint* normals,
+                              read_only image2d_t image)
 {
-    // TODO
-}
\ No newline at end of file
+    __local float tile[NORMAL_HALO_TILE * NORMAL_HALO_TILE];
+
+    const int width = get_image_width(image);
+    const int height = get_image_height(image);
+    const int2 origin = (int2)(get_group_id(0), get_group_id(1)) * NORMAL_TILE;
+    const int lid = get_local_id(1) * NORMAL_TILE + get_local_id(0);
+
+    for (int i = lid; i < NORMAL_HALO_TILE * NORMAL_HALO_TILE;
+         i += NORMAL_TILE * NORMAL_TILE) {
+        const int2 at = origin + (int2)(i % NORMAL_HALO_TILE - 1,
+                                        i / NORMAL_HALO_TILE - 1);
+        tile[i] = read_imagef(image, edge_samp, at).x;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    float h[9];
+    for (int i = 0; i < 9; ++i) {
+        const int tx = get_local_id(0) + i % 3;
+        const int ty = get_local_id(1) + i / 3;
+        h[i] = tile[ty * NORMAL_HALO_TILE + tx];
+    }
+    normals[y * width + x] =
+        oct_encode(sobel_normal(h, (float2)(width, height)));
+}
@@ -0,0 +1,289 @@
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "exec/executor.hpp"
+#include "font/atlas_build.hpp"
+#include "font/config.hpp"
+#include "font/face.hpp"
+#include "font/utf8.hpp"
+#include "trace/trace.hpp"
+
+// ft_atlas: precomputes SDF/MSDF/MTSDF atlases for the asset pipeline, e.g.
+//   ft_atlas "sans" latin.png --mode msdf --ranges 20-7E,A0-17F
+// writes latin.png and latin.json with the glyph metrics.
+
+namespace {
+
+// PNG strips are encoded in parallel but their count changes the bytes, so
+// it is fixed instead of following --threads
+constexpr unsigned kEncodeStrips = 4;
+
+struct Arguments {
+  std::string font;
+  std::filesystem::path output;
+  AtlasBuildOptions options;
+  std::vector<std::pair<char32_t, char32_t>> ranges;
+  std::filesystem::path textFile;
+};
+
+void PrintUsage(const char *argv0) {
+  std::puts(std::format(
+                "usage: {} <font query or file> <output.png> [--size <px>] "
+                "[--spread <px>] [--mode sdf|msdf|mtsdf] "
+                "[--ranges <hex>-<hex>,...] [--text <utf-8 file>] "
+                "[--width <texels>] [--threads <n>]",
+                argv0)
+                .c_str());
+}
+
+/// "20-7E,U+400-U+4FF,A9": inclusive hex ranges or single code points.
+std::vector<std::pair<char32_t, char32_t>> ParseRanges(std::string_view arg) {
+  const auto parse = [&](std::string_view hex) {
+    if (hex.starts_with("U+") || hex.starts_with("u+"))
+      hex.remove_prefix(2);
+    size_t used = 0;
+    const auto value = std::stoul(std::string(hex), &used, 16);
+    if (used != hex.size() || value > 0x10FFFF)
+      throw std::invalid_argument(std::format("bad code point '{}'", hex));
+    return (char32_t)value;
+  };
+
+  std::vector<std::pair<char32_t, char32_t>> ranges;
+  while (!arg.empty()) {
+    const size_t comma = arg.find(',');
+    const std::string_view range = arg.substr(0, comma);
+    const size_t dash = range.find('-');
+    const char32_t first = parse(range.substr(0, dash));
+    const char32_t last =
+        dash == std::string_view::npos ? first : parse(range.substr(dash + 1));
+    if (last < first)
+      throw std::invalid_argument(std::format("empty range '{}'", range));
+    ranges.emplace_back(first, last);
+    arg = comma == std::string_view::npos ? "" : arg.substr(comma + 1);
+  }
+  return ranges;
+}
+
+SdfKind ParseMode(std::string_view mode) {
+  if (mode == "sdf")
+    return SdfKind::Sdf;
+  if (mode == "msdf")
+    return SdfKind::Msdf;
+  if (mode == "mtsdf")
+    return SdfKind::Mtsdf;
+  throw std::invalid_argument(std::format("unknown mode '{}'", mode));
+}
+
+std::string_view ModeName(SdfKind kind) {
+  switch (kind) {
+  case SdfKind::Sdf:
+    return "sdf";
+  case SdfKind::Msdf:
+    return "msdf";
+  case SdfKind::Mtsdf:
+    return "mtsdf";
+  }
+  return "";
+}
+
+std::string ReadFile(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Failed to read: " + path.string());
+  }
+  std::ostringstream text;
+  text << in.rdbuf();
+  return text.str();
+}
+
+std::string Escape(std::string_view text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    if ((unsigned char)c >= 0x20)
+      out += c;
+  }
+  return out;
+}
+
+/**
+ * @brief Metrics next to the texture: font metrics at the atlas size, the
+ * cmap of the requested code points and every glyph cell. Floats are
+ * printed in shortest round-trip form, so equal atlases give equal files.
+ */
+void WriteMetrics(const std::filesystem::path &path, FT_Face face,
+                  const BuiltAtlas &atlas,
+                  const std::vector<std::pair<char32_t, FT_UInt>> &cmap) {
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error("Failed to write: " + path.string());
+  }
+
+  const float scale = atlas.emSize / (float)face->units_per_EM;
+  out << "{\n";
+  out << std::format("  \"family\": \"{}\",\n", Escape(face->family_name));
+  out << std::format("  \"style\": \"{}\",\n", Escape(face->style_name));
+  out << std::format("  \"mode\": \"{}\",\n", ModeName(atlas.kind));
+  out << std::format("  \"em_size\": {},\n", atlas.emSize);
+  out << std::format("  \"distance_range\": {},\n", atlas.distanceRange);
+  out << std::format("  \"width\": {},\n", atlas.image.size.x);
+  out << std::format("  \"height\": {},\n", atlas.image.size.y);
+  out << std::format("  \"ascender\": {},\n", face->ascender * scale);
+  out << std::format("  \"descender\": {},\n", face->descender * scale);
+  out << std::format("  \"line_height\": {},\n", face->height * scale);
+
+  out << "  \"cmap\": [";
+  for (size_t i = 0; i < cmap.size(); ++i) {
+    const char *separator = i == 0 ? "\n    " : i % 8 ? ", " : ",\n    ";
+    out << std::format("{}[{}, {}]", separator,
+                       (uint32_t)cmap[i].first, cmap[i].second);
+  }
+  out << "\n  ],\n";
+
+  // x, y, width, height in texels; bearing x, y and advance in px
+  out << "  \"glyphs\": [\n";
+  for (size_t i = 0; i < atlas.glyphs.size(); ++i) {
+    const BuiltGlyph &g = atlas.glyphs[i];
+    out << std::format("    {{\"index\": {}, \"rect\": [{}, {}, {}, {}], "
+                       "\"bearing\": [{}, {}], \"advance\": {}}}{}\n",
+                       g.glyph, g.position.x, g.position.y, g.size.x,
+                       g.size.y, g.bearing.x, g.bearing.y, g.advance,
+                       i + 1 < atlas.glyphs.size() ? "," : "");
+  }
+  out << "  ]\n}\n";
+}
+
+int Run(const Arguments &args) {
+  FT_Library ft = InitializeFreeType();
+  FT_Face face = nullptr;
+  try {
+    const std::string path = std::filesystem::exists(args.font)
+                                 ? args.font
+                                 : find_font(args.font);
+    face = LoadFace(ft, path, (int)std::lround(args.options.pixelSize));
+
+    std::string text;
+    if (!args.textFile.empty())
+      text = ReadFile(args.textFile);
+
+    // glyphs of the ranges and the corpus, and the cmap entries behind them
+    std::vector<FT_UInt> glyphs = GlyphsForRanges(face, args.ranges);
+    if (!text.empty()) {
+      const auto more = GlyphsForText(face, text);
+      glyphs.insert(glyphs.end(), more.begin(), more.end());
+    }
+
+    std::vector<std::pair<char32_t, FT_UInt>> cmap;
+    for (const auto &[first, last] : args.ranges) {
+      for (char32_t cp = first; cp <= last; ++cp) {
+        if (FT_UInt glyph = FT_Get_Char_Index(face, cp))
+          cmap.emplace_back(cp, glyph);
+      }
+    }
+    for (size_t offset = 0; offset < text.size();) {
+      const char32_t cp = NextCodepoint(text, offset);
+      if (FT_UInt glyph = FT_Get_Char_Index(face, cp))
+        cmap.emplace_back(cp, glyph);
+    }
+    std::sort(cmap.begin(), cmap.end());
+    cmap.erase(std::unique(cmap.begin(), cmap.end()), cmap.end());
+
+    spdlog::info("Building a {} atlas of {} glyphs at {} px",
+                 ModeName(args.options.kind), glyphs.size(),
+                 args.options.pixelSize);
+
+    size_t reported = SIZE_MAX;
+    const BuiltAtlas atlas = BuildAtlas(
+        face, glyphs, args.options, [&](size_t done, size_t total) {
+          if (done == reported)
+            return;
+          reported = done;
+          std::fputs(std::format("\r{}/{} glyphs ({}%)", done, total,
+                                 total ? done * 100 / total : 100)
+                         .c_str(),
+                     stderr);
+          if (done == total)
+            std::fputs("\n", stderr);
+        });
+
+    Executor encoder(kEncodeStrips);
+    WriteImage(args.output, atlas.image, ImageFormatFromPath(args.output),
+               &encoder);
+    auto metricsPath = args.output;
+    WriteMetrics(metricsPath.replace_extension(".json"), face, atlas, cmap);
+    spdlog::info("Wrote {}x{} atlas to '{}'", atlas.image.size.x,
+                 atlas.image.size.y, args.output.string());
+  } catch (...) {
+    if (face)
+      FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+    throw;
+  }
+
+  FT_Done_Face(face);
+  FT_Done_FreeType(ft);
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  TRACE_THREAD_NAME("main");
+
+  try {
+    Arguments args;
+    args.font = argv[1];
+    args.output = argv[2];
+    for (int i = 3; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (i + 1 >= argc) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (arg == "--size") {
+        args.options.pixelSize = std::stof(argv[++i]);
+      } else if (arg == "--spread") {
+        args.options.spread = std::stof(argv[++i]);
+      } else if (arg == "--mode") {
+        args.options.kind = ParseMode(argv[++i]);
+      } else if (arg == "--ranges") {
+        const auto ranges = ParseRanges(argv[++i]);
+        args.ranges.insert(args.ranges.end(), ranges.begin(), ranges.end());
+      } else if (arg == "--text") {
+        args.textFile = argv[++i];
+      } else if (arg == "--width") {
+        args.options.width = (unsigned)std::stoul(argv[++i]);
+      } else if (arg == "--threads") {
+        args.options.threads = (unsigned)std::stoul(argv[++i]);
+      } else {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+    if (args.ranges.empty() && args.textFile.empty())
+      args.ranges.emplace_back(0x20, 0x7E);
+
+    return Run(args);
+  } catch (const std::exception &e) {
+    spdlog::error("Exception: {}", e.what());
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,40 @@
+#include "bench.hpp"
+
+#include <cstdlib>
+#include <new>
+
+// Replacement global operator new/delete that count per thread, so
+// benchmarks can assert that a steady-state path does not allocate. The
+// array and nothrow forms forward to these by default; the aligned ones are
+// what std::pmr::new_delete_resource uses.
+
+namespace {
+
+thread_local size_t allocations = 0;
+
+} // namespace
+
+size_t bench::ThreadAllocations() { return allocations; }
+
+void *operator new(std::size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  ++allocations;
+  const auto align = (std::size_t)alignment;
+  const std::size_t rounded = (size + align - 1) / align * align;
+  if (void *p = std::aligned_alloc(align, rounded ? rounded : align))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
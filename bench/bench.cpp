@@ -0,0 +1,239 @@
+#include "bench.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <format>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double TimeIterations(const Benchmark &benchmark, size_t iterations) {
+  const auto start = Clock::now();
+  benchmark.run(iterations);
+  const auto stop = Clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+// Doubles the iteration count until one batch takes at least `minTime`, then
+// scales it so every repetition runs for roughly that long.
+size_t Calibrate(const Benchmark &benchmark,
+                 std::chrono::duration<double> minTime) {
+  const double target = std::chrono::duration<double, std::nano>(minTime).count();
+
+  size_t iterations = 1;
+  for (;;) {
+    const double elapsed = TimeIterations(benchmark, iterations);
+    if (elapsed >= target || iterations >= (1u << 30)) {
+      return iterations;
+    }
+    if (elapsed < target / 100) {
+      iterations *= 10;
+    } else {
+      iterations = std::max<size_t>(iterations + 1,
+                                    (size_t)(iterations * 1.2 * target / elapsed));
+    }
+  }
+}
+
+std::string Escape(std::string_view s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+std::string Timestamp() {
+  const std::time_t now = std::time(nullptr);
+  char buffer[32];
+  std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ",
+                std::gmtime(&now));
+  return buffer;
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+double Result::min() const {
+  return samples.empty() ? 0 : *std::min_element(samples.begin(), samples.end());
+}
+
+double Result::median() const {
+  if (samples.empty())
+    return 0;
+  auto sorted = samples;
+  std::sort(sorted.begin(), sorted.end());
+  return sorted[sorted.size() / 2];
+}
+
+double Result::mean() const {
+  if (samples.empty())
+    return 0;
+  return std::accumulate(samples.begin(), samples.end(), 0.0) /
+         (double)samples.size();
+}
+
+/* ------------------------------------------------------------------------- */
+
+void Registry::add(Benchmark benchmark) {
+  _benchmarks.push_back(std::move(benchmark));
+}
+
+void Registry::add(std::string name, std::function<void(size_t)> run,
+                   size_t itemsPerIteration, std::function<void()> verify) {
+  add(Benchmark{std::move(name), std::move(run), itemsPerIteration,
+                std::move(verify)});
+}
+
+std::vector<Result> Registry::run(const Options &options) const {
+  std::vector<Result> results;
+
+  for (const Benchmark &benchmark : _benchmarks) {
+    if (!options.filter.empty() &&
+        benchmark.name.find(options.filter) == std::string::npos)
+      continue;
+
+    Result result;
+    result.name = benchmark.name;
+    result.itemsPerIteration = benchmark.itemsPerIteration;
+
+    try {
+      if (benchmark.verify)
+        benchmark.verify();
+      result.iterations = Calibrate(benchmark, options.minTime);
+      for (unsigned i = 0; i < options.repetitions; ++i) {
+        result.samples.push_back(TimeIterations(benchmark, result.iterations) /
+                                 (double)result.iterations);
+      }
+    } catch (const std::exception &e) {
+      spdlog::error("{}: {}", benchmark.name, e.what());
+      std::puts(std::format("{:<48} FAILED", result.name).c_str());
+      result.samples.clear();
+      result.error = e.what();
+      results.push_back(std::move(result));
+      continue;
+    }
+
+    const double median = result.median();
+    std::puts(std::format("{:<48} {:>14.1f} ns {:>16.1f} items/s ({} x {})",
+                          result.name, median,
+                          (double)result.itemsPerIteration * 1e9 / median,
+                          options.repetitions, result.iterations)
+                  .c_str());
+    results.push_back(std::move(result));
+  }
+
+  return results;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void WriteJson(const std::filesystem::path &path,
+               const std::vector<Result> &results) {
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error("Failed to write: " + path.string());
+  }
+
+  out << "{\n  \"context\": {\n";
+  out << std::format("    \"date\": \"{}\",\n", Timestamp());
+  out << std::format("    \"num_cpus\": {},\n",
+                     std::thread::hardware_concurrency());
+#ifdef NDEBUG
+  out << "    \"build_type\": \"release\",\n";
+#else
+  out << "    \"build_type\": \"debug\",\n";
+#endif
+  out << std::format("    \"compiler\": \"{}\"\n", Escape(__VERSION__));
+  out << "  },\n  \"benchmarks\": [\n";
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    const double median = r.median();
+    out << "    {\n";
+    out << std::format("      \"name\": \"{}\",\n", Escape(r.name));
+    if (!r.error.empty())
+      out << std::format("      \"error\": \"{}\",\n", Escape(r.error));
+    out << std::format("      \"iterations\": {},\n", r.iterations);
+    out << std::format("      \"repetitions\": {},\n", r.samples.size());
+    out << std::format("      \"min_ns\": {:.3f},\n", r.min());
+    out << std::format("      \"median_ns\": {:.3f},\n", median);
+    out << std::format("      \"mean_ns\": {:.3f},\n", r.mean());
+    out << std::format("      \"items_per_second\": {:.3f}\n",
+                       median > 0 ? (double)r.itemsPerIteration * 1e9 / median
+                                  : 0.0);
+    out << (i + 1 < results.size() ? "    },\n" : "    }\n");
+  }
+  out << "  ]\n}\n";
+
+  spdlog::info("Saved results to '{}'", path.string());
+}
+
+// Only reads what WriteJson() writes: one key per line, names before
+// medians, no escapes in names.
+std::map<std::string, double> ReadJson(const std::filesystem::path &path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("Failed to read: " + path.string());
+  }
+
+  std::map<std::string, double> medians;
+  std::string line, name;
+  while (std::getline(in, line)) {
+    const auto value = [&](std::string_view key) -> std::string_view {
+      const auto at = line.find(std::format("\"{}\": ", key));
+      if (at == std::string::npos)
+        return {};
+      std::string_view rest(line);
+      rest.remove_prefix(at + key.size() + 4);
+      return rest.substr(0, rest.find_last_not_of(",") + 1);
+    };
+
+    if (const auto quoted = value("name"); quoted.size() >= 2) {
+      name = quoted.substr(1, quoted.size() - 2);
+    } else if (const auto median = value("median_ns"); !median.empty()) {
+      double ns = 0;
+      std::istringstream(std::string(median)) >> ns;
+      if (!name.empty() && ns > 0)
+        medians[name] = ns;
+      name.clear();
+    }
+  }
+  return medians;
+}
+
+std::vector<std::string>
+FindRegressions(const std::vector<Result> &results,
+                const std::map<std::string, double> &baseline,
+                double maxRegression) {
+  std::vector<std::string> regressed;
+  for (const Result &r : results) {
+    const auto it = baseline.find(r.name);
+    if (!r.error.empty() || it == baseline.end())
+      continue;
+    const double ratio = r.median() / it->second;
+    if (ratio > 1.0 + maxRegression) {
+      spdlog::error("{}: {:.1f} ns, {:.0f} % slower than the baseline's "
+                    "{:.1f} ns",
+                    r.name, r.median(), (ratio - 1.0) * 100.0, it->second);
+      regressed.push_back(r.name);
+    }
+  }
+  return regressed;
+}
+
+} // namespace bench
@@ -0,0 +1,92 @@
+#ifndef BENCH_BENCH_HPP
+#define BENCH_BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief A single benchmark. `run(n)` executes the measured operation `n`
+ * times; setup belongs in the closure that creates it, not in `run`.
+ * `verify`, if set, runs once before timing and throws if the output does
+ * not match a reference, so a fast but wrong kernel fails instead of being
+ * timed.
+ */
+struct Benchmark {
+  std::string name;
+  std::function<void(size_t iterations)> run;
+  size_t itemsPerIteration = 1; // glyphs, pixels, ... for throughput
+  std::function<void()> verify;
+};
+
+struct Result {
+  std::string name;
+  size_t iterations = 0;
+  size_t itemsPerIteration = 1;
+  std::vector<double> samples; // ns per iteration, one per repetition
+  std::string error;           // failed verification or run, no samples
+
+  double min() const;
+  double median() const;
+  double mean() const;
+};
+
+struct Options {
+  std::string filter;             // substring match on the benchmark name
+  std::filesystem::path json;     // empty = no JSON export
+  std::chrono::duration<double> minTime{0.2};
+  unsigned repetitions = 5;
+  std::filesystem::path baseline; // earlier JSON export to compare against
+  double maxRegression = 0.1;     // allowed median slowdown, 0.1 = 10 %
+};
+
+class Registry {
+public:
+  void add(Benchmark benchmark);
+  void add(std::string name, std::function<void(size_t)> run,
+           size_t itemsPerIteration = 1,
+           std::function<void()> verify = {});
+
+  std::vector<Result> run(const Options &options) const;
+
+private:
+  std::vector<Benchmark> _benchmarks;
+};
+
+void WriteJson(const std::filesystem::path &path,
+               const std::vector<Result> &results);
+
+/// Median ns per iteration by name from a file WriteJson() wrote.
+std::map<std::string, double> ReadJson(const std::filesystem::path &path);
+
+/**
+ * @brief Names of the results whose median is more than `maxRegression`
+ * slower than in `baseline`, each logged. Benchmarks missing from the
+ * baseline are new and pass.
+ */
+std::vector<std::string>
+FindRegressions(const std::vector<Result> &results,
+                const std::map<std::string, double> &baseline,
+                double maxRegression);
+
+/**
+ * @brief Heap allocations made by the calling thread so far, counted by the
+ * replacement operator new in alloc.cpp. Compare before and after a loop to
+ * assert that it does not allocate.
+ */
+size_t ThreadAllocations();
+
+/// Keeps the optimizer from discarding a computed value.
+template <typename T> inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
+
+#endif // BENCH_BENCH_HPP
@@ -0,0 +1,45 @@
+#ifndef BENCH_CORPUS_HPP
+#define BENCH_CORPUS_HPP
+
+#include <array>
+#include <string_view>
+
+namespace bench {
+
+/**
+ * @brief Fixed input strings. Never change an existing entry, results are
+ * only comparable between releases as long as the inputs stay identical.
+ */
+struct Corpus {
+  std::string_view name;
+  std::string_view fontQuery; // fontconfig pattern used to pick the face
+  std::string_view text;
+};
+
+inline constexpr std::array<Corpus, 4> kCorpora{{
+    {"latin", "sans:weight=bold",
+     "The quick brown fox jumps over the lazy dog. Sphinx of black quartz, "
+     "judge my vow! Pack my box with five dozen liquor jugs. AVAWAY Ta Te To "
+     "fi fl ffi 0123456789 (Hello beautiful, BGL!)"},
+    {"arabic", "sans:lang=ar",
+     "مرحبا بالعالم، هذا نص تجريبي "
+     "لقياس أداء تشكيل النصوص والحروف المتصلة ١٢٣"},
+    {"cjk", "sans:lang=zh-cn",
+     "永和九年，岁在癸丑，暮春之初，会于会稽山阴之兰亭，修禊事也。"
+     "いろはにほへとちりぬるを。한국어 테스트"},
+    {"emoji", "emoji",
+     "\U0001F642\U0001F44D\U0001F3FD "
+     "\U0001F468\u200D\U0001F469\u200D\U0001F467\u200D\U0001F466 "
+     "\U0001F1E9\U0001F1EA\U0001F1EF\U0001F1F5 "
+     "\u2764\uFE0F\u200D\U0001F525 \U0001F9D1\U0001F3FF\u200D\U0001F4BB "
+     "\U0001F680\U0001F30D\U0001F389 ok \u2705"},
+}};
+
+/// Edge lengths of the synthetic square heightmaps used by kernel benchmarks.
+inline constexpr std::array<unsigned, 3> kHeightmapSizes{256, 512, 1024};
+
+inline constexpr unsigned kFontPixelSize = 64;
+
+} // namespace bench
+
+#endif // BENCH_CORPUS_HPP
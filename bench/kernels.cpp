@@ -0,0 +1,947 @@
+#include <CL/opencl.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "cl/AtlasMirror.hpp"
+#include "cl/Autotuner.hpp"
+#include "cl/Device.hpp"
+#include "cl/GlyphQuads.hpp"
+#include "cl/SdfCompositor.hpp"
+#include "cl/GltfExport.hpp"
+#include "cl/HeightPyramid.hpp"
+#include "cl/Program.hpp"
+#include "cl/Rtin.hpp"
+#include "cl/TerrainNormals.hpp"
+#include "corpus.hpp"
+#include "scenes.hpp"
+#include "exec/executor.hpp"
+
+namespace {
+
+// Host mirrors of the kernel structs (float3 is 16 bytes, pointers are 64 bit
+// on every device we target).
+struct Node {
+  cl_float4 min;
+  cl_float4 max;
+  cl_uint children[4];
+  uint64_t items;
+  cl_uint numChildren;
+  cl_uint numItems;
+};
+static_assert(sizeof(Node) == 64);
+
+struct Plane {
+  cl_float4 normal; // xyz used, w is padding
+  cl_float distance;
+  cl_float padding[3];
+};
+
+struct Frustum {
+  Plane planes[6];
+};
+
+struct Mesh {
+  uint64_t triangles;
+  cl_uint numTriangles;
+  cl_uint padding;
+};
+
+constexpr size_t kVertexSize = 48; // struct Vertex in vadd.cl
+constexpr size_t kNodeCount = 1 << 16;
+
+struct GeometryVertex {
+  cl_float4 position; // xyz used
+  cl_float4 normal;   // xyz used
+  cl_float2 texCoord;
+  cl_float2 padding;
+};
+static_assert(sizeof(GeometryVertex) == kVertexSize);
+
+struct Device {
+  cl::Device device;
+  cl::Context context;
+  cl::CommandQueue queue;
+
+  Device()
+      : device(FindOpenCLDevice("Portable Computing Language")),
+        context(device), queue(context, device) {}
+
+  cl::Program build(const char *file, std::string_view defines = {}) {
+    Program builder(context);
+    return builder.build(device, std::filesystem::path(BENCH_ASSETS_DIR) / file,
+                         defines);
+  }
+};
+
+// Deterministic height field with both smooth and high-frequency content.
+std::vector<uint8_t> MakeHeightPixels(unsigned size) {
+  std::vector<uint8_t> pixels((size_t)size * size * 4);
+  for (unsigned y = 0; y < size; ++y) {
+    for (unsigned x = 0; x < size; ++x) {
+      const uint32_t h = (x * 7 + y * 13) ^ ((x * y) >> 5);
+      uint8_t *p = pixels.data() + ((size_t)y * size + x) * 4;
+      p[0] = p[1] = p[2] = (uint8_t)h;
+      p[3] = 255;
+    }
+  }
+  return pixels;
+}
+
+cl::Image2D MakeHeightmap(cl::Context &context, unsigned size,
+                          std::vector<uint8_t> &pixels) {
+  return cl::Image2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                     cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), size, size, 0,
+                     pixels.data());
+}
+
+// Fails with the first value off by more than `tolerance`.
+void ExpectNear(std::string_view what, size_t index, float actual,
+                float expected, float tolerance) {
+  if (!(std::abs(actual - expected) <= tolerance)) {
+    throw std::runtime_error(std::format("{}: item {} is {}, expected {}",
+                                         what, index, actual, expected));
+  }
+}
+
+// Checks oct-encoded normals against ReferenceNormals(); rounding may differ
+// by a unit in the last place of the encoding.
+void ExpectNormals(std::string_view what,
+                   std::span<const uint32_t> computed,
+                   std::span<const uint32_t> reference) {
+  for (size_t i = 0; i < reference.size(); ++i) {
+    const float cosine =
+        glm::dot(OctDecode(computed[i]), OctDecode(reference[i]));
+    if (cosine < 0.9999f) {
+      throw std::runtime_error(std::format(
+          "{}: texel {} is off by {} degrees", what, i,
+          glm::degrees(std::acos(std::min(cosine, 1.0f)))));
+    }
+  }
+}
+
+// calculate_geometry's four corners per texel against the heightmap: x and
+// y over the map, z the texel height and the normal as ReferenceNormals().
+void VerifyGeometry(Device &cl, const cl::Kernel &geometry,
+                    const cl::Buffer &vertices,
+                    std::span<const uint8_t> pixels, unsigned size) {
+  const size_t texels = (size_t)size * size;
+  cl.queue.enqueueNDRangeKernel(geometry, cl::NullRange,
+                                cl::NDRange(size, size), cl::NullRange);
+  std::vector<GeometryVertex> out(texels * 4);
+  cl.queue.enqueueReadBuffer(vertices, CL_TRUE, 0,
+                             out.size() * sizeof(GeometryVertex), out.data());
+
+  const auto normals = ReferenceNormals(pixels, size, size);
+  const std::string what = std::format("calculate_geometry/{}", size);
+  for (unsigned y = 0; y < size; ++y) {
+    for (unsigned x = 0; x < size; ++x) {
+      for (unsigned i = 0; i < 4; ++i) {
+        const unsigned cx = x + i % 2, cy = y + i / 2;
+        if (cx >= size || cy >= size)
+          continue; // not written
+
+        const size_t index = ((size_t)y * size + x) * 4 + i;
+        const size_t texel = (size_t)cy * size + cx;
+        const GeometryVertex &v = out[index];
+        const float u = (float)cx / (float)size, w = (float)cy / (float)size;
+        // OpenCL division is only good to 2.5 ulp
+        ExpectNear(what, index, v.position.s[0], u, 1e-6f);
+        ExpectNear(what, index, v.position.s[1], w, 1e-6f);
+        ExpectNear(what, index, v.position.s[2], pixels[texel * 4] / 255.0f,
+                   1e-6f);
+        ExpectNear(what, index, v.texCoord.s[0], u, 1e-6f);
+        ExpectNear(what, index, v.texCoord.s[1], w, 1e-6f);
+
+        const glm::vec3 normal(v.normal.s[0], v.normal.s[1], v.normal.s[2]);
+        const uint32_t encoded = OctEncode(normal);
+        ExpectNormals(what, {&encoded, 1}, {&normals[texel], 1});
+      }
+    }
+  }
+}
+
+void RegisterTerrainKernels(bench::Registry &registry,
+                            std::shared_ptr<Device> cl) {
+  cl::Program program = cl->build("vadd.cl");
+
+  for (unsigned size : bench::kHeightmapSizes) {
+    const size_t texels = (size_t)size * size;
+    auto pixels =
+        std::make_shared<std::vector<uint8_t>>(MakeHeightPixels(size));
+    auto heightmap = std::make_shared<cl::Image2D>(
+        MakeHeightmap(cl->context, size, *pixels));
+    auto vertices = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_WRITE, texels * 4 * kVertexSize);
+
+    auto pass = std::make_shared<TerrainNormals>(cl->context, cl->device,
+                                                 cl->queue, BENCH_ASSETS_DIR);
+    auto normals = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_WRITE, texels * sizeof(uint32_t));
+
+    cl::Kernel geometry(program, "calculate_geometry");
+    geometry.setArg(0, *vertices);
+    geometry.setArg(1, *vertices);
+    geometry.setArg(2, *vertices);
+    geometry.setArg(3, *heightmap);
+    geometry.setArg(4, *normals);
+
+    // the vertices decode the normal pass's output, which verify computes
+    registry.add(
+        std::format("cl/calculate_geometry/{}", size),
+        [cl, heightmap, vertices, normals, geometry, size](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            cl->queue.enqueueNDRangeKernel(geometry, cl::NullRange,
+                                           cl::NDRange(size, size),
+                                           cl::NullRange);
+          }
+          cl->queue.finish();
+        },
+        texels,
+        [cl, heightmap, vertices, normals, pass, geometry, pixels, size] {
+          pass->compute(*heightmap, size, size, *normals);
+          VerifyGeometry(*cl, geometry, *vertices, *pixels, size);
+        });
+
+    registry.add(
+        std::format("cl/calculate_surface_normal/{}", size),
+        [cl, heightmap, normals, pass, size](size_t n) {
+          for (size_t i = 0; i < n; ++i)
+            pass->compute(*heightmap, size, size, *normals);
+          cl->queue.finish();
+        },
+        texels,
+        [cl, heightmap, normals, pass, pixels, size, texels] {
+          pass->compute(*heightmap, size, size, *normals);
+          std::vector<uint32_t> computed(texels);
+          cl->queue.enqueueReadBuffer(*normals, CL_TRUE, 0,
+                                      texels * sizeof(uint32_t),
+                                      computed.data());
+          ExpectNormals(std::format("calculate_surface_normal/{}", size),
+                        computed, ReferenceNormals(*pixels, size, size));
+        });
+  }
+}
+
+// RTIN error maps of the heightmap sizes on the host, serially and across
+// all cores, and on the device after checking it against the host; then
+// the triangulation at a 2/255 maximum error. `cl` may be null.
+void RegisterRtin(bench::Registry &registry, std::shared_ptr<Device> cl) {
+  const unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+  for (unsigned size : bench::kHeightmapSizes) {
+    const auto pixels = MakeHeightPixels(size);
+    auto heights = std::make_shared<std::vector<float>>(
+        HeightsFromRgba(pixels, size, size));
+    const HeightField field{*heights, size, size};
+    const size_t texels = (size_t)size * size;
+
+    for (unsigned threads : {1u, cores}) {
+      auto executor =
+          threads > 1 ? std::make_shared<Executor>(threads) : nullptr;
+      registry.add(
+          std::format("terrain/rtin_errors/{}/{}", size, threads),
+          [heights, field, executor](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+              bench::DoNotOptimize(
+                  ComputeRtinErrors(field, executor.get()).errors.data());
+            }
+          },
+          texels);
+    }
+
+    auto errors = std::make_shared<RtinErrors>(ComputeRtinErrors(field));
+    registry.add(
+        std::format("terrain/rtin_mesh/{}", size),
+        [errors](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            bench::DoNotOptimize(
+                BuildRtinMesh(*errors, 2.0f / 255.0f).indices.data());
+          }
+        },
+        texels);
+
+    if (!cl)
+      continue;
+    auto kernel = std::make_shared<RtinErrorKernel>(
+        cl->context, cl->device, cl->queue, BENCH_ASSETS_DIR);
+    registry.add(
+        std::format("cl/rtin_errors/{}", size),
+        [heights, field, kernel](size_t n) {
+          for (size_t i = 0; i < n; ++i)
+            bench::DoNotOptimize(kernel->compute(field).errors.data());
+        },
+        texels,
+        [heights, field, kernel, errors, size] {
+          const RtinErrors device = kernel->compute(field);
+          for (size_t i = 0; i < device.errors.size(); ++i) {
+            ExpectNear(std::format("rtin_errors/{}", size), i,
+                       device.errors[i], errors->errors[i], 1e-6f);
+          }
+        });
+  }
+}
+
+// Height pyramids of the heightmap sizes, checked against the host
+// reference, and the node boxes filled from them.
+void RegisterHeightPyramid(bench::Registry &registry,
+                           std::shared_ptr<Device> cl) {
+  for (unsigned size : bench::kHeightmapSizes) {
+    auto pixels = MakeHeightPixels(size);
+    auto heightmap = std::make_shared<cl::Image2D>(
+        MakeHeightmap(cl->context, size, pixels));
+    const size_t texels = (size_t)size * size;
+
+    auto pyramid = std::make_shared<HeightPyramid>(
+        cl->context, cl->device, cl->queue, BENCH_ASSETS_DIR);
+    pyramid->build(*heightmap);
+    registry.add(
+        std::format("cl/height_pyramid/{}", size),
+        [cl, heightmap, pyramid](size_t n) {
+          for (size_t i = 0; i < n; ++i)
+            pyramid->build(*heightmap);
+          cl->queue.finish();
+        },
+        texels,
+        [heightmap, pyramid, pixels, size] {
+          pyramid->build(*heightmap);
+          const std::vector<HeightBounds> device = pyramid->read();
+          const std::vector<float> heights =
+              HeightsFromRgba(pixels, size, size);
+          const std::vector<HeightBounds> host = ReferenceHeightPyramid(
+              {heights, size, size}, pyramid->layout());
+          const std::string what = std::format("height_pyramid/{}", size);
+          for (size_t i = 0; i < host.size(); ++i) {
+            ExpectNear(what, i, device[i].min, host[i].min, 0.0f);
+            ExpectNear(what, i, device[i].max, host[i].max, 0.0f);
+            ExpectNear(what, i, device[i].error, host[i].error, 1e-6f);
+          }
+        });
+
+    const size_t count = std::min(pyramid->layout().nodes(), kNodeCount);
+    auto nodes = std::make_shared<cl::Buffer>(cl->context, CL_MEM_READ_WRITE,
+                                              count * sizeof(Node));
+    registry.add(
+        std::format("cl/fill_node_boxes/{}", size),
+        [cl, heightmap, pyramid, nodes, count](size_t n) {
+          for (size_t i = 0; i < n; ++i)
+            pyramid->fillNodes(*nodes, count);
+          cl->queue.finish();
+        },
+        count,
+        // against ReferenceNodeBox(); x and y are quotients, which OpenCL
+        // does not require to be correctly rounded
+        [cl, heightmap, pyramid, nodes, count, pixels, size] {
+          pyramid->build(*heightmap);
+          pyramid->fillNodes(*nodes, count);
+          std::vector<Node> device(count);
+          cl->queue.enqueueReadBuffer(*nodes, CL_TRUE, 0,
+                                      count * sizeof(Node), device.data());
+          const std::vector<float> heights =
+              HeightsFromRgba(pixels, size, size);
+          const std::vector<HeightBounds> levels = ReferenceHeightPyramid(
+              {heights, size, size}, pyramid->layout());
+          const std::string what = std::format("fill_node_boxes/{}", size);
+          for (size_t i = 0; i < count; ++i) {
+            const HeightNodeBox host = ReferenceNodeBox(
+                levels, pyramid->layout(), glm::uvec2(size), i);
+            const Node &d = device[i];
+            for (int a = 0; a < 2; ++a) {
+              ExpectNear(what, i, d.min.s[a], host.min[a], 1e-6f);
+              ExpectNear(what, i, d.max.s[a], host.max[a], 1e-6f);
+            }
+            ExpectNear(what, i, d.min.s[2], host.min.z, 0.0f);
+            ExpectNear(what, i, d.max.s[2], host.max.z, 0.0f);
+            ExpectNear(what, i, (float)d.numChildren,
+                       host.inner ? 4.0f : 0.0f, 0.0f);
+            for (cl_uint c = 0; c < 4; ++c) {
+              const size_t child = host.inner ? i * 4 + 1 + c : 0;
+              ExpectNear(what, i, (float)d.children[c], (float)child, 0.0f);
+            }
+          }
+        });
+  }
+}
+
+// Flat quadtree nodes without items; cull only reads the boxes and the child
+// lists, create_index_buffer gets its items from MakeItems().
+std::vector<Node> MakeNodes() {
+  std::vector<Node> nodes(kNodeCount);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const float x = (float)(i % 256);
+    const float y = (float)(i / 256);
+    nodes[i].min = {{x, y, 0.0f, 0.0f}};
+    nodes[i].max = {{x + 1.0f, y + 1.0f, 1.0f, 0.0f}};
+    const bool inner = i * 4 + 4 < nodes.size();
+    nodes[i].numChildren = inner ? 4 : 0;
+    for (cl_uint c = 0; c < 4; ++c)
+      nodes[i].children[c] = inner ? (cl_uint)(i * 4 + 1 + c) : 0;
+  }
+  return nodes;
+}
+
+// contains() in culling.cl; touching counts
+bool Overlaps(const Node &a, const Node &b) {
+  for (int i = 0; i < 3; ++i) {
+    if (a.min.s[i] > b.max.s[i] || a.max.s[i] < b.min.s[i])
+      return false;
+  }
+  return true;
+}
+
+// cull in culling.cl: the children overlapping `box` of every node
+// overlapping it, in node order.
+std::vector<cl_uint> ReferenceCull(const std::vector<Node> &nodes,
+                                   const Node &box) {
+  std::vector<cl_uint> hits;
+  for (const Node &node : nodes) {
+    if (!Overlaps(node, box))
+      continue;
+    for (cl_uint c = 0; c < node.numChildren; ++c) {
+      if (Overlaps(nodes[node.children[c]], box))
+        hits.push_back(node.children[c]);
+    }
+  }
+  return hits;
+}
+
+// intersects_aabb_frustum in frustum.cl
+bool IntersectsFrustum(const Node &node, const Frustum &frustum) {
+  for (const Plane &plane : frustum.planes) {
+    float distance = plane.distance;
+    for (int i = 0; i < 3; ++i) {
+      const float n = plane.normal.s[i];
+      distance += n * (n >= 0 ? node.max.s[i] : node.min.s[i]);
+    }
+    if (distance < 0)
+      return false;
+  }
+  return true;
+}
+
+// What create_index_buffer follows through Node::items and Mesh::triangles.
+struct SceneItems {
+  std::vector<std::vector<cl_uint>> meshes;    // per node
+  std::vector<std::vector<cl_uint>> triangles; // per mesh, 3 indices each
+};
+
+// Every fifth node holds one to three of 64 meshes of one to four triangles;
+// indices are distinct per mesh, so a misplaced triangle shows.
+SceneItems MakeItems(size_t nodes) {
+  constexpr cl_uint kMeshes = 64;
+  SceneItems items;
+  items.meshes.resize(nodes);
+  items.triangles.resize(kMeshes);
+  for (cl_uint m = 0; m < kMeshes; ++m) {
+    for (cl_uint i = 0; i < 3 * (1 + m % 4); ++i)
+      items.triangles[m].push_back(m * 16 + i);
+  }
+  for (size_t n = 0; n < nodes; n += 5) {
+    for (size_t k = 0; k <= n % 3; ++k)
+      items.meshes[n].push_back((cl_uint)((n * 7 + k) % kMeshes));
+  }
+  return items;
+}
+
+// create_index_buffer on the host: the triangles of the meshes of every node
+// not outside the frustum, in node order.
+std::vector<cl_uint> ReferenceIndexBuffer(const std::vector<Node> &nodes,
+                                          const SceneItems &items,
+                                          const Frustum &frustum) {
+  std::vector<cl_uint> indices;
+  for (size_t n = 0; n < nodes.size(); ++n) {
+    if (!IntersectsFrustum(nodes[n], frustum))
+      continue;
+    for (cl_uint mesh : items.meshes[n]) {
+      indices.insert(indices.end(), items.triangles[mesh].begin(),
+                     items.triangles[mesh].end());
+    }
+  }
+  return indices;
+}
+
+// The kernels follow raw pointers out of their structs, so what they point
+// at lives in a coarse-grained SVM block, freed with the last reference.
+std::shared_ptr<cl_uint> MakeSvm(Device &cl,
+                                 const std::vector<cl_uint> &words) {
+  const size_t bytes = std::max<size_t>(words.size(), 1) * sizeof(cl_uint);
+  auto *data =
+      (cl_uint *)clSVMAlloc(cl.context(), CL_MEM_READ_ONLY, bytes, 0);
+  if (!data)
+    throw std::runtime_error("device has no shared virtual memory");
+  std::shared_ptr<cl_uint> block(
+      data, [context = cl.context](cl_uint *p) { clSVMFree(context(), p); });
+  cl.queue.enqueueMapSVM(data, CL_TRUE, CL_MAP_WRITE, bytes);
+  std::ranges::copy(words, data);
+  cl.queue.enqueueUnmapSVM(data);
+  return block;
+}
+
+// Runs a kernel that appends to `output` through `counter`, one item per
+// node, and reads back what it appended.
+std::vector<cl_uint> RunAppending(Device &cl, const cl::Kernel &kernel,
+                                  const cl::NDRange &local,
+                                  cl::Buffer &counter, cl::Buffer &output,
+                                  size_t capacity) {
+  cl.queue.enqueueFillBuffer(counter, cl_uint{0}, 0, sizeof(cl_uint));
+  cl.queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                cl::NDRange(kNodeCount), local);
+  cl_uint count = 0;
+  cl.queue.enqueueReadBuffer(counter, CL_TRUE, 0, sizeof(count), &count);
+  if (count > capacity) {
+    throw std::runtime_error(std::format(
+        "{} values appended to a buffer of {}", count, capacity));
+  }
+  std::vector<cl_uint> values(count);
+  if (count > 0) {
+    cl.queue.enqueueReadBuffer(output, CL_TRUE, 0, count * sizeof(cl_uint),
+                               values.data());
+  }
+  return values;
+}
+
+// Compares appended records of N values with the host's regardless of
+// order: work groups append in whatever order they reach the counter.
+template <size_t N>
+void ExpectSameRecords(std::string_view what,
+                       const std::vector<cl_uint> &actual,
+                       const std::vector<cl_uint> &expected) {
+  if (actual.size() != expected.size()) {
+    throw std::runtime_error(std::format("{}: {} values, expected {}", what,
+                                         actual.size(), expected.size()));
+  }
+  const auto records = [](const std::vector<cl_uint> &values) {
+    std::vector<std::array<cl_uint, N>> out(values.size() / N);
+    for (size_t i = 0; i < out.size(); ++i)
+      std::copy_n(values.begin() + i * N, N, out[i].begin());
+    std::ranges::sort(out);
+    return out;
+  };
+  const auto sortedActual = records(actual);
+  const auto sortedExpected = records(expected);
+  const auto [a, e] = std::ranges::mismatch(sortedActual, sortedExpected);
+  if (a != sortedActual.end()) {
+    throw std::runtime_error(std::format(
+        "{}: sorted record {} starts with {}, expected {}", what,
+        a - sortedActual.begin(), (*a)[0], (*e)[0]));
+  }
+}
+
+void RegisterCullingKernels(bench::Registry &registry,
+                            std::shared_ptr<Device> cl) {
+  auto nodes = MakeNodes();
+  auto nodeBuffer = std::make_shared<cl::Buffer>(
+      cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      nodes.size() * sizeof(Node), nodes.data());
+  auto counter = std::make_shared<cl::Buffer>(cl->context, CL_MEM_READ_WRITE,
+                                              sizeof(cl_uint));
+  const size_t capacity = nodes.size() * 4;
+  auto output = std::make_shared<cl::Buffer>(
+      cl->context, CL_MEM_READ_WRITE, capacity * sizeof(cl_uint));
+
+  {
+    Node box{};
+    box.max = {{64.0f, 64.0f, 1.0f, 0.0f}};
+    auto aabb = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 2 * sizeof(cl_float4),
+        &box.min);
+    auto meshes = std::make_shared<cl::Buffer>(cl->context, CL_MEM_READ_ONLY,
+                                               sizeof(Mesh));
+
+    cl::Kernel cull(cl->build("culling.cl"), "cull");
+    cull.setArg(0, *nodeBuffer);
+    cull.setArg(1, *aabb);
+    cull.setArg(2, *meshes);
+    cull.setArg(3, *counter);
+    cull.setArg(4, *output);
+
+    auto expected =
+        std::make_shared<std::vector<cl_uint>>(ReferenceCull(nodes, box));
+    registry.add(
+        "cl/cull/65536",
+        [cl, nodeBuffer, aabb, meshes, counter, output, cull](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            cl->queue.enqueueFillBuffer(*counter, cl_uint{0}, 0,
+                                        sizeof(cl_uint));
+            cl->queue.enqueueNDRangeKernel(cull, cl::NullRange,
+                                           cl::NDRange(kNodeCount),
+                                           cl::NullRange);
+          }
+          cl->queue.finish();
+        },
+        kNodeCount,
+        // against ReferenceCull()
+        [cl, nodeBuffer, aabb, meshes, counter, output, cull, capacity,
+         expected] {
+          ExpectSameRecords<1>("cull",
+                               RunAppending(*cl, cull, cl::NullRange,
+                                            *counter, *output, capacity),
+                               *expected);
+        });
+  }
+
+  {
+    // an axis aligned box frustum around the first quarter of the grid
+    Frustum frustum{};
+    const float planes[6][4] = {{1, 0, 0, 0},    {-1, 0, 0, 128}, {0, 1, 0, 0},
+                                {0, -1, 0, 128}, {0, 0, 1, 0},    {0, 0, -1, 1}};
+    for (int p = 0; p < 6; ++p) {
+      frustum.planes[p].normal = {{planes[p][0], planes[p][1], planes[p][2], 0}};
+      frustum.planes[p].distance = planes[p][3];
+    }
+
+    auto frustumBuffer = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Frustum),
+        &frustum);
+    auto triangles = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_ONLY, 3 * sizeof(cl_uint));
+
+    // the mesh lists of the nodes, then the triangles of the meshes
+    const SceneItems items = MakeItems(nodes.size());
+    std::vector<cl_uint> words;
+    std::vector<size_t> lists, firstTriangle;
+    for (const auto &list : items.meshes) {
+      lists.push_back(words.size());
+      words.insert(words.end(), list.begin(), list.end());
+    }
+    for (const auto &indices : items.triangles) {
+      firstTriangle.push_back(words.size());
+      words.insert(words.end(), indices.begin(), indices.end());
+    }
+    auto svm = MakeSvm(*cl, words);
+
+    std::vector<Node> itemNodes = nodes;
+    for (size_t n = 0; n < itemNodes.size(); ++n) {
+      itemNodes[n].items = (uint64_t)(uintptr_t)(svm.get() + lists[n]);
+      itemNodes[n].numItems = (cl_uint)items.meshes[n].size();
+    }
+    std::vector<Mesh> meshData(items.triangles.size());
+    for (size_t m = 0; m < meshData.size(); ++m) {
+      meshData[m].triangles =
+          (uint64_t)(uintptr_t)(svm.get() + firstTriangle[m]);
+      meshData[m].numTriangles = (cl_uint)(items.triangles[m].size() / 3);
+    }
+    auto itemBuffer = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        itemNodes.size() * sizeof(Node), itemNodes.data());
+    auto meshes = std::make_shared<cl::Buffer>(
+        cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        meshData.size() * sizeof(Mesh), meshData.data());
+    auto expected = std::make_shared<std::vector<cl_uint>>(
+        ReferenceIndexBuffer(nodes, items, frustum));
+
+    const auto makeIndices = [&](std::string_view defines) {
+      cl::Kernel kernel(cl->build("frustum.cl", defines),
+                        "create_index_buffer");
+      kernel.setArg(0, *meshes);
+      kernel.setArg(1, *triangles);
+      kernel.setArg(2, *itemBuffer);
+      kernel.setArg(3, *frustumBuffer);
+      kernel.setArg(4, *output);
+      kernel.setArg(5, *counter);
+      kernel.setSVMPointers(std::vector<void *>{svm.get()});
+      return kernel;
+    };
+    cl::Kernel indices = makeIndices({});
+
+    // against ReferenceIndexBuffer()
+    const auto verify = [&](const cl::Kernel &kernel, cl::NDRange local) {
+      return [cl, kernel, local, counter, output, capacity, expected, svm] {
+        ExpectSameRecords<3>("create_index_buffer",
+                             RunAppending(*cl, kernel, local, *counter,
+                                          *output, capacity),
+                             *expected);
+      };
+    };
+
+    registry.add(
+        "cl/create_index_buffer/65536",
+        [cl, itemBuffer, frustumBuffer, meshes, triangles, counter, output,
+         svm, indices](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            cl->queue.enqueueFillBuffer(*counter, cl_uint{0}, 0,
+                                        sizeof(cl_uint));
+            cl->queue.enqueueNDRangeKernel(indices, cl::NullRange,
+                                           cl::NDRange(kNodeCount),
+                                           cl::NDRange(256));
+          }
+          cl->queue.finish();
+        },
+        kNodeCount, verify(indices, cl::NDRange(256)));
+
+    // the same dispatch with the local size and WG_SIZE the autotuner picks;
+    // every variant is built once, the winner is remembered across runs
+    std::map<std::string, cl::Kernel> variants;
+    std::vector<LaunchShape> shapes;
+    for (LaunchShape shape : Autotuner::LocalSizes(indices, cl->device, 1)) {
+      if (shape.items() == 0)
+        continue; // the scan needs WG_SIZE >= the local size
+      shape.defines = std::format("-DWG_SIZE={}", shape.local[0]);
+      shapes.push_back(shape);
+    }
+    const auto variant = [&](const LaunchShape &shape) -> cl::Kernel & {
+      auto [it, added] = variants.try_emplace(shape.defines);
+      if (added)
+        it->second = makeIndices(shape.defines);
+      return it->second;
+    };
+    const LaunchShape tuned = Autotuner::Shared().select(
+        cl->device, "create_index_buffer", shapes,
+        [&](const LaunchShape &shape) {
+          cl->queue.enqueueFillBuffer(*counter, cl_uint{0}, 0,
+                                      sizeof(cl_uint));
+          const cl_int status = cl->queue.enqueueNDRangeKernel(
+              variant(shape), cl::NullRange, cl::NDRange(kNodeCount),
+              shape.range(1));
+          return status == CL_SUCCESS ? cl->queue.finish() : status;
+        });
+
+    registry.add(
+        "cl/create_index_buffer/65536/tuned",
+        [cl, itemBuffer, frustumBuffer, meshes, triangles, counter, output,
+         svm, kernel = variant(tuned), local = tuned.range(1)](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            cl->queue.enqueueFillBuffer(*counter, cl_uint{0}, 0,
+                                        sizeof(cl_uint));
+            cl->queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                           cl::NDRange(kNodeCount), local);
+          }
+          cl->queue.finish();
+        },
+        kNodeCount, verify(variant(tuned), tuned.range(1)));
+  }
+}
+
+// Same shape as quads/build/10000_labels, but synthetic: 10000 labels of 128
+// glyphs each over a 96 entry atlas, so no font is needed.
+void RegisterTextKernels(bench::Registry &registry,
+                         std::shared_ptr<Device> cl) {
+  constexpr size_t kLabels = 10000;
+  constexpr size_t kGlyphsPerLabel = 128;
+
+  auto atlas = std::make_shared<GlyphAtlas>(glm::uvec2(1024),
+                                            (float)bench::kFontPixelSize);
+  for (unsigned i = 0; i < 96; ++i) {
+    atlas->add(0, i, {i % 16 * 64, i / 16 * 64}, {40, 48}, {2.0f, 40.0f});
+  }
+
+  auto labels = std::make_shared<std::vector<Label>>(kLabels);
+  auto batch = std::make_shared<GlyphBatch>();
+  for (size_t l = 0; l < kLabels; ++l) {
+    (*labels)[l] = {nullptr,
+                    {(float)(l % 7 * 97), (float)(l % 101 * 9)},
+                    0.5f,
+                    0xFFFFFFFFu};
+    for (size_t g = 0; g < kGlyphsPerLabel; ++g) {
+      batch->x.push_back((float)g * 37.5f);
+      batch->y.push_back(0.0f);
+      batch->entry.push_back((uint32_t)((l + g) % 96));
+      batch->label.push_back((uint32_t)l);
+    }
+  }
+
+  auto builder = std::make_shared<GlyphQuadBuilder>(
+      cl->context, cl->device, cl->queue,
+      std::filesystem::path(BENCH_ASSETS_DIR));
+  builder->uploadAtlas(*atlas);
+
+  registry.add(
+      "cl/build_glyph_quads/10000_labels",
+      [cl, builder, labels, batch](size_t n) {
+        for (size_t i = 0; i < n; ++i)
+          builder->build(*batch, *labels);
+        cl->queue.finish();
+      },
+      batch->size(),
+      // against PackGlyphQuads(); a fused multiply-add may move a rounded
+      // coordinate by one unit
+      [builder, labels, batch, atlas] {
+        std::vector<GlyphQuad> device, host;
+        builder->build(*batch, *labels);
+        builder->read(batch->size(), device);
+        PackGlyphQuads(*batch, *labels, *atlas, host);
+        for (size_t i = 0; i < host.size(); ++i) {
+          const GlyphQuad &d = device[i], &h = host[i];
+          const int fields[8][2] = {{d.x, h.x},       {d.y, h.y},
+                                    {d.width, h.width}, {d.height, h.height},
+                                    {d.u0, h.u0},     {d.v0, h.v0},
+                                    {d.u1, h.u1},     {d.v1, h.v1}};
+          for (const auto &[actual, expected] : fields) {
+            ExpectNear("build_glyph_quads", i, (float)actual,
+                       (float)expected, 1.0f);
+          }
+          if (d.color != h.color) {
+            throw std::runtime_error(std::format(
+                "build_glyph_quads: quad {} has color {:08x}, expected "
+                "{:08x}",
+                i, d.color, h.color));
+          }
+        }
+      });
+}
+
+void RegisterSdfKernels(bench::Registry &registry,
+                        std::shared_ptr<Device> cl) {
+  auto scene = std::make_shared<const bench::SdfScene>();
+  auto setup = std::make_shared<SdfTextSetup>();
+  PrepareSdfText(scene->batch(), scene->atlas(), scene->image, *setup);
+
+  auto compositor = std::make_shared<SdfCompositor>(
+      cl->context, cl->device, cl->queue,
+      std::filesystem::path(BENCH_ASSETS_DIR));
+  compositor->uploadAtlas(scene->atlas());
+
+  const size_t pixels = (size_t)scene->image.x * scene->image.y;
+  auto target = std::make_shared<cl::Buffer>(cl->context, CL_MEM_READ_WRITE,
+                                             pixels * 4);
+  cl->queue.enqueueFillBuffer(*target, cl_uint{0}, 0, pixels * 4);
+
+  registry.add(
+      "cl/composite_sdf_text/1920x1080",
+      [cl, compositor, setup, target](size_t n) {
+        for (size_t i = 0; i < n; ++i)
+          compositor->composite(*setup, *target);
+        cl->queue.finish();
+      },
+      pixels,
+      // against CompositeSdfText() over a cleared target; float rounding
+      // differs, so channels may be a step or two apart
+      [cl, compositor, setup, target, scene, pixels] {
+        std::vector<uint8_t> device(pixels * 4), host(pixels * 4);
+        cl->queue.enqueueFillBuffer(*target, cl_uint{0}, 0, pixels * 4);
+        compositor->composite(*setup, *target);
+        cl->queue.enqueueReadBuffer(*target, CL_TRUE, 0, device.size(),
+                                    device.data());
+        CompositeSdfText(*setup, scene->atlas(), host.data());
+        for (size_t i = 0; i < host.size(); ++i) {
+          ExpectNear("composite_sdf_text", i, device[i], host[i], 2.0f);
+        }
+      });
+}
+
+// 400 glyphs uploaded to the device copy, every other one evicted, then one
+// defragment() call; its moves are replayed from the pre-move texels and the
+// result has to equal the host texels, which defragment() already moved.
+void RegisterAtlasKernels(bench::Registry &registry,
+                          std::shared_ptr<Device> cl) {
+  constexpr FT_UInt kGlyphs = 400;
+
+  AtlasBudget budget;
+  budget.maxPages = 2;
+  budget.minIdleFrames = 4;
+  auto manager = std::make_shared<AtlasManager>(budget, 32.0f);
+  auto mirror = std::make_shared<AtlasMirror>(
+      cl->context, cl->device, cl->queue,
+      std::filesystem::path(BENCH_ASSETS_DIR), *manager);
+
+  manager->beginFrame();
+  for (FT_UInt glyph = 0; glyph < kGlyphs; ++glyph) {
+    const glm::uvec2 size(12 + glyph % 29, 20 + glyph % 13);
+    const auto cell = manager->insert(0, glyph, size, glm::vec2(1.0f, 18.0f));
+    if (!cell)
+      throw std::runtime_error(std::format("glyph {} does not fit", glyph));
+    auto texels = manager->texels();
+    for (unsigned y = 0; y < size.y; ++y) {
+      std::fill_n(texels.data() + (cell->position.y + y) * manager->pitch() +
+                      cell->position.x,
+                  size.x, (uint8_t)(glyph * 31 + y));
+    }
+    mirror->upload(*manager, *cell);
+  }
+  for (unsigned frame = 0; frame <= budget.minIdleFrames; ++frame) {
+    manager->beginFrame();
+    for (FT_UInt glyph = 0; glyph < kGlyphs; glyph += 2)
+      manager->use(0, glyph);
+  }
+  manager->evictIdle(budget.minIdleFrames);
+
+  auto before = std::make_shared<std::vector<uint8_t>>(
+      manager->texels().begin(), manager->texels().end());
+  auto moves = std::make_shared<std::vector<AtlasMove>>(manager->defragment());
+  if (moves->empty())
+    throw std::runtime_error("defragment() returned no moves");
+
+  // the moves of one call are disjoint, so replaying them again is a no-op
+  // on the result and every iteration does the same work
+  registry.add(
+      std::format("cl/copy_atlas_rects/{}_moves", moves->size()),
+      [cl, mirror, moves](size_t n) {
+        for (size_t i = 0; i < n; ++i)
+          mirror->apply(*moves);
+        cl->queue.finish();
+      },
+      moves->size(),
+      [cl, manager, mirror, moves, before] {
+        cl->queue.enqueueWriteBuffer(mirror->texels(), CL_TRUE, 0,
+                                     before->size(), before->data());
+        mirror->apply(*moves);
+        const auto host = manager->texels();
+        std::vector<uint8_t> device(host.size());
+        cl->queue.enqueueReadBuffer(mirror->texels(), CL_TRUE, 0,
+                                    device.size(), device.data());
+        const auto [d, h] = std::ranges::mismatch(device, host);
+        if (d != device.end()) {
+          const size_t i = d - device.begin();
+          throw std::runtime_error(std::format(
+              "copy_atlas_rects: texel ({}, {}) is {}, expected {}",
+              i % manager->pitch(), i / manager->pitch(), *d, *h));
+        }
+      });
+}
+
+} // namespace
+
+void RegisterKernelBenchmarks(bench::Registry &registry) {
+  std::shared_ptr<Device> cl;
+  std::string unavailable;
+  try {
+    cl = std::make_shared<Device>();
+  } catch (const std::exception &e) {
+    spdlog::error("OpenCL unavailable, skipping kernel benchmarks: {}",
+                  e.what());
+    unavailable = e.what();
+  }
+
+  // a kernel that fails to build must not take the other groups down with
+  // it, but it still fails the run
+  const auto group = [&](std::string name, auto &&add) {
+    try {
+      add(registry, cl);
+    } catch (const std::exception &e) {
+      spdlog::error("{}: {}", name, e.what());
+      registry.add(
+          "cl/" + name, [](size_t) {}, 1,
+          [message = std::string(e.what())] {
+            throw std::runtime_error(message);
+          });
+    }
+  };
+  // the host side of the RTIN error map needs no device
+  group("rtin", RegisterRtin);
+  if (!cl) {
+    // no device must not look like all kernels passing
+    group("device", [&](bench::Registry &, const std::shared_ptr<Device> &) {
+      throw std::runtime_error(unavailable);
+    });
+    return;
+  }
+
+  group("terrain", RegisterTerrainKernels);
+  group("height_pyramid", RegisterHeightPyramid);
+  group("culling", RegisterCullingKernels);
+  group("text", RegisterTextKernels);
+  group("sdf", RegisterSdfKernels);
+  group("atlas", RegisterAtlasKernels);
+}
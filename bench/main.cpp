@@ -0,0 +1,805 @@
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <hb-ft.h>
+#include <hb.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+#include "corpus.hpp"
+#include "scenes.hpp"
+#include "exec/executor.hpp"
+#include "font/atlas_build.hpp"
+#include "font/atlas_manager.hpp"
+#include "font/config.hpp"
+#include "font/face.hpp"
+#include "font/fallback.hpp"
+#include "font/layout.hpp"
+#include "font/measure.hpp"
+#include "font/outline.hpp"
+#include "font/quads.hpp"
+#include "font/render.hpp"
+#include "font/sdf.hpp"
+#include "font/shaping.hpp"
+#include "font/utf8.hpp"
+#include "trace/trace.hpp"
+
+void RegisterKernelBenchmarks(bench::Registry &registry);
+
+namespace {
+
+/**
+ * @brief FreeType state that stays alive for the whole run so setup cost is
+ * never part of a measurement.
+ */
+struct Fonts {
+  FT_Library library = nullptr;
+  std::vector<FT_Face> faces; // one per corpus, same order as kCorpora
+
+  Fonts() {
+    if (FT_Init_FreeType(&library)) {
+      throw std::runtime_error("FT_Init_FreeType failed");
+    }
+
+    for (const auto &corpus : bench::kCorpora) {
+      const auto path = find_font(std::string(corpus.fontQuery));
+      FT_Face face;
+      if (FT_New_Face(library, path.c_str(), 0, &face)) {
+        throw std::runtime_error(std::format("FT_New_Face failed (font: {})",
+                                             path));
+      }
+      // bitmap-only faces (color emoji) only come in fixed strikes
+      if (FT_Set_Pixel_Sizes(face, 0, bench::kFontPixelSize) &&
+          face->num_fixed_sizes > 0) {
+        FT_Select_Size(face, 0);
+      }
+      faces.push_back(face);
+    }
+  }
+
+  ~Fonts() {
+    for (FT_Face face : faces)
+      FT_Done_Face(face);
+    FT_Done_FreeType(library);
+  }
+};
+
+/**
+ * @brief One render thread: its own copy of a face, and a pool the glyph
+ * cache and the image allocate from.
+ */
+struct RenderWorker {
+  std::shared_ptr<Fonts> fonts; // keeps the library alive
+  std::shared_ptr<const std::vector<FT_Byte>> data;
+  FT_Face face;
+  std::pmr::unsynchronized_pool_resource pool;
+  GlyphBitmapCache cache{&pool};
+  std::pmr::vector<uint8_t> image{&pool};
+
+  RenderWorker(std::shared_ptr<Fonts> owner, FT_Face like)
+      : fonts(std::move(owner)), data(LoadFontData(like)),
+        face(CloneFace(fonts->library, *data, like)) {}
+  ~RenderWorker() { FT_Done_Face(face); }
+};
+
+/**
+ * @brief Threads that each own a warm RenderWorker and render `run` when
+ * asked. They live as long as the benchmark, so starting a thread, its
+ * first trace record and the cache warm-up all happen once, before any
+ * allocation is counted.
+ */
+class RenderThreads {
+public:
+  RenderThreads(std::vector<std::unique_ptr<RenderWorker>> workers,
+                std::shared_ptr<const GlyphRun> run)
+      : _workers(std::move(workers)), _run(std::move(run)),
+        _pending((unsigned)_workers.size()) {
+    for (auto &worker : _workers)
+      _threads.emplace_back([this, &worker] { loop(*worker); });
+    wait();
+  }
+
+  ~RenderThreads() {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &thread : _threads)
+      thread.join();
+  }
+
+  /// Renders `n` times on every thread; returns the allocations made.
+  size_t render(size_t n) {
+    {
+      std::lock_guard lock(_mutex);
+      _iterations = n;
+      _allocations = 0;
+      _pending = (unsigned)_workers.size();
+      ++_generation;
+    }
+    _wake.notify_all();
+    return wait();
+  }
+
+private:
+  size_t wait() {
+    std::unique_lock lock(_mutex);
+    _done.wait(lock, [this] { return _pending == 0; });
+    if (_error)
+      std::rethrow_exception(std::exchange(_error, nullptr));
+    return _allocations;
+  }
+
+  void finish(size_t allocations, std::exception_ptr error) {
+    std::lock_guard lock(_mutex);
+    _allocations += allocations;
+    if (error)
+      _error = error;
+    if (--_pending == 0)
+      _done.notify_one();
+  }
+
+  void loop(RenderWorker &worker) {
+    uint64_t seen = 0;
+    try {
+      TRACE_SCOPE("bench/warm_up");
+      Render(worker.face, *_run, worker.cache, worker.image);
+      finish(0, nullptr);
+    } catch (...) {
+      finish(0, std::current_exception());
+    }
+
+    for (;;) {
+      size_t n;
+      {
+        std::unique_lock lock(_mutex);
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop)
+          return;
+        seen = _generation;
+        n = _iterations;
+      }
+
+      const size_t before = bench::ThreadAllocations();
+      std::exception_ptr error;
+      try {
+        for (size_t i = 0; i < n; ++i) {
+          Render(worker.face, *_run, worker.cache, worker.image);
+          bench::DoNotOptimize(worker.image.data());
+        }
+      } catch (...) {
+        error = std::current_exception();
+      }
+      finish(bench::ThreadAllocations() - before, error);
+    }
+  }
+
+  std::vector<std::unique_ptr<RenderWorker>> _workers;
+  std::shared_ptr<const GlyphRun> _run;
+  std::mutex _mutex;
+  std::condition_variable _wake, _done;
+  uint64_t _generation = 0;
+  size_t _iterations = 0;
+  unsigned _pending;
+  size_t _allocations = 0;
+  std::exception_ptr _error;
+  bool _stop = false;
+  std::vector<std::thread> _threads;
+};
+
+/// One thread and every core, for benchmarks that run both ways.
+std::array<unsigned, 2> ThreadCounts() {
+  return {1u, std::max(2u, std::thread::hardware_concurrency())};
+}
+
+/// A text and the face to shape it with.
+struct Sample {
+  FT_Face face;
+  std::string text;
+};
+
+// Throw with `what` unless both outputs are the same.
+void ExpectSame(std::string_view what, const GlyphRun &actual,
+                const GlyphRun &expected) {
+  bool same = actual.size == expected.size &&
+              actual.glyphs.size() == expected.glyphs.size();
+  for (size_t i = 0; same && i < actual.glyphs.size(); ++i) {
+    const Glyph &a = actual.glyphs[i], &b = expected.glyphs[i];
+    same = a.glyphIndex == b.glyphIndex && a.offset == b.offset &&
+           a.advance == b.advance && a.font == b.font;
+  }
+  if (!same)
+    throw std::runtime_error(std::format("{} shapes differently", what));
+}
+
+void ExpectSame(std::string_view what, const std::vector<uint8_t> &actual,
+                const std::vector<uint8_t> &expected) {
+  if (actual != expected)
+    throw std::runtime_error(std::format("{} renders differently", what));
+}
+
+std::string Describe(const Sample &sample) {
+  return std::format("'{}' in {}", sample.text, sample.face->family_name);
+}
+
+std::string Describe(const GlyphRun &run) {
+  return std::format("a run of {} glyphs", run.glyphs.size());
+}
+
+/**
+ * @brief Registers `name`, timing `output(input)` over `inputs`. Before
+ * timing, `output` has to give what `reference` gives for every input and
+ * for every one of `checks`, which only widen the comparison.
+ */
+template <typename Input, typename Output, typename Reference>
+void AddCompared(bench::Registry &registry, std::string name, size_t items,
+                 std::vector<Input> inputs, Output output,
+                 Reference reference, std::vector<Input> checks = {}) {
+  auto shared = std::make_shared<const std::vector<Input>>(std::move(inputs));
+  registry.add(
+      std::move(name),
+      [shared, output](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          for (const Input &input : *shared)
+            bench::DoNotOptimize(output(input));
+        }
+      },
+      items,
+      [shared, output, reference, checks = std::move(checks)] {
+        for (const auto *list : {shared.get(), &checks}) {
+          for (const Input &input : *list)
+            ExpectSame(Describe(input), output(input), reference(input));
+        }
+      });
+}
+
+void RegisterFontBenchmarks(bench::Registry &registry,
+                            std::shared_ptr<Fonts> fonts) {
+  registry.add("fontconfig/find_font", [](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      bench::DoNotOptimize(find_font("sans:weight=bold"));
+    }
+  });
+
+  // shape() against HarfBuzz alone, which it must always match
+  const auto shapeSample = [fonts](const Sample &sample) {
+    return shape(sample.face, sample.text);
+  };
+  const auto harfBuzz = [fonts](const Sample &sample) {
+    return shapeWithHarfBuzz(sample.face, sample.text);
+  };
+
+  for (size_t c = 0; c < bench::kCorpora.size(); ++c) {
+    const auto &corpus = bench::kCorpora[c];
+    FT_Face face = fonts->faces[c];
+    const auto glyphCount = shape(face, corpus.text).glyphs.size();
+
+    AddCompared(registry, std::format("shape/{}", corpus.name), glyphCount,
+                std::vector{Sample{face, std::string(corpus.text)}},
+                shapeSample, harfBuzz);
+
+    registry.add(
+        std::format("render/{}", corpus.name),
+        [fonts, face, run = shape(face, corpus.text)](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            bench::DoNotOptimize(Render(face, run));
+          }
+        },
+        glyphCount);
+
+    registry.add(
+        std::format("bounding_rect/{}", corpus.name),
+        [fonts, face, text = corpus.text](size_t n) {
+          hb_font_t *font = hb_ft_font_create_referenced(face);
+          hb_buffer_t *buf = hb_buffer_create();
+          hb_buffer_add_utf8(buf, text.data(), (int)text.size(), 0,
+                             (int)text.size());
+          hb_buffer_guess_segment_properties(buf);
+          hb_shape(font, buf, nullptr, 0);
+
+          for (size_t i = 0; i < n; ++i) {
+            bench::DoNotOptimize(CalculateBoundingRectPx(font, buf));
+          }
+
+          hb_buffer_destroy(buf);
+          hb_font_destroy(font);
+        },
+        glyphCount);
+
+    // alternating widths: after the first two passes every line comes from
+    // the cache, so this measures breaking and lookups, not HarfBuzz
+    registry.add(
+        std::format("layout/reflow/{}", corpus.name),
+        [fonts, face, text = corpus.text](size_t n) {
+          ParagraphLayout layout(face);
+          layout.setText(std::string(text));
+          for (size_t i = 0; i < n; ++i) {
+            layout.setOptions({i % 2 ? 300 : 400, Align::Left, 1.0f});
+            bench::DoNotOptimize(layout.layout().size());
+          }
+        },
+        glyphCount);
+  }
+
+  // short ASCII labels, the common case, through the AsciiShaper tables and
+  // through HarfBuzz; both must give the same runs
+  {
+    static constexpr std::array<std::string_view, 8> kLabels{
+        "OK",           "Cancel",          "Width: 1024 px", "Zoom 125%",
+        "Save As...",   "Frame time (ms)", "Layer 3 / Terrain",
+        "AVAWAY Ta Te To"};
+    FT_Face face = fonts->faces[0];
+    size_t glyphCount = 0;
+    std::vector<Sample> labels;
+    for (std::string_view label : kLabels) {
+      glyphCount += label.size();
+      labels.push_back({face, std::string(label)});
+    }
+
+    // also every corpus line and triples of kerning-prone characters, which
+    // catch pairs that interact, on every face
+    std::vector<std::string> texts;
+    for (const auto &corpus : bench::kCorpora) {
+      for (auto line : std::views::split(corpus.text, '\n'))
+        texts.emplace_back(line.begin(), line.end());
+    }
+    constexpr std::string_view kKerning = "AFLPTVWYfkrvwy.,-'\"o1";
+    for (char a : kKerning) {
+      for (char b : kKerning) {
+        for (char c : kKerning)
+          texts.push_back({a, b, c});
+      }
+    }
+    std::vector<Sample> checks;
+    for (FT_Face other : fonts->faces) {
+      for (std::string_view label : kLabels)
+        checks.push_back({other, std::string(label)});
+      for (const std::string &text : texts)
+        checks.push_back({other, text});
+    }
+
+    AddCompared(registry, "shape/labels/ascii", glyphCount, labels,
+                shapeSample, harfBuzz, std::move(checks));
+    registry.add(
+        "shape/labels/harfbuzz",
+        [fonts, face](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            for (std::string_view label : kLabels)
+              bench::DoNotOptimize(shapeWithHarfBuzz(face, label));
+          }
+        },
+        glyphCount);
+
+    // sizes only, the whole batch at once; must agree with shape()
+    // the deleter keeps the library alive until the measurer's HarfBuzz
+    // font, which references the face, is gone
+    std::shared_ptr<TextMeasurer> measurer(
+        new TextMeasurer(face), [fonts](TextMeasurer *m) { delete m; });
+    registry.add(
+        "measure/labels",
+        [measurer](size_t n) {
+          std::array<TextMetrics, kLabels.size()> out;
+          for (size_t i = 0; i < n; ++i) {
+            measurer->measure(kLabels, out);
+            bench::DoNotOptimize(out.data());
+          }
+        },
+        glyphCount, [face, measurer] {
+          std::vector<std::string_view> texts(kLabels.begin(), kLabels.end());
+          for (const auto &corpus : bench::kCorpora)
+            texts.push_back(corpus.text);
+          std::vector<TextMetrics> out(texts.size());
+          measurer->measure(texts, out);
+          for (size_t i = 0; i < texts.size(); ++i) {
+            const GlyphRun run = shape(face, texts[i]);
+            float advance = 0.0f;
+            for (const Glyph &g : run.glyphs)
+              advance += g.advance.x;
+            if (out[i].size != run.size || out[i].advance != advance) {
+              throw std::runtime_error(std::format(
+                  "text {} measures {}x{} advancing {}, shape() gives "
+                  "{}x{} advancing {}",
+                  i, out[i].size.x, out[i].size.y, out[i].advance,
+                  run.size.x, run.size.y, advance));
+            }
+          }
+        });
+  }
+
+  // a long mixed-script document, shaped serially and across all cores; the
+  // latin face lacks most glyphs, which does not change the shaping work
+  {
+    std::string document;
+    for (int i = 0; i < 32; ++i) {
+      for (size_t c = 0; c < 3; ++c) {
+        document += bench::kCorpora[c].text;
+        document += ' ';
+      }
+    }
+
+    FT_Face face = fonts->faces[0];
+    const auto glyphCount = shape(face, document).glyphs.size();
+    for (unsigned threads : ThreadCounts()) {
+      auto executor = std::make_shared<Executor>(threads);
+      AddCompared(
+          registry, std::format("shape/mixed_document/{}", threads),
+          glyphCount, std::vector{Sample{face, document}},
+          [fonts, executor](const Sample &sample) {
+            return shape(sample.face, sample.text, executor.get());
+          },
+          shapeSample);
+    }
+  }
+
+  // cold renders rasterizing each distinct glyph once, serially and across
+  // all cores; the threaded image must match the serial one byte for byte
+  for (size_t c : {0, 2}) {
+    const auto &corpus = bench::kCorpora[c];
+    FT_Face face = fonts->faces[c];
+    std::string text;
+    for (int i = 0; i < 4; ++i) {
+      text += corpus.text;
+      text += ' ';
+    }
+    const GlyphRun run = shape(face, text);
+    for (unsigned threads : ThreadCounts()) {
+      auto executor = std::make_shared<Executor>(threads);
+      AddCompared(
+          registry,
+          std::format("render/unique_glyphs/{}/{}", corpus.name, threads),
+          run.glyphs.size(), std::vector{run},
+          [fonts, face, executor](const GlyphRun &glyphs) {
+            return Render(face, glyphs, *executor);
+          },
+          [fonts, face](const GlyphRun &glyphs) {
+            return Render(face, glyphs);
+          });
+    }
+  }
+
+  // rendering with warm per-thread caches and images must not touch the
+  // heap at all; any allocation fails the run, and ctest runs the check
+  {
+    FT_Face face = fonts->faces[0];
+    auto run =
+        std::make_shared<GlyphRun>(shape(face, bench::kCorpora[0].text));
+    for (unsigned threads : ThreadCounts()) {
+      std::vector<std::unique_ptr<RenderWorker>> workers;
+      for (unsigned t = 0; t < threads; ++t)
+        workers.push_back(std::make_unique<RenderWorker>(fonts, face));
+      auto pool = std::make_shared<RenderThreads>(std::move(workers), run);
+
+      const auto check = [pool](size_t n) {
+        if (const size_t count = pool->render(n)) {
+          throw std::runtime_error(std::format(
+              "steady-state rendering allocated {} times", count));
+        }
+      };
+      registry.add(std::format("render/steady_state/latin/{}", threads),
+                   check, run->glyphs.size() * threads,
+                   [check] { check(1); });
+    }
+  }
+
+  // outlines of the latin corpus: decomposing from FreeType versus rescaling
+  // the cached font unit copy to the benchmark size
+  {
+    FT_Face face = fonts->faces[0];
+    std::vector<FT_UInt> glyphs;
+    for (const Glyph &g : shape(face, bench::kCorpora[0].text).glyphs)
+      glyphs.push_back(g.glyphIndex);
+
+    registry.add(
+        "outline/decompose/latin",
+        [fonts, face, glyphs](size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            OutlineCache cache(face);
+            for (FT_UInt glyph : glyphs)
+              bench::DoNotOptimize(cache.get(glyph).segments());
+          }
+        },
+        glyphs.size());
+
+    auto cache = std::make_shared<OutlineCache>(face);
+    registry.add(
+        "outline/scaled/latin",
+        [fonts, cache, glyphs](size_t n) {
+          const float scale = cache->scaleFor(bench::kFontPixelSize);
+          for (size_t i = 0; i < n; ++i) {
+            for (FT_UInt glyph : glyphs)
+              bench::DoNotOptimize(cache->get(glyph).scaled(scale));
+          }
+        },
+        glyphs.size());
+  }
+
+  // code point to face resolution over a chain of all corpus faces
+  {
+    auto chain = std::make_shared<FontChain>(fonts->faces);
+    std::u32string codepoints;
+    for (const auto &corpus : bench::kCorpora) {
+      for (size_t offset = 0; offset < corpus.text.size();)
+        codepoints += NextCodepoint(corpus.text, offset);
+    }
+
+    registry.add(
+        "fallback/select",
+        [fonts, chain, codepoints](size_t n) {
+          unsigned sum = 0;
+          for (size_t i = 0; i < n; ++i) {
+            for (char32_t cp : codepoints)
+              sum += chain->select(cp);
+          }
+          bench::DoNotOptimize(sum);
+        },
+        codepoints.size());
+  }
+
+  // 10000 labels of the latin corpus at varying sizes, against an atlas with
+  // every glyph in 64 px cells; covers flattening and the packed conversion
+  {
+    FT_Face face = fonts->faces[0];
+    auto run =
+        std::make_shared<GlyphRun>(shape(face, bench::kCorpora[0].text));
+    auto atlas = std::make_shared<GlyphAtlas>(glm::uvec2(2048),
+                                              (float)bench::kFontPixelSize);
+    for (const Glyph &g : run->glyphs) {
+      if (atlas->find(g.font, g.glyphIndex) != GlyphAtlas::kMissing ||
+          FT_Load_Glyph(face, g.glyphIndex, FT_LOAD_DEFAULT)) {
+        continue;
+      }
+      const auto &m = face->glyph->metrics;
+      const auto cell = (unsigned)atlas->entries().size();
+      const glm::uvec2 size(std::min<FT_Pos>(m.width >> 6, 64),
+                            std::min<FT_Pos>(m.height >> 6, 64));
+      atlas->add(g.font, g.glyphIndex, {cell % 32 * 64, cell / 32 * 64}, size,
+                 {m.horiBearingX / 64.0f, m.horiBearingY / 64.0f});
+    }
+
+    auto labels = std::make_shared<std::vector<Label>>(10000);
+    for (size_t i = 0; i < labels->size(); ++i) {
+      (*labels)[i] = {run.get(),
+                      {(float)(i % 7 * 97), (float)(i % 101 * 9)},
+                      0.25f + (float)(i % 4) * 0.125f,
+                      0xFF000000u | (uint32_t)i};
+    }
+
+    const auto glyphCount = labels->size() * run->glyphs.size();
+    registry.add(
+        "quads/build/10000_labels",
+        [fonts, run, atlas, labels](size_t n) {
+          GlyphBatch batch;
+          std::vector<GlyphQuad> quads;
+          for (size_t i = 0; i < n; ++i) {
+            BuildGlyphQuads(*labels, *atlas, batch, quads);
+            bench::DoNotOptimize(quads.data());
+          }
+        },
+        glyphCount);
+  }
+
+  // compositing a full HD frame of SDF text; preparation is measured apart
+  // since it runs once per frame for both the CPU and the OpenCL path
+  {
+    auto scene = std::make_shared<bench::SdfScene>();
+    registry.add(
+        "sdf/prepare/2000_labels",
+        [scene](size_t n) {
+          SdfTextSetup setup;
+          for (size_t i = 0; i < n; ++i) {
+            PrepareSdfText(scene->batch(), scene->atlas(), scene->image, setup);
+            bench::DoNotOptimize(setup.tileQuads.data());
+          }
+        },
+        scene->quads.size());
+
+    auto setup = std::make_shared<SdfTextSetup>();
+    PrepareSdfText(scene->batch(), scene->atlas(), scene->image, *setup);
+    for (unsigned threads : ThreadCounts()) {
+      registry.add(
+          std::format("sdf/composite/1920x1080/{}", threads),
+          [scene, setup, threads](size_t n) {
+            std::vector<uint8_t> target(
+                (size_t)scene->image.x * scene->image.y * 4);
+            for (size_t i = 0; i < n; ++i) {
+              CompositeSdfText(*setup, scene->atlas(), target.data(),
+                               threads);
+            }
+            bench::DoNotOptimize(target.data());
+          },
+          (size_t)scene->image.x * scene->image.y);
+    }
+  }
+
+  // offline MSDF generation of printable ASCII, serially and across all cores
+  {
+    FT_Face face = fonts->faces[0];
+    const std::pair<char32_t, char32_t> ascii{0x21, 0x7E};
+    const auto glyphs = GlyphsForRanges(face, {&ascii, 1});
+    for (unsigned threads : ThreadCounts()) {
+      registry.add(
+          std::format("atlas/build_msdf/ascii/{}", threads),
+          [fonts, face, glyphs, threads](size_t n) {
+            AtlasBuildOptions options;
+            options.threads = threads;
+            for (size_t i = 0; i < n; ++i) {
+              bench::DoNotOptimize(
+                  BuildAtlas(face, glyphs, options).image.pixels.data());
+            }
+          },
+          glyphs.size());
+    }
+  }
+
+  // a long-running atlas: each frame uses a window of 400 glyphs drifting by
+  // 8 glyphs per frame, so old glyphs go idle and get evicted under pressure
+  // or every 60 frames, after which the pages are compacted a few moves at a
+  // time
+  {
+    constexpr unsigned kWindow = 400;
+    constexpr unsigned kDrift = 8;
+    registry.add(
+        "atlas/churn/400_glyphs",
+        [](size_t n) {
+          AtlasBudget budget;
+          budget.maxPages = 2;
+          budget.minIdleFrames = 4;
+          AtlasManager manager(budget, 32.0f);
+          for (size_t frame = 0; frame < n; ++frame) {
+            manager.beginFrame();
+            const auto first = (FT_UInt)(frame * kDrift);
+            for (FT_UInt glyph = first; glyph < first + kWindow; ++glyph) {
+              if (manager.use(0, glyph) != GlyphAtlas::kMissing)
+                continue;
+              const glm::uvec2 size(12 + glyph % 29, 20 + glyph % 13);
+              const auto cell =
+                  manager.insert(0, glyph, size, glm::vec2(1.0f, 18.0f));
+              if (!cell)
+                continue;
+              auto texels = manager.texels();
+              for (unsigned y = 0; y < size.y; ++y) {
+                std::fill_n(texels.data() +
+                                (cell->position.y + y) * manager.pitch() +
+                                cell->position.x,
+                            size.x, (uint8_t)glyph);
+              }
+            }
+            if (frame % 60 == 59)
+              manager.evictIdle(budget.minIdleFrames);
+            bench::DoNotOptimize(manager.defragment(16).data());
+          }
+        },
+        kWindow);
+  }
+
+  // a synthetic 64x64 coverage ramp blended over a 512x512 target, clipped at
+  // the right edge on every fourth placement
+  constexpr int kGlyph = 64;
+  constexpr int kImage = 512;
+  registry.add(
+      "blend_glyph_bitmap/64x64",
+      [](size_t n) {
+        std::vector<unsigned char> coverage(kGlyph * kGlyph);
+        for (int y = 0; y < kGlyph; ++y)
+          for (int x = 0; x < kGlyph; ++x)
+            coverage[y * kGlyph + x] = (unsigned char)((x * 4 + y) & 0xFF);
+
+        FT_Bitmap bitmap{};
+        bitmap.rows = kGlyph;
+        bitmap.width = kGlyph;
+        bitmap.pitch = kGlyph;
+        bitmap.buffer = coverage.data();
+        bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+
+        std::vector<unsigned char> image(kImage * kImage);
+        for (size_t i = 0; i < n; ++i) {
+          const int x = (int)(i * 37 % (kImage - kGlyph / 2));
+          const int y = (int)(i * 11 % (kImage - kGlyph));
+          blend_glyph_bitmap(image.data(), kImage, kImage, &bitmap, x, y);
+        }
+        bench::DoNotOptimize(image.data());
+      },
+      kGlyph * kGlyph);
+}
+
+void PrintUsage(const char *argv0) {
+  std::puts(std::format("usage: {} [--filter <substring>] [--json <file>] "
+                        "[--min-time <seconds>] [--repetitions <n>] "
+                        "[--baseline <file>] [--max-regression <fraction>]",
+                        argv0)
+                .c_str());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  spdlog::set_level(spdlog::level::warn); // the library logs every call
+
+  bench::Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      PrintUsage(argv[0]);
+      return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (arg == "--filter") {
+      options.filter = argv[++i];
+    } else if (arg == "--json") {
+      options.json = argv[++i];
+    } else if (arg == "--min-time") {
+      options.minTime = std::chrono::duration<double>(std::atof(argv[++i]));
+    } else if (arg == "--repetitions") {
+      options.repetitions = (unsigned)std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--baseline") {
+      options.baseline = argv[++i];
+    } else if (arg == "--max-regression") {
+      options.maxRegression = std::max(0.0, std::atof(argv[++i]));
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  try {
+    bench::Registry registry;
+    RegisterFontBenchmarks(registry, std::make_shared<Fonts>());
+    RegisterKernelBenchmarks(registry);
+
+    const auto results = registry.run(options);
+    if (!options.json.empty()) {
+      bench::WriteJson(options.json, results);
+    }
+
+    // wrong output or a slowdown past the threshold fails the run, so the
+    // kernels can be optimized without silently breaking them
+    const auto failed = std::ranges::count_if(
+        results, [](const bench::Result &r) { return !r.error.empty(); });
+    size_t regressed = 0;
+    if (!options.baseline.empty()) {
+      if (std::filesystem::exists(options.baseline)) {
+        regressed = bench::FindRegressions(results,
+                                           bench::ReadJson(options.baseline),
+                                           options.maxRegression)
+                        .size();
+      } else {
+        spdlog::error("no baseline at '{}', timings not compared",
+                      options.baseline.string());
+        return EXIT_FAILURE;
+      }
+    }
+    if (results.empty()) {
+      spdlog::error("no benchmark matches '{}'", options.filter);
+      return EXIT_FAILURE;
+    }
+    if (failed > 0 || regressed > 0) {
+      spdlog::error("{} benchmarks failed, {} regressed", failed, regressed);
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception &e) {
+    spdlog::error("Exception: {}", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
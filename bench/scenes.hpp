@@ -0,0 +1,88 @@
+#ifndef BENCH_SCENES_HPP
+#define BENCH_SCENES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "font/sdf.hpp"
+
+namespace bench {
+
+/**
+ * @brief Synthetic SDF text scene shared by the CPU and OpenCL compositor
+ * benchmarks: a 1024² single-channel atlas of 256 ring "glyphs" and 2000
+ * labels of 24 glyphs, a quarter rotated, half outlined, some shadowed.
+ */
+struct SdfScene {
+  static constexpr unsigned kAtlas = 1024;
+  static constexpr unsigned kCell = 64;
+  static constexpr float kRange = 8.0f;
+
+  glm::uvec2 image{1920, 1080};
+  std::vector<uint8_t> texels;
+  std::vector<GlyphQuad> quads;
+  std::vector<uint32_t> style;
+  std::vector<TextStyle> styles;
+
+  SdfAtlasView atlas() const {
+    return {texels.data(), glm::uvec2(kAtlas), SdfKind::Sdf, kRange};
+  }
+  SdfTextBatch batch() const { return {quads, style, styles}; }
+
+  SdfScene() {
+    texels.resize(kAtlas * kAtlas);
+    for (unsigned y = 0; y < kAtlas; ++y) {
+      for (unsigned x = 0; x < kAtlas; ++x) {
+        const unsigned cell = (y / kCell) * (kAtlas / kCell) + x / kCell;
+        const float dx = (float)(x % kCell) + 0.5f - kCell / 2.0f;
+        const float dy = (float)(y % kCell) + 0.5f - kCell / 2.0f;
+        const float r = std::sqrt(dx * dx + dy * dy);
+        const float d = 6.0f - std::abs(r - (12.0f + (float)(cell % 8)));
+        texels[y * kAtlas + x] =
+            (uint8_t)std::clamp(std::lround((d / kRange + 0.5f) * 255.0f),
+                                0L, 255L);
+      }
+    }
+
+    constexpr unsigned kLabels = 2000;
+    constexpr unsigned kGlyphs = 24;
+    const uint16_t cellUv = 65535 / (kAtlas / kCell);
+    for (unsigned l = 0; l < kLabels; ++l) {
+      const glm::vec2 origin((float)(l * 97 % image.x),
+                             (float)(l * 53 % image.y));
+      TextStyle s = TextStyle::Placed(origin, 0.25f + (float)(l % 3) * 0.125f,
+                                      l % 4 == 0 ? 0.5f : 0.0f);
+      if (l % 2) {
+        s.outlineColor = 0xFF000000;
+        s.outlineWidth = 1.5f;
+      }
+      if (l % 5 == 0) {
+        s.shadowColor = 0x80000000;
+        s.shadowOffset = {3.0f, 3.0f};
+        s.shadowSoftness = 2.0f;
+      }
+      styles.push_back(s);
+
+      for (unsigned g = 0; g < kGlyphs; ++g) {
+        const unsigned cell = (l * 7 + g) % 256;
+        GlyphQuad q;
+        q.x = (int16_t)(g * 48 * kQuadSubpixel);
+        q.y = (int16_t)(-48 * kQuadSubpixel);
+        q.width = q.height = (uint16_t)(kCell * kQuadSubpixel);
+        q.u0 = (uint16_t)(cell % 16 * cellUv);
+        q.v0 = (uint16_t)(cell / 16 * cellUv);
+        q.u1 = (uint16_t)(q.u0 + cellUv);
+        q.v1 = (uint16_t)(q.v0 + cellUv);
+        q.color = 0xFF000000u | (l * 2654435761u >> 8);
+        quads.push_back(q);
+        style.push_back(l);
+      }
+    }
+  }
+};
+
+} // namespace bench
+
+#endif // BENCH_SCENES_HPP
@@ -0,0 +1,53 @@
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <string_view>
+
+#include "cl/AssetBundle.hpp"
+#include "trace/trace.hpp"
+
+// ft_bundle: packs the assets directory into one mapped file for the build,
+//   ft_bundle assets build/assets.bundle
+// and lists a bundle's contents with their content hashes,
+//   ft_bundle --list build/assets.bundle
+
+namespace {
+
+void PrintUsage(const char *argv0) {
+  std::puts(std::format("usage: {} <directory> <output.bundle>\n"
+                        "       {} --list <bundle>",
+                        argv0, argv0)
+                .c_str());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  TRACE_THREAD_NAME("main");
+
+  try {
+    if (std::string_view(argv[1]) == "--list") {
+      const AssetBundle bundle(argv[2]);
+      for (std::string_view name : bundle.names()) {
+        const auto asset = bundle.find(name);
+        std::puts(std::format("{:016x} {:>10} {}", asset->hash,
+                              asset->bytes.size(), name)
+                      .c_str());
+      }
+    } else {
+      WriteAssetBundle(argv[1], argv[2]);
+    }
+  } catch (const std::exception &e) {
+    spdlog::error("Exception: {}", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
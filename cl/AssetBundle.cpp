@@ -0,0 +1,323 @@
+#include "AssetBundle.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr char kMagic[8] = {'B', 'G', 'L', 'A', 'S', 'S', 'E', 'T'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kAlignment = 16;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slotCount; // power of two
+  uint64_t entries;
+};
+static_assert(sizeof(Header) == 24);
+
+size_t AlignUp(size_t value) {
+  return (value + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+} // namespace
+
+// nameSize == 0 marks an empty slot
+struct AssetBundle::Slot {
+  uint64_t nameHash;
+  uint64_t contentHash;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t nameOffset;
+  uint32_t nameSize;
+};
+static_assert(std::endian::native == std::endian::little,
+              "bundles are little endian and read in place");
+
+uint64_t HashBytes(std::span<const std::byte> bytes, uint64_t seed) {
+  uint64_t hash = seed;
+  for (std::byte b : bytes) {
+    hash ^= (uint64_t)b;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/* ------------------------------------------------------------------------- */
+
+AssetBundle::AssetBundle(const std::filesystem::path &path) : _path(path) {
+  TRACE_SCOPE("assets/map_bundle");
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(std::format("cannot open asset bundle '{}': {}",
+                                         path.string(), std::strerror(errno)));
+  }
+
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header)) {
+    ::close(fd);
+    throw std::runtime_error(
+        std::format("'{}' is too short for an asset bundle", path.string()));
+  }
+  _size = (size_t)info.st_size;
+
+  // one populated mapping: on network mounts a single large read beats
+  // faulting pages in one at a time
+  int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+#endif
+  void *mapped = ::mmap(nullptr, _size, PROT_READ, flags, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error(std::format("cannot map '{}': {}", path.string(),
+                                         std::strerror(errno)));
+  }
+  _data = static_cast<const std::byte *>(mapped);
+
+  // everything is checked once here, so find() can trust the offsets
+  const auto fail = [&](std::string_view why) {
+    ::munmap(const_cast<std::byte *>(_data), _size);
+    throw std::runtime_error(
+        std::format("invalid asset bundle '{}': {}", path.string(), why));
+  };
+
+  Header header;
+  std::memcpy(&header, _data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    fail("bad magic");
+  if (header.version != kVersion)
+    fail(std::format("version {}, expected {}", header.version, kVersion));
+  // find() stops at an empty slot, so at least one has to be left
+  if (!std::has_single_bit(header.slotCount) ||
+      header.entries >= header.slotCount ||
+      sizeof(Header) + (size_t)header.slotCount * sizeof(Slot) > _size)
+    fail("bad slot table");
+  _slotCount = header.slotCount;
+  _entries = header.entries;
+
+  size_t used = 0;
+  for (const Slot &slot : std::span(slots(), _slotCount)) {
+    if (slot.nameSize == 0)
+      continue;
+    ++used;
+    if ((size_t)slot.nameOffset + slot.nameSize > _size ||
+        slot.offset > _size || slot.size > _size - slot.offset)
+      fail(std::format("entry {} is out of bounds", used));
+  }
+  if (used != _entries)
+    fail("entry count mismatch");
+
+  spdlog::info("mapped asset bundle '{}' ({} assets, {} bytes)", path.string(),
+               _entries, _size);
+}
+
+AssetBundle::~AssetBundle() {
+  if (_data)
+    ::munmap(const_cast<std::byte *>(_data), _size);
+}
+
+const AssetBundle::Slot *AssetBundle::slots() const {
+  static_assert(sizeof(Slot) == 40);
+  return reinterpret_cast<const Slot *>(_data + sizeof(Header));
+}
+
+std::string_view AssetBundle::name(const Slot &slot) const {
+  return {reinterpret_cast<const char *>(_data + slot.nameOffset),
+          slot.nameSize};
+}
+
+std::optional<Asset> AssetBundle::find(std::string_view name) const {
+  if (name.empty())
+    return std::nullopt;
+
+  const uint64_t hash = HashString(name);
+  const uint32_t mask = _slotCount - 1;
+  uint32_t i = (uint32_t)hash & mask;
+  for (uint32_t probes = 0; probes < _slotCount; ++probes, i = (i + 1) & mask) {
+    const Slot &slot = slots()[i];
+    if (slot.nameSize == 0)
+      return std::nullopt;
+    if (slot.nameHash == hash && this->name(slot) == name) {
+      return Asset{{_data + slot.offset, (size_t)slot.size},
+                   slot.contentHash,
+                   weak_from_this().lock()};
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::string_view> AssetBundle::names() const {
+  std::vector<std::string_view> out;
+  for (const Slot &slot : std::span(slots(), _slotCount)) {
+    if (slot.nameSize != 0)
+      out.push_back(name(slot));
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+std::shared_ptr<const AssetBundle>
+AssetBundle::ForDirectory(const std::filesystem::path &directory) {
+  static std::mutex mutex;
+  static std::map<std::filesystem::path, std::shared_ptr<const AssetBundle>>
+      opened; // null for directories without a bundle
+
+  std::filesystem::path file = directory;
+  file += ".bundle";
+
+  std::lock_guard lock(mutex);
+  auto [it, added] = opened.try_emplace(file);
+  if (added && std::filesystem::is_regular_file(file))
+    it->second = std::make_shared<const AssetBundle>(file);
+  return it->second;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void WriteAssetBundle(const std::filesystem::path &directory,
+                      const std::filesystem::path &output) {
+  struct File {
+    std::string name;
+    std::vector<char> content;
+  };
+  std::vector<File> files;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(directory)) {
+    if (!entry.is_regular_file())
+      continue;
+    std::ifstream in(entry.path(), std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("Failed to read: " + entry.path().string());
+    }
+    files.push_back(
+        {std::filesystem::relative(entry.path(), directory).generic_string(),
+         std::vector<char>(std::istreambuf_iterator<char>(in),
+                           std::istreambuf_iterator<char>())});
+  }
+  // sorted, so the same tree always gives the same bytes
+  std::sort(files.begin(), files.end(),
+            [](const File &a, const File &b) { return a.name < b.name; });
+
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.slotCount =
+      std::bit_ceil((uint32_t)std::max<size_t>(files.size() * 2, 1));
+  header.entries = files.size();
+
+  std::vector<AssetBundle::Slot> slots(header.slotCount);
+  std::string names;
+  size_t offset = sizeof(Header) + slots.size() * sizeof(AssetBundle::Slot);
+  for (const File &file : files)
+    names += file.name;
+  size_t nameOffset = offset;
+  offset = AlignUp(offset + names.size());
+
+  const uint32_t mask = header.slotCount - 1;
+  for (const File &file : files) {
+    const uint64_t hash = HashString(file.name);
+    uint32_t i = (uint32_t)hash & mask;
+    while (slots[i].nameSize != 0)
+      i = (i + 1) & mask;
+    slots[i] = {hash,
+                HashBytes(std::as_bytes(std::span(file.content))),
+                offset,
+                file.content.size(),
+                (uint32_t)nameOffset,
+                (uint32_t)file.name.size()};
+    nameOffset += file.name.size();
+    offset = AlignUp(offset + file.content.size());
+  }
+
+  std::filesystem::path temp = output;
+  temp += ".tmp";
+  {
+    std::ofstream out(temp, std::ios::binary);
+    if (!out) {
+      throw std::runtime_error("Failed to write: " + temp.string());
+    }
+    const auto pad = [&] {
+      static constexpr char zeros[kAlignment] = {};
+      out.write(zeros, (std::streamsize)(AlignUp((size_t)out.tellp()) -
+                                         (size_t)out.tellp()));
+    };
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(slots.data()),
+              (std::streamsize)(slots.size() * sizeof(AssetBundle::Slot)));
+    out.write(names.data(), (std::streamsize)names.size());
+    pad();
+    for (const File &file : files) {
+      out.write(file.content.data(), (std::streamsize)file.content.size());
+      pad();
+    }
+    if (!out) {
+      throw std::runtime_error("Failed to write: " + temp.string());
+    }
+  }
+  // rename keeps the old inode alive for processes that still map it
+  std::filesystem::rename(temp, output);
+  spdlog::info("packed {} assets from '{}' into '{}'", files.size(),
+               directory.string(), output.string());
+}
+
+Asset LoadAsset(const std::filesystem::path &path) {
+  for (auto directory = path.parent_path();
+       !directory.empty() && directory != directory.root_path();
+       directory = directory.parent_path()) {
+    const auto bundle = AssetBundle::ForDirectory(directory);
+    if (!bundle)
+      continue;
+    const auto name =
+        std::filesystem::relative(path, directory).generic_string();
+    if (auto asset = bundle->find(name))
+      return *asset;
+    spdlog::warn("'{}' is not in asset bundle '{}'", name,
+                 bundle->path().string());
+  }
+
+  TRACE_SCOPE("assets/read_file");
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Failed to open asset: " + path.string());
+  }
+  auto content = std::make_shared<std::vector<std::byte>>();
+  in.seekg(0, std::ios::end);
+  content->resize((size_t)in.tellg());
+  in.seekg(0);
+  in.read(reinterpret_cast<char *>(content->data()),
+          (std::streamsize)content->size());
+  if (!in) {
+    throw std::runtime_error("Failed to read asset: " + path.string());
+  }
+  return {*content, HashBytes(*content), content};
+}
+
+bool AssetExists(const std::filesystem::path &path) {
+  for (auto directory = path.parent_path();
+       !directory.empty() && directory != directory.root_path();
+       directory = directory.parent_path()) {
+    const auto bundle = AssetBundle::ForDirectory(directory);
+    if (bundle &&
+        bundle->find(
+            std::filesystem::relative(path, directory).generic_string()))
+      return true;
+  }
+  return std::filesystem::is_regular_file(path);
+}
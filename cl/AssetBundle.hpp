@@ -0,0 +1,105 @@
+#ifndef ASSET_BUNDLE_HPP
+#define ASSET_BUNDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// 64-bit FNV-1a, the bundle's name and content hash. Stable across runs,
+/// so content hashes can key on-disk caches.
+uint64_t HashBytes(std::span<const std::byte> bytes,
+                   uint64_t seed = 0xcbf29ce484222325ull);
+
+inline uint64_t HashString(std::string_view text,
+                           uint64_t seed = 0xcbf29ce484222325ull) {
+  return HashBytes(std::as_bytes(std::span(text)), seed);
+}
+
+/**
+ * @brief The bytes of one asset and the hash of its content. `owner` keeps
+ * them alive: the bundle mapping, or a copy read from a loose file.
+ */
+struct Asset {
+  std::span<const std::byte> bytes;
+  uint64_t hash = 0;
+  std::shared_ptr<const void> owner;
+
+  std::string_view text() const {
+    return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+  }
+};
+
+/**
+ * @brief Read-only view of a file written by WriteAssetBundle(), mapped
+ * with mmap, so opening it is one system call however many assets it holds
+ * and pages are only read when touched.
+ *
+ * Layout, little endian: a 24 byte header ("BGLASSET", version, slot
+ * count, entry count), an open addressing table of 40 byte slots indexed
+ * by name hash, the names, then the contents at 16 byte alignment. Lookups
+ * probe about one slot since the table is at most half full.
+ */
+class AssetBundle : public std::enable_shared_from_this<AssetBundle> {
+public:
+  /// Maps and validates `path`; throws std::runtime_error if it is no
+  /// bundle or is truncated.
+  explicit AssetBundle(const std::filesystem::path &path);
+  ~AssetBundle();
+
+  AssetBundle(const AssetBundle &) = delete;
+  AssetBundle &operator=(const AssetBundle &) = delete;
+
+  /// `name` is the path relative to the packed directory, '/' separated.
+  std::optional<Asset> find(std::string_view name) const;
+
+  std::vector<std::string_view> names() const;
+  size_t size() const { return _entries; }
+  const std::filesystem::path &path() const { return _path; }
+
+  /**
+   * @brief The bundle standing in for `directory`, i.e. `directory` with
+   * ".bundle" appended, opened once per process; null if there is none.
+   */
+  static std::shared_ptr<const AssetBundle>
+  ForDirectory(const std::filesystem::path &directory);
+
+private:
+  struct Slot;
+  friend void WriteAssetBundle(const std::filesystem::path &directory,
+                               const std::filesystem::path &output);
+
+  const Slot *slots() const;
+  std::string_view name(const Slot &slot) const;
+
+  std::filesystem::path _path;
+  const std::byte *_data = nullptr;
+  size_t _size = 0;
+  uint32_t _slotCount = 0;
+  size_t _entries = 0;
+};
+
+/**
+ * @brief Packs every regular file under `directory` into a bundle at
+ * `output`, named by their relative paths. Written to a temporary first, so
+ * running programs keep their mapping of the old bundle.
+ */
+void WriteAssetBundle(const std::filesystem::path &directory,
+                      const std::filesystem::path &output);
+
+/**
+ * @brief `path` from the bundle standing in for its directory if there is
+ * one (see AssetBundle::ForDirectory), else read from the file itself.
+ * Throws std::runtime_error if neither has it.
+ */
+Asset LoadAsset(const std::filesystem::path &path);
+
+/// Whether LoadAsset() would find `path`, without reading it.
+bool AssetExists(const std::filesystem::path &path);
+
+#endif // ASSET_BUNDLE_HPP
@@ -0,0 +1,76 @@
+#ifndef ATLAS_MIRROR_HPP
+#define ATLAS_MIRROR_HPP
+
+#include <CL/opencl.hpp>
+#include <array>
+#include <filesystem>
+#include <vector>
+
+#include "Buffer.hpp"
+#include "Program.hpp"
+#include "font/atlas_manager.hpp"
+
+/**
+ * @brief Device copy of an AtlasManager's texels. The buffer is allocated
+ * for the whole page budget once, so it never has to be reallocated while
+ * frames are in flight; new glyphs are uploaded cell by cell and
+ * defragmentation moves run on the device with atlas_copy.cl.
+ */
+class AtlasMirror {
+public:
+  AtlasMirror(cl::Context &context, cl::Device &device,
+              cl::CommandQueue &queue, const std::filesystem::path &assetsDir,
+              const AtlasManager &manager)
+      : _context(context), _queue(queue), _pitch(manager.pitch()),
+        _channels(manager.budget().channels) {
+    Program program(context);
+    _kernel = cl::Kernel(program.build(device, assetsDir / "atlas_copy.cl"),
+                         "copy_atlas_rects");
+
+    // one spare row like the host copy, for bilinear taps
+    const auto &budget = manager.budget();
+    const size_t bytes =
+        ((size_t)budget.pageSize.y * budget.maxPages + 1) * _pitch;
+    _texels = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+    _queue.enqueueFillBuffer(_texels, cl_uchar{0}, 0, bytes);
+  }
+
+  /// Uploads the cell of a glyph just written into the host texels.
+  void upload(const AtlasManager &manager, const AtlasAllocation &glyph) {
+    const std::array<size_t, 3> origin{glyph.position.x * _channels,
+                                       glyph.position.y, 0};
+    const std::array<size_t, 3> region{glyph.cellSize * _channels,
+                                       glyph.cellSize, 1};
+    _queue.enqueueWriteBufferRect(_texels, CL_TRUE, origin, origin, region,
+                                  _pitch, 0, _pitch, 0,
+                                  manager.texels().data());
+  }
+
+  /// Enqueues the moves returned by AtlasManager::defragment().
+  void apply(const std::vector<AtlasMove> &moves) {
+    if (moves.empty())
+      return;
+
+    constexpr size_t kGroup = 64;
+    _kernel.setArg(0, _texels);
+    _kernel.setArg(1, (cl_uint)_pitch);
+    _kernel.setArg(2, (cl_uint)_channels);
+    _kernel.setArg(3, _moves.write(_context, _queue, moves));
+    _queue.enqueueNDRangeKernel(_kernel, cl::NullRange,
+                                cl::NDRange(kGroup, moves.size()),
+                                cl::NDRange(kGroup, 1));
+  }
+
+  cl::Buffer &texels() { return _texels; }
+
+private:
+  cl::Context &_context;
+  cl::CommandQueue &_queue;
+  cl::Kernel _kernel;
+  size_t _pitch;
+  unsigned _channels;
+  cl::Buffer _texels;
+  GrowableBuffer _moves;
+};
+
+#endif // ATLAS_MIRROR_HPP
@@ -0,0 +1,260 @@
+#ifndef AUTOTUNER_HPP
+#define AUTOTUNER_HPP
+
+#include <CL/opencl.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "Program.hpp"
+
+/**
+ * @brief One way to launch a kernel: its local size, all zero for
+ * cl::NullRange (the driver's choice), and the compiler options the program
+ * has to be built with for it, e.g. "-DWG_SIZE=128".
+ */
+struct LaunchShape {
+  std::array<size_t, 3> local{0, 0, 0};
+  std::string defines;
+
+  cl::NDRange range(size_t dims) const {
+    if (local[0] == 0)
+      return cl::NullRange;
+    switch (dims) {
+    case 1:
+      return cl::NDRange(local[0]);
+    case 2:
+      return cl::NDRange(local[0], local[1]);
+    default:
+      return cl::NDRange(local[0], local[1], local[2]);
+    }
+  }
+
+  size_t items() const { return local[0] * local[1] * local[2]; }
+
+  bool operator==(const LaunchShape &) const = default;
+};
+
+/**
+ * @brief Picks the fastest LaunchShape per kernel and device by timing the
+ * candidates once, and remembers the winners in a text file next to the
+ * program cache, so later runs dispatch with them right away. Drivers differ
+ * wildly here: PoCL wants few large groups, GPUs a multiple of their SIMD
+ * width. Set BGL_AUTOTUNE=0 to skip timing and take the first candidate.
+ *
+ * Thread safe; tuning holds the lock, so a kernel is tuned only once even
+ * when several jobs reach it at the same time.
+ */
+class Autotuner {
+public:
+  /// Enqueues one dispatch with the shape and waits for it. Anything but
+  /// CL_SUCCESS, or an exception, rules the shape out.
+  using Run = std::function<cl_int(const LaunchShape &)>;
+
+  explicit Autotuner(std::filesystem::path file) : _file(std::move(file)) {
+    load();
+  }
+
+  /// Process wide instance backed by ProgramCache::Directory().
+  static Autotuner &Shared() {
+    static Autotuner tuner(ProgramCache::Directory() / "workgroups.tsv");
+    return tuner;
+  }
+
+  /**
+   * @brief The stored winner for `kernel` on `device` if it is still one of
+   * the `candidates`, else the fastest candidate, which is then stored.
+   * `kernel` names the dispatch; append a size class to it when the best
+   * shape depends on the problem size. If the shapes carry defines, `run`
+   * has to build (and should cache) the matching program variant.
+   */
+  LaunchShape select(const cl::Device &device, std::string_view kernel,
+                     std::span<const LaunchShape> candidates, const Run &run) {
+    if (candidates.empty())
+      throw std::invalid_argument(
+          std::format("no launch shapes for kernel '{}'", kernel));
+
+    const std::string key = Key(device, kernel);
+    std::lock_guard lock(_mutex);
+    if (auto it = _winners.find(key); it != _winners.end()) {
+      if (std::find(candidates.begin(), candidates.end(), it->second) !=
+          candidates.end())
+        return it->second;
+    }
+
+    if (const char *env = std::getenv("BGL_AUTOTUNE");
+        env && std::string_view(env) == "0")
+      return candidates.front();
+
+    const LaunchShape best = tune(kernel, candidates, run);
+    _winners[key] = best;
+    save();
+    return best;
+  }
+
+  /// The stored winner, without tuning.
+  std::optional<LaunchShape> find(const cl::Device &device,
+                                  std::string_view kernel) const {
+    std::lock_guard lock(_mutex);
+    if (auto it = _winners.find(Key(device, kernel)); it != _winners.end())
+      return it->second;
+    return std::nullopt;
+  }
+
+  /// Device and driver go into the key: an update can move the optimum.
+  static std::string Key(const cl::Device &device, std::string_view kernel) {
+    return std::format("{}|{}|{}", device.getInfo<CL_DEVICE_NAME>(),
+                       device.getInfo<CL_DRIVER_VERSION>(), kernel);
+  }
+
+  /**
+   * @brief The driver's choice, then power of two multiples of the kernel's
+   * preferred work-group size multiple up to what it can launch. 2D shapes
+   * are at most 16:1 wide, rows first, since images and buffers are row
+   * major. `defines` are attached to every shape.
+   */
+  static std::vector<LaunchShape> LocalSizes(const cl::Kernel &kernel,
+                                             const cl::Device &device,
+                                             size_t dims,
+                                             std::string_view defines = {}) {
+    const size_t limit =
+        kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    const size_t multiple = std::max<size_t>(
+        kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(
+            device),
+        1);
+    std::vector<size_t> itemLimit =
+        device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    itemLimit.resize(3, limit);
+
+    std::vector<LaunchShape> shapes{{{0, 0, 0}, std::string(defines)}};
+    for (size_t total = multiple; total <= limit; total *= 2) {
+      if (dims == 1) {
+        if (total <= itemLimit[0])
+          shapes.push_back({{total, 1, 1}, std::string(defines)});
+        continue;
+      }
+      for (size_t rows = 1; rows * rows <= total; rows *= 2) {
+        const size_t width = total / rows;
+        if (width * rows != total || width > rows * 16 ||
+            width > itemLimit[0] || rows > itemLimit[1])
+          continue;
+        shapes.push_back({{width, rows, 1}, std::string(defines)});
+      }
+    }
+    return shapes;
+  }
+
+private:
+  static constexpr int kRepeats = 5;
+
+  LaunchShape tune(std::string_view kernel,
+                   std::span<const LaunchShape> candidates, const Run &run) {
+    using Clock = std::chrono::steady_clock;
+
+    std::optional<LaunchShape> best;
+    Clock::duration bestTime = Clock::duration::max();
+    for (const LaunchShape &shape : candidates) {
+      try {
+        // the first run builds variants and warms caches, so it is not timed
+        if (run(shape) != CL_SUCCESS)
+          continue;
+
+        Clock::duration fastest = Clock::duration::max();
+        bool failed = false;
+        for (int i = 0; i < kRepeats && !failed; ++i) {
+          const auto start = Clock::now();
+          failed = run(shape) != CL_SUCCESS;
+          fastest = std::min(fastest, Clock::now() - start);
+        }
+        if (failed)
+          continue;
+
+        spdlog::debug("autotune {}: {}x{}x{} '{}' {:.3f} ms", kernel,
+                      shape.local[0], shape.local[1], shape.local[2],
+                      shape.defines,
+                      std::chrono::duration<double, std::milli>(fastest)
+                          .count());
+        if (fastest < bestTime) {
+          bestTime = fastest;
+          best = shape;
+        }
+      } catch (const std::exception &e) {
+        spdlog::debug("autotune {}: '{}' failed: {}", kernel, shape.defines,
+                      e.what());
+      }
+    }
+
+    if (!best) {
+      throw std::runtime_error(
+          std::format("no launch shape for kernel '{}' ran", kernel));
+    }
+    spdlog::info("autotune {}: {}x{}x{} '{}'", kernel, best->local[0],
+                 best->local[1], best->local[2], best->defines);
+    return *best;
+  }
+
+  // key <TAB> x y z <TAB> defines, one winner per line
+  void load() {
+    std::ifstream in(_file);
+    std::string line;
+    while (std::getline(in, line)) {
+      const size_t keyEnd = line.find('\t');
+      const size_t sizeEnd = line.find('\t', keyEnd + 1);
+      if (line.starts_with('#') || sizeEnd == std::string::npos)
+        continue;
+
+      LaunchShape shape;
+      std::istringstream sizes(line.substr(keyEnd + 1, sizeEnd - keyEnd - 1));
+      if (!(sizes >> shape.local[0] >> shape.local[1] >> shape.local[2]))
+        continue;
+      shape.defines = line.substr(sizeEnd + 1);
+      _winners[line.substr(0, keyEnd)] = std::move(shape);
+    }
+  }
+
+  // written to a temporary first, so a crash never leaves half a file
+  void save() const {
+    std::filesystem::path temp = _file;
+    temp += ".tmp";
+    {
+      std::ofstream out(temp);
+      if (!out) {
+        spdlog::warn("cannot write '{}'", temp.string());
+        return;
+      }
+      out << "# device|driver|kernel\tlocal size\tdefines\n";
+      for (const auto &[key, shape] : _winners) {
+        out << std::format("{}\t{} {} {}\t{}\n", key, shape.local[0],
+                           shape.local[1], shape.local[2], shape.defines);
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, _file, error);
+    if (error) {
+      spdlog::warn("cannot replace '{}': {}", _file.string(),
+                   error.message());
+    }
+  }
+
+  std::filesystem::path _file;
+  mutable std::mutex _mutex;
+  std::unordered_map<std::string, LaunchShape> _winners;
+};
+
+#endif // AUTOTUNER_HPP
@@ -1 +1,45 @@
-// TODO
\ No newline at end of file
+#ifndef BUFFER_HPP
+#define BUFFER_HPP
+
+#include <CL/opencl.hpp>
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief A device buffer for per-frame uploads: it is only reallocated, with
+ * doubled capacity, when the data no longer fits.
+ */
+class GrowableBuffer {
+public:
+  explicit GrowableBuffer(cl_mem_flags flags = CL_MEM_READ_ONLY)
+      : _flags(flags) {}
+
+  cl::Buffer &reserve(cl::Context &context, size_t bytes) {
+    if (bytes > _capacity) {
+      _capacity = std::max(bytes, _capacity * 2);
+      _buffer = cl::Buffer(context, _flags, _capacity);
+    }
+    return _buffer;
+  }
+
+  /// Blocking upload, so `data` may change as soon as this returns.
+  template <typename T>
+  cl::Buffer &write(cl::Context &context, cl::CommandQueue &queue,
+                    const std::vector<T> &data) {
+    const size_t bytes = data.size() * sizeof(T);
+    reserve(context, std::max(bytes, sizeof(T)));
+    if (bytes > 0)
+      queue.enqueueWriteBuffer(_buffer, CL_TRUE, 0, bytes, data.data());
+    return _buffer;
+  }
+
+  cl::Buffer &get() { return _buffer; }
+  size_t capacity() const { return _capacity; }
+
+private:
+  cl_mem_flags _flags;
+  cl::Buffer _buffer;
+  size_t _capacity = 0;
+};
+
+#endif // BUFFER_HPP
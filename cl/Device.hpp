@@ -10,7 +10,7 @@ static bool hasExtension(const cl::Device &dev, const std::string &ext) {
   return exts.find(ext) != std::string::npos;
 }
 
-void printDeviceInfo(const cl::Device &device) {
+inline void printDeviceInfo(const cl::Device &device) {
   std::string name = device.getInfo<CL_DEVICE_NAME>();
   std::string vendor = device.getInfo<CL_DEVICE_VENDOR>();
   std::string version = device.getInfo<CL_DEVICE_VERSION>();
@@ -28,7 +28,7 @@ void printDeviceInfo(const cl::Device &device) {
   spdlog::info("Max Compute Units: {}", maxComputeUnits);
 }; //
 
-void PrintPlatformInfo(const cl::Platform &platform) {
+inline void PrintPlatformInfo(const cl::Platform &platform) {
   std::string pName = platform.getInfo<CL_PLATFORM_NAME>();
   std::string pVer = platform.getInfo<CL_PLATFORM_VERSION>();
   std::string pVendor = platform.getInfo<CL_PLATFORM_VENDOR>();
@@ -41,7 +41,7 @@ void PrintPlatformInfo(const cl::Platform &platform) {
   // spdlog::info(" Extensions: {}", pExtensions);
 } //
 
-cl::Device GetOpenCLDevice() {
+inline cl::Device GetOpenCLDevice() {
   auto device{cl::Device::getDefault()};
   cl::Platform platform{device.getInfo<CL_DEVICE_PLATFORM>()};
   PrintPlatformInfo(platform);
@@ -54,4 +54,31 @@ cl::Device GetOpenCLDevice() {
   return device;
 }
 
+/**
+ * @brief Returns the first device of the platform whose name contains
+ * `platformName` (e.g. "Portable Computing Language" for PoCL), or the default
+ * device if there is no such platform.
+ */
+inline cl::Device FindOpenCLDevice(std::string_view platformName) {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+
+  for (const auto &platform : platforms) {
+    if (platform.getInfo<CL_PLATFORM_NAME>().find(platformName) ==
+        std::string::npos)
+      continue;
+
+    std::vector<cl::Device> devices;
+    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    if (!devices.empty()) {
+      PrintPlatformInfo(platform);
+      return devices.front();
+    }
+  }
+
+  spdlog::warn("no OpenCL platform matching '{}', using default device",
+               platformName);
+  return cl::Device::getDefault();
+}
+
 #endif // DEVICE_HPP-
\ No newline at end of file
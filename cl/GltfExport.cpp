@@ -0,0 +1,440 @@
+#include "GltfExport.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "Image.hpp"
+#include "TerrainNormals.hpp"
+#include "trace/trace.hpp"
+
+static_assert(std::endian::native == std::endian::little,
+              "glTF buffers are little endian");
+
+namespace {
+
+// glTF enums
+constexpr int kByte = 5120;
+constexpr int kUnsignedShort = 5123;
+constexpr int kUnsignedInt = 5125;
+constexpr int kFloat = 5126;
+constexpr int kArrayBuffer = 34962;
+constexpr int kElementArrayBuffer = 34963;
+
+constexpr uint32_t kGlbMagic = 0x46546C67; // "glTF"
+constexpr uint32_t kGlbJson = 0x4E4F534A;  // "JSON"
+constexpr uint32_t kGlbBin = 0x004E4942;   // "BIN\0"
+
+size_t Align4(size_t bytes) { return (bytes + 3) & ~size_t{3}; }
+
+/// Interleaved vertex: position, normal, texture coordinate. Quantized
+/// attributes are padded to 4 bytes as glTF requires.
+struct VertexFormat {
+  size_t stride;
+  size_t normalOffset;
+  size_t texCoordOffset;
+};
+
+constexpr VertexFormat kFloatVertex{32, 12, 24};
+constexpr VertexFormat kQuantizedVertex{16, 8, 12};
+
+struct Chunk {
+  size_t x = 0, y = 0;         // texel of the first vertex
+  size_t quadsX = 0, quadsY = 0;
+  float minHeight = 0.0f;      // world units
+  float maxHeight = 0.0f;
+  size_t vertexOffset = 0;     // bytes into the buffer
+  size_t indexOffset = 0;
+  size_t indexSize = 2;
+
+  size_t vertices() const { return (quadsX + 1) * (quadsY + 1); }
+  size_t indices() const { return 6 * quadsX * quadsY; }
+};
+
+class TerrainWriter {
+public:
+  TerrainWriter(const HeightField &field, const GltfExportOptions &options)
+      : _field(field), _options(options),
+        _format(options.quantize ? kQuantizedVertex : kFloatVertex) {
+    const size_t quadsX = field.width - 1;
+    const size_t quadsY = field.height - 1;
+    const size_t side = options.chunkSize
+                            ? options.chunkSize
+                            : std::max(quadsX, quadsY);
+
+    for (size_t y = 0; y < quadsY; y += side) {
+      for (size_t x = 0; x < quadsX; x += side) {
+        Chunk chunk;
+        chunk.x = x;
+        chunk.y = y;
+        chunk.quadsX = std::min(side, quadsX - x);
+        chunk.quadsY = std::min(side, quadsY - y);
+        chunk.indexSize = chunk.vertices() > 65535 ? 4 : 2;
+
+        // bounds up front: the JSON, which GLB puts first, needs them
+        chunk.minHeight = std::numeric_limits<float>::max();
+        chunk.maxHeight = std::numeric_limits<float>::lowest();
+        for (size_t j = y; j <= y + chunk.quadsY; ++j) {
+          for (size_t i = x; i <= x + chunk.quadsX; ++i) {
+            const float h = worldHeight(i, j);
+            chunk.minHeight = std::min(chunk.minHeight, h);
+            chunk.maxHeight = std::max(chunk.maxHeight, h);
+          }
+        }
+
+        chunk.vertexOffset = _bytes;
+        _bytes += chunk.vertices() * _format.stride;
+        chunk.indexOffset = _bytes;
+        _bytes += Align4(chunk.indices() * chunk.indexSize);
+        _chunks.push_back(chunk);
+      }
+    }
+  }
+
+  size_t bufferBytes() const { return _bytes; }
+
+  /// The document; `uri` names the external buffer, empty for GLB.
+  std::string json(const std::string &uri) const {
+    std::string out;
+    const auto put = [&out]<typename... Args>(
+                         std::format_string<Args...> format, Args &&...args) {
+      std::format_to(std::back_inserter(out), format,
+                     std::forward<Args>(args)...);
+    };
+
+    put("{{\"asset\":{{\"version\":\"2.0\",\"generator\":\"bgl terrain\"}},");
+    if (_options.quantize) {
+      put("\"extensionsUsed\":[\"KHR_mesh_quantization\"],"
+          "\"extensionsRequired\":[\"KHR_mesh_quantization\"],");
+    }
+    put("\"scene\":0,\"scenes\":[{{\"nodes\":[0]}}],");
+
+    put("\"nodes\":[{{\"name\":\"terrain\",\"children\":[");
+    for (size_t c = 0; c < _chunks.size(); ++c)
+      put("{}{}", c ? "," : "", c + 1);
+    put("]}}");
+    for (size_t c = 0; c < _chunks.size(); ++c) {
+      const Chunk &chunk = _chunks[c];
+      put(",{{\"name\":\"chunk_{}_{}\",\"mesh\":{}", chunk.x, chunk.y, c);
+      if (_options.quantize) {
+        const Dequantize d = dequantize(chunk);
+        put(",\"translation\":[{},{},{}],\"scale\":[{},{},{}]",
+            d.translation[0], d.translation[1], d.translation[2], d.scale[0],
+            d.scale[1], d.scale[2]);
+      }
+      put("}}");
+    }
+    put("],");
+
+    put("\"meshes\":[");
+    for (size_t c = 0; c < _chunks.size(); ++c) {
+      const size_t a = c * 4; // accessors of the chunk
+      put("{}{{\"primitives\":[{{\"attributes\":{{\"POSITION\":{},"
+          "\"NORMAL\":{},\"TEXCOORD_0\":{}}},\"indices\":{},\"mode\":4}}]}}",
+          c ? "," : "", a, a + 1, a + 2, a + 3);
+    }
+    put("],");
+
+    put("\"buffers\":[{{\"byteLength\":{}", _bytes);
+    if (!uri.empty())
+      put(",\"uri\":\"{}\"", uri);
+    put("}}],");
+
+    // two views per chunk: interleaved vertices, then indices
+    put("\"bufferViews\":[");
+    for (size_t c = 0; c < _chunks.size(); ++c) {
+      const Chunk &chunk = _chunks[c];
+      put("{}{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},"
+          "\"byteStride\":{},\"target\":{}}},",
+          c ? "," : "", chunk.vertexOffset,
+          chunk.vertices() * _format.stride, _format.stride, kArrayBuffer);
+      put("{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},"
+          "\"target\":{}}}",
+          chunk.indexOffset, chunk.indices() * chunk.indexSize,
+          kElementArrayBuffer);
+    }
+    put("],");
+
+    put("\"accessors\":[");
+    for (size_t c = 0; c < _chunks.size(); ++c) {
+      const Chunk &chunk = _chunks[c];
+      const size_t view = c * 2;
+      const size_t count = chunk.vertices();
+      if (_options.quantize) {
+        // quantized to the chunk's box, so the bounds are the full range
+        const unsigned top = chunk.maxHeight > chunk.minHeight ? 65535 : 0;
+        put("{}{{\"bufferView\":{},\"byteOffset\":0,\"componentType\":{},"
+            "\"count\":{},\"type\":\"VEC3\",\"min\":[0,0,0],"
+            "\"max\":[65535,{},65535]}},",
+            c ? "," : "", view, kUnsignedShort, count, top);
+        put("{{\"bufferView\":{},\"byteOffset\":{},\"componentType\":{},"
+            "\"normalized\":true,\"count\":{},\"type\":\"VEC3\"}},",
+            view, _format.normalOffset, kByte, count);
+        put("{{\"bufferView\":{},\"byteOffset\":{},\"componentType\":{},"
+            "\"normalized\":true,\"count\":{},\"type\":\"VEC2\"}},",
+            view, _format.texCoordOffset, kUnsignedShort, count);
+      } else {
+        put("{}{{\"bufferView\":{},\"byteOffset\":0,\"componentType\":{},"
+            "\"count\":{},\"type\":\"VEC3\",\"min\":[{},{},{}],"
+            "\"max\":[{},{},{}]}},",
+            c ? "," : "", view, kFloat, count, world(chunk.x),
+            chunk.minHeight, world(chunk.y), world(chunk.x + chunk.quadsX),
+            chunk.maxHeight, world(chunk.y + chunk.quadsY));
+        put("{{\"bufferView\":{},\"byteOffset\":{},\"componentType\":{},"
+            "\"count\":{},\"type\":\"VEC3\"}},",
+            view, _format.normalOffset, kFloat, count);
+        put("{{\"bufferView\":{},\"byteOffset\":{},\"componentType\":{},"
+            "\"count\":{},\"type\":\"VEC2\"}},",
+            view, _format.texCoordOffset, kFloat, count);
+      }
+      put("{{\"bufferView\":{},\"byteOffset\":0,\"componentType\":{},"
+          "\"count\":{},\"type\":\"SCALAR\"}}",
+          view + 1, chunk.indexSize == 4 ? kUnsignedInt : kUnsignedShort,
+          chunk.indices());
+    }
+    put("]}}");
+    return out;
+  }
+
+  /// Streams the buffer, one chunk's vertices and indices at a time.
+  void writeBuffer(std::ostream &out) const {
+    std::vector<uint8_t> bytes;
+    for (const Chunk &chunk : _chunks) {
+      TRACE_SCOPE("gltf/chunk");
+      bytes.assign(chunk.vertices() * _format.stride, 0);
+      writeVertices(chunk, bytes.data());
+      out.write((const char *)bytes.data(), (std::streamsize)bytes.size());
+
+      bytes.assign(Align4(chunk.indices() * chunk.indexSize), 0);
+      writeIndices(chunk, bytes.data());
+      out.write((const char *)bytes.data(), (std::streamsize)bytes.size());
+    }
+  }
+
+private:
+  struct Dequantize {
+    float translation[3];
+    float scale[3];
+  };
+
+  /// Horizontal position of a texel column or row.
+  float world(size_t texel) const {
+    return (float)texel * _options.cellSize;
+  }
+
+  float worldHeight(size_t x, size_t y) const {
+    return _field.heights[y * _field.width + x] * _options.heightScale;
+  }
+
+  // positions are stored as 0..65535 across the chunk's box
+  Dequantize dequantize(const Chunk &chunk) const {
+    const float range = chunk.maxHeight - chunk.minHeight;
+    return {{world(chunk.x), chunk.minHeight, world(chunk.y)},
+            {(float)chunk.quadsX * _options.cellSize / 65535.0f,
+             range > 0.0f ? range / 65535.0f : 1.0f,
+             (float)chunk.quadsY * _options.cellSize / 65535.0f}};
+  }
+
+  /// Sobel normal in world space, y up.
+  glm::vec3 normal(size_t x, size_t y) const {
+    const auto at = [&](long i, long j) {
+      i = std::clamp<long>(i, 0, (long)_field.width - 1);
+      j = std::clamp<long>(j, 0, (long)_field.height - 1);
+      return worldHeight((size_t)i, (size_t)j);
+    };
+    float h[9];
+    for (int i = 0; i < 9; ++i)
+      h[i] = at((long)x + i % 3 - 1, (long)y + i / 3 - 1);
+    const glm::vec3 n = SobelNormal(h, glm::vec2(1.0f / _options.cellSize));
+    return {n.x, n.z, n.y};
+  }
+
+  void writeVertices(const Chunk &chunk, uint8_t *out) const {
+    const auto unorm16 = [](float v) {
+      return (uint16_t)std::lrint(std::clamp(v, 0.0f, 1.0f) * 65535.0f);
+    };
+    const auto snorm8 = [](float v) {
+      return (int8_t)std::lrint(std::clamp(v, -1.0f, 1.0f) * 127.0f);
+    };
+
+    // the node's non-uniform scale transforms normals by its inverse, so
+    // quantized ones are stored pre-multiplied by it
+    const Dequantize node = dequantize(chunk);
+    const glm::vec3 nodeScale(node.scale[0], node.scale[1], node.scale[2]);
+
+    const float range = chunk.maxHeight - chunk.minHeight;
+    for (size_t j = 0; j <= chunk.quadsY; ++j) {
+      for (size_t i = 0; i <= chunk.quadsX; ++i, out += _format.stride) {
+        const size_t x = chunk.x + i;
+        const size_t y = chunk.y + j;
+        const float height = worldHeight(x, y);
+        const glm::vec3 n = normal(x, y);
+        const glm::vec2 uv((float)x / (float)(_field.width - 1),
+                           (float)y / (float)(_field.height - 1));
+
+        if (_options.quantize) {
+          const uint16_t position[3] = {
+              unorm16((float)i / (float)chunk.quadsX),
+              range > 0.0f ? unorm16((height - chunk.minHeight) / range)
+                           : uint16_t{0},
+              unorm16((float)j / (float)chunk.quadsY)};
+          const glm::vec3 local = glm::normalize(n * nodeScale);
+          const int8_t normal[3] = {snorm8(local.x), snorm8(local.y),
+                                    snorm8(local.z)};
+          const uint16_t texCoord[2] = {unorm16(uv.x), unorm16(uv.y)};
+          std::memcpy(out, position, sizeof(position));
+          std::memcpy(out + _format.normalOffset, normal, sizeof(normal));
+          std::memcpy(out + _format.texCoordOffset, texCoord,
+                      sizeof(texCoord));
+        } else {
+          const float position[3] = {world(x), height, world(y)};
+          const float normal[3] = {n.x, n.y, n.z};
+          const float texCoord[2] = {uv.x, uv.y};
+          std::memcpy(out, position, sizeof(position));
+          std::memcpy(out + _format.normalOffset, normal, sizeof(normal));
+          std::memcpy(out + _format.texCoordOffset, texCoord,
+                      sizeof(texCoord));
+        }
+      }
+    }
+  }
+
+  // counter-clockwise seen from above
+  void writeIndices(const Chunk &chunk, uint8_t *out) const {
+    const size_t row = chunk.quadsX + 1;
+    const auto put = [&](size_t index) {
+      if (chunk.indexSize == 4) {
+        const uint32_t value = (uint32_t)index;
+        std::memcpy(out, &value, 4);
+      } else {
+        const uint16_t value = (uint16_t)index;
+        std::memcpy(out, &value, 2);
+      }
+      out += chunk.indexSize;
+    };
+
+    for (size_t j = 0; j < chunk.quadsY; ++j) {
+      for (size_t i = 0; i < chunk.quadsX; ++i) {
+        const size_t a = j * row + i, b = a + 1;
+        const size_t c = a + row, d = c + 1;
+        put(a);
+        put(c);
+        put(b);
+        put(b);
+        put(c);
+        put(d);
+      }
+    }
+  }
+
+  const HeightField &_field;
+  const GltfExportOptions &_options;
+  VertexFormat _format;
+  std::vector<Chunk> _chunks;
+  size_t _bytes = 0;
+};
+
+void WriteU32(std::ostream &out, uint32_t value) {
+  out.write((const char *)&value, sizeof(value));
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+std::vector<float> HeightsFromRgba(std::span<const uint8_t> rgba, size_t width,
+                                   size_t height) {
+  if (rgba.size() < width * height * 4) {
+    throw std::invalid_argument(
+        std::format("{} bytes are no {}x{} RGBA image", rgba.size(), width,
+                    height));
+  }
+  std::vector<float> heights(width * height);
+  for (size_t i = 0; i < heights.size(); ++i)
+    heights[i] = rgba[i * 4] / 255.0f;
+  return heights;
+}
+
+void ExportTerrainGltf(const std::filesystem::path &path,
+                       const HeightField &field,
+                       const GltfExportOptions &options) {
+  TRACE_SCOPE("gltf/export");
+  if (field.width < 2 || field.height < 2 ||
+      field.heights.size() < field.width * field.height) {
+    throw std::invalid_argument(
+        std::format("cannot export a {}x{} height field of {} samples",
+                    field.width, field.height, field.heights.size()));
+  }
+  if (!(options.cellSize > 0.0f)) {
+    throw std::invalid_argument(
+        std::format("invalid cell size {}", options.cellSize));
+  }
+
+  const TerrainWriter writer(field, options);
+  const bool binary = path.extension() == ".glb";
+
+  if (binary) {
+    std::string json = writer.json({});
+    json.resize(Align4(json.size()), ' ');
+    const size_t total = 12 + 8 + json.size() + 8 + writer.bufferBytes();
+    if (total > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error(
+          std::format("{} bytes do not fit a GLB, write .gltf instead",
+                      total));
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+      throw std::runtime_error("Failed to write: " + path.string());
+    WriteU32(out, kGlbMagic);
+    WriteU32(out, 2);
+    WriteU32(out, (uint32_t)total);
+    WriteU32(out, (uint32_t)json.size());
+    WriteU32(out, kGlbJson);
+    out.write(json.data(), (std::streamsize)json.size());
+    WriteU32(out, (uint32_t)writer.bufferBytes());
+    WriteU32(out, kGlbBin);
+    writer.writeBuffer(out);
+    if (!out)
+      throw std::runtime_error("Failed to write: " + path.string());
+  } else {
+    auto binPath = path;
+    binPath.replace_extension(".bin");
+    {
+      std::ofstream bin(binPath, std::ios::binary);
+      if (!bin)
+        throw std::runtime_error("Failed to write: " + binPath.string());
+      writer.writeBuffer(bin);
+      if (!bin)
+        throw std::runtime_error("Failed to write: " + binPath.string());
+    }
+
+    std::ofstream out(path);
+    if (!out)
+      throw std::runtime_error("Failed to write: " + path.string());
+    out << writer.json(binPath.filename().string());
+  }
+
+  spdlog::info("exported {}x{} terrain to '{}' ({} KB of vertex data{})",
+               field.width, field.height, path.string(),
+               writer.bufferBytes() / 1024,
+               options.quantize ? ", quantized" : "");
+}
+
+void ExportHeightmapGltf(const std::filesystem::path &heightmap,
+                         const std::filesystem::path &path,
+                         const GltfExportOptions &options) {
+  const Image image(heightmap);
+  const auto heights = HeightsFromRgba(image.pixels, image.width,
+                                       image.height);
+  ExportTerrainGltf(path, {heights, image.width, image.height}, options);
+}
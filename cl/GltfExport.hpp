@@ -0,0 +1,40 @@
+#ifndef GLTF_EXPORT_HPP
+#define GLTF_EXPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include "Terrain.hpp"
+
+/// Red channel of an RGBA8 image, as the kernels read the heightmap.
+std::vector<float> HeightsFromRgba(std::span<const uint8_t> rgba, size_t width,
+                                   size_t height);
+
+struct GltfExportOptions {
+  bool quantize = false;    // KHR_mesh_quantization: 16 bit positions and
+                            // texture coordinates, 8 bit normals
+  unsigned chunkSize = 0;   // quads per chunk side, 0 = a single mesh
+  float cellSize = 1.0f;    // world units between texels
+  float heightScale = 1.0f; // world units for height 1
+};
+
+/**
+ * @brief Writes the terrain of `field` as glTF 2.0, GLB when `path` ends in
+ * .glb, else a .gltf with a .bin next to it. Every chunk becomes its own
+ * mesh and node, y up; with `quantize` the node carries the dequantizing
+ * transform. Vertex data is generated and written one chunk at a time, so
+ * memory stays at one chunk however large the terrain is.
+ */
+void ExportTerrainGltf(const std::filesystem::path &path,
+                       const HeightField &field,
+                       const GltfExportOptions &options = {});
+
+/// ExportTerrainGltf() for a heightmap image such as assets/heightmap.png.
+void ExportHeightmapGltf(const std::filesystem::path &heightmap,
+                         const std::filesystem::path &path,
+                         const GltfExportOptions &options = {});
+
+#endif // GLTF_EXPORT_HPP
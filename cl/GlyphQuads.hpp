@@ -0,0 +1,96 @@
+#ifndef GLYPH_QUADS_HPP
+#define GLYPH_QUADS_HPP
+
+#include <CL/opencl.hpp>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include "Buffer.hpp"
+#include "Program.hpp"
+#include "font/quads.hpp"
+
+/**
+ * @brief Device side of BuildGlyphQuads(): the flattened batch is uploaded
+ * and glyph_quads.cl writes one GlyphQuad per glyph, so the result can stay
+ * on the device as an instance buffer. Buffers only ever grow.
+ */
+class GlyphQuadBuilder {
+public:
+  /// Mirror of `struct Label` in glyph_quads.cl.
+  struct DeviceLabel {
+    cl_float2 origin;
+    cl_float scale;
+    cl_uint color;
+  };
+  static_assert(sizeof(DeviceLabel) == 16);
+
+  GlyphQuadBuilder(cl::Context &context, cl::Device &device,
+                   cl::CommandQueue &queue,
+                   const std::filesystem::path &assetsDir)
+      : _context(context), _queue(queue) {
+    Program program(context);
+    _kernel = cl::Kernel(program.build(device, assetsDir / "glyph_quads.cl"),
+                         "build_glyph_quads");
+  }
+
+  /// Uploads the entry table; call again whenever the atlas changed.
+  void uploadAtlas(const GlyphAtlas &atlas) {
+    _entries.write(_context, _queue, atlas.entries());
+  }
+
+  /**
+   * @brief Enqueues the kernel for `batch` and returns the quad buffer, valid
+   * for `batch.size()` quads once the queue reaches it. Uploads are blocking,
+   * so `batch` and `labels` may change as soon as this returns.
+   */
+  const cl::Buffer &build(const GlyphBatch &batch,
+                          std::span<const Label> labels) {
+    if (batch.size() == 0)
+      return _quads.get();
+
+    _labels.resize(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i) {
+      _labels[i] = {{{labels[i].origin.x, labels[i].origin.y}},
+                    labels[i].scale,
+                    labels[i].color};
+    }
+
+    const auto count = (cl_uint)batch.size();
+    _kernel.setArg(0, _x.write(_context, _queue, batch.x));
+    _kernel.setArg(1, _y.write(_context, _queue, batch.y));
+    _kernel.setArg(2, _entry.write(_context, _queue, batch.entry));
+    _kernel.setArg(3, _label.write(_context, _queue, batch.label));
+    _kernel.setArg(4, _labelTable.write(_context, _queue, _labels));
+    _kernel.setArg(5, _entries.get());
+    _kernel.setArg(6, _quads.reserve(_context, count * sizeof(GlyphQuad)));
+    _kernel.setArg(7, count);
+
+    constexpr size_t kGroup = 64;
+    _queue.enqueueNDRangeKernel(_kernel, cl::NullRange,
+                                cl::NDRange((count + kGroup - 1) / kGroup *
+                                            kGroup),
+                                cl::NDRange(kGroup));
+    return _quads.get();
+  }
+
+  /// Blocking read of the last build() result.
+  void read(size_t count, std::vector<GlyphQuad> &out) {
+    out.resize(count);
+    if (count > 0) {
+      _queue.enqueueReadBuffer(_quads.get(), CL_TRUE, 0,
+                               count * sizeof(GlyphQuad), out.data());
+    }
+  }
+
+private:
+  cl::Context &_context;
+  cl::CommandQueue &_queue;
+  cl::Kernel _kernel;
+
+  std::vector<DeviceLabel> _labels;
+  GrowableBuffer _x, _y, _entry, _label, _labelTable, _entries;
+  GrowableBuffer _quads{CL_MEM_READ_WRITE};
+};
+
+#endif // GLYPH_QUADS_HPP
@@ -0,0 +1,344 @@
+#ifndef HEIGHT_PYRAMID_HPP
+#define HEIGHT_PYRAMID_HPP
+
+#include <CL/opencl.hpp>
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Buffer.hpp"
+#include "Program.hpp"
+#include "Terrain.hpp"
+
+/// One cell of height_pyramid.cl's float4 levels.
+struct HeightBounds {
+  cl_float min;
+  cl_float max;
+  cl_float error; // from drawing the cell as one patch over its corners
+  cl_float padding;
+};
+static_assert(sizeof(HeightBounds) == 16);
+
+/**
+ * @brief Shape of a height pyramid: level 0 has one cell per `leaf` x `leaf`
+ * quads, each level above halves both sides, and the top has one cell.
+ * Levels are stored one after the other.
+ */
+struct HeightPyramidLayout {
+  glm::uvec2 leafCells{1};
+  unsigned leaf = 16;
+  std::vector<size_t> offsets; // cell index of each level's first cell
+  size_t cells = 0;            // all levels
+
+  HeightPyramidLayout() = default;
+  HeightPyramidLayout(size_t width, size_t height, unsigned leafSize)
+      : leaf(leafSize) {
+    if (leaf == 0 || !std::has_single_bit(leaf)) {
+      throw std::invalid_argument(
+          std::format("leaf size {} is no power of two", leaf));
+    }
+    leafCells = glm::uvec2(
+        std::max<size_t>((std::max<size_t>(width, 1) - 1 + leaf - 1) / leaf,
+                         1),
+        std::max<size_t>((std::max<size_t>(height, 1) - 1 + leaf - 1) / leaf,
+                         1));
+    const unsigned top = std::bit_width(
+        std::bit_ceil(std::max(leafCells.x, leafCells.y)) - 1);
+    for (unsigned level = 0; level <= top; ++level) {
+      offsets.push_back(cells);
+      const glm::uvec2 size = this->size(level);
+      cells += (size_t)size.x * size.y;
+    }
+  }
+
+  unsigned levels() const { return (unsigned)offsets.size(); }
+  unsigned top() const { return levels() - 1; }
+
+  glm::uvec2 size(unsigned level) const {
+    return (leafCells + (1u << level) - 1u) >> level;
+  }
+
+  /// Nodes of the complete quadtree with one leaf per level 0 cell.
+  size_t nodes() const { return ((size_t(1) << (2 * levels())) - 1) / 3; }
+};
+
+/* ------------------------------------------------------------------------- */
+/* CPU reference, mirroring height_pyramid.cl                                */
+
+namespace detail {
+
+// struct Patch and patch_deviation in height_pyramid.cl
+struct HeightPatch {
+  long x0, y0, x1, y1;
+  float h00, h10, h01, h11;
+
+  static float lerp(float a, float b, float t) { return a + (b - a) * t; }
+
+  float deviation(float h, long x, long y) const {
+    const float tx = x1 > x0 ? (float)(x - x0) / (float)(x1 - x0) : 0.0f;
+    const float ty = y1 > y0 ? (float)(y - y0) / (float)(y1 - y0) : 0.0f;
+    const float top = lerp(h00, h10, tx);
+    const float bottom = lerp(h01, h11, tx);
+    return std::fabs(h - lerp(top, bottom, ty));
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief The pyramid height_pyramid.cl builds for `field`, for validating the
+ * kernels. Slow on purpose: level 0 is computed directly, every level above
+ * from its children.
+ */
+inline std::vector<HeightBounds>
+ReferenceHeightPyramid(const HeightField &field,
+                       const HeightPyramidLayout &layout) {
+  const auto at = [&](long x, long y) {
+    return field.at(std::clamp<long>(x, 0, (long)field.width - 1),
+                    std::clamp<long>(y, 0, (long)field.height - 1));
+  };
+  const auto patch = [&](long cx, long cy, long span) {
+    detail::HeightPatch p;
+    p.x0 = cx * span;
+    p.y0 = cy * span;
+    p.x1 = std::min(p.x0 + span, (long)field.width - 1);
+    p.y1 = std::min(p.y0 + span, (long)field.height - 1);
+    p.h00 = at(p.x0, p.y0);
+    p.h10 = at(p.x1, p.y0);
+    p.h01 = at(p.x0, p.y1);
+    p.h11 = at(p.x1, p.y1);
+    return p;
+  };
+
+  std::vector<HeightBounds> out(layout.cells);
+  const glm::uvec2 leafCells = layout.size(0);
+  for (long cy = 0; cy < leafCells.y; ++cy) {
+    for (long cx = 0; cx < leafCells.x; ++cx) {
+      const detail::HeightPatch p = patch(cx, cy, layout.leaf);
+      HeightBounds b{FLT_MAX, -FLT_MAX, 0.0f, 0.0f};
+      for (long y = p.y0; y <= p.y1; ++y) {
+        for (long x = p.x0; x <= p.x1; ++x) {
+          const float h = at(x, y);
+          b.min = std::fmin(b.min, h);
+          b.max = std::fmax(b.max, h);
+          b.error = std::fmax(b.error, p.deviation(h, x, y));
+        }
+      }
+      out[cy * leafCells.x + cx] = b;
+    }
+  }
+
+  for (unsigned level = 1; level < layout.levels(); ++level) {
+    const glm::uvec2 cells = layout.size(level);
+    const glm::uvec2 childCells = layout.size(level - 1);
+    const HeightBounds *children = out.data() + layout.offsets[level - 1];
+    const long span = (long)layout.leaf << level;
+    for (long cy = 0; cy < cells.y; ++cy) {
+      for (long cx = 0; cx < cells.x; ++cx) {
+        HeightBounds b{FLT_MAX, -FLT_MAX, 0.0f, 0.0f};
+        for (long j = 0; j < 2; ++j) {
+          for (long i = 0; i < 2; ++i) {
+            const long x = cx * 2 + i, y = cy * 2 + j;
+            if (x >= childCells.x || y >= childCells.y)
+              continue;
+            const HeightBounds &c = children[y * childCells.x + x];
+            b.min = std::fmin(b.min, c.min);
+            b.max = std::fmax(b.max, c.max);
+            b.error = std::fmax(b.error, c.error);
+          }
+        }
+
+        const detail::HeightPatch p = patch(cx, cy, span);
+        const long xs[3] = {p.x0, std::min(p.x0 + span / 2, p.x1), p.x1};
+        const long ys[3] = {p.y0, std::min(p.y0 + span / 2, p.y1), p.y1};
+        float deviation = 0.0f;
+        for (long y : ys) {
+          for (long x : xs)
+            deviation = std::fmax(deviation, p.deviation(at(x, y), x, y));
+        }
+        b.error += deviation;
+        out[layout.offsets[level] + cy * cells.x + cx] = b;
+      }
+    }
+  }
+  return out;
+}
+
+/// What fill_node_boxes writes into a Node besides its child links.
+struct HeightNodeBox {
+  glm::vec3 min;
+  glm::vec3 max;
+  bool inner; // children at 4i + 1 .. 4i + 4
+};
+
+/**
+ * @brief The box fill_node_boxes gives node `index` of the breadth-first
+ * quadtree over `pyramid`, for an `imageSize` heightmap.
+ */
+inline HeightNodeBox ReferenceNodeBox(const std::vector<HeightBounds> &pyramid,
+                                      const HeightPyramidLayout &layout,
+                                      glm::uvec2 imageSize, size_t index) {
+  unsigned depth = 0;
+  size_t first = 0, count = 1;
+  while (index >= first + count) {
+    first += count;
+    count *= 4;
+    ++depth;
+  }
+
+  // Morton code of the path from the root
+  glm::uvec2 cell{0};
+  size_t code = index - first;
+  for (unsigned bit = 0; code; ++bit, code >>= 2) {
+    cell.x |= (unsigned)(code & 1) << bit;
+    cell.y |= (unsigned)((code >> 1) & 1) << bit;
+  }
+
+  const unsigned level = layout.top() - depth;
+  const glm::uvec2 cells = layout.size(level);
+  HeightNodeBox box{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX),
+                    depth < layout.top()};
+  if (cell.x < cells.x && cell.y < cells.y) {
+    const HeightBounds &b =
+        pyramid[layout.offsets[level] + cell.y * cells.x + cell.x];
+    const unsigned span = layout.leaf << level;
+    const glm::uvec2 lo = cell * span;
+    const glm::uvec2 hi = glm::min(lo + span, imageSize - 1u);
+    box.min = glm::vec3(glm::vec2(lo) / glm::vec2(imageSize), b.min);
+    box.max = glm::vec3(glm::vec2(hi) / glm::vec2(imageSize), b.max);
+  }
+  return box;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Builds the pyramid of a heightmap image on the device in one
+ * dispatch per level, and fills quadtree Node boxes (AABB.h) from it, so
+ * culling gets tight bounds without the heights ever reaching the host.
+ */
+class HeightPyramid {
+public:
+  HeightPyramid(cl::Context &context, cl::Device &device,
+                cl::CommandQueue &queue,
+                const std::filesystem::path &assetsDir, unsigned leaf = 16)
+      : _context(context), _queue(queue), _leaf(leaf) {
+    Program program(context);
+    const cl::Program built =
+        program.build(device, assetsDir / "height_pyramid.cl");
+    _leafKernel = cl::Kernel(built, "height_bounds_leaf");
+    _reduce = cl::Kernel(built, "height_bounds_reduce");
+    _fill = cl::Kernel(built, "fill_node_boxes");
+  }
+
+  /// Enqueues all levels for `heightmap`; not waited for.
+  void build(const cl::Image2D &heightmap) {
+    _imageSize = glm::uvec2(heightmap.getImageInfo<CL_IMAGE_WIDTH>(),
+                            heightmap.getImageInfo<CL_IMAGE_HEIGHT>());
+    HeightPyramidLayout layout(_imageSize.x, _imageSize.y, _leaf);
+
+    const size_t bytes = layout.cells * sizeof(HeightBounds);
+    if (_bytes < bytes) {
+      _pyramid = cl::Buffer(_context, CL_MEM_READ_WRITE, bytes);
+      _bytes = bytes;
+    }
+    // only uploaded when the heightmap size changed
+    if (layout.offsets != _layout.offsets) {
+      _offsets.write(_context, _queue,
+                     std::vector<cl_uint>(layout.offsets.begin(),
+                                          layout.offsets.end()));
+    }
+    _layout = std::move(layout);
+
+    const glm::uvec2 leafCells = _layout.size(0);
+    _leafKernel.setArg(0, heightmap);
+    _leafKernel.setArg(1, _pyramid);
+    _leafKernel.setArg(2, cl_uint2{{leafCells.x, leafCells.y}});
+    _leafKernel.setArg(3, (cl_int)_leaf);
+    enqueue(_leafKernel, leafCells);
+
+    // one buffer at level offsets rather than sub-buffers, whose origins
+    // would have to meet CL_DEVICE_MEM_BASE_ADDR_ALIGN
+    _reduce.setArg(0, heightmap);
+    _reduce.setArg(1, _pyramid);
+    for (unsigned l = 1; l < _layout.levels(); ++l) {
+      const glm::uvec2 cells = _layout.size(l);
+      const glm::uvec2 childCells = _layout.size(l - 1);
+      _reduce.setArg(2, (cl_uint)_layout.offsets[l - 1]);
+      _reduce.setArg(3, cl_uint2{{childCells.x, childCells.y}});
+      _reduce.setArg(4, (cl_uint)_layout.offsets[l]);
+      _reduce.setArg(5, cl_uint2{{cells.x, cells.y}});
+      _reduce.setArg(6, (cl_int)(_leaf << l));
+      enqueue(_reduce, cells);
+    }
+  }
+
+  /**
+   * @brief Enqueues filling the boxes and child links of `count` nodes of
+   * `nodes`, a complete quadtree stored breadth first. layout().nodes() of
+   * them cover the pyramid down to level 0; nodes past those are left alone.
+   */
+  void fillNodes(cl::Buffer &nodes, size_t count) {
+    count = std::min(count, _layout.nodes());
+    const glm::uvec2 leafCells = _layout.size(0);
+    _fill.setArg(0, _pyramid);
+    _fill.setArg(1, _offsets.get());
+    _fill.setArg(2, cl_uint2{{leafCells.x, leafCells.y}});
+    _fill.setArg(3, (cl_uint)_layout.top());
+    _fill.setArg(4, (cl_int)_leaf);
+    _fill.setArg(5, cl_uint2{{_imageSize.x, _imageSize.y}});
+    _fill.setArg(6, nodes);
+    _fill.setArg(7, (cl_uint)count);
+    const cl_int status = _queue.enqueueNDRangeKernel(
+        _fill, cl::NullRange, cl::NDRange((count + 63) / 64 * 64));
+    check(status);
+  }
+
+  const HeightPyramidLayout &layout() const { return _layout; }
+  cl::Buffer &buffer() { return _pyramid; }
+
+  /// Reads every level back, blocking.
+  std::vector<HeightBounds> read() {
+    std::vector<HeightBounds> out(_layout.cells);
+    _queue.enqueueReadBuffer(_pyramid, CL_TRUE, 0,
+                             out.size() * sizeof(HeightBounds), out.data());
+    return out;
+  }
+
+private:
+  void enqueue(const cl::Kernel &kernel, glm::uvec2 cells) {
+    constexpr size_t kGroup = 8;
+    check(_queue.enqueueNDRangeKernel(
+        kernel, cl::NullRange,
+        cl::NDRange((cells.x + kGroup - 1) / kGroup * kGroup,
+                    (cells.y + kGroup - 1) / kGroup * kGroup),
+        cl::NDRange(kGroup, kGroup)));
+  }
+
+  static void check(cl_int status) {
+    if (status != CL_SUCCESS) {
+      throw std::runtime_error(
+          std::format("height pyramid kernel failed to enqueue ({})", status));
+    }
+  }
+
+  cl::Context &_context;
+  cl::CommandQueue &_queue;
+  unsigned _leaf;
+  cl::Kernel _leafKernel, _reduce, _fill;
+  glm::uvec2 _imageSize{0};
+  HeightPyramidLayout _layout;
+  cl::Buffer _pyramid;
+  GrowableBuffer _offsets;
+  size_t _bytes = 0;
+};
+
+#endif // HEIGHT_PYRAMID_HPP
@@ -1,6 +1,7 @@
 #ifndef IMAGELOADER_HPP
 #define IMAGELOADER_HPP
 
+#include <spanstream>
 #include <vector>
 
 #include <CL/opencl.hpp>
@@ -12,14 +13,22 @@
 #include <filesystem>
 #include <spdlog/spdlog.h>
 
+#include "AssetBundle.hpp"
+
 struct Image {
   std::vector<std::uint8_t> pixels;
   size_t width;
   size_t height;
 
-  Image(const std::filesystem::path &path) {
+  /// `path` through LoadAsset(), so it may come from an asset bundle.
+  Image(const std::filesystem::path &path) : Image(LoadAsset(path)) {}
+
+  /// Decodes a PNG in memory.
+  explicit Image(const Asset &asset) {
 #ifdef USE_PNG
-    png::image<png::rgba_pixel> png(path.string());
+    std::ispanstream stream(asset.text());
+    png::image<png::rgba_pixel> png;
+    png.read_stream(stream);
 
     width = png.get_width();
     height = png.get_height();
@@ -44,7 +53,7 @@ struct Image {
   }
 };
 
-cl::Image2D LoadImage(cl::Context &context, const std::filesystem::path &path) {
+inline cl::Image2D LoadImage(cl::Context &context, const std::filesystem::path &path) {
   const Image png(path);
   const cl::ImageFormat imageFormat(CL_RGBA, CL_UNORM_INT8);
   cl::Image2D image(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
@@ -3,9 +3,13 @@
 #include <spdlog/spdlog.h>
 #include <vector>
 
+#include "Autotuner.hpp"
 #include "Device.hpp"
 #include "Image.hpp"
 #include "Program.hpp"
+#include "Terrain.hpp"
+#include "TerrainNormals.hpp"
+#include "trace/trace.hpp"
 #include <glm/glm.hpp>
 
 struct Vertex {
@@ -18,9 +22,11 @@ struct Triangle {
   uint32_t vertices[3];
 };
 
-template <typename T> cl::Buffer make_buffer(cl::Context &context, int size) {
-  return cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                    sizeof(T) * size, nullptr);
+// uninitialized; CL_MEM_COPY_HOST_PTR without a host pointer is
+// CL_INVALID_HOST_PTR
+template <typename T>
+cl::Buffer make_buffer(cl::Context &context, size_t size) {
+  return cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(T) * size);
 }
 
 template <typename T>
@@ -29,70 +35,164 @@ cl::Buffer make_buffer(cl::Context &context, std::vector<T> data) {
                     sizeof(T) * data.size(), data.data());
 }
 
-int RunOpenCL(int argc, char **argv) {
-  const auto assetsDir =
-      std::filesystem::path(argv[0]).parent_path() / "assets";
-  const std::filesystem::path kernelPath{assetsDir / "vadd.cl"};
-  const std::filesystem::path imagePath{assetsDir / "heightmap.png"};
-  // TODO: check files
+struct TerrainJob::State {
+  std::filesystem::path assetsDir;
+  std::filesystem::path kernelPath;
+  std::filesystem::path imagePath;
+
+  cl::Device device;
+  cl::Context context;
+  cl::CommandQueue queue;
+  std::unique_ptr<Program> programBuilder; // refers to `context`
+  cl::Program program;
+  cl::Kernel kernel;
+  std::unique_ptr<TerrainNormals> normalPass; // refers to device and queue
+
+  cl::Image2D heightmap;
+  cl::Buffer bufA, triangles, vertices, normals;
+  size_t width = 0, height = 0;
+  size_t N = 0;
+  std::vector<float> out;
+  std::vector<uint32_t> normalsOut;
+};
 
-  // setup OpenCL
-  auto device{GetOpenCLDevice()};
-  cl::Context context(device);
-  cl::CommandQueue queue(context, device);
+TerrainJob::TerrainJob(std::filesystem::path assetsDir)
+    : _state(std::make_unique<State>()) {
+  _state->assetsDir = assetsDir;
+  _state->kernelPath = assetsDir / "vadd.cl";
+  _state->imagePath = assetsDir / "heightmap.png";
+
+  // fail before the pipeline runs rather than halfway through it
+  for (const auto *path : {&_state->kernelPath, &_state->imagePath}) {
+    if (!AssetExists(*path)) {
+      throw std::runtime_error("Missing asset: " + path->string());
+    }
+  }
+}
 
-  // build OpenCL program
-  Program programBuilder(context);
-  cl::Program program = programBuilder.build(device, kernelPath);
+TerrainJob::~TerrainJob() = default;
 
-  try {
-    cl::Kernel kernel = programBuilder.getKernel("calculate_geometry");
+void TerrainJob::setup() {
+  TRACE_SCOPE("opencl/setup");
+  _state->device = GetOpenCLDevice();
+  _state->context = cl::Context(_state->device);
+  _state->queue = cl::CommandQueue(_state->context, _state->device);
+}
 
-    // load heightmap image
-    cl::Image2D heightmap = LoadImage(context, imagePath);
-    auto width = heightmap.getImageInfo<CL_IMAGE_WIDTH>();
-    auto height = heightmap.getImageInfo<CL_IMAGE_HEIGHT>();
-    spdlog::info("uploaded cl::Image2D ({}x{})", width, height);
+void TerrainJob::build() {
+  TRACE_SCOPE("opencl/build");
+  _state->programBuilder = std::make_unique<Program>(_state->context);
+  _state->program =
+      _state->programBuilder->build(_state->device, _state->kernelPath);
+  _state->kernel = _state->programBuilder->getKernel("calculate_geometry");
+  _state->normalPass = std::make_unique<TerrainNormals>(
+      _state->context, _state->device, _state->queue, _state->assetsDir);
+}
 
-    // 4) Prepare Data
-    const auto numTriangles{width * height * 2};
-    const size_t numVertices{numTriangles * 3};
+void TerrainJob::upload() {
+  auto &s = *_state;
 
-    const size_t N = numVertices * 3 * 4; // x,y,z pro Vertex
-    std::vector<float> a(N), b(N), out(N, 0.0f);
+  // load heightmap image
+  {
+    TRACE_SCOPE("opencl/upload_heightmap");
+    s.heightmap = LoadImage(s.context, s.imagePath);
+  }
+  s.width = s.heightmap.getImageInfo<CL_IMAGE_WIDTH>();
+  s.height = s.heightmap.getImageInfo<CL_IMAGE_HEIGHT>();
+  spdlog::info("uploaded cl::Image2D ({}x{})", s.width, s.height);
+
+  // 4) Prepare Data
+  const auto numTriangles{s.width * s.height * 2};
+  const size_t numVertices{numTriangles * 3};
+
+  s.N = numVertices * 3 * 4; // x,y,z pro Vertex
+  std::vector<float> a(s.N), b(s.N);
+  s.out.assign(s.N, 0.0f);
+
+  // 5) Buffers + Upload
+  spdlog::info("creating buffers and uploading ({} MB)",
+               (sizeof(float) * s.N * 3) / (1024 * 1024));
+
+  {
+    TRACE_SCOPE("opencl/upload");
+    s.bufA = make_buffer(s.context, a);
+    s.triangles = make_buffer(s.context, b);
+    s.vertices = make_buffer<float>(s.context, s.N);
+    s.normals = cl::Buffer(s.context, CL_MEM_READ_WRITE,
+                           sizeof(uint32_t) * s.width * s.height);
+  }
+  s.normalsOut.assign(s.width * s.height, 0);
+  spdlog::info("uploaded buffers");
 
-    // 5) Buffers + Upload
-    spdlog::info("creating buffers and uploading ({} MB)",
-                 (sizeof(float) * N * 3) / (1024 * 1024));
+  spdlog::info("vertices: {}, triangles: {}", numVertices, numTriangles);
+}
 
-    cl::Buffer bufA = make_buffer(context, a);
-    cl::Buffer triangles = make_buffer(context, b);
-    cl::Buffer vertices = make_buffer<float>(context, N);
-    spdlog::info("uploaded buffers");
+void TerrainJob::dispatch() {
+  TRACE_SCOPE("opencl/kernel");
+  auto &s = *_state;
+
+  // 6) Kernel Args + Dispatch
+  s.kernel.setArg(0, s.vertices);
+  s.kernel.setArg(1, s.triangles);
+  s.kernel.setArg(2, s.vertices);
+  s.kernel.setArg(3, s.heightmap);
+  s.kernel.setArg(4, s.normals);
+
+  // the vertices take their normals from the tiled pass
+  s.normalPass->compute(s.heightmap, s.width, s.height, s.normals);
+
+  // non-uniform groups are fine under -cl-std=CL2.0, so the grid is not
+  // rounded up to the local size
+  const cl::NDRange global(s.width, s.height);
+  const auto shapes = Autotuner::LocalSizes(s.kernel, s.device, 2);
+  const LaunchShape shape = Autotuner::Shared().select(
+      s.device, "calculate_geometry", shapes, [&](const LaunchShape &c) {
+        const cl_int status = s.queue.enqueueNDRangeKernel(
+            s.kernel, cl::NullRange, global, c.range(2));
+        return status == CL_SUCCESS ? s.queue.finish() : status;
+      });
+
+  spdlog::info("kernel dispatched");
+  s.queue.enqueueNDRangeKernel(s.kernel, cl::NullRange, global,
+                               shape.range(2));
+
+  spdlog::info("Waiting to finish...");
+  s.queue.finish();
+  spdlog::info("Done");
+}
 
-    spdlog::info("vertices: {}, triangles: {}", numVertices, numTriangles);
+void TerrainJob::download() {
+  TRACE_SCOPE("opencl/download");
+  auto &s = *_state;
 
-    // 6) Kernel Args + Dispatch
-    kernel.setArg(0, vertices);
-    kernel.setArg(1, triangles);
-    kernel.setArg(2, vertices);
-    kernel.setArg(3, heightmap);
+  // 7) Download
+  s.queue.enqueueReadBuffer(s.vertices, CL_TRUE, 0, sizeof(float) * s.N,
+                            s.out.data());
+  s.queue.enqueueReadBuffer(s.normals, CL_TRUE, 0,
+                            sizeof(uint32_t) * s.normalsOut.size(),
+                            s.normalsOut.data());
+}
 
-    spdlog::info("kernel dispatched");
-    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
-                               cl::NDRange(width, height), cl::NullRange);
+const std::vector<float> &TerrainJob::vertices() const { return _state->out; }
 
-    spdlog::info("Waiting to finish...");
-    queue.finish();
-    spdlog::info("Done");
+const std::vector<uint32_t> &TerrainJob::normals() const {
+  return _state->normalsOut;
+}
 
-    // 7) Download
-    queue.enqueueReadBuffer(vertices, CL_TRUE, 0, sizeof(float) * N,
-                            out.data());
+/* ------------------------------------------------------------------------- */
+
+int RunOpenCL(int argc, char **argv) {
+  try {
+    TerrainJob job(std::filesystem::path(argv[0]).parent_path() / "assets");
+    job.setup();
+    job.build();
+    job.upload();
+    job.dispatch();
+    job.download();
   } catch (const std::exception &e) {
     spdlog::error("Exception: {}", e.what());
     return 1;
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -2,10 +2,21 @@
 #define PROGRAM_HPP
 
 #include <CL/opencl.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <spdlog/spdlog.h>
 
+#include "AssetBundle.hpp"
+
 /**
  * @brief Helps to build and manage OpenCL programs.
  */
@@ -13,98 +24,214 @@ class Program {
 public:
   Program(cl::Context &context) : _context(context) {}
 
-  cl::Program build(cl::Device &device, const std::filesystem::path &path) {
-    spdlog::info("Building OpenCL Program from source: {}", path.string());
+  /**
+   * @brief Builds `path`, loaded through LoadAsset() so it may come from an
+   * asset bundle. Quoted includes are spliced in from next to it, so no
+   * include path is needed. Binaries are cached under a key made of the
+   * content hashes of all sources, the options and the driver, so a cached
+   * one is only reused for identical input.
+   *
+   * `defines` are extra compiler options, e.g. "-DWG_SIZE=128" for a
+   * variant picked by the Autotuner.
+   */
+  cl::Program build(cl::Device &device, const std::filesystem::path &path,
+                    std::string_view defines = {});
 
-    const cl::Program::Sources sources{loadSource(path)};
-    _program = cl::Program(_context, sources);
+  cl::Kernel getKernel(const std::string &name) {
+    cl::Kernel kernel(_program, name.c_str());
+    return kernel;
+  }
 
-    const auto includePath = path.parent_path().string();
-    const std::string options =
-        "-cl-std=CL2.0 -I" + includePath; // TODO: make configurable
-    const auto status{_program.build({device}, options.c_str())};
+private:
+  void loadSpirV() {
+    // TODO
+  }
 
-    if (status != CL_SUCCESS) {
-      spdlog::error("Build log:\n{}\n",
-                    _program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
-      throw std::runtime_error("could not build OpenCL program");
+  // appends `path` to `source` with its quoted includes expanded, each file
+  // once, and chains every file's content hash into `key`
+  static void loadSource(const std::filesystem::path &path,
+                         std::string &source, uint64_t &key,
+                         std::vector<std::filesystem::path> &seen) {
+    if (std::find(seen.begin(), seen.end(), path) != seen.end())
+      return;
+    seen.push_back(path);
+
+    const Asset asset = LoadAsset(path);
+    key = HashBytes(std::as_bytes(std::span(&asset.hash, 1)), key);
+
+    const std::string name = path.filename().string();
+    std::string_view text = asset.text();
+    for (size_t line = 1; !text.empty(); ++line) {
+      const size_t end = std::min(text.find('\n'), text.size());
+      const std::string_view row = text.substr(0, end);
+      text.remove_prefix(std::min(end + 1, text.size()));
+
+      const std::string_view directive =
+          row.substr(std::min(row.find_first_not_of(" \t"), row.size()));
+      const size_t open = directive.find('"');
+      const size_t close = directive.rfind('"');
+      if (!directive.starts_with("#include") || open == close) {
+        source += row;
+        source += '\n';
+        continue;
+      }
+
+      const auto header =
+          path.parent_path() / directive.substr(open + 1, close - open - 1);
+      source += std::format("#line 1 \"{}\"\n", header.filename().string());
+      loadSource(header, source, key, seen);
+      source += std::format("\n#line {} \"{}\"\n", line + 1, name);
     }
+  }
 
-    spdlog::info("OpenCL Program built successfully.");
+private:
+  cl::Context &_context;
+  cl::Program _program;
+};
 
-    // TODO: cache binary
-    saveBinary();
-    return _program;
+/**
+ * @brief Compiled program binaries on disk, by content key (see
+ * Program::build()). Binaries are written to a temporary first, so a crash
+ * or a concurrent build never leaves half a file. Set BGL_PROGRAM_CACHE=0
+ * to always build from source.
+ */
+class ProgramCache {
+public:
+  ProgramCache() : _directory(Directory()) {
+    spdlog::info("program cache: '{}'", _directory.string());
   }
 
-  cl::Kernel getKernel(const std::string &name) {
-    cl::Kernel kernel(_program, name.c_str());
-    return kernel;
+  /// Process wide instance in Directory().
+  static ProgramCache &Shared() {
+    static ProgramCache cache;
+    return cache;
   }
 
-private:
-  void load() {
-    // TODO: load source
-    // TODO: load binary
-    // TODO: load SpirV
-  }
+  const std::filesystem::path &directory() const { return _directory; }
 
-  void loadBinary() {
-    // TODO
+  /// Key of `device`'s build of sources hashing to `sources` with `options`.
+  static uint64_t Key(const cl::Device &device, uint64_t sources,
+                      std::string_view options) {
+    uint64_t key = HashString(options, sources);
+    key = HashString(device.getInfo<CL_DEVICE_NAME>(), key);
+    return HashString(device.getInfo<CL_DRIVER_VERSION>(), key);
   }
 
-  void loadSpirV() {
-    // TODO
+  std::optional<std::vector<unsigned char>> load(uint64_t key) const {
+    if (!Enabled())
+      return std::nullopt;
+    std::ifstream in(file(key), std::ios::binary);
+    if (!in)
+      return std::nullopt;
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(in),
+                                      std::istreambuf_iterator<char>());
   }
 
-  cl::Program::Sources loadSource(const std::filesystem::path &path) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-      throw std::runtime_error("Failed to open kernel source file: " +
-                               path.string());
+  void store(uint64_t key, std::span<const unsigned char> binary) const {
+    if (!Enabled() || binary.empty())
+      return;
+    std::filesystem::path temp = file(key);
+    temp += std::format(".{}.tmp", std::hash<std::thread::id>()(
+                                       std::this_thread::get_id()));
+    {
+      std::ofstream out(temp, std::ios::binary);
+      out.write(reinterpret_cast<const char *>(binary.data()),
+                (std::streamsize)binary.size());
+      if (!out) {
+        spdlog::warn("cannot write '{}'", temp.string());
+        return;
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, file(key), error);
+    if (error) {
+      spdlog::warn("cannot cache program binary: {}", error.message());
+      std::filesystem::remove(temp, error);
     }
-
-    const std::string source{std::string(std::istreambuf_iterator<char>(file),
-                                         std::istreambuf_iterator<char>())};
-    return {source};
   }
 
-  void saveBinary() {
-#if 1
-    // 1) Wie groß ist das Binary?
-    auto sizes = _program.getInfo<CL_PROGRAM_BINARY_SIZES>();
-    if (sizes.empty() || sizes[0] == 0) {
-      throw std::runtime_error("No program binary available.");
+  /**
+   * @brief $BGL_CACHE_DIR, else $XDG_CACHE_HOME/bgl, else ~/.cache/bgl, else
+   * a directory under the system temp path. Created on first use.
+   */
+  static std::filesystem::path Directory() {
+    std::filesystem::path dir;
+    if (const char *env = std::getenv("BGL_CACHE_DIR"); env && *env)
+      dir = env;
+    else if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+      dir = std::filesystem::path(xdg) / "bgl";
+    else if (const char *home = std::getenv("HOME"); home && *home)
+      dir = std::filesystem::path(home) / ".cache" / "bgl";
+    else
+      dir = std::filesystem::temp_directory_path() / "bgl";
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+      spdlog::warn("cannot create cache directory '{}': {}", dir.string(),
+                   error.message());
     }
-
-    // 2) Speicher allokieren & Binary holen
-    std::vector<unsigned char> bin(sizes[0]);
-    std::vector<unsigned char *> ptrs{bin.data()};
-    _program.getInfo(CL_PROGRAM_BINARIES, &ptrs);
-
-    // 3) Schreiben
-    std::filesystem::path outFile{"/tmp/kernel.bin"};
-    std::ofstream f(outFile, std::ios::binary);
-    if (!f)
-      throw std::runtime_error("Failed to write: " + outFile.string());
-    f.write(reinterpret_cast<const char *>(bin.data()),
-            (std::streamsize)bin.size());
-    spdlog::info("Saved program binary to '{}'", outFile.string());
-#endif
+    return dir;
   }
 
 private:
-  cl::Context &_context;
-  cl::Program _program;
-};
+  static bool Enabled() {
+    const char *env = std::getenv("BGL_PROGRAM_CACHE");
+    return !env || std::string_view(env) != "0";
+  }
 
-class ProgramCache {
-  // TODO: implement cache mechanism
-public:
-  ProgramCache() {
-    auto home = std::getenv("HOME"); // just to set a breakpoint here
-    spdlog::info("HOME={}", home ? home : "not set");
+  std::filesystem::path file(uint64_t key) const {
+    return _directory / std::format("{:016x}.bin", key);
   }
+
+  std::filesystem::path _directory;
 };
 
+/* ------------------------------------------------------------------------- */
+
+inline cl::Program Program::build(cl::Device &device,
+                                  const std::filesystem::path &path,
+                                  std::string_view defines) {
+  std::string options = "-cl-std=CL2.0";
+  if (!defines.empty())
+    options += " " + std::string(defines);
+
+  std::string source;
+  uint64_t sources = HashString("");
+  std::vector<std::filesystem::path> seen;
+  loadSource(path, source, sources, seen);
+
+  ProgramCache &cache = ProgramCache::Shared();
+  const uint64_t key = ProgramCache::Key(device, sources, options);
+  if (auto binary = cache.load(key)) {
+    cl_int status = CL_SUCCESS;
+    _program = cl::Program(_context, {device}, {*binary}, nullptr, &status);
+    if (status == CL_SUCCESS &&
+        _program.build({device}, options.c_str()) == CL_SUCCESS) {
+      spdlog::info("OpenCL Program '{}' loaded from cache ({:016x})",
+                   path.string(), key);
+      return _program;
+    }
+    spdlog::warn("cached binary {:016x} rejected, building from source",
+                 key);
+  }
+
+  spdlog::info("Building OpenCL Program from source: {}", path.string());
+  _program = cl::Program(_context, cl::Program::Sources{source});
+  const auto status{_program.build({device}, options.c_str())};
+
+  if (status != CL_SUCCESS) {
+    spdlog::error("Build log:\n{}\n",
+                  _program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+    throw std::runtime_error("could not build OpenCL program");
+  }
+
+  spdlog::info("OpenCL Program built successfully.");
+
+  const auto binaries = _program.getInfo<CL_PROGRAM_BINARIES>();
+  if (!binaries.empty())
+    cache.store(key, binaries[0]);
+  return _program;
+}
+
 #endif // PROGRAM_HPP
\ No newline at end of file
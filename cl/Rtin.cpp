@@ -0,0 +1,193 @@
+#include "Rtin.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "exec/executor.hpp"
+#include "trace/trace.hpp"
+
+namespace {
+
+// levels with fewer vertices run on the calling thread
+constexpr size_t kParallelVertices = 1 << 14;
+
+class ErrorPass {
+public:
+  ErrorPass(const std::vector<float> &heights, std::vector<float> &errors,
+            long size)
+      : _heights(heights), _errors(errors), _size(size) {}
+
+  // rtin_square_errors in rtin.cl
+  void square(long d, long i, long j) const {
+    const long x = d + 2 * d * i, y = d + 2 * d * j;
+    const long turn = ((i + j) & 1) == 0 ? 1 : -1; // main or anti diagonal
+    float error =
+        interpolation(x, y, x - d, y - turn * d, x + d, y + turn * d);
+    error = std::fmax(error, at(_errors, x - d, y));
+    error = std::fmax(error, at(_errors, x + d, y));
+    error = std::fmax(error, at(_errors, x, y - d));
+    error = std::fmax(error, at(_errors, x, y + d));
+    _errors[y * _size + x] = error;
+  }
+
+  // rtin_edge_errors in rtin.cl; (ux, uy) along the edge, (vx, vy) across
+  void edge(long d, bool vertical, long along, long across) const {
+    const long ux = vertical ? 0 : 1, uy = vertical ? 1 : 0;
+    const long vx = uy, vy = ux;
+    const long x = ux * (d + 2 * d * along) + vx * (2 * d * across);
+    const long y = uy * (d + 2 * d * along) + vy * (2 * d * across);
+
+    float error =
+        interpolation(x, y, x - ux * d, y - uy * d, x + ux * d, y + uy * d);
+    if (d > 1) {
+      const long h = d / 2;
+      for (long side = -1; side <= 1; side += 2) {
+        const long cx = x + vx * side * d, cy = y + vy * side * d;
+        if (cx < 0 || cy < 0 || cx > _size - 1 || cy > _size - 1)
+          continue;
+        const long mx = x + vx * side * h, my = y + vy * side * h;
+        error = std::fmax(error, at(_errors, mx - ux * h, my - uy * h));
+        error = std::fmax(error, at(_errors, mx + ux * h, my + uy * h));
+      }
+    }
+    _errors[y * _size + x] = error;
+  }
+
+private:
+  float at(const std::vector<float> &values, long x, long y) const {
+    return values[y * _size + x];
+  }
+
+  float interpolation(long x, long y, long ax, long ay, long bx,
+                      long by) const {
+    const float h = at(_heights, x, y);
+    return std::fabs(h - 0.5f * (at(_heights, ax, ay) + at(_heights, bx, by)));
+  }
+
+  const std::vector<float> &_heights;
+  std::vector<float> &_errors;
+  long _size;
+};
+
+/// Runs body(row) for rows [0, rows), on `executor` if there is one.
+template <typename Body>
+void ForRows(long rows, Executor *executor, size_t vertices,
+             const Body &body) {
+  if (!executor || executor->size() <= 1 || vertices < kParallelVertices) {
+    for (long row = 0; row < rows; ++row)
+      body(row);
+    return;
+  }
+
+  // one task per worker, rows interleaved so each gets a similar share
+  const long tasks = std::min<long>(executor->size(), rows);
+  executor->parallelFor((size_t)tasks, [&](size_t t) {
+    TRACE_SCOPE("rtin/errors");
+    for (long row = (long)t; row < rows; row += tasks)
+      body(row);
+  });
+}
+
+struct MeshBuilder {
+  const RtinErrors &map;
+  float maxError;
+  std::vector<uint32_t> index; // per grid vertex, 0 = not emitted yet
+  RtinMesh mesh;
+
+  uint32_t vertex(long x, long y) {
+    uint32_t &slot = index[y * map.size + x];
+    if (slot == 0) {
+      mesh.vertices.emplace_back((unsigned)x, (unsigned)y);
+      slot = (uint32_t)mesh.vertices.size();
+    }
+    return slot - 1;
+  }
+
+  // right angle at c, hypotenuse a-b
+  void triangle(long ax, long ay, long bx, long by, long cx, long cy) {
+    const long right = (long)map.width - 1, bottom = (long)map.height - 1;
+    const long minX = std::min({ax, bx, cx}), maxX = std::max({ax, bx, cx});
+    const long minY = std::min({ay, by, cy}), maxY = std::max({ay, by, cy});
+    if (minX >= right && maxX > right)
+      return; // padding only
+    if (minY >= bottom && maxY > bottom)
+      return;
+
+    const long mx = (ax + bx) / 2, my = (ay + by) / 2;
+    const bool straddles = (minX < right && maxX > right) ||
+                           (minY < bottom && maxY > bottom);
+    if (std::abs(ax - cx) + std::abs(ay - cy) > 1 &&
+        (straddles || map.errors[my * map.size + mx] > maxError)) {
+      triangle(cx, cy, ax, ay, mx, my);
+      triangle(bx, by, cx, cy, mx, my);
+      return;
+    }
+
+    const uint32_t a = vertex(ax, ay), b = vertex(bx, by), c = vertex(cx, cy);
+    mesh.indices.insert(mesh.indices.end(), {a, c, b});
+  }
+};
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+std::vector<float> RtinGrid(const HeightField &field) {
+  if (field.width == 0 || field.height == 0 ||
+      field.heights.size() < field.width * field.height) {
+    throw std::invalid_argument(
+        std::format("invalid {}x{} height field of {} samples", field.width,
+                    field.height, field.heights.size()));
+  }
+
+  const size_t size = RtinGridSize(field.width, field.height);
+  std::vector<float> grid(size * size);
+  for (size_t y = 0; y < size; ++y) {
+    for (size_t x = 0; x < size; ++x) {
+      grid[y * size + x] = field.at(std::min(x, field.width - 1),
+                                    std::min(y, field.height - 1));
+    }
+  }
+  return grid;
+}
+
+RtinErrors ComputeRtinErrors(const HeightField &field, Executor *executor) {
+  TRACE_SCOPE("rtin/error_map");
+  const std::vector<float> grid = RtinGrid(field);
+
+  RtinErrors out;
+  out.size = RtinGridSize(field.width, field.height);
+  out.width = field.width;
+  out.height = field.height;
+  out.errors.assign(out.size * out.size, 0.0f);
+
+  const ErrorPass pass(grid, out.errors, (long)out.size);
+  for (long d = 1; (size_t)d * 2 < out.size; d *= 2) {
+    const long n = ((long)out.size - 1) / (2 * d);
+    const size_t vertices = (size_t)n * (n + 1) * 2;
+
+    // edge midpoints first: the square centres of this level gather them
+    ForRows(n + 1, executor, vertices, [&](long across) {
+      for (long along = 0; along < n; ++along) {
+        pass.edge(d, false, along, across);
+        pass.edge(d, true, along, across);
+      }
+    });
+    ForRows(n, executor, vertices, [&](long j) {
+      for (long i = 0; i < n; ++i)
+        pass.square(d, i, j);
+    });
+  }
+  return out;
+}
+
+RtinMesh BuildRtinMesh(const RtinErrors &errors, float maxError) {
+  TRACE_SCOPE("rtin/mesh");
+  MeshBuilder builder{errors, maxError, {}, {}};
+  builder.index.assign(errors.size * errors.size, 0);
+
+  const long last = (long)errors.size - 1;
+  builder.triangle(0, 0, last, last, last, 0);
+  builder.triangle(last, last, 0, 0, 0, last);
+  return std::move(builder.mesh);
+}
@@ -0,0 +1,136 @@
+#ifndef RTIN_HPP
+#define RTIN_HPP
+
+#include <CL/opencl.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Program.hpp"
+#include "Terrain.hpp"
+
+class Executor;
+
+/**
+ * @brief Error map of a right-triangulated irregular network over a height
+ * field: the vertical error of leaving out each vertex of a square grid of
+ * 2^k + 1 samples. Fields of any other size are covered by the next such
+ * grid, repeating the edge samples.
+ */
+struct RtinErrors {
+  std::vector<float> errors; // row major, size * size
+  size_t size = 0;           // 2^k + 1
+  size_t width = 0;          // of the field, the rest is padding
+  size_t height = 0;
+};
+
+/// Triangles in texel coordinates, wound like calculate_geometry's.
+struct RtinMesh {
+  std::vector<glm::uvec2> vertices;
+  std::vector<uint32_t> indices;
+
+  size_t triangles() const { return indices.size() / 3; }
+};
+
+/// Side of the grid covering a width x height field.
+inline size_t RtinGridSize(size_t width, size_t height) {
+  return std::bit_ceil(std::max<size_t>({width, height, 2}) - 1) + 1;
+}
+
+/// The field's samples on the RTIN grid, edge samples repeated.
+std::vector<float> RtinGrid(const HeightField &field);
+
+/**
+ * @brief Computes the error map, on `executor` if there is one. The levels
+ * run one after the other, the vertices of a level in parallel.
+ */
+RtinErrors ComputeRtinErrors(const HeightField &field,
+                             Executor *executor = nullptr);
+
+/**
+ * @brief Splits triangles from the two halves of the grid down while their
+ * midpoint error exceeds `maxError`, so flat regions keep large triangles.
+ * Triangles are also split where they reach past the field, and those
+ * outside it are dropped.
+ */
+RtinMesh BuildRtinMesh(const RtinErrors &errors, float maxError);
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief ComputeRtinErrors() on the device with rtin.cl, two dispatches per
+ * level on one in-order queue.
+ */
+class RtinErrorKernel {
+public:
+  RtinErrorKernel(cl::Context &context, cl::Device &device,
+                  cl::CommandQueue &queue,
+                  const std::filesystem::path &assetsDir)
+      : _context(context), _queue(queue) {
+    Program program(context);
+    const cl::Program built = program.build(device, assetsDir / "rtin.cl");
+    _square = cl::Kernel(built, "rtin_square_errors");
+    _edge = cl::Kernel(built, "rtin_edge_errors");
+  }
+
+  /// Blocks until the map is read back.
+  RtinErrors compute(const HeightField &field) {
+    RtinErrors out;
+    out.size = RtinGridSize(field.width, field.height);
+    out.width = field.width;
+    out.height = field.height;
+    out.errors.resize(out.size * out.size);
+
+    std::vector<float> grid = RtinGrid(field);
+    const size_t bytes = grid.size() * sizeof(float);
+    if (_bytes < bytes) {
+      _heights = cl::Buffer(_context, CL_MEM_READ_ONLY, bytes);
+      _errors = cl::Buffer(_context, CL_MEM_READ_WRITE, bytes);
+      _bytes = bytes;
+    }
+    _queue.enqueueWriteBuffer(_heights, CL_FALSE, 0, bytes, grid.data());
+    // corners are never midpoints and keep 0
+    _queue.enqueueFillBuffer(_errors, 0.0f, 0, bytes);
+
+    const cl_uint size = (cl_uint)out.size;
+    for (cl::Kernel *kernel : {&_square, &_edge}) {
+      kernel->setArg(0, _heights);
+      kernel->setArg(1, _errors);
+      kernel->setArg(2, size);
+    }
+    for (cl_int d = 1; (size_t)d * 2 < out.size; d *= 2) {
+      const size_t n = (out.size - 1) / (2 * (size_t)d);
+      _edge.setArg(3, d);
+      enqueue(_edge, cl::NDRange(n + 1, n + 1, 2));
+      _square.setArg(3, d);
+      enqueue(_square, cl::NDRange(n, n));
+    }
+
+    _queue.enqueueReadBuffer(_errors, CL_TRUE, 0, bytes, out.errors.data());
+    return out;
+  }
+
+private:
+  void enqueue(const cl::Kernel &kernel, const cl::NDRange &global) {
+    const cl_int status =
+        _queue.enqueueNDRangeKernel(kernel, cl::NullRange, global);
+    if (status != CL_SUCCESS) {
+      throw std::runtime_error(
+          std::format("rtin kernel failed to enqueue ({})", status));
+    }
+  }
+
+  cl::Context &_context;
+  cl::CommandQueue &_queue;
+  cl::Kernel _square, _edge;
+  cl::Buffer _heights, _errors;
+  size_t _bytes = 0;
+};
+
+#endif // RTIN_HPP
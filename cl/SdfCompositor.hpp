@@ -0,0 +1,75 @@
+#ifndef SDF_COMPOSITOR_HPP
+#define SDF_COMPOSITOR_HPP
+
+#include <CL/opencl.hpp>
+#include <filesystem>
+#include <vector>
+
+#include "Buffer.hpp"
+#include "Program.hpp"
+#include "font/sdf.hpp"
+
+/**
+ * @brief Device side of CompositeSdfText(): sdf_text.cl runs one work group
+ * per tile of a prepared SdfTextSetup and blends into a premultiplied RGBA8
+ * buffer, so many strings at any scale and rotation take a single dispatch.
+ */
+class SdfCompositor {
+public:
+  SdfCompositor(cl::Context &context, cl::Device &device,
+                cl::CommandQueue &queue,
+                const std::filesystem::path &assetsDir)
+      : _context(context), _queue(queue) {
+    Program program(context);
+    _kernel = cl::Kernel(program.build(device, assetsDir / "sdf_text.cl"),
+                         "composite_sdf_text");
+  }
+
+  /// Copies the atlas texels to the device; call again when they changed.
+  void uploadAtlas(const SdfAtlasView &atlas) {
+    const size_t bytes =
+        (size_t)atlas.size.x * atlas.size.y * (size_t)atlas.kind;
+    _queue.enqueueWriteBuffer(_atlas.reserve(_context, bytes), CL_TRUE, 0,
+                              bytes, atlas.texels);
+    _atlasView = atlas;
+    _atlasView.texels = nullptr; // the host copy may go away
+  }
+
+  /**
+   * @brief Enqueues compositing `setup` into `target`, a buffer of
+   * `setup.image` premultiplied RGBA8 pixels. Uploads are blocking; the
+   * kernel is not waited for.
+   */
+  void composite(const SdfTextSetup &setup, cl::Buffer &target) {
+    if (setup.tileQuads.empty())
+      return;
+
+    constexpr unsigned kTile = SdfTextSetup::kTile;
+    _kernel.setArg(0, _quads.write(_context, _queue, setup.quads));
+    _kernel.setArg(1, _styles.write(_context, _queue, setup.styles));
+    _kernel.setArg(2, _offsets.write(_context, _queue, setup.tileOffsets));
+    _kernel.setArg(3, _tileQuads.write(_context, _queue, setup.tileQuads));
+    _kernel.setArg(4, _atlas.get());
+    _kernel.setArg(5, cl_int2{{(cl_int)_atlasView.size.x,
+                               (cl_int)_atlasView.size.y}});
+    _kernel.setArg(6, (cl_int)_atlasView.kind);
+    _kernel.setArg(7, _atlasView.distanceRange);
+    _kernel.setArg(8, target);
+    _kernel.setArg(9, cl_uint2{{setup.image.x, setup.image.y}});
+
+    _queue.enqueueNDRangeKernel(
+        _kernel, cl::NullRange,
+        cl::NDRange(setup.tiles.x * kTile, setup.tiles.y * kTile),
+        cl::NDRange(kTile, kTile));
+  }
+
+private:
+  cl::Context &_context;
+  cl::CommandQueue &_queue;
+  cl::Kernel _kernel;
+
+  SdfAtlasView _atlasView;
+  GrowableBuffer _atlas, _quads, _styles, _offsets, _tileQuads;
+};
+
+#endif // SDF_COMPOSITOR_HPP
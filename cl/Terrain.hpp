@@ -0,0 +1,50 @@
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+/// Heights row major, one per texel; 0..1 for heightmaps loaded as UNORM.
+struct HeightField {
+  std::span<const float> heights;
+  size_t width = 0;
+  size_t height = 0;
+
+  float at(size_t x, size_t y) const { return heights[y * width + x]; }
+};
+
+/**
+ * @brief Heightmap-to-geometry job split into its OpenCL stages, so a
+ * scheduler can overlap them with other work. Stages must be called in
+ * declaration order; each may run on a different thread.
+ */
+class TerrainJob {
+public:
+  explicit TerrainJob(std::filesystem::path assetsDir);
+  ~TerrainJob();
+
+  TerrainJob(const TerrainJob &) = delete;
+  TerrainJob &operator=(const TerrainJob &) = delete;
+
+  void setup();    // device, context, queue
+  void build();    // compile vadd.cl
+  void upload();   // heightmap image + buffers
+  void dispatch(); // run calculate_surface_normal, calculate_geometry, wait
+  void download(); // read back the vertex and normal buffers
+
+  const std::vector<float> &vertices() const;
+
+  /// Oct-encoded normal per heightmap texel, row major; see OctDecode().
+  const std::vector<uint32_t> &normals() const;
+
+private:
+  struct State;
+  std::unique_ptr<State> _state;
+};
+
+int RunOpenCL(int argc, char **argv);
+
+#endif // TERRAIN_HPP
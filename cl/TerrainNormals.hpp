@@ -0,0 +1,168 @@
+#ifndef TERRAIN_NORMALS_HPP
+#define TERRAIN_NORMALS_HPP
+
+#include <CL/opencl.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Autotuner.hpp"
+#include "Program.hpp"
+
+/* ------------------------------------------------------------------------- */
+/* CPU reference, mirroring the helpers in vadd.cl                           */
+
+/// Octahedral encoding as two snorm16 in one uint, x in the low half.
+inline uint32_t OctEncode(glm::vec3 n) {
+  n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  glm::vec2 p(n.x, n.y);
+  if (n.z < 0.0f) {
+    p = (1.0f - glm::abs(glm::vec2(n.y, n.x))) *
+        glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  const auto quantize = [](float v) {
+    const long q = std::lrint(std::clamp(v, -1.0f, 1.0f) * 32767.0f);
+    return (uint32_t)(uint16_t)(int16_t)q;
+  };
+  return quantize(p.x) | ((uint32_t)quantize(p.y) << 16);
+}
+
+inline glm::vec3 OctDecode(uint32_t packed) {
+  const glm::vec2 p((float)(int16_t)(packed & 0xFFFF) / 32767.0f,
+                    (float)(int16_t)(packed >> 16) / 32767.0f);
+  glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+  if (n.z < 0.0f) {
+    n.x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+    n.y = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  return glm::normalize(n);
+}
+
+/// Sobel normal from the 3x3 heights around a texel, row major, in the space
+/// of the terrain vertices, where x and y span 0..1 over the map.
+inline glm::vec3 SobelNormal(const float h[9], glm::vec2 size) {
+  const float gx = (h[2] + 2.0f * h[5] + h[8]) - (h[0] + 2.0f * h[3] + h[6]);
+  const float gy = (h[6] + 2.0f * h[7] + h[8]) - (h[0] + 2.0f * h[1] + h[2]);
+  return glm::normalize(
+      glm::vec3(-gx * size.x * 0.125f, -gy * size.y * 0.125f, 1.0f));
+}
+
+/**
+ * @brief What calculate_surface_normal writes for an RGBA8 heightmap (height
+ * in the red channel, as Image loads it), for validating the kernel. Borders
+ * repeat the edge texels.
+ */
+inline std::vector<uint32_t> ReferenceNormals(std::span<const uint8_t> rgba,
+                                              size_t width, size_t height) {
+  if (rgba.size() < width * height * 4) {
+    throw std::invalid_argument(
+        std::format("{} bytes are no {}x{} RGBA image", rgba.size(), width,
+                    height));
+  }
+
+  const auto at = [&](long x, long y) {
+    x = std::clamp<long>(x, 0, (long)width - 1);
+    y = std::clamp<long>(y, 0, (long)height - 1);
+    return rgba[((size_t)y * width + (size_t)x) * 4] / 255.0f;
+  };
+
+  std::vector<uint32_t> normals(width * height);
+  const glm::vec2 size((float)width, (float)height);
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      float h[9];
+      for (int i = 0; i < 9; ++i)
+        h[i] = at((long)x + i % 3 - 1, (long)y + i / 3 - 1);
+      normals[y * width + x] = OctEncode(SobelNormal(h, size));
+    }
+  }
+  return normals;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Runs calculate_surface_normal from vadd.cl. The tile edge is a
+ * compile-time define, so each candidate is its own program; the fastest is
+ * picked by the Autotuner on the first dispatch and remembered.
+ */
+class TerrainNormals {
+public:
+  static constexpr unsigned kTiles[] = {8, 16, 32};
+
+  TerrainNormals(cl::Context &context, cl::Device &device,
+                 cl::CommandQueue &queue,
+                 const std::filesystem::path &assetsDir)
+      : _context(context), _device(device), _queue(queue),
+        _source(assetsDir / "vadd.cl") {}
+
+  /**
+   * @brief Enqueues oct-encoded normals of `heightmap` into `normals`, which
+   * holds at least width * height uints. Not waited for.
+   */
+  void compute(const cl::Image2D &heightmap, size_t width, size_t height,
+               cl::Buffer &normals) {
+    if (!_tuned) {
+      const size_t limit = _device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+      std::vector<LaunchShape> shapes;
+      for (unsigned tile : kTiles) {
+        if (tile * tile <= limit)
+          shapes.push_back({{tile, tile, 1},
+                            std::format("-DNORMAL_TILE={}", tile)});
+      }
+      _shape = Autotuner::Shared().select(
+          _device, "calculate_surface_normal", shapes,
+          [&](const LaunchShape &shape) {
+            const cl_int status = enqueue(shape, heightmap, width, height,
+                                          normals);
+            return status == CL_SUCCESS ? _queue.finish() : status;
+          });
+      _tuned = true;
+    }
+    enqueue(_shape, heightmap, width, height, normals);
+  }
+
+  /// Tile edge in use, 0 before the first compute().
+  unsigned tile() const { return _tuned ? (unsigned)_shape.local[0] : 0; }
+
+private:
+  cl_int enqueue(const LaunchShape &shape, const cl::Image2D &heightmap,
+                 size_t width, size_t height, cl::Buffer &normals) {
+    auto it = _variants.find(shape.defines);
+    if (it == _variants.end()) {
+      Program program(_context);
+      cl::Kernel kernel(program.build(_device, _source, shape.defines),
+                        "calculate_surface_normal");
+      it = _variants.emplace(shape.defines, std::move(kernel)).first;
+    }
+
+    const size_t tile = shape.local[0];
+    cl::Kernel &kernel = it->second;
+    kernel.setArg(0, normals);
+    kernel.setArg(1, heightmap);
+    return _queue.enqueueNDRangeKernel(
+        kernel, cl::NullRange,
+        cl::NDRange((width + tile - 1) / tile * tile,
+                    (height + tile - 1) / tile * tile),
+        shape.range(2));
+  }
+
+  cl::Context &_context;
+  cl::Device &_device;
+  cl::CommandQueue &_queue;
+  std::filesystem::path _source;
+  std::map<std::string, cl::Kernel> _variants; // by defines
+  LaunchShape _shape;
+  bool _tuned = false;
+};
+
+#endif // TERRAIN_NORMALS_HPP
@@ -0,0 +1,299 @@
+#include "executor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <stdexcept>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+thread_local const Executor *tlsExecutor = nullptr;
+thread_local int tlsWorker = -1;
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+TaskGraph::TaskId TaskGraph::add(const char *name, std::function<void()> fn) {
+  _nodes.push_back(Node{name, std::move(fn), {}, 0});
+  return _nodes.size() - 1;
+}
+
+void TaskGraph::precede(TaskId before, TaskId after) {
+  if (before >= _nodes.size() || after >= _nodes.size() || before == after) {
+    throw std::invalid_argument(
+        std::format("invalid task edge {} -> {}", before, after));
+  }
+  _nodes[before].successors.push_back(after);
+  ++_nodes[after].dependencies;
+}
+
+void TaskGraph::validate() const {
+  // Kahn's algorithm: every task is reached from the roots only if no
+  // dependency cycle holds any of them back
+  std::vector<size_t> pending(_nodes.size());
+  std::vector<TaskId> ready;
+  for (TaskId id = 0; id < _nodes.size(); ++id) {
+    pending[id] = _nodes[id].dependencies;
+    if (pending[id] == 0)
+      ready.push_back(id);
+  }
+
+  size_t reached = 0;
+  while (!ready.empty()) {
+    const TaskId id = ready.back();
+    ready.pop_back();
+    ++reached;
+    for (TaskId successor : _nodes[id].successors) {
+      if (--pending[successor] == 0)
+        ready.push_back(successor);
+    }
+  }
+
+  if (reached != _nodes.size()) {
+    throw std::invalid_argument(
+        std::format("task graph has a cycle through {} of its {} tasks",
+                    _nodes.size() - reached, _nodes.size()));
+  }
+}
+
+TaskGraph::TaskId TaskGraph::chain(std::initializer_list<TaskId> tasks) {
+  if (tasks.size() == 0) {
+    throw std::invalid_argument("empty task chain");
+  }
+  const TaskId *previous = nullptr;
+  for (const TaskId &task : tasks) {
+    if (previous)
+      precede(*previous, task);
+    previous = &task;
+  }
+  return *previous;
+}
+
+/* ------------------------------------------------------------------------- */
+
+namespace {
+
+/**
+ * @brief Bookkeeping for one Executor::run() call. Shared with every job so it
+ * stays alive until the last one has returned, not just until run() wakes up.
+ */
+struct RunState {
+  TaskGraph *graph;
+  std::unique_ptr<std::atomic<size_t>[]> pending;
+  std::unique_ptr<std::atomic<bool>[]> skipped; // a predecessor failed
+  std::atomic<size_t> remaining;
+
+  std::mutex mutex;
+  std::condition_variable done;
+  std::exception_ptr error;
+  bool finished = false;
+};
+
+} // namespace
+
+Executor::Executor(unsigned threads) {
+  threads = std::max(threads, 1u);
+  for (unsigned i = 0; i < threads; ++i) {
+    _workers.push_back(std::make_unique<Worker>());
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    _threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard lock(_sleepMutex);
+    _stop = true;
+  }
+  _wake.notify_all();
+  _threads.clear();
+}
+
+int Executor::currentWorker() const {
+  return tlsExecutor == this ? tlsWorker : -1;
+}
+
+void Executor::run(TaskGraph &graph) {
+  if (graph.empty())
+    return;
+  graph.validate();
+
+  auto state = std::make_shared<RunState>();
+  state->graph = &graph;
+  state->pending = std::make_unique<std::atomic<size_t>[]>(graph.size());
+  state->skipped = std::make_unique<std::atomic<bool>[]>(graph.size());
+  state->remaining = graph.size();
+  for (size_t i = 0; i < graph.size(); ++i) {
+    state->pending[i] = graph._nodes[i].dependencies;
+    state->skipped[i] = false;
+  }
+
+  // jobs schedule their successors before `remaining` drops, i.e. while
+  // run() and this reference are still alive
+  std::function<void(size_t)> schedule;
+  schedule = [this, state, &schedule](size_t id) {
+    push([this, state, id, schedule] {
+      auto &node = state->graph->_nodes[id];
+
+      bool failed = state->skipped[id].load();
+      if (!failed) {
+#ifdef USE_TRACE
+        trace::Zone zone(node.name);
+#endif
+        try {
+          node.fn();
+        } catch (...) {
+          failed = true;
+          std::lock_guard lock(state->mutex);
+          if (!state->error)
+            state->error = std::current_exception();
+        }
+      }
+
+      for (size_t successor : node.successors) {
+        if (failed)
+          state->skipped[successor] = true;
+        if (state->pending[successor].fetch_sub(1) == 1)
+          schedule(successor);
+      }
+
+      if (state->remaining.fetch_sub(1) == 1) {
+        std::lock_guard lock(state->mutex);
+        state->finished = true;
+        state->done.notify_all();
+      }
+    });
+  };
+
+  for (size_t i = 0; i < graph.size(); ++i) {
+    if (graph._nodes[i].dependencies == 0)
+      schedule(i);
+  }
+
+  if (currentWorker() >= 0) {
+    // a worker must not block, it would starve the graph it is waiting for;
+    // it helps while there is work and otherwise parks for growing spans,
+    // woken early when the graph finishes
+    constexpr auto kMinPark = std::chrono::microseconds(20);
+    constexpr auto kMaxPark = std::chrono::milliseconds(2);
+    auto park = kMinPark;
+    for (;;) {
+      if (runOne()) {
+        park = kMinPark;
+        continue;
+      }
+      std::unique_lock lock(state->mutex);
+      if (state->done.wait_for(lock, park, [&] { return state->finished; }))
+        break;
+      park = std::min<std::chrono::microseconds>(park * 2, kMaxPark);
+    }
+  } else {
+    std::unique_lock lock(state->mutex);
+    state->done.wait(lock, [&] { return state->finished; });
+  }
+
+  if (state->error)
+    std::rethrow_exception(state->error);
+}
+
+void Executor::parallelFor(size_t count,
+                            const std::function<void(size_t)> &fn,
+                            size_t grain) {
+  grain = std::max<size_t>(grain, 1);
+
+  TaskGraph graph;
+  for (size_t begin = 0; begin < count; begin += grain) {
+    const size_t end = std::min(count, begin + grain);
+    graph.add("parallelFor", [&fn, begin, end] {
+      for (size_t i = begin; i < end; ++i)
+        fn(i);
+    });
+  }
+  run(graph);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void Executor::push(Job job) {
+  _queued.fetch_add(1);
+
+  const int self = currentWorker();
+  Worker &target = self >= 0 ? *_workers[self] : _injected;
+  {
+    std::lock_guard lock(target.mutex);
+    target.jobs.push_back(std::move(job));
+  }
+
+  // taking the lock orders the notify after a sleeper's predicate check
+  { std::lock_guard lock(_sleepMutex); }
+  _wake.notify_one();
+}
+
+bool Executor::tryPop(Job &job) {
+  const int self = currentWorker();
+  if (self >= 0) {
+    Worker &own = *_workers[self];
+    std::lock_guard lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.back()); // LIFO: hot in cache
+      own.jobs.pop_back();
+      return true;
+    }
+  }
+
+  std::lock_guard lock(_injected.mutex);
+  if (!_injected.jobs.empty()) {
+    job = std::move(_injected.jobs.front());
+    _injected.jobs.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool Executor::trySteal(Job &job, size_t self) {
+  const size_t count = _workers.size();
+  for (size_t i = 1; i <= count; ++i) {
+    Worker &victim = *_workers[(self + i) % count];
+    std::unique_lock lock(victim.mutex, std::try_to_lock);
+    if (lock.owns_lock() && !victim.jobs.empty()) {
+      job = std::move(victim.jobs.front()); // FIFO: oldest, largest work
+      victim.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Executor::runOne() {
+  const int self = currentWorker();
+  Job job;
+  if (!tryPop(job) && !trySteal(job, self >= 0 ? (size_t)self : 0)) {
+    return false;
+  }
+
+  _queued.fetch_sub(1);
+  job();
+  return true;
+}
+
+void Executor::work(size_t index) {
+  tlsExecutor = this;
+  tlsWorker = (int)index;
+  TRACE_THREAD_NAME(std::format("worker {}", index));
+
+  for (;;) {
+    if (runOne())
+      continue;
+
+    std::unique_lock lock(_sleepMutex);
+    if (_stop && _queued.load() == 0)
+      return;
+    _wake.wait_for(lock, std::chrono::milliseconds(10), [this] {
+      return _stop || _queued.load() > 0;
+    });
+  }
+}
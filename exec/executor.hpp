@@ -0,0 +1,109 @@
+#ifndef EXEC_EXECUTOR_HPP
+#define EXEC_EXECUTOR_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A DAG of tasks. Edges are added with precede(); a task starts once
+ * all of its predecessors have finished.
+ */
+class TaskGraph {
+public:
+  using TaskId = size_t;
+
+  /// `name` must be a string literal, it labels the task in traces.
+  TaskId add(const char *name, std::function<void()> fn);
+
+  /// `before` has to finish before `after` may start.
+  void precede(TaskId before, TaskId after);
+
+  /// Chains the tasks in order, returns the last one.
+  TaskId chain(std::initializer_list<TaskId> tasks);
+
+  size_t size() const { return _nodes.size(); }
+  bool empty() const { return _nodes.empty(); }
+
+  /// Throws std::invalid_argument if the edges form a cycle.
+  void validate() const;
+
+private:
+  friend class Executor;
+
+  struct Node {
+    const char *name;
+    std::function<void()> fn;
+    std::vector<TaskId> successors;
+    size_t dependencies = 0;
+  };
+
+  std::vector<Node> _nodes;
+};
+
+/**
+ * @brief Work-stealing thread pool that runs TaskGraphs.
+ *
+ * Every worker owns a deque: it pushes and pops its own work at the back and
+ * idle workers steal from the front of the others. Threads that are not
+ * workers hand work in through an injection queue. A worker that waits for a
+ * nested graph keeps executing tasks, and parks with backoff while there are
+ * none, so graphs may be run from inside tasks.
+ */
+class Executor {
+public:
+  explicit Executor(unsigned threads = std::thread::hardware_concurrency());
+  ~Executor();
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  /**
+   * @brief Runs the graph to completion. If a task throws, everything that
+   * depends on it is skipped, independent tasks still run, and the first
+   * exception is rethrown here. A graph with a cycle throws before any task
+   * runs.
+   */
+  void run(TaskGraph &graph);
+
+  /// Calls fn(i) for i in [0, count), `grain` indices per task.
+  void parallelFor(size_t count, const std::function<void(size_t)> &fn,
+                    size_t grain = 1);
+
+  unsigned size() const { return (unsigned)_workers.size(); }
+
+  /// Index of the calling worker thread of this executor, or -1.
+  int currentWorker() const;
+
+private:
+  using Job = std::function<void()>;
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  void push(Job job);
+  bool tryPop(Job &job);
+  bool trySteal(Job &job, size_t self);
+  bool runOne();
+  void work(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> _workers;
+  Worker _injected;
+
+  std::mutex _sleepMutex;
+  std::condition_variable _wake;
+  std::atomic<size_t> _queued{0};
+  bool _stop = false;
+
+  std::vector<std::jthread> _threads;
+};
+
+#endif // EXEC_EXECUTOR_HPP
@@ -0,0 +1,310 @@
+#include "ascii_shaper.hpp"
+
+#include <hb-aat.h>
+#include <hb-ft.h>
+#include <hb-ot.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <span>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+void ReleaseShaper(void *object) {
+  FT_Face face = static_cast<FT_Face>(object);
+  delete static_cast<AsciiShaper *>(face->generic.data);
+  face->generic.data = nullptr;
+}
+
+// what ShapeRun() does for a one-run Latin text
+unsigned ShapeLatin(hb_font_t *font, hb_buffer_t *buf, std::string_view text,
+                    const hb_glyph_info_t *&infos,
+                    const hb_glyph_position_t *&positions) {
+  hb_buffer_clear_contents(buf);
+  hb_buffer_add_utf8(buf, text.data(), (int)text.size(), 0, (int)text.size());
+  hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
+  hb_buffer_set_script(buf, HB_SCRIPT_LATIN);
+  hb_buffer_guess_segment_properties(buf);
+  hb_shape(font, buf, nullptr, 0);
+
+  unsigned count = 0;
+  infos = hb_buffer_get_glyph_infos(buf, &count);
+  positions = hb_buffer_get_glyph_positions(buf, &count);
+  return count;
+}
+
+enum class GposLookup { Adjustment, SkipsSecond, Contextual };
+
+/**
+ * @brief What a GPOS lookup does, read from the raw table because HarfBuzz
+ * does not tell. Single, pair, cursive and mark lookups are adjustments,
+ * unless a pair subtable has a second value record: HarfBuzz then moves
+ * past the second glyph, so it cannot start a pair of the same lookup.
+ * Context and chained context lookups, and anything that cannot be read,
+ * are contextual.
+ */
+GposLookup ClassifyGposLookup(std::span<const uint8_t> gpos, unsigned index) {
+  const auto read = [&](size_t offset, size_t bytes, uint32_t &out) {
+    if (offset + bytes > gpos.size())
+      return false;
+    out = 0;
+    for (size_t i = 0; i < bytes; ++i)
+      out = out << 8 | gpos[offset + i];
+    return true;
+  };
+
+  uint32_t list, count, lookup, type, subtables;
+  if (!read(8, 2, list) || !read(list, 2, count) || index >= count ||
+      !read(list + 2 + 2 * index, 2, lookup))
+    return GposLookup::Contextual;
+  lookup += list;
+  if (!read(lookup, 2, type) || !read(lookup + 4, 2, subtables))
+    return GposLookup::Contextual;
+
+  bool skips = false;
+  for (uint32_t i = 0; i < subtables; ++i) {
+    uint32_t offset, subtype = type, extension;
+    if (!read(lookup + 6 + 2 * i, 2, offset))
+      return GposLookup::Contextual;
+    size_t subtable = lookup + offset;
+    if (type == 9) { // extension: the actual type and a 32-bit offset
+      if (!read(subtable + 2, 2, subtype) ||
+          !read(subtable + 4, 4, extension))
+        return GposLookup::Contextual;
+      subtable += extension;
+    }
+    if (subtype < 1 || subtype > 6)
+      return GposLookup::Contextual;
+
+    uint32_t valueFormat2 = 0;
+    if (subtype == 2 && !read(subtable + 6, 2, valueFormat2))
+      return GposLookup::Contextual;
+    skips |= valueFormat2 != 0;
+  }
+  return skips ? GposLookup::SkipsSecond : GposLookup::Adjustment;
+}
+
+/**
+ * @brief Glyphs the Latin shape plan's lookups may change. All of them for
+ * GSUB, which could substitute, and for contextual GPOS lookups. The other
+ * GPOS lookups adjust single glyphs or pairs, whose effect shows when
+ * shaping one or two characters, so their glyphs go into `kerned`; those of
+ * pair lookups that skip the second glyph also go into `skipping`.
+ */
+void CollectLookupGlyphs(hb_font_t *font, hb_set_t *unsafe, hb_set_t *kerned,
+                         hb_set_t *skipping) {
+  hb_face_t *face = hb_font_get_face(font);
+  hb_segment_properties_t props = HB_SEGMENT_PROPERTIES_DEFAULT;
+  props.direction = HB_DIRECTION_LTR;
+  props.script = HB_SCRIPT_LATIN;
+  props.language = hb_language_get_default();
+  hb_shape_plan_t *plan =
+      hb_shape_plan_create_cached(face, &props, nullptr, 0, nullptr);
+  hb_blob_t *gposBlob = hb_face_reference_table(face, HB_OT_TAG_GPOS);
+  unsigned gposSize = 0;
+  const char *gposData = hb_blob_get_data(gposBlob, &gposSize);
+  const std::span<const uint8_t> gpos(
+      reinterpret_cast<const uint8_t *>(gposData), gposSize);
+
+  hb_set_t *lookups = hb_set_create();
+  hb_set_t *before = hb_set_create();
+  hb_set_t *input = hb_set_create();
+  hb_set_t *after = hb_set_create();
+  for (hb_tag_t table : {HB_OT_TAG_GSUB, HB_OT_TAG_GPOS}) {
+    hb_set_clear(lookups);
+    hb_ot_shape_plan_collect_lookups(plan, table, lookups);
+    for (hb_codepoint_t lookup = HB_SET_VALUE_INVALID;
+         hb_set_next(lookups, &lookup);) {
+      hb_set_clear(before);
+      hb_set_clear(input);
+      hb_set_clear(after);
+      // GSUB output goes with the input, GPOS has none
+      hb_ot_layout_lookup_collect_glyphs(face, table, lookup, before, input,
+                                         after, input);
+      const GposLookup kind = table == HB_OT_TAG_GPOS
+                                  ? ClassifyGposLookup(gpos, lookup)
+                                  : GposLookup::Contextual;
+      if (kind == GposLookup::Contextual) {
+        hb_set_union(unsafe, before);
+        hb_set_union(unsafe, input);
+        hb_set_union(unsafe, after);
+        continue;
+      }
+      hb_set_union(kerned, input);
+      if (kind == GposLookup::SkipsSecond)
+        hb_set_union(skipping, input);
+    }
+  }
+  hb_set_destroy(after);
+  hb_set_destroy(input);
+  hb_set_destroy(before);
+  hb_set_destroy(lookups);
+  hb_blob_destroy(gposBlob);
+  hb_shape_plan_destroy(plan);
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+const AsciiShaper *AsciiShaper::For(FT_Face face) {
+  if (face->generic.data && face->generic.finalizer != &ReleaseShaper)
+    return nullptr;
+
+  auto *shaper = static_cast<AsciiShaper *>(face->generic.data);
+  if (shaper && shaper->_xScale == face->size->metrics.x_scale &&
+      shaper->_yScale == face->size->metrics.y_scale)
+    return shaper;
+
+  // resized since, or never built
+  auto *built = new AsciiShaper(face);
+  delete shaper;
+  face->generic.data = built;
+  face->generic.finalizer = &ReleaseShaper;
+  return built;
+}
+
+AsciiShaper::AsciiShaper(FT_Face face)
+    : _xScale(face->size->metrics.x_scale),
+      _yScale(face->size->metrics.y_scale),
+      _kerning(kCount * kCount, kUnsafePair) {
+  TRACE_SCOPE("harfbuzz/ascii_tables");
+  hb_font_t *font = hb_ft_font_create_referenced(face);
+  hb_buffer_t *buf = hb_buffer_create();
+  try {
+    build(face, font, buf);
+  } catch (...) {
+    hb_buffer_destroy(buf);
+    hb_font_destroy(font);
+    throw;
+  }
+  hb_buffer_destroy(buf);
+  hb_font_destroy(font);
+}
+
+void AsciiShaper::build(FT_Face face, hb_font_t *font, hb_buffer_t *buf) {
+  // morx, kerx and trak are applied instead of, or as well as, GSUB and
+  // GPOS; such fonts always go through HarfBuzz
+  hb_face_t *hbFace = hb_font_get_face(font);
+  if (hb_aat_layout_has_substitution(hbFace) ||
+      hb_aat_layout_has_positioning(hbFace) ||
+      hb_aat_layout_has_tracking(hbFace)) {
+    spdlog::debug("'{}' has AAT tables, no ASCII fast path",
+                  face->family_name);
+    return;
+  }
+
+  hb_set_t *unsafe = hb_set_create();
+  hb_set_t *kerned = hb_set_create();
+  hb_set_t *skipping = hb_set_create();
+  CollectLookupGlyphs(font, unsafe, kerned, skipping);
+
+  const hb_glyph_info_t *infos;
+  const hb_glyph_position_t *pos;
+  for (unsigned i = 0; i < kCount; ++i) {
+    const char c = (char)(kFirst + i);
+    Char &entry = _chars[i];
+    if (!hb_font_get_nominal_glyph(font, (hb_codepoint_t)c, &entry.glyph) ||
+        hb_set_has(unsafe, entry.glyph))
+      continue;
+    if (ShapeLatin(font, buf, {&c, 1}, infos, pos) != 1 ||
+        infos[0].codepoint != entry.glyph || pos[0].x_offset != 0 ||
+        pos[0].y_offset != 0 || pos[0].y_advance != 0)
+      continue;
+    entry.advance = pos[0].x_advance;
+    entry.inked = hb_font_get_glyph_extents(font, entry.glyph, &entry.extents);
+    entry.safe = true;
+  }
+
+  // a legacy kern table or, without GPOS, HarfBuzz's fallback kerning may
+  // adjust any pair; otherwise only pairs starting with a glyph a GPOS pair
+  // adjustment covers, whatever follows (class 0 matches any glyph)
+  const bool anyPair =
+      FT_HAS_KERNING(face) || !hb_ot_layout_has_positioning(hbFace);
+
+  size_t pairs = 0, adjusted = 0;
+  for (unsigned a = 0; a < kCount; ++a) {
+    const Char &first = _chars[a];
+    if (!first.safe)
+      continue;
+    for (unsigned b = 0; b < kCount; ++b) {
+      const Char &second = _chars[b];
+      if (!second.safe)
+        continue;
+      hb_position_t &kerning = _kerning[a * kCount + b];
+      if (!anyPair && !hb_set_has(kerned, first.glyph)) {
+        kerning = 0;
+        continue;
+      }
+      // after a pair that skips `second`, HarfBuzz does not kern the pair
+      // `second` starts, which the table cannot express
+      if (hb_set_has(skipping, first.glyph) &&
+          hb_set_has(skipping, second.glyph))
+        continue;
+
+      ++pairs;
+      const char text[2] = {(char)(kFirst + a), (char)(kFirst + b)};
+      // the pair may only change the first advance; anything else, like
+      // moving the second glyph, is left to HarfBuzz
+      if (ShapeLatin(font, buf, {text, 2}, infos, pos) != 2 ||
+          infos[0].codepoint != first.glyph ||
+          infos[1].codepoint != second.glyph || pos[0].x_offset != 0 ||
+          pos[0].y_offset != 0 || pos[0].y_advance != 0 ||
+          pos[1].x_advance != second.advance || pos[1].x_offset != 0 ||
+          pos[1].y_offset != 0 || pos[1].y_advance != 0)
+        continue;
+      kerning = pos[0].x_advance - first.advance;
+      adjusted += kerning != 0;
+    }
+  }
+
+  hb_set_destroy(skipping);
+  hb_set_destroy(kerned);
+  hb_set_destroy(unsafe);
+
+  spdlog::debug("ASCII tables for '{}': {} of {} characters, {} of {} pairs "
+                "shaped are kerned",
+                face->family_name,
+                std::count_if(_chars.begin(), _chars.end(),
+                              [](const Char &entry) { return entry.safe; }),
+                kCount, adjusted, pairs);
+}
+
+bool AsciiShaper::IsSimpleText(std::string_view text) {
+  bool letter = false;
+  for (char c : text) {
+    if ((unsigned char)c < kFirst || (unsigned char)c > kLast)
+      return false;
+    letter |= (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+  }
+  return letter;
+}
+
+bool AsciiShaper::accepts(std::string_view text) const {
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (!_chars[(unsigned char)text[i] - kFirst].safe)
+      return false;
+    if (i + 1 < text.size() &&
+        _kerning[pair(text[i], text[i + 1])] == kUnsafePair)
+      return false;
+  }
+  return true;
+}
+
+void AsciiShaper::shape(std::string_view text,
+                        std::vector<hb_glyph_info_t> &infos,
+                        std::vector<hb_glyph_position_t> &positions) const {
+  infos.assign(text.size(), hb_glyph_info_t{});
+  positions.assign(text.size(), hb_glyph_position_t{});
+  for (size_t i = 0; i < text.size(); ++i) {
+    const Char &entry = _chars[(unsigned char)text[i] - kFirst];
+    infos[i].codepoint = entry.glyph;
+    infos[i].cluster = (uint32_t)i;
+    positions[i].x_advance = entry.advance;
+    if (i + 1 < text.size())
+      positions[i].x_advance += _kerning[pair(text[i], text[i + 1])];
+  }
+}
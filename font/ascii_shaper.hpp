@@ -0,0 +1,80 @@
+#ifndef FONT_ASCII_SHAPER_HPP
+#define FONT_ASCII_SHAPER_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <hb.h>
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Shapes printable ASCII without HarfBuzz, from cmap, advance,
+ * kerning pair and extent tables that are read from HarfBuzz once per face
+ * and size.
+ *
+ * Only text HarfBuzz is known to shape as nominal glyphs plus pair kerning
+ * is accepted: characters that no GSUB lookup and no contextual GPOS lookup
+ * of the Latin shape plan touches, and pairs whose kerning only changes the
+ * first glyph's advance and does not make HarfBuzz skip the second glyph,
+ * so every pair of the text is kerned on its own. For such text, glyphs,
+ * positions and extents are exactly the ones hb_shape() and
+ * hb_font_get_glyph_extents() give.
+ */
+class AsciiShaper {
+public:
+  /**
+   * @brief The tables of `face` at its current size. They are built on
+   * first use and freed with the face through FT_Face::generic. Returns
+   * null if something else already uses that slot.
+   */
+  static const AsciiShaper *For(FT_Face face);
+
+  explicit AsciiShaper(FT_Face face);
+
+  /// Printable ASCII with at least one letter, so it itemizes as one
+  /// left-to-right Latin run. This is cheap and needs no tables.
+  static bool IsSimpleText(std::string_view text);
+
+  /// Whether shape() matches HarfBuzz for `text`, which must be simple.
+  bool accepts(std::string_view text) const;
+
+  /// Glyphs in HarfBuzz's form; clusters are byte offsets into `text`.
+  void shape(std::string_view text, std::vector<hb_glyph_info_t> &infos,
+             std::vector<hb_glyph_position_t> &positions) const;
+
+  /// hb_font_get_glyph_extents() for the glyph of `c`.
+  bool extents(char c, hb_glyph_extents_t &out) const {
+    const Char &entry = _chars[(unsigned char)c - kFirst];
+    out = entry.extents;
+    return entry.inked;
+  }
+
+private:
+  static constexpr unsigned kFirst = 0x20, kLast = 0x7E;
+  static constexpr unsigned kCount = kLast - kFirst + 1;
+  static constexpr hb_position_t kUnsafePair = INT32_MIN;
+
+  struct Char {
+    hb_codepoint_t glyph = 0;
+    hb_position_t advance = 0; // 26.6, before kerning
+    hb_glyph_extents_t extents{};
+    bool inked = false; // extents are valid
+    bool safe = false;
+  };
+
+  void build(FT_Face face, hb_font_t *font, hb_buffer_t *buf);
+
+  static unsigned pair(char a, char b) {
+    return ((unsigned char)a - kFirst) * kCount + ((unsigned char)b - kFirst);
+  }
+
+  FT_Fixed _xScale, _yScale;
+  std::array<Char, kCount> _chars{};
+  std::vector<hb_position_t> _kerning; // added to the first advance
+};
+
+#endif // FONT_ASCII_SHAPER_HPP
@@ -0,0 +1,52 @@
+#include "atlas.hpp"
+
+#include <format>
+#include <stdexcept>
+
+namespace {
+
+uint16_t Unorm16(unsigned texel, unsigned extent) {
+  return (uint16_t)(((uint64_t)texel * 65535u + extent / 2) / extent);
+}
+
+} // namespace
+
+uint32_t GlyphAtlas::add(uint16_t font, FT_UInt glyphIndex,
+                         glm::uvec2 position, glm::uvec2 size,
+                         glm::vec2 bearing) {
+  if (position.x + size.x > _size.x || position.y + size.y > _size.y) {
+    throw std::out_of_range(std::format(
+        "glyph {} at ({}, {}) size ({}, {}) exceeds the {}x{} atlas",
+        glyphIndex, position.x, position.y, size.x, size.y, _size.x, _size.y));
+  }
+
+  AtlasGlyph entry;
+  entry.bearing = bearing;
+  entry.size = glm::vec2(size);
+  entry.u0 = Unorm16(position.x, _size.x);
+  entry.v0 = Unorm16(position.y, _size.y);
+  entry.u1 = Unorm16(position.x + size.x, _size.x);
+  entry.v1 = Unorm16(position.y + size.y, _size.y);
+
+  auto [it, inserted] = _index.emplace(Key(font, glyphIndex), 0);
+  if (!inserted) {
+    _entries[it->second] = entry; // moved within the texture
+  } else if (!_free.empty()) {
+    it->second = _free.back();
+    _free.pop_back();
+    _entries[it->second] = entry;
+  } else {
+    it->second = (uint32_t)_entries.size();
+    _entries.push_back(entry);
+  }
+  return it->second;
+}
+
+void GlyphAtlas::remove(uint16_t font, FT_UInt glyphIndex) {
+  auto it = _index.find(Key(font, glyphIndex));
+  if (it == _index.end())
+    return;
+  _entries[it->second] = {glm::vec2(0.0f), glm::vec2(0.0f), 0, 0, 0, 0};
+  _free.push_back(it->second);
+  _index.erase(it);
+}
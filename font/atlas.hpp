@@ -0,0 +1,69 @@
+#ifndef FONT_ATLAS_HPP
+#define FONT_ATLAS_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * @brief Where a glyph lives in the atlas texture. Matches `struct AtlasGlyph`
+ * in glyph_quads.cl, keep both in sync.
+ */
+struct AtlasGlyph {
+  glm::vec2 bearing; // left and top edge relative to the pen, px, y up
+  glm::vec2 size;    // px at the atlas em size
+  uint16_t u0, v0;   // texture rect, unorm16
+  uint16_t u1, v1;
+};
+static_assert(sizeof(AtlasGlyph) == 24);
+
+/**
+ * @brief Lookup from (font, glyph) to the glyph's place in an SDF/MSDF atlas
+ * texture. Entries are stored densely so they can be uploaded as one table
+ * and referenced by index.
+ */
+class GlyphAtlas {
+public:
+  static constexpr uint32_t kMissing = UINT32_MAX;
+
+  /// `emSize` is the pixel size the glyphs were rendered at.
+  GlyphAtlas(glm::uvec2 size, float emSize) : _size(size), _emSize(emSize) {}
+
+  /// Adds or moves a glyph stored at `position` (texels), returns its index.
+  uint32_t add(uint16_t font, FT_UInt glyphIndex, glm::uvec2 position,
+               glm::uvec2 size, glm::vec2 bearing);
+
+  /**
+   * @brief Forgets a glyph. Its entry is zeroed, so quads still referring to
+   * it draw nothing, and the index is handed out again by a later add().
+   */
+  void remove(uint16_t font, FT_UInt glyphIndex);
+
+  /// Index of the glyph's entry or kMissing.
+  uint32_t find(uint16_t font, FT_UInt glyphIndex) const {
+    auto it = _index.find(Key(font, glyphIndex));
+    return it == _index.end() ? kMissing : it->second;
+  }
+
+  const std::vector<AtlasGlyph> &entries() const { return _entries; }
+  glm::uvec2 size() const { return _size; }
+  float emSize() const { return _emSize; }
+
+private:
+  static uint64_t Key(uint16_t font, FT_UInt glyphIndex) {
+    return ((uint64_t)font << 32) | glyphIndex;
+  }
+
+  glm::uvec2 _size;
+  float _emSize;
+  std::unordered_map<uint64_t, uint32_t> _index;
+  std::vector<AtlasGlyph> _entries;
+  std::vector<uint32_t> _free; // removed entry indices
+};
+
+#endif // FONT_ATLAS_HPP
@@ -0,0 +1,191 @@
+#include "atlas_build.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "distance_field.hpp"
+#include "outline.hpp"
+#include "shaping.hpp"
+#include "trace/trace.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+constexpr unsigned kGap = 1; // empty texels between cells against bleeding
+
+/// Shelf packing by decreasing height, then width, then glyph index, so
+/// positions depend on nothing but the glyph set. Returns the height used.
+unsigned Pack(std::vector<BuiltGlyph> &glyphs, unsigned width) {
+  std::vector<BuiltGlyph *> order;
+  for (BuiltGlyph &g : glyphs) {
+    if (g.size.x == 0)
+      continue;
+    if (g.size.x > width) {
+      throw std::runtime_error(
+          std::format("glyph {} is {} texels wide, the atlas only {}",
+                      g.glyph, g.size.x, width));
+    }
+    order.push_back(&g);
+  }
+  std::sort(order.begin(), order.end(),
+            [](const BuiltGlyph *a, const BuiltGlyph *b) {
+              if (a->size.y != b->size.y)
+                return a->size.y > b->size.y;
+              if (a->size.x != b->size.x)
+                return a->size.x > b->size.x;
+              return a->glyph < b->glyph;
+            });
+
+  glm::uvec2 pen(0);
+  unsigned shelf = 0;
+  for (BuiltGlyph *g : order) {
+    if (pen.x + g->size.x > width) {
+      pen = glm::uvec2(0, pen.y + shelf + kGap);
+      shelf = 0;
+    }
+    g->position = pen;
+    pen.x += g->size.x + kGap;
+    shelf = std::max(shelf, g->size.y);
+  }
+  return pen.y + shelf;
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+GlyphAtlas BuiltAtlas::atlas(uint16_t font) const {
+  GlyphAtlas atlas(image.size, emSize);
+  for (const BuiltGlyph &g : glyphs) {
+    if (g.size.x)
+      atlas.add(font, g.glyph, g.position, g.size, g.bearing);
+  }
+  return atlas;
+}
+
+BuiltAtlas BuildAtlas(FT_Face face, std::span<const FT_UInt> glyphs,
+                      const AtlasBuildOptions &options,
+                      const AtlasProgress &progress) {
+  TRACE_SCOPE("atlas/build");
+  if (!(options.pixelSize > 0.0f) || !(options.spread > 0.0f)) {
+    throw std::invalid_argument(
+        std::format("invalid atlas size {} px or spread {} px",
+                    options.pixelSize, options.spread));
+  }
+
+  BuiltAtlas out;
+  out.kind = options.kind;
+  out.emSize = options.pixelSize;
+  out.distanceRange = 2.0f * options.spread;
+
+  std::vector<FT_UInt> sorted(glyphs.begin(), glyphs.end());
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  // decomposing is cheap next to the fields, and the face is not shared
+  OutlineCache cache(face);
+  const float scale = cache.scaleFor(options.pixelSize);
+  std::vector<GlyphOutline> outlines;
+  outlines.reserve(sorted.size());
+  for (FT_UInt glyph : sorted) {
+    GlyphOutline outline = cache.get(glyph).scaled(scale);
+    BuiltGlyph g;
+    g.glyph = glyph;
+    g.advance = outline.advance;
+    if (!outline.empty()) {
+      const glm::vec2 lo = glm::floor(outline.min - options.spread);
+      const glm::vec2 hi = glm::ceil(outline.max + options.spread);
+      g.bearing = glm::vec2(lo.x, hi.y);
+      g.size = glm::uvec2(hi - lo);
+    }
+    out.glyphs.push_back(g);
+    outlines.push_back(std::move(outline));
+  }
+
+  const unsigned channels = (unsigned)options.kind;
+  const unsigned height = Pack(out.glyphs, options.width);
+  out.image.size = glm::uvec2(options.width, std::max(height, 1u));
+  out.image.channels = channels;
+  out.image.pixels.assign(
+      (size_t)out.image.size.x * out.image.size.y * channels, 0);
+
+  const size_t total = out.glyphs.size();
+  const size_t pitch = (size_t)out.image.size.x * channels;
+  const DistanceFieldOptions field{options.kind, out.distanceRange};
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+
+  // glyphs vary a lot in cost, so workers pull them one at a time; each
+  // writes only its own cell
+  const auto work = [&] {
+    TRACE_SCOPE("atlas/generate");
+    for (size_t i; (i = next++) < total; ++done) {
+      const BuiltGlyph &g = out.glyphs[i];
+      if (g.size.x == 0)
+        continue;
+      uint8_t *cell = out.image.pixels.data() + g.position.y * pitch +
+                      (size_t)g.position.x * channels;
+      GenerateDistanceField(outlines[i], field, g.bearing, g.size, cell,
+                            pitch);
+    }
+  };
+
+  unsigned threads = options.threads ? options.threads
+                                     : std::thread::hardware_concurrency();
+  threads = (unsigned)std::clamp<size_t>(threads, 1,
+                                         std::max<size_t>(total, 1));
+  std::vector<std::future<void>> pending;
+  for (unsigned t = 0; t < threads; ++t)
+    pending.push_back(std::async(std::launch::async, work));
+
+  for (auto &job : pending) {
+    while (job.wait_for(std::chrono::milliseconds(100)) !=
+           std::future_status::ready) {
+      if (progress)
+        progress(done.load(), total);
+    }
+  }
+  for (auto &job : pending)
+    job.get();
+  if (progress)
+    progress(total, total);
+
+  return out;
+}
+
+std::vector<FT_UInt>
+GlyphsForRanges(FT_Face face,
+                std::span<const std::pair<char32_t, char32_t>> ranges) {
+  std::vector<FT_UInt> glyphs;
+  for (const auto &[first, last] : ranges) {
+    for (char32_t cp = first; cp <= last && cp <= 0x10FFFF; ++cp) {
+      if (FT_UInt glyph = FT_Get_Char_Index(face, cp))
+        glyphs.push_back(glyph);
+    }
+  }
+  std::sort(glyphs.begin(), glyphs.end());
+  glyphs.erase(std::unique(glyphs.begin(), glyphs.end()), glyphs.end());
+  return glyphs;
+}
+
+std::vector<FT_UInt> GlyphsForText(FT_Face face, std::string_view utf8Text) {
+  std::vector<FT_UInt> glyphs;
+  for (size_t offset = 0; offset < utf8Text.size();) {
+    const char32_t cp = NextCodepoint(utf8Text, offset);
+    if (FT_UInt glyph = FT_Get_Char_Index(face, cp))
+      glyphs.push_back(glyph);
+  }
+  for (const Glyph &g : shape(face, utf8Text).glyphs) {
+    if (g.glyphIndex)
+      glyphs.push_back(g.glyphIndex);
+  }
+  std::sort(glyphs.begin(), glyphs.end());
+  glyphs.erase(std::unique(glyphs.begin(), glyphs.end()), glyphs.end());
+  return glyphs;
+}
@@ -0,0 +1,75 @@
+#ifndef FONT_ATLAS_BUILD_HPP
+#define FONT_ATLAS_BUILD_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <functional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "atlas.hpp"
+#include "output.hpp"
+#include "sdf.hpp"
+
+struct AtlasBuildOptions {
+  SdfKind kind = SdfKind::Msdf;
+  float pixelSize = 32.0f; // em size the fields are generated at
+  float spread = 4.0f;     // px from the edge to where the field saturates
+  unsigned width = 1024;   // texels; the height follows from the packing
+  unsigned threads = 0;    // 0 = one per core
+};
+
+/// One glyph of a built atlas, in the terms of GlyphAtlas::add.
+struct BuiltGlyph {
+  FT_UInt glyph = 0;
+  glm::uvec2 position{0}; // texels, top left
+  glm::uvec2 size{0};     // texels including the spread, 0 when blank
+  glm::vec2 bearing{0.0f}; // cell's left and top edge from the pen, px, y up
+  float advance = 0.0f;    // px
+};
+
+struct BuiltAtlas {
+  OutputImage image; // channels as the kind
+  SdfKind kind = SdfKind::Msdf;
+  float emSize = 0.0f;
+  float distanceRange = 0.0f;  // 2 * spread
+  std::vector<BuiltGlyph> glyphs; // ascending glyph index
+
+  /// Runtime lookup of the non-blank glyphs, e.g. for BuildGlyphQuads.
+  GlyphAtlas atlas(uint16_t font = 0) const;
+
+  SdfAtlasView view() const {
+    return {image.pixels.data(), image.size, kind, distanceRange};
+  }
+};
+
+/// Called from the building thread with glyphs done so far.
+using AtlasProgress = std::function<void(size_t done, size_t total)>;
+
+/**
+ * @brief Generates distance fields for `glyphs` of `face` on `threads` cores
+ * and packs them into one texture. Glyphs are placed by size and index only
+ * and every field is generated independently, so the result is identical
+ * across runs and thread counts.
+ */
+BuiltAtlas BuildAtlas(FT_Face face, std::span<const FT_UInt> glyphs,
+                      const AtlasBuildOptions &options,
+                      const AtlasProgress &progress = {});
+
+/// Glyphs the face's cmap maps the inclusive code point ranges to.
+std::vector<FT_UInt>
+GlyphsForRanges(FT_Face face,
+                std::span<const std::pair<char32_t, char32_t>> ranges);
+
+/**
+ * @brief Glyphs needed to render `utf8Text`: every mapped code point plus
+ * whatever shaping substitutes, such as ligatures and contextual forms.
+ */
+std::vector<FT_UInt> GlyphsForText(FT_Face face, std::string_view utf8Text);
+
+#endif // FONT_ATLAS_BUILD_HPP
@@ -0,0 +1,398 @@
+#include "atlas_manager.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr uint32_t kFree = UINT32_MAX;
+constexpr uint32_t kRetired = UINT32_MAX - 1;
+constexpr uint32_t kWholeSlab = UINT32_MAX;
+constexpr uint8_t kMinClass = 3; // 8 px cells
+constexpr uint8_t kMaxClass = std::bit_width(kAtlasSlab) - 1;
+
+uint8_t SizeClass(glm::uvec2 size) {
+  const unsigned edge = std::max({size.x, size.y, 1u << kMinClass});
+  return (uint8_t)std::bit_width(edge - 1);
+}
+
+size_t CellsPerSlab(uint8_t sizeClass) {
+  const size_t perRow = kAtlasSlab >> sizeClass;
+  return perRow * perRow;
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+AtlasManager::AtlasManager(const AtlasBudget &budget, float emSize)
+    : _budget(budget),
+      _atlas({budget.pageSize.x, budget.pageSize.y * budget.maxPages}, emSize),
+      _slabGrid(budget.pageSize / kAtlasSlab) {
+  if (budget.pageSize.x % kAtlasSlab || budget.pageSize.y % kAtlasSlab ||
+      _slabGrid.x == 0 || _slabGrid.y == 0) {
+    throw std::invalid_argument(
+        std::format("atlas page {}x{} is not a multiple of {}",
+                    budget.pageSize.x, budget.pageSize.y, kAtlasSlab));
+  }
+  // unorm16 texture coordinates span all pages
+  if (budget.maxPages == 0 || budget.pageSize.y * budget.maxPages > 65536) {
+    throw std::invalid_argument(
+        std::format("{} atlas pages of height {} do not fit unorm16 UVs",
+                    budget.maxPages, budget.pageSize.y));
+  }
+  if (budget.channels == 0 || budget.channels > 4) {
+    throw std::invalid_argument(
+        std::format("unsupported atlas channel count {}", budget.channels));
+  }
+
+  // evicting a glyph a submitted frame still samples would corrupt it
+  _budget.minIdleFrames =
+      std::max(_budget.minIdleFrames, _budget.framesInFlight + 1);
+
+  // one spare row keeps bilinear taps below the last page in bounds
+  _texels.resize(pitch());
+}
+
+void AtlasManager::beginFrame() {
+  ++_frame;
+
+  std::erase_if(_retired, [this](const Retired &retired) {
+    if (retired.frame > _frame)
+      return false;
+
+    Slab &slab = _slabs[retired.slab];
+    if (retired.cell == kWholeSlab) {
+      slab.retired = 0;
+    } else {
+      slab.cells[retired.cell] = kFree;
+      --slab.retired;
+    }
+    if (slab.used == 0 && slab.retired == 0) {
+      slab.sizeClass = kUnassigned;
+      slab.cells.clear();
+    }
+    return true;
+  });
+
+  // trailing empty pages give their memory back
+  while (_pages > 0) {
+    const auto first = _slabs.begin() + (_pages - 1) * slabsPerPage();
+    if (!std::all_of(first, _slabs.end(), [](const Slab &slab) {
+          return slab.sizeClass == kUnassigned;
+        })) {
+      break;
+    }
+    --_pages;
+    _slabs.erase(first, _slabs.end());
+    _texels.resize(((size_t)_pages * _budget.pageSize.y + 1) * pitch());
+    _texels.shrink_to_fit();
+  }
+}
+
+uint32_t AtlasManager::use(uint16_t font, FT_UInt glyphIndex) {
+  const uint32_t entry = _atlas.find(font, glyphIndex);
+  if (entry != GlyphAtlas::kMissing)
+    _residents[entry].lastUse = _frame;
+  return entry;
+}
+
+std::optional<AtlasAllocation>
+AtlasManager::insert(uint16_t font, FT_UInt glyphIndex, glm::uvec2 size,
+                     glm::vec2 bearing) {
+  if (size.x > kAtlasSlab || size.y > kAtlasSlab) {
+    throw std::invalid_argument(
+        std::format("glyph {} of {}x{} exceeds the {} px atlas slab",
+                    glyphIndex, size.x, size.y, kAtlasSlab));
+  }
+
+  const uint8_t sizeClass = SizeClass(size);
+  if (const uint32_t entry = use(font, glyphIndex);
+      entry != GlyphAtlas::kMissing) {
+    const Resident &r = _residents[entry];
+    return AtlasAllocation{entry, cellPosition(r.slab, r.cell),
+                           1u << _slabs[r.slab].sizeClass};
+  }
+
+  auto cell = findCell(sizeClass);
+  if (!cell && evictFor(sizeClass))
+    cell = findCell(sizeClass);
+  if (!cell) {
+    spdlog::warn("atlas budget of {} pages exhausted by glyphs in use",
+                 _budget.maxPages);
+    return std::nullopt;
+  }
+
+  const auto [slab, index] = *cell;
+  const glm::uvec2 position = cellPosition(slab, index);
+  const uint32_t entry = _atlas.add(font, glyphIndex, position, size, bearing);
+  if (entry >= _residents.size())
+    _residents.resize(entry + 1);
+
+  Resident &r = _residents[entry];
+  r = {glyphIndex, font, true, _frame, slab, index, size, bearing};
+  _slabs[slab].cells[index] = entry;
+  ++_slabs[slab].used;
+  ++_glyphs;
+
+  // the previous occupant's texels would bleed into bilinear taps
+  const unsigned edge = 1u << sizeClass;
+  for (unsigned y = 0; y < edge; ++y) {
+    std::memset(&_texels[(position.y + y) * pitch() +
+                         position.x * _budget.channels],
+                0, (size_t)edge * _budget.channels);
+  }
+  return AtlasAllocation{entry, position, edge};
+}
+
+size_t AtlasManager::evictIdle(uint32_t idleFrames) {
+  idleFrames = std::max(idleFrames, _budget.minIdleFrames);
+  size_t count = 0;
+  for (uint32_t e = 0; e < _residents.size(); ++e) {
+    if (_residents[e].live && _frame - _residents[e].lastUse > idleFrames) {
+      evict(e);
+      ++count;
+    }
+  }
+  return count;
+}
+
+std::vector<AtlasMove> AtlasManager::defragment(unsigned maxMoves) {
+  TRACE_SCOPE("atlas/defragment");
+  std::vector<AtlasMove> moves;
+
+  // whole slabs of the last page move into free slabs further up, so the
+  // page can be dropped once the old copies retire
+  if (_pages > 1) {
+    const uint32_t lastPage = (_pages - 1) * slabsPerPage();
+    uint32_t target = 0;
+    for (uint32_t s = lastPage; s < _slabs.size(); ++s) {
+      if (moves.size() >= maxMoves)
+        return moves;
+      Slab &source = _slabs[s];
+      if (source.sizeClass == kUnassigned || source.retired > 0)
+        continue;
+
+      while (target < lastPage && _slabs[target].sizeClass != kUnassigned)
+        ++target;
+      if (target == lastPage)
+        break;
+
+      const glm::uvec2 from = slabPosition(s);
+      const glm::uvec2 to = slabPosition(target);
+      moves.push_back({from.x, from.y, to.x, to.y, kAtlasSlab, kAtlasSlab});
+      copy(moves.back());
+
+      Slab &dest = _slabs[target];
+      dest.sizeClass = source.sizeClass;
+      dest.cells = source.cells;
+      dest.used = source.used;
+      for (uint32_t c = 0; c < dest.cells.size(); ++c) {
+        if (dest.cells[c] < kRetired)
+          place(dest.cells[c], target, c);
+      }
+
+      std::fill(source.cells.begin(), source.cells.end(), kRetired);
+      source.used = 0;
+      source.retired = (uint16_t)source.cells.size();
+      _retired.push_back({_frame + _budget.framesInFlight, s, kWholeSlab});
+    }
+    // the slabs just filled must not be read or written by the moves below
+    // in the same call: the replay runs all of a call's moves unordered
+    if (!moves.empty())
+      return moves;
+  }
+
+  // per size class, empty the least used slab into the others if they have
+  // room for all of it; partial work continues on the next call
+  for (uint8_t k = kMinClass; k <= kMaxClass; ++k) {
+    uint32_t source = kFree;
+    size_t room = 0;
+    for (uint32_t s = 0; s < _slabs.size(); ++s) {
+      const Slab &slab = _slabs[s];
+      if (slab.sizeClass != k)
+        continue;
+      room += slab.cells.size() - slab.used - slab.retired;
+      if (slab.used > 0 &&
+          (source == kFree || slab.used <= _slabs[source].used))
+        source = s;
+    }
+    if (source == kFree)
+      continue;
+    Slab &from = _slabs[source];
+    room -= from.cells.size() - from.used - from.retired;
+    if (room < from.used)
+      continue;
+
+    const unsigned edge = 1u << k;
+    uint32_t target = 0;
+    for (uint32_t c = 0; c < from.cells.size() && from.used > 0; ++c) {
+      if (moves.size() >= maxMoves)
+        return moves;
+      const uint32_t entry = from.cells[c];
+      if (entry >= kRetired)
+        continue;
+
+      // the room check above guarantees a free cell in another slab
+      std::optional<uint32_t> freeCell;
+      for (; !freeCell; ++target) {
+        Slab &slab = _slabs[target];
+        if (target == source || slab.sizeClass != k ||
+            slab.used + slab.retired == slab.cells.size())
+          continue;
+        const auto it = std::find(slab.cells.begin(), slab.cells.end(), kFree);
+        freeCell = (uint32_t)(it - slab.cells.begin());
+        break;
+      }
+
+      const glm::uvec2 src = cellPosition(source, c);
+      const glm::uvec2 dst = cellPosition(target, *freeCell);
+      moves.push_back({src.x, src.y, dst.x, dst.y, edge, edge});
+      copy(moves.back());
+
+      _slabs[target].cells[*freeCell] = entry;
+      ++_slabs[target].used;
+      place(entry, target, *freeCell);
+
+      from.cells[c] = kRetired;
+      --from.used;
+      ++from.retired;
+      _retired.push_back({_frame + _budget.framesInFlight, source, c});
+    }
+  }
+  return moves;
+}
+
+SdfAtlasView AtlasManager::view(SdfKind kind, float distanceRange) const {
+  if ((unsigned)kind != _budget.channels) {
+    throw std::invalid_argument(
+        std::format("atlas has {} channels, view asks for {}",
+                    _budget.channels, (unsigned)kind));
+  }
+  return {_texels.data(), _atlas.size(), kind, distanceRange};
+}
+
+/* ------------------------------------------------------------------------- */
+
+glm::uvec2 AtlasManager::slabPosition(uint32_t slab) const {
+  const unsigned page = slab / slabsPerPage();
+  const unsigned s = slab % slabsPerPage();
+  return {s % _slabGrid.x * kAtlasSlab,
+          page * _budget.pageSize.y + s / _slabGrid.x * kAtlasSlab};
+}
+
+glm::uvec2 AtlasManager::cellPosition(uint32_t slab, uint32_t cell) const {
+  const uint8_t k = _slabs[slab].sizeClass;
+  const unsigned perRow = kAtlasSlab >> k;
+  return slabPosition(slab) +
+         glm::uvec2(cell % perRow << k, cell / perRow << k);
+}
+
+std::optional<std::pair<uint32_t, uint32_t>>
+AtlasManager::findCell(uint8_t sizeClass) {
+  // lowest slabs first, which keeps the last page the emptiest
+  for (uint32_t s = 0; s < _slabs.size(); ++s) {
+    Slab &slab = _slabs[s];
+    if (slab.sizeClass != sizeClass ||
+        slab.used + slab.retired == slab.cells.size())
+      continue;
+    const auto it = std::find(slab.cells.begin(), slab.cells.end(), kFree);
+    return std::pair(s, (uint32_t)(it - slab.cells.begin()));
+  }
+
+  auto unassigned = std::find_if(_slabs.begin(), _slabs.end(), [](auto &s) {
+    return s.sizeClass == kUnassigned;
+  });
+  if (unassigned == _slabs.end()) {
+    if (_pages == _budget.maxPages)
+      return std::nullopt;
+    addPage();
+    unassigned = _slabs.end() - slabsPerPage();
+  }
+
+  unassigned->sizeClass = sizeClass;
+  unassigned->cells.assign(CellsPerSlab(sizeClass), kFree);
+  return std::pair((uint32_t)(unassigned - _slabs.begin()), 0u);
+}
+
+bool AtlasManager::evictFor(uint8_t sizeClass) {
+  const auto idle = [this](uint32_t entry) {
+    return _frame - _residents[entry].lastUse > _budget.minIdleFrames;
+  };
+
+  // the least recently used idle glyph of the same size frees a cell
+  uint32_t oldest = kFree;
+  for (uint32_t e = 0; e < _residents.size(); ++e) {
+    const Resident &r = _residents[e];
+    if (r.live && _slabs[r.slab].sizeClass == sizeClass && idle(e) &&
+        (oldest == kFree || r.lastUse < _residents[oldest].lastUse))
+      oldest = e;
+  }
+  if (oldest != kFree) {
+    evict(oldest);
+    return true;
+  }
+
+  // otherwise a slab of another size whose glyphs are all idle
+  for (uint32_t s = 0; s < _slabs.size(); ++s) {
+    const Slab &slab = _slabs[s];
+    if (slab.sizeClass == kUnassigned || slab.retired > 0)
+      continue;
+    if (std::all_of(slab.cells.begin(), slab.cells.end(),
+                    [&](uint32_t e) { return e >= kRetired || idle(e); })) {
+      const auto cells = slab.cells;
+      for (uint32_t e : cells) {
+        if (e < kRetired)
+          evict(e);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void AtlasManager::evict(uint32_t entry) {
+  Resident &r = _residents[entry];
+  Slab &slab = _slabs[r.slab];
+  slab.cells[r.cell] = kFree;
+  if (--slab.used == 0 && slab.retired == 0) {
+    slab.sizeClass = kUnassigned;
+    slab.cells.clear();
+  }
+
+  _atlas.remove(r.font, r.glyph);
+  r.live = false;
+  --_glyphs;
+  ++_evictions;
+}
+
+void AtlasManager::place(uint32_t entry, uint32_t slab, uint32_t cell) {
+  Resident &r = _residents[entry];
+  r.slab = slab;
+  r.cell = cell;
+  _atlas.add(r.font, r.glyph, cellPosition(slab, cell), r.size, r.bearing);
+}
+
+void AtlasManager::copy(const AtlasMove &move) {
+  const size_t bytes = (size_t)move.width * _budget.channels;
+  for (uint32_t y = 0; y < move.height; ++y) {
+    std::memcpy(&_texels[(move.dstY + y) * pitch() +
+                         move.dstX * _budget.channels],
+                &_texels[(move.srcY + y) * pitch() +
+                         move.srcX * _budget.channels],
+                bytes);
+  }
+}
+
+void AtlasManager::addPage() {
+  ++_pages;
+  _slabs.resize((size_t)_pages * slabsPerPage());
+  _texels.resize(((size_t)_pages * _budget.pageSize.y + 1) * pitch());
+}
@@ -0,0 +1,165 @@
+#ifndef FONT_ATLAS_MANAGER_HPP
+#define FONT_ATLAS_MANAGER_HPP
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "atlas.hpp"
+#include "sdf.hpp"
+
+/// Pages are split into square slabs of this edge, each holding cells of a
+/// single power-of-two size; glyphs larger than a slab are rejected.
+constexpr unsigned kAtlasSlab = 256;
+
+struct AtlasBudget {
+  glm::uvec2 pageSize{1024, 1024}; // multiples of kAtlasSlab
+  unsigned maxPages = 4;
+  unsigned channels = 1;        // bytes per texel
+  unsigned framesInFlight = 2;  // frames that may still sample old locations
+  unsigned minIdleFrames = 120; // unused this long, a glyph may be evicted
+};
+
+/**
+ * @brief A rectangle copy within the atlas texture, in texels. Matches
+ * `struct AtlasMove` in atlas_copy.cl.
+ */
+struct AtlasMove {
+  uint32_t srcX, srcY;
+  uint32_t dstX, dstY;
+  uint32_t width, height;
+};
+static_assert(sizeof(AtlasMove) == 24);
+
+/// Where a newly inserted glyph's texels have to be written.
+struct AtlasAllocation {
+  uint32_t entry;
+  glm::uvec2 position;
+  unsigned cellSize; // the cleared square around it, upload all of it
+};
+
+/**
+ * @brief Keeps a GlyphAtlas within a page budget for long-running processes.
+ *
+ * Pages are stacked vertically in one texture of `pageSize.x` by
+ * `pageSize.y * maxPages` texels, so atlas entries stay valid however many
+ * pages are in use; host memory only covers the pages in use. Glyphs
+ * remember the last frame they were used in. When space runs out, the least
+ * recently used idle glyphs are evicted. defragment() packs glyphs into
+ * fewer slabs and pages a few moves at a time; it runs on the calling
+ * thread, so call it once per frame to spread the copies over frames.
+ *
+ * Moved glyphs keep their entry index and only their texture rectangle
+ * changes, so quads built after a move pick up the new place. The old place
+ * stays intact for `framesInFlight` frames so frames already submitted
+ * render correctly. Not thread-safe.
+ */
+class AtlasManager {
+public:
+  AtlasManager(const AtlasBudget &budget, float emSize);
+
+  /// Advances the frame clock, releases retired cells and trailing pages.
+  void beginFrame();
+
+  /// Marks a resident glyph as used this frame; its entry or kMissing.
+  uint32_t use(uint16_t font, FT_UInt glyphIndex);
+
+  /**
+   * @brief Reserves space for a glyph, evicting idle glyphs when needed. The
+   * caller writes `size` texels at the returned position into texels(). A
+   * resident glyph is only marked as used. Empty if every slab is held by
+   * glyphs used too recently to evict.
+   */
+  std::optional<AtlasAllocation> insert(uint16_t font, FT_UInt glyphIndex,
+                                        glm::uvec2 size, glm::vec2 bearing);
+
+  /**
+   * @brief Evicts every glyph unused for more than `idleFrames` (at least
+   * minIdleFrames) without waiting for pressure, e.g. after a language
+   * switch, so defragment() can give pages back. Returns the count.
+   */
+  size_t evictIdle(uint32_t idleFrames);
+
+  /**
+   * @brief Runs up to `maxMoves` copies towards fewer slabs and pages. The
+   * host texels are updated immediately; the returned moves must be replayed
+   * on any device copy (see cl/AtlasMirror.hpp) before the next frame.
+   * No move of one call overlaps another's source or destination, so they
+   * can be replayed in any order.
+   */
+  std::vector<AtlasMove> defragment(unsigned maxMoves = 64);
+
+  const GlyphAtlas &atlas() const { return _atlas; }
+  const AtlasBudget &budget() const { return _budget; }
+
+  /// Host copy of the pages in use, pitch() bytes per row.
+  std::span<uint8_t> texels() { return _texels; }
+  std::span<const uint8_t> texels() const { return _texels; }
+  size_t pitch() const {
+    return (size_t)_budget.pageSize.x * _budget.channels;
+  }
+
+  /// Compositor view of the host texels; channels must match `kind`.
+  SdfAtlasView view(SdfKind kind, float distanceRange) const;
+
+  unsigned pages() const { return _pages; }
+  size_t glyphs() const { return _glyphs; }
+  uint32_t frame() const { return _frame; }
+  size_t evictions() const { return _evictions; }
+
+private:
+  static constexpr uint8_t kUnassigned = 0xFF;
+
+  struct Slab {
+    uint8_t sizeClass = kUnassigned; // log2 of the cell edge
+    uint16_t used = 0;
+    uint16_t retired = 0;        // cells waiting for frames in flight
+    std::vector<uint32_t> cells; // entry, kFree or kRetired
+  };
+
+  struct Resident {
+    FT_UInt glyph = 0;
+    uint16_t font = 0;
+    bool live = false;
+    uint32_t lastUse = 0;
+    uint32_t slab = 0;
+    uint32_t cell = 0;
+    glm::uvec2 size{0};
+    glm::vec2 bearing{0.0f};
+  };
+
+  struct Retired {
+    uint32_t frame; // released once the clock passes it
+    uint32_t slab;
+    uint32_t cell; // kWholeSlab for a relocated slab
+  };
+
+  glm::uvec2 cellPosition(uint32_t slab, uint32_t cell) const;
+  glm::uvec2 slabPosition(uint32_t slab) const;
+  unsigned slabsPerPage() const { return _slabGrid.x * _slabGrid.y; }
+
+  std::optional<std::pair<uint32_t, uint32_t>> findCell(uint8_t sizeClass);
+  bool evictFor(uint8_t sizeClass);
+  void evict(uint32_t entry);
+  void place(uint32_t entry, uint32_t slab, uint32_t cell);
+  void copy(const AtlasMove &move);
+  void addPage();
+
+  AtlasBudget _budget;
+  GlyphAtlas _atlas;
+  glm::uvec2 _slabGrid; // slabs per page, x and y
+  std::vector<uint8_t> _texels;
+  std::vector<Slab> _slabs; // page-major
+  std::vector<Resident> _residents; // by atlas entry
+  std::vector<Retired> _retired;
+  uint32_t _frame = 0;
+  unsigned _pages = 0;
+  size_t _glyphs = 0;
+  size_t _evictions = 0;
+};
+
+#endif // FONT_ATLAS_MANAGER_HPP
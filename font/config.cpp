@@ -1,9 +1,16 @@
+#include "config.hpp"
+
 #include <cstdlib>
 #include <cstring>
 #include <fontconfig/fontconfig.h>
 #include <format>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "trace/trace.hpp"
+#include "utf8.hpp"
 
 // Returns a malloc()'d UTF-8 path to the matched font file, or NULL on failure.
 // Caller must free() the returned string.
@@ -49,6 +56,7 @@ static char *fontconfig_find_font_file(const char *query) {
 }
 
 std::string find_font(const std::string &query) {
+  TRACE_SCOPE("fontconfig/find_font");
 
   char *path = fontconfig_find_font_file(query.c_str());
   if (!path) {
@@ -59,3 +67,69 @@ std::string find_font(const std::string &query) {
   spdlog::info("found font file: {}", path);
   return std::string(path);
 }
+
+std::vector<std::string> find_fonts_for_text(const std::string &query,
+                                             std::string_view utf8Text) {
+  TRACE_SCOPE("fontconfig/find_fonts_for_text");
+
+  // code points that still need a font, controls and spaces never do
+  std::vector<FcChar32> missing;
+  {
+    std::unordered_set<FcChar32> seen;
+    for (size_t offset = 0; offset < utf8Text.size();) {
+      const FcChar32 cp = NextCodepoint(utf8Text, offset);
+      if (cp > 0x20 && seen.insert(cp).second)
+        missing.push_back(cp);
+    }
+  }
+
+  if (!FcInit()) {
+    throw std::runtime_error("FcInit failed");
+  }
+
+  FcPattern *pat = FcNameParse((const FcChar8 *)query.c_str());
+  if (!pat) {
+    throw std::runtime_error(std::format("bad font query '{}'", query));
+  }
+  FcConfigSubstitute(NULL, pat, FcMatchPattern);
+  FcDefaultSubstitute(pat);
+
+  FcResult result = FcResultNoMatch;
+  FcFontSet *set = FcFontSort(NULL, pat, FcTrue, NULL, &result);
+  FcPatternDestroy(pat);
+
+  std::vector<std::string> files;
+  for (int i = 0; set && i < set->nfont; ++i) {
+    FcChar8 *file = NULL;
+    FcCharSet *charset = NULL;
+    if (FcPatternGetString(set->fonts[i], FC_FILE, 0, &file) != FcResultMatch)
+      continue;
+    FcPatternGetCharSet(set->fonts[i], FC_CHARSET, 0, &charset);
+
+    const auto covered = [charset](FcChar32 cp) {
+      return charset && FcCharSetHasChar(charset, cp);
+    };
+    const size_t before = missing.size();
+    std::erase_if(missing, covered);
+
+    // the best match always comes first, even if it covers nothing
+    if (files.empty() || missing.size() < before)
+      files.emplace_back((const char *)file);
+    if (missing.empty())
+      break;
+  }
+  if (set)
+    FcFontSetDestroy(set);
+
+  if (files.empty()) {
+    throw std::runtime_error(
+        std::format("could not find font for query '{}'", query));
+  }
+  if (!missing.empty()) {
+    spdlog::warn("no font covers {} code points, e.g. U+{:04X}",
+                 missing.size(), (uint32_t)missing.front());
+  }
+
+  spdlog::info("found {} font files, primary: {}", files.size(), files[0]);
+  return files;
+}
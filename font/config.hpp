@@ -0,0 +1,22 @@
+#ifndef FONT_CONFIG_HPP
+#define FONT_CONFIG_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Resolves a fontconfig pattern (e.g. "sans:weight=bold") to a font
+ * file path. Throws if nothing matches.
+ */
+std::string find_font(const std::string &query);
+
+/**
+ * @brief Font files for `query` in fallback order: the best match first, then
+ * only those fonts that cover code points of `utf8Text` that none of the
+ * earlier ones has.
+ */
+std::vector<std::string> find_fonts_for_text(const std::string &query,
+                                             std::string_view utf8Text);
+
+#endif // FONT_CONFIG_HPP
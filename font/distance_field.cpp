@@ -0,0 +1,396 @@
+#include "distance_field.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr uint8_t kRed = 1;
+constexpr uint8_t kGreen = 2;
+constexpr uint8_t kBlue = 4;
+constexpr uint8_t kCyan = kGreen | kBlue;
+constexpr uint8_t kMagenta = kRed | kBlue;
+constexpr uint8_t kYellow = kRed | kGreen;
+constexpr uint8_t kWhite = kRed | kGreen | kBlue;
+
+constexpr float kFlatness = 0.02f; // px between a curve and its chords
+constexpr unsigned kMaxChords = 64;
+
+float Cross(glm::vec2 a, glm::vec2 b) { return a.x * b.y - a.y * b.x; }
+
+float Median(float a, float b, float c) {
+  return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+glm::vec2 Direction(glm::vec2 from, glm::vec2 to) {
+  const float length = glm::length(to - from);
+  return length > 0.0f ? (to - from) / length : glm::vec2(0.0f);
+}
+
+/// One outline segment with control points `p[0, points)`.
+struct Edge {
+  std::array<glm::vec2, 4> p;
+  unsigned points = 2;
+  uint8_t color = kWhite;
+
+  glm::vec2 startTangent() const {
+    for (unsigned i = 1; i < points; ++i)
+      if (p[i] != p[0])
+        return Direction(p[0], p[i]);
+    return glm::vec2(0.0f);
+  }
+
+  glm::vec2 endTangent() const {
+    for (unsigned i = points - 1; i-- > 0;)
+      if (p[i] != p[points - 1])
+        return Direction(p[i], p[points - 1]);
+    return glm::vec2(0.0f);
+  }
+
+  glm::vec2 at(float t) const {
+    std::array<glm::vec2, 4> q = p;
+    for (unsigned n = points; n > 1; --n)
+      for (unsigned i = 0; i + 1 < n; ++i)
+        q[i] = glm::mix(q[i], q[i + 1], t);
+    return q[0];
+  }
+
+  /// Chords that keep within kFlatness: the error of n chords is at most
+  /// d(d-1)/8 · max|second difference| / n² for degree d.
+  unsigned chords() const {
+    if (points == 2)
+      return 1;
+    float second = 0.0f;
+    for (unsigned i = 0; i + 2 < points; ++i)
+      second = std::max(second,
+                        glm::length(p[i] - 2.0f * p[i + 1] + p[i + 2]));
+    const float bound = (float)((points - 1) * (points - 2)) / 8.0f * second;
+    return std::clamp((unsigned)std::ceil(std::sqrt(bound / kFlatness)), 1u,
+                      kMaxChords);
+  }
+};
+
+/// A chord of a flattened edge.
+struct Piece {
+  glm::vec2 a, b;
+  glm::vec2 dir; // unit
+  glm::vec2 lo, hi;
+  float invLength2;
+  uint8_t color;
+  bool first, last; // starts or ends its edge
+};
+
+template <size_t Points>
+glm::vec2 ControlPoint(const SegmentBuffer<Points> &buffer, size_t segment,
+                       unsigned point) {
+  return {buffer.x[point][segment], buffer.y[point][segment]};
+}
+
+std::vector<std::vector<Edge>> Contours(const GlyphOutline &outline) {
+  std::vector<std::vector<Edge>> contours;
+  std::array<size_t, 3> next{};
+  size_t begin = 0;
+  for (uint32_t end : outline.contourEnds) {
+    auto &edges = contours.emplace_back();
+    for (size_t i = begin; i < end; ++i) {
+      const uint8_t kind = outline.order[i];
+      const size_t segment = next[kind]++;
+      Edge edge;
+      edge.points = kind + 2u;
+      for (unsigned k = 0; k < edge.points; ++k) {
+        edge.p[k] = kind == 0   ? ControlPoint(outline.lines, segment, k)
+                    : kind == 1 ? ControlPoint(outline.quads, segment, k)
+                                : ControlPoint(outline.cubics, segment, k);
+      }
+      if (edge.startTangent() != glm::vec2(0.0f)) // skip collapsed curves
+        edges.push_back(edge);
+    }
+    begin = end;
+  }
+  return contours;
+}
+
+/**
+ * @brief msdfgen's simple edge coloring: edges between two corners share a
+ * color and neighbouring runs differ in two channels, so the median keeps
+ * the corner sharp. Smooth contours stay white, a single corner gets three
+ * colors along the contour.
+ */
+void ColorEdges(std::vector<Edge> &edges, float crossThreshold) {
+  const size_t n = edges.size();
+  std::vector<bool> corner(n);
+  size_t corners = 0;
+  size_t firstCorner = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const glm::vec2 a = edges[(i + n - 1) % n].endTangent();
+    const glm::vec2 b = edges[i].startTangent();
+    corner[i] =
+        glm::dot(a, b) <= 0.0f || std::abs(Cross(a, b)) > crossThreshold;
+    if (corner[i] && !corners++)
+      firstCorner = i;
+  }
+
+  if (corners == 0)
+    return;
+
+  if (corners == 1) {
+    if (n < 3)
+      return;
+    constexpr uint8_t kTeardrop[] = {kMagenta, kWhite, kYellow};
+    for (size_t k = 0; k < n; ++k)
+      edges[(firstCorner + k) % n].color = kTeardrop[3 * k / n];
+    return;
+  }
+
+  // the run closing the contour must also differ from the first one
+  constexpr uint8_t kCycle[] = {kCyan, kMagenta, kYellow};
+  size_t run = 0;
+  uint8_t color = kCycle[0];
+  for (size_t k = 0; k < n; ++k) {
+    const size_t i = (firstCorner + k) % n;
+    if (k && corner[i]) {
+      ++run;
+      color = kCycle[run % 3];
+      if (run + 1 == corners && color == kCycle[0])
+        color = kCycle[(run + 1) % 3];
+    }
+    edges[i].color = color;
+  }
+}
+
+void Flatten(const Edge &edge, std::vector<Piece> &pieces) {
+  const unsigned chords = edge.chords();
+  const size_t begin = pieces.size();
+  glm::vec2 a = edge.p[0];
+  for (unsigned k = 1; k <= chords; ++k) {
+    const glm::vec2 b =
+        k == chords ? edge.p[edge.points - 1] : edge.at((float)k / chords);
+    if (b == a)
+      continue;
+    const glm::vec2 d = b - a;
+    pieces.push_back({a, b, Direction(a, b), glm::min(a, b), glm::max(a, b),
+                      1.0f / glm::dot(d, d), edge.color,
+                      pieces.size() == begin, false});
+    a = b;
+  }
+  if (pieces.size() > begin)
+    pieces.back().last = true;
+}
+
+/// Closest piece so far; on equal distance the more orthogonal one wins,
+/// which is the one giving the right side at a shared corner.
+struct Nearest {
+  const Piece *piece = nullptr;
+  float distance2 = std::numeric_limits<float>::infinity();
+  float orthogonality = 0.0f;
+  float t = 0.0f;
+
+  void offer(const Piece &candidate, float d2, float orth, float at) {
+    if (d2 < distance2 || (d2 == distance2 && orth > orthogonality)) {
+      piece = &candidate;
+      distance2 = d2;
+      orthogonality = orth;
+      t = at;
+    }
+  }
+
+  float signedDistance(glm::vec2 p, float orientation) const {
+    const float d = std::sqrt(distance2);
+    return Cross(piece->dir, p - piece->a) * orientation >= 0.0f ? d : -d;
+  }
+
+  /// Beyond an edge's end points, the distance to its extended tangent.
+  float pseudoDistance(glm::vec2 p, float orientation) const {
+    if (t <= 0.0f && piece->first && glm::dot(p - piece->a, piece->dir) < 0)
+      return Cross(piece->dir, p - piece->a) * orientation;
+    if (t >= 1.0f && piece->last && glm::dot(p - piece->b, piece->dir) > 0)
+      return Cross(piece->dir, p - piece->b) * orientation;
+    return signedDistance(p, orientation);
+  }
+};
+
+/// Where the row at `y` crosses the outline, with the crossing direction.
+void RowCrossings(const std::vector<Piece> &pieces, float y,
+                  std::vector<std::pair<float, int>> &crossings) {
+  crossings.clear();
+  for (const Piece &s : pieces) {
+    if ((s.a.y <= y) == (s.b.y <= y))
+      continue;
+    const float x = s.a.x + (y - s.a.y) * (s.b.x - s.a.x) / (s.b.y - s.a.y);
+    crossings.emplace_back(x, s.b.y > s.a.y ? 1 : -1);
+  }
+  std::sort(crossings.begin(), crossings.end());
+}
+
+/**
+ * @brief msdfgen's legacy clash test on normalized texels: two channels jump
+ * by more than a distance field can between neighbours. Only the texel
+ * farther from the edge is flagged.
+ */
+bool Clash(const float *a, const float *b, float threshold) {
+  float a0 = a[0], a1 = a[1], a2 = a[2];
+  float b0 = b[0], b1 = b[1], b2 = b[2];
+  // order the channels by decreasing difference
+  if (std::abs(b0 - a0) < std::abs(b1 - a1)) {
+    std::swap(a0, a1);
+    std::swap(b0, b1);
+  }
+  if (std::abs(b1 - a1) < std::abs(b2 - a2)) {
+    std::swap(a1, a2);
+    std::swap(b1, b2);
+    if (std::abs(b0 - a0) < std::abs(b1 - a1)) {
+      std::swap(a0, a1);
+      std::swap(b0, b1);
+    }
+  }
+  return std::abs(b1 - a1) >= threshold && !(b0 == b1 && b0 == b2) &&
+         std::abs(a2 - 0.5f) >= std::abs(b2 - 0.5f);
+}
+
+void FixClashes(std::vector<float> &field, glm::uvec2 size, unsigned channels,
+                float threshold) {
+  const auto at = [&](unsigned x, unsigned y) {
+    return &field[((size_t)y * size.x + x) * channels];
+  };
+
+  std::vector<size_t> clashes;
+  for (unsigned y = 0; y < size.y; ++y) {
+    for (unsigned x = 0; x < size.x; ++x) {
+      const float *t = at(x, y);
+      if ((x > 0 && Clash(t, at(x - 1, y), threshold)) ||
+          (x + 1 < size.x && Clash(t, at(x + 1, y), threshold)) ||
+          (y > 0 && Clash(t, at(x, y - 1), threshold)) ||
+          (y + 1 < size.y && Clash(t, at(x, y + 1), threshold))) {
+        clashes.push_back((size_t)y * size.x + x);
+      }
+    }
+  }
+
+  for (size_t i : clashes) {
+    float *t = &field[i * channels];
+    t[0] = t[1] = t[2] = Median(t[0], t[1], t[2]);
+  }
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+void GenerateDistanceField(const GlyphOutline &outline,
+                           const DistanceFieldOptions &options,
+                           glm::vec2 origin, glm::uvec2 size, uint8_t *texels,
+                           size_t pitch) {
+  TRACE_SCOPE("sdf/generate");
+  const unsigned channels = (unsigned)options.kind;
+  if (outline.order.size() != outline.segments()) {
+    throw std::invalid_argument("outline without segment order");
+  }
+  if (!(options.range > 0.0f)) {
+    throw std::invalid_argument("distance range must be positive");
+  }
+
+  std::vector<Piece> pieces;
+  const float crossThreshold = std::sin(options.cornerAngle);
+  for (auto &edges : Contours(outline)) {
+    if (channels > 1)
+      ColorEdges(edges, crossThreshold);
+    for (const Edge &edge : edges)
+      Flatten(edge, pieces);
+  }
+
+  if (pieces.empty()) {
+    for (unsigned y = 0; y < size.y; ++y)
+      std::fill_n(texels + y * pitch, (size_t)size.x * channels, 0);
+    return;
+  }
+
+  // outer contours may run either way; the shoelace sum says which
+  float area = 0.0f;
+  for (const Piece &piece : pieces)
+    area += Cross(piece.a, piece.b);
+  const float orientation = area >= 0.0f ? 1.0f : -1.0f;
+
+  std::vector<float> field((size_t)size.x * size.y * channels);
+  std::vector<std::pair<float, int>> crossings;
+  for (unsigned y = 0; y < size.y; ++y) {
+    const float py = origin.y - ((float)y + 0.5f);
+    RowCrossings(pieces, py, crossings);
+    size_t crossing = 0;
+    int winding = 0;
+
+    for (unsigned x = 0; x < size.x; ++x) {
+      const glm::vec2 p(origin.x + (float)x + 0.5f, py);
+      while (crossing < crossings.size() && crossings[crossing].first < p.x)
+        winding += crossings[crossing++].second;
+      const bool inside = outline.evenOdd ? (winding & 1) : winding != 0;
+
+      Nearest all;
+      std::array<Nearest, 3> rgb;
+      for (const Piece &s : pieces) {
+        float bound = all.distance2;
+        if (channels > 1) {
+          for (const Nearest &n : rgb)
+            bound = std::max(bound, n.distance2);
+        }
+        const glm::vec2 outside =
+            glm::max(glm::max(s.lo - p, p - s.hi), glm::vec2(0.0f));
+        if (glm::dot(outside, outside) > bound)
+          continue;
+
+        const float t = std::clamp(
+            glm::dot(p - s.a, s.b - s.a) * s.invLength2, 0.0f, 1.0f);
+        const glm::vec2 q = t <= 0.0f   ? s.a
+                            : t >= 1.0f ? s.b
+                                        : s.a + (s.b - s.a) * t;
+        const glm::vec2 d = p - q;
+        const float d2 = glm::dot(d, d);
+        const float orth = d2 > 0.0f ? std::abs(Cross(s.dir, d)) / std::sqrt(d2)
+                                     : 1.0f;
+        all.offer(s, d2, orth, t);
+        if (channels > 1) {
+          for (unsigned c = 0; c < 3; ++c) {
+            if (s.color & (1u << c))
+              rgb[c].offer(s, d2, orth, t);
+          }
+        }
+      }
+
+      // the fill rule decides the sign of the true distance, so overlapping
+      // contours do not punch holes
+      const float distance =
+          inside ? std::sqrt(all.distance2) : -std::sqrt(all.distance2);
+      float *out = &field[((size_t)y * size.x + x) * channels];
+      if (channels == 1) {
+        out[0] = distance;
+        continue;
+      }
+
+      for (unsigned c = 0; c < 3; ++c) {
+        out[c] = rgb[c].piece ? rgb[c].pseudoDistance(p, orientation)
+                              : distance;
+      }
+      if ((Median(out[0], out[1], out[2]) > 0.0f) != inside)
+        out[0] = out[1] = out[2] = distance;
+      if (channels == 4)
+        out[3] = distance;
+    }
+  }
+
+  for (float &value : field)
+    value = std::clamp(value / options.range + 0.5f, 0.0f, 1.0f);
+  if (channels > 1)
+    FixClashes(field, size, channels, 1.001f / options.range);
+
+  for (unsigned y = 0; y < size.y; ++y) {
+    const float *row = &field[(size_t)y * size.x * channels];
+    for (size_t i = 0; i < (size_t)size.x * channels; ++i)
+      texels[y * pitch + i] = (uint8_t)std::lround(row[i] * 255.0f);
+  }
+}
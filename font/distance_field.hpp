@@ -0,0 +1,39 @@
+#ifndef FONT_DISTANCE_FIELD_HPP
+#define FONT_DISTANCE_FIELD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "outline.hpp"
+#include "sdf.hpp"
+
+/**
+ * @brief `range` is the distance in pixels covered by the full 0..1 value
+ * range, i.e. SdfAtlasView::distanceRange: the field saturates `range / 2`
+ * pixels from the edge.
+ */
+struct DistanceFieldOptions {
+  SdfKind kind = SdfKind::Msdf;
+  float range = 4.0f;
+  float cornerAngle = 3.0f; // radians; sharper turns switch the edge color
+};
+
+/**
+ * @brief Renders the distance field of `outline` (pixels, y up) into `size`
+ * texels at `texels`, `pitch` bytes per row and one byte per channel of the
+ * kind. `origin` is the outline position of the top left texel corner.
+ * Inside is above 0.5, as SdfAtlasView expects.
+ *
+ * MSDF channels are signed pseudo-distances to msdfgen-style colored edges.
+ * Texels whose median disagrees with the fill rule fall back to the true
+ * distance, and channel clashes between neighbours are flattened to the
+ * median. Deterministic and thread-safe.
+ */
+void GenerateDistanceField(const GlyphOutline &outline,
+                           const DistanceFieldOptions &options,
+                           glm::vec2 origin, glm::uvec2 size, uint8_t *texels,
+                           size_t pitch);
+
+#endif // FONT_DISTANCE_FIELD_HPP
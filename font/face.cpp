@@ -0,0 +1,209 @@
+#include "face.hpp"
+
+#include FT_TRUETYPE_TABLES_H
+
+#include <spdlog/spdlog.h>
+
+#include <format>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "trace/trace.hpp"
+
+FT_Library InitializeFreeType() {
+  TRACE_SCOPE("freetype/init");
+  FT_Library ft;
+  if (FT_Init_FreeType(&ft)) {
+    throw std::runtime_error("FT_Init_FreeType failed");
+  }
+  return ft;
+}
+
+FT_Face LoadFace(FT_Library ft, const std::string &fontPath, int size) {
+  TRACE_SCOPE("freetype/load_face");
+  FT_Face face;
+
+  if (FT_New_Face(ft, fontPath.c_str(), 0, &face)) {
+    throw std::runtime_error(
+        std::format("FT_New_Face failed (font: {})", fontPath));
+  }
+
+  // Set font size in pixels
+  if (FT_Set_Pixel_Sizes(face, 0, size)) {
+    FT_Done_Face(face);
+    throw std::runtime_error("FT_Set_Pixel_Sizes failed");
+  }
+
+  spdlog::info("Loaded {}", fontPath);
+  return face;
+}
+
+std::shared_ptr<const std::vector<FT_Byte>> LoadFontData(FT_Face face) {
+  TRACE_SCOPE("freetype/load_font_data");
+
+  // tag 0 reads the complete file instead of a single table
+  FT_ULong length = 0;
+  if (FT_Load_Sfnt_Table(face, 0, 0, nullptr, &length)) {
+    throw std::runtime_error(
+        std::format("font '{}' is not an sfnt file", face->family_name));
+  }
+
+  auto data = std::make_shared<std::vector<FT_Byte>>(length);
+  if (FT_Load_Sfnt_Table(face, 0, 0, data->data(), &length)) {
+    throw std::runtime_error(
+        std::format("could not read font '{}'", face->family_name));
+  }
+  return data;
+}
+
+FT_Face CloneFace(FT_Library ft, const std::vector<FT_Byte> &data,
+                  FT_Face like) {
+  TRACE_SCOPE("freetype/clone_face");
+  FT_Face face;
+
+  if (FT_New_Memory_Face(ft, data.data(), (FT_Long)data.size(),
+                         like->face_index, &face)) {
+    throw std::runtime_error(
+        std::format("FT_New_Memory_Face failed (font: {})", like->family_name));
+  }
+
+  FT_Error error = 0;
+  if (FT_IS_SCALABLE(like)) {
+    // request the scales themselves, pixel sizes would be rounded again
+    FT_Size_RequestRec request{};
+    request.type = FT_SIZE_REQUEST_TYPE_SCALES;
+    request.width = like->size->metrics.x_scale;
+    request.height = like->size->metrics.y_scale;
+    error = FT_Request_Size(face, &request);
+  } else {
+    // bitmap-only faces (color emoji) come in fixed strikes
+    FT_Int strike = 0;
+    for (FT_Int i = 0; i < like->num_fixed_sizes; ++i) {
+      if (like->available_sizes[i].y_ppem >> 6 == like->size->metrics.y_ppem)
+        strike = i;
+    }
+    error = FT_Select_Size(face, strike);
+  }
+
+  if (error) {
+    FT_Done_Face(face);
+    throw std::runtime_error("could not size the cloned face");
+  }
+  return face;
+}
+
+/* ------------------------------------------------------------------------- */
+
+namespace {
+
+/**
+ * @brief A thread's FreeType library. Its faces are only used by that
+ * thread, but may be freed from another one; FreeType allows that when
+ * creating and freeing faces is serialized.
+ */
+struct SharedLibrary {
+  FT_Library ft = InitializeFreeType();
+  std::mutex mutex; // around FT_New_Memory_Face and FT_Done_Face
+
+  SharedLibrary() = default;
+  SharedLibrary(const SharedLibrary &) = delete;
+  SharedLibrary &operator=(const SharedLibrary &) = delete;
+  ~SharedLibrary() { FT_Done_FreeType(ft); }
+};
+
+// lives until the thread has exited and its last copy is freed
+std::shared_ptr<SharedLibrary> ThreadLibrary() {
+  thread_local auto library = std::make_shared<SharedLibrary>();
+  return library;
+}
+
+/// Copies of one face by thread, hung on its FT_Size::generic.
+struct FaceCopies {
+  struct Copy {
+    std::shared_ptr<SharedLibrary> library;
+    FT_Face face;
+  };
+
+  std::mutex mutex;
+  std::shared_ptr<const std::vector<FT_Byte>> data; // null: not copyable
+  std::map<std::thread::id, Copy> copies;
+
+  ~FaceCopies() {
+    for (auto &[thread, copy] : copies) {
+      std::lock_guard lock(copy.library->mutex);
+      FT_Done_Face(copy.face);
+    }
+  }
+};
+
+void ReleaseCopies(void *object) {
+  FT_Size size = static_cast<FT_Size>(object);
+  delete static_cast<FaceCopies *>(size->generic.data);
+  size->generic.data = nullptr;
+}
+
+// attaching happens once per face, concurrently from several workers
+std::mutex attachMutex;
+
+FaceCopies *CopiesOf(FT_Face face) {
+  std::lock_guard lock(attachMutex);
+  FT_Generic &slot = face->size->generic;
+  if (slot.data)
+    return slot.finalizer == &ReleaseCopies
+               ? static_cast<FaceCopies *>(slot.data)
+               : nullptr;
+
+  auto copies = std::make_unique<FaceCopies>();
+  try {
+    copies->data = LoadFontData(face);
+  } catch (const std::exception &e) {
+    spdlog::debug("no per-thread copies: {}", e.what());
+  }
+  slot.data = copies.release();
+  slot.finalizer = &ReleaseCopies;
+  return static_cast<FaceCopies *>(slot.data);
+}
+
+bool SameSize(FT_Face a, FT_Face b) {
+  return a->size->metrics.x_scale == b->size->metrics.x_scale &&
+         a->size->metrics.y_scale == b->size->metrics.y_scale &&
+         a->size->metrics.y_ppem == b->size->metrics.y_ppem;
+}
+
+} // namespace
+
+FT_Face ThreadFace(FT_Face face) {
+  FaceCopies *copies = CopiesOf(face);
+  if (!copies || !copies->data)
+    return nullptr;
+
+  std::lock_guard lock(copies->mutex);
+  auto it = copies->copies.find(std::this_thread::get_id());
+  if (it != copies->copies.end() && SameSize(it->second.face, face))
+    return it->second.face;
+
+  auto library = it != copies->copies.end() ? it->second.library
+                                            : ThreadLibrary();
+  std::lock_guard libraryLock(library->mutex);
+  FT_Face copy = CloneFace(library->ft, *copies->data, face);
+  if (it != copies->copies.end()) {
+    FT_Done_Face(it->second.face); // resized since
+    it->second.face = copy;
+    return copy;
+  }
+  try {
+    copies->copies.emplace(std::this_thread::get_id(),
+                           FaceCopies::Copy{library, copy});
+  } catch (...) {
+    FT_Done_Face(copy);
+    throw;
+  }
+  return copy;
+}
+
+bool CanCopyFace(FT_Face face) {
+  const FaceCopies *copies = CopiesOf(face);
+  return copies && copies->data;
+}
@@ -0,0 +1,44 @@
+#ifndef FONT_FACE_HPP
+#define FONT_FACE_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+FT_Library InitializeFreeType();
+
+/// Opens the first face in `fontPath` and sets its size in pixels.
+FT_Face LoadFace(FT_Library ft, const std::string &fontPath, int size = 64);
+
+/**
+ * @brief The whole font file behind `face` (sfnt formats only). FreeType
+ * faces must not be shared between threads; this is what other threads open
+ * their own copy from.
+ */
+std::shared_ptr<const std::vector<FT_Byte>> LoadFontData(FT_Face face);
+
+/**
+ * @brief Opens `data` on `ft` with the face index and scale of `like`, so
+ * advances and outlines match the original exactly. `data` must outlive the
+ * returned face.
+ */
+FT_Face CloneFace(FT_Library ft, const std::vector<FT_Byte> &data,
+                  FT_Face like);
+
+/**
+ * @brief The calling thread's copy of `face`, for work spread over
+ * long-lived threads such as an Executor's workers. A thread's first call
+ * opens the copy on an FT_Library of that thread; later calls return it,
+ * resized if `face` was. Copies are freed with `face`, which must not be
+ * freed while they are in use. The font data is read once for all threads.
+ * Null for fonts LoadFontData() cannot copy.
+ */
+FT_Face ThreadFace(FT_Face face);
+
+/// Whether ThreadFace() can copy `face`; the first call reads the font.
+bool CanCopyFace(FT_Face face);
+
+#endif // FONT_FACE_HPP
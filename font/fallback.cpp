@@ -0,0 +1,150 @@
+#include "fallback.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <format>
+#include <map>
+#include <stdexcept>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr size_t kBlocks = 0x110000 >> 8;
+
+// Replaces a full table of pages by unique pages plus indices.
+template <typename Page>
+void Deduplicate(const std::vector<Page> &blocks, std::vector<uint16_t> &index,
+                 std::vector<Page> &pages) {
+  std::map<Page, uint16_t> unique;
+  unique.emplace(Page{}, 0);
+  pages.assign(1, Page{});
+  index.resize(blocks.size());
+
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    auto [it, inserted] = unique.emplace(blocks[b], (uint16_t)pages.size());
+    if (inserted)
+      pages.push_back(blocks[b]);
+    index[b] = it->second;
+  }
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+CoverageMap::CoverageMap() : _index(kBlocks, 0), _pages(1, Page{}) {}
+
+CoverageMap::CoverageMap(FT_Face face) {
+  TRACE_SCOPE("fallback/coverage");
+  std::vector<Page> blocks(kBlocks, Page{});
+
+  FT_UInt glyph = 0;
+  for (FT_ULong cp = FT_Get_First_Char(face, &glyph); glyph != 0;
+       cp = FT_Get_Next_Char(face, cp, &glyph)) {
+    if (cp <= kLastCodepoint)
+      blocks[cp >> 8][(cp >> 6) & 3] |= uint64_t{1} << (cp & 63);
+  }
+
+  Deduplicate(blocks, _index, _pages);
+}
+
+/* ------------------------------------------------------------------------- */
+
+FontChain::FontChain(std::vector<FT_Face> faces) {
+  for (FT_Face face : faces)
+    add(face);
+}
+
+void FontChain::add(FT_Face face) {
+  if (!face) {
+    throw std::invalid_argument("null face in font chain");
+  }
+  if (_faces.size() >= 255) {
+    throw std::length_error("font chain is limited to 255 faces");
+  }
+
+  CoverageMap coverage(face);
+  std::vector<uint16_t> index;
+  std::vector<Page> pages;
+  merge(coverage, (uint8_t)_faces.size(), index, pages);
+
+  // nothing throws past the reservations, so a failed add leaves the chain
+  // as it was
+  _faces.reserve(_faces.size() + 1);
+  _coverage.reserve(_coverage.size() + 1);
+  _faces.push_back(face);
+  _coverage.push_back(std::move(coverage));
+  _index.swap(index);
+  _pages.swap(pages);
+
+  spdlog::debug("font chain: added {} ({} coverage pages), {} lookup pages",
+                face->family_name ? face->family_name : "?",
+                _coverage.back().pageCount(), _pages.size());
+}
+
+void FontChain::merge(const CoverageMap &added, uint8_t font,
+                      std::vector<uint16_t> &index,
+                      std::vector<Page> &pages) const {
+  TRACE_SCOPE("fallback/rebuild");
+  // the primary face gets the 0 every code point starts with
+  index.assign(kBlocks, 0);
+  pages.assign(1, Page{});
+  if (font == 0)
+    return;
+  index = _index;
+  pages = _pages;
+
+  std::map<Page, uint16_t> unique;
+  for (size_t p = 0; p < pages.size(); ++p)
+    unique.emplace(pages[p], (uint16_t)p);
+
+  for (size_t b = 0; b < kBlocks; ++b) {
+    if (!added.coversBlock(b))
+      continue;
+    // 0 is the primary face or no face at all; only the latter is taken
+    Page page = pages[index[b]];
+    for (char32_t i = 0; i < 256; ++i) {
+      const char32_t cp = (char32_t)(b << 8) | i;
+      if (page[i] == 0 && !_coverage[0].contains(cp) && added.contains(cp))
+        page[i] = font;
+    }
+    auto [it, inserted] = unique.emplace(page, (uint16_t)pages.size());
+    if (inserted)
+      pages.push_back(page);
+    index[b] = it->second;
+  }
+
+  // drop pages no block refers to any more
+  std::vector<uint16_t> remap(pages.size(), 0);
+  for (uint16_t p : index)
+    remap[p] = 1;
+  remap[0] = 1;
+  uint16_t kept = 0;
+  for (size_t p = 0; p < pages.size(); ++p) {
+    if (remap[p]) {
+      pages[kept] = pages[p];
+      remap[p] = kept++;
+    }
+  }
+  pages.resize(kept);
+  for (uint16_t &p : index)
+    p = remap[p];
+}
+
+FontChain::GlyphRef FontChain::resolve(char32_t cp) const {
+  if (_faces.empty()) {
+    throw std::logic_error("empty font chain");
+  }
+
+  const unsigned font = select(cp);
+  if (FT_UInt glyph = FT_Get_Char_Index(_faces[font], cp))
+    return {font, glyph};
+
+  FT_UInt fallback = FT_Get_Char_Index(_faces[0], (FT_ULong)'?');
+  if (fallback == 0) {
+    throw std::runtime_error(std::format(
+        "No glyph for codepoint U+{:04X} and no fallback '?'", (uint32_t)cp));
+  }
+  return {0, fallback};
+}
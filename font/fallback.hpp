@@ -0,0 +1,91 @@
+#ifndef FONT_FALLBACK_HPP
+#define FONT_FALLBACK_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Code points a face has glyphs for, as a two-level bitmap: a table
+ * of 0x1100 page indices (one per 256 code points) into deduplicated 256-bit
+ * pages. Empty and full pages are shared, a Latin font costs a few KB.
+ */
+class CoverageMap {
+public:
+  CoverageMap();
+  /// Walks the face's active charmap once.
+  explicit CoverageMap(FT_Face face);
+
+  bool contains(char32_t cp) const {
+    if (cp > kLastCodepoint)
+      return false;
+    const Page &page = _pages[_index[cp >> 8]];
+    return (page[(cp >> 6) & 3] >> (cp & 63)) & 1;
+  }
+
+  /// Whether any code point of the block of 256 starting at `block << 8` is.
+  bool coversBlock(size_t block) const { return _index[block] != 0; }
+
+  size_t pageCount() const { return _pages.size(); }
+
+private:
+  using Page = std::array<uint64_t, 4>;
+  static constexpr char32_t kLastCodepoint = 0x10FFFF;
+
+  std::vector<uint16_t> _index; // page of every block of 256 code points
+  std::vector<Page> _pages;     // page 0 is empty
+};
+
+/**
+ * @brief Ordered fallback list of faces. Every code point resolves to the
+ * first face that covers it through a precomputed two-level table, so the
+ * lookup costs the same for one face or twenty.
+ *
+ * The chain does not own the faces; they must all be sized alike.
+ */
+class FontChain {
+public:
+  struct GlyphRef {
+    unsigned font;
+    FT_UInt glyphIndex;
+  };
+
+  FontChain() = default;
+  explicit FontChain(std::vector<FT_Face> faces);
+
+  /// Appends a face with lower priority than all others.
+  void add(FT_Face face);
+
+  size_t size() const { return _faces.size(); }
+  bool empty() const { return _faces.empty(); }
+  FT_Face face(size_t i) const { return _faces[i]; }
+  const std::vector<FT_Face> &faces() const { return _faces; }
+
+  /// Index of the first face covering `cp`, 0 if none does (primary .notdef).
+  unsigned select(char32_t cp) const {
+    if (cp > 0x10FFFF || _index.empty())
+      return 0;
+    return _pages[_index[cp >> 8]][cp & 0xFF];
+  }
+
+  /// The glyph for `cp`; '?' of the primary face when no face covers it.
+  GlyphRef resolve(char32_t cp) const;
+
+private:
+  using Page = std::array<uint8_t, 256>; // face per code point
+
+  // the lookup table with `added` appended as face `font`; only blocks it
+  // covers are revisited
+  void merge(const CoverageMap &added, uint8_t font,
+             std::vector<uint16_t> &index, std::vector<Page> &pages) const;
+
+  std::vector<FT_Face> _faces;
+  std::vector<CoverageMap> _coverage;
+  std::vector<uint16_t> _index;
+  std::vector<Page> _pages;
+};
+
+#endif // FONT_FALLBACK_HPP
@@ -0,0 +1,364 @@
+#include "itemize.hpp"
+
+#include <hb.h>
+
+#include <algorithm>
+
+#include "trace/trace.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+// UAX #9 bidi classes, without the explicit formatting ones.
+enum class BidiClass : uint8_t {
+  L,   // left-to-right
+  R,   // right-to-left
+  AL,  // Arabic letter
+  EN,  // European number
+  AN,  // Arabic number
+  ES,  // European separator
+  ET,  // European terminator
+  CS,  // common separator
+  NSM, // non-spacing mark
+  BN,  // boundary neutral
+  B,   // paragraph separator
+  S,   // segment separator
+  WS,  // white space
+  ON,  // other neutral
+};
+
+BidiClass ClassifyBidi(char32_t cp) {
+  switch (cp) {
+  case U'\n':
+  case U'\r':
+  case U'\u001C':
+  case U'\u001D':
+  case U'\u001E':
+  case U'\u0085':
+  case U'\u2029':
+    return BidiClass::B;
+  case U'\t':
+  case U'\v':
+  case U'\u001F':
+    return BidiClass::S;
+  case U' ':
+  case U'\f':
+  case U'\u2028':
+  case U'\u205F':
+  case U'\u3000':
+    return BidiClass::WS;
+  case U'+':
+  case U'-':
+    return BidiClass::ES;
+  case U'#':
+  case U'$':
+  case U'%':
+  case U'\u00B0':
+  case U'\u00B1':
+  case U'\u066A':
+    return BidiClass::ET;
+  case U',':
+  case U'.':
+  case U'/':
+  case U':':
+  case U'\u00A0':
+  case U'\u060C':
+  case U'\u202F':
+  case U'\u2044':
+    return BidiClass::CS;
+  case U'\u00AD':
+  case U'\u200B':
+  case U'\u200C':
+  case U'\u200D':
+  case U'\uFEFF':
+    return BidiClass::BN;
+  case U'\u200E': // LRM
+    return BidiClass::L;
+  case U'\u200F': // RLM
+    return BidiClass::R;
+  case U'\u061C': // ALM
+    return BidiClass::AL;
+  default:
+    break;
+  }
+
+  if ((cp >= U'0' && cp <= U'9') || cp == 0xB2 || cp == 0xB3 || cp == 0xB9 ||
+      (cp >= 0x06F0 && cp <= 0x06F9) || (cp >= 0xFF10 && cp <= 0xFF19))
+    return BidiClass::EN;
+  if ((cp >= 0x0660 && cp <= 0x0669) || cp == 0x066B || cp == 0x066C)
+    return BidiClass::AN;
+  if ((cp >= 0x2000 && cp <= 0x200A))
+    return BidiClass::WS;
+  if ((cp >= 0x202A && cp <= 0x202E) || (cp >= 0x2060 && cp <= 0x2069))
+    return BidiClass::BN; // embeddings and isolates are not supported
+
+  switch (hb_unicode_general_category(hb_unicode_funcs_get_default(), cp)) {
+  case HB_UNICODE_GENERAL_CATEGORY_NON_SPACING_MARK:
+  case HB_UNICODE_GENERAL_CATEGORY_ENCLOSING_MARK:
+    return BidiClass::NSM;
+  case HB_UNICODE_GENERAL_CATEGORY_CURRENCY_SYMBOL:
+    return BidiClass::ET;
+  case HB_UNICODE_GENERAL_CATEGORY_CONNECT_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_DASH_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_CLOSE_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_FINAL_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_INITIAL_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_OTHER_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_OPEN_PUNCTUATION:
+  case HB_UNICODE_GENERAL_CATEGORY_MODIFIER_SYMBOL:
+  case HB_UNICODE_GENERAL_CATEGORY_MATH_SYMBOL:
+  case HB_UNICODE_GENERAL_CATEGORY_OTHER_SYMBOL:
+    return BidiClass::ON;
+  default:
+    break;
+  }
+
+  if ((cp >= 0x0590 && cp <= 0x05FF) || (cp >= 0x07C0 && cp <= 0x085F) ||
+      (cp >= 0xFB1D && cp <= 0xFB4F) || (cp >= 0x10800 && cp <= 0x10FFF) ||
+      (cp >= 0x1E800 && cp <= 0x1EFFF))
+    return BidiClass::R;
+  if ((cp >= 0x0600 && cp <= 0x07BF) || (cp >= 0x0860 && cp <= 0x08FF) ||
+      (cp >= 0xFB50 && cp <= 0xFDFF) || (cp >= 0xFE70 && cp <= 0xFEFF))
+    return BidiClass::AL;
+
+  return BidiClass::L;
+}
+
+bool IsNeutral(BidiClass c) {
+  return c == BidiClass::B || c == BidiClass::S || c == BidiClass::WS ||
+         c == BidiClass::ON;
+}
+
+// Direction a resolved class counts as for N1: numbers act as R.
+BidiClass StrongDirection(BidiClass c) {
+  return c == BidiClass::L ? BidiClass::L : BidiClass::R;
+}
+
+std::vector<uint8_t> ResolveLevels(const std::vector<BidiClass> &classes) {
+  const size_t n = classes.size();
+
+  // P2, P3
+  uint8_t paragraph = 0;
+  for (BidiClass c : classes) {
+    if (c == BidiClass::L)
+      break;
+    if (c == BidiClass::R || c == BidiClass::AL) {
+      paragraph = 1;
+      break;
+    }
+  }
+  const BidiClass sos = paragraph % 2 ? BidiClass::R : BidiClass::L;
+
+  std::vector<BidiClass> types = classes;
+
+  // W1 (boundary neutrals are treated like marks, X9)
+  for (size_t i = 0; i < n; ++i) {
+    if (types[i] == BidiClass::NSM || types[i] == BidiClass::BN)
+      types[i] = i == 0 ? sos : types[i - 1];
+  }
+
+  // W2, W3
+  BidiClass strong = sos;
+  for (auto &t : types) {
+    if (t == BidiClass::L || t == BidiClass::R || t == BidiClass::AL)
+      strong = t;
+    else if (t == BidiClass::EN && strong == BidiClass::AL)
+      t = BidiClass::AN;
+  }
+  for (auto &t : types) {
+    if (t == BidiClass::AL)
+      t = BidiClass::R;
+  }
+
+  // W4
+  for (size_t i = 1; i + 1 < n; ++i) {
+    const BidiClass prev = types[i - 1], next = types[i + 1];
+    if (prev != next)
+      continue;
+    if ((types[i] == BidiClass::ES && prev == BidiClass::EN) ||
+        (types[i] == BidiClass::CS &&
+         (prev == BidiClass::EN || prev == BidiClass::AN)))
+      types[i] = prev;
+  }
+
+  // W5, W6
+  for (size_t i = 0; i < n;) {
+    if (types[i] != BidiClass::ET) {
+      ++i;
+      continue;
+    }
+    size_t end = i;
+    while (end < n && types[end] == BidiClass::ET)
+      ++end;
+    const bool number = (i > 0 && types[i - 1] == BidiClass::EN) ||
+                        (end < n && types[end] == BidiClass::EN);
+    std::fill(types.begin() + i, types.begin() + end,
+              number ? BidiClass::EN : BidiClass::ON);
+    i = end;
+  }
+  for (auto &t : types) {
+    if (t == BidiClass::ES || t == BidiClass::CS)
+      t = BidiClass::ON;
+  }
+
+  // W7
+  strong = sos;
+  for (auto &t : types) {
+    if (t == BidiClass::L || t == BidiClass::R)
+      strong = t;
+    else if (t == BidiClass::EN && strong == BidiClass::L)
+      t = BidiClass::L;
+  }
+
+  // N1, N2
+  for (size_t i = 0; i < n;) {
+    if (!IsNeutral(types[i])) {
+      ++i;
+      continue;
+    }
+    size_t end = i;
+    while (end < n && IsNeutral(types[end]))
+      ++end;
+    const BidiClass before = i > 0 ? StrongDirection(types[i - 1]) : sos;
+    const BidiClass after = end < n ? StrongDirection(types[end]) : sos;
+    std::fill(types.begin() + i, types.begin() + end,
+              before == after ? before : sos);
+    i = end;
+  }
+
+  // I1, I2
+  std::vector<uint8_t> levels(n, paragraph);
+  for (size_t i = 0; i < n; ++i) {
+    if (paragraph % 2 == 0) {
+      if (types[i] == BidiClass::R)
+        levels[i] += 1;
+      else if (types[i] == BidiClass::AN || types[i] == BidiClass::EN)
+        levels[i] += 2;
+    } else if (types[i] == BidiClass::L || types[i] == BidiClass::EN ||
+               types[i] == BidiClass::AN) {
+      levels[i] += 1;
+    }
+  }
+
+  // L1: separators and the white space before them or the line end
+  bool trailing = true;
+  for (size_t i = n; i-- > 0;) {
+    const BidiClass c = classes[i];
+    if (c == BidiClass::B || c == BidiClass::S) {
+      levels[i] = paragraph;
+      trailing = true;
+    } else if (trailing && (c == BidiClass::WS || c == BidiClass::BN)) {
+      levels[i] = paragraph;
+    } else {
+      trailing = false;
+    }
+  }
+
+  return levels;
+}
+
+bool IsRealScript(hb_script_t script) {
+  return script != HB_SCRIPT_COMMON && script != HB_SCRIPT_INHERITED &&
+         script != HB_SCRIPT_UNKNOWN;
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+std::vector<TextRun> Itemize(std::string_view utf8Text,
+                             const FontSelector &selectFont) {
+  TRACE_SCOPE("shaping/itemize");
+  hb_unicode_funcs_t *unicode = hb_unicode_funcs_get_default();
+
+  std::vector<size_t> offsets; // byte offset of every code point
+  std::vector<BidiClass> classes;
+  std::vector<hb_script_t> scripts;
+  std::vector<unsigned> fonts;
+  offsets.reserve(utf8Text.size());
+  classes.reserve(utf8Text.size());
+  scripts.reserve(utf8Text.size());
+  fonts.reserve(utf8Text.size());
+
+  for (size_t offset = 0; offset < utf8Text.size();) {
+    offsets.push_back(offset);
+    const char32_t cp = NextCodepoint(utf8Text, offset);
+    const BidiClass cls = ClassifyBidi(cp);
+    classes.push_back(cls);
+    scripts.push_back(hb_unicode_script(unicode, cp));
+
+    const bool attached = cls == BidiClass::NSM || cls == BidiClass::BN;
+    if (attached && !fonts.empty())
+      fonts.push_back(fonts.back());
+    else
+      fonts.push_back(selectFont ? selectFont(cp) : 0);
+  }
+  offsets.push_back(utf8Text.size());
+
+  const size_t n = classes.size();
+  if (n == 0)
+    return {};
+
+  // common and inherited characters join the preceding script, a leading
+  // stretch of them the first real one
+  hb_script_t current = HB_SCRIPT_COMMON;
+  for (hb_script_t script : scripts) {
+    if (IsRealScript(script)) {
+      current = script;
+      break;
+    }
+  }
+  for (auto &script : scripts) {
+    if (IsRealScript(script))
+      current = script;
+    else
+      script = current;
+  }
+
+  const std::vector<uint8_t> levels = ResolveLevels(classes);
+
+  std::vector<TextRun> runs;
+  size_t begin = 0;
+  for (size_t i = 1; i <= n; ++i) {
+    if (i < n && levels[i] == levels[begin] && scripts[i] == scripts[begin] &&
+        fonts[i] == fonts[begin])
+      continue;
+    runs.push_back(TextRun{offsets[begin], offsets[i], (uint32_t)scripts[begin],
+                           levels[begin], fonts[begin]});
+    begin = i;
+  }
+  return runs;
+}
+
+std::vector<size_t> VisualOrder(const std::vector<TextRun> &runs) {
+  std::vector<size_t> order(runs.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  if (runs.empty())
+    return order;
+
+  uint8_t highest = 0;
+  uint8_t lowestOdd = UINT8_MAX;
+  for (const TextRun &run : runs) {
+    highest = std::max(highest, run.level);
+    if (run.level % 2)
+      lowestOdd = std::min(lowestOdd, run.level);
+  }
+
+  // L2: from the highest level down to the lowest odd one, reverse every
+  // sequence of runs at that level or above
+  for (int level = highest; level >= (int)lowestOdd; --level) {
+    for (size_t i = 0; i < order.size();) {
+      if (runs[order[i]].level < level) {
+        ++i;
+        continue;
+      }
+      size_t end = i;
+      while (end < order.size() && runs[order[end]].level >= level)
+        ++end;
+      std::reverse(order.begin() + i, order.begin() + end);
+      i = end;
+    }
+  }
+  return order;
+}
@@ -0,0 +1,39 @@
+#ifndef FONT_ITEMIZE_HPP
+#define FONT_ITEMIZE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A maximal stretch of text with one script, one bidi level and one
+ * font; the unit HarfBuzz can shape on its own.
+ */
+struct TextRun {
+  size_t begin = 0; // byte range in the itemized text
+  size_t end = 0;
+  uint32_t script = 0; // hb_script_t
+  uint8_t level = 0;   // bidi embedding level, odd levels are right-to-left
+  unsigned font = 0;   // index returned by the font selector
+};
+
+/// Maps a code point to the index of the font that should draw it.
+using FontSelector = std::function<unsigned(char32_t)>;
+
+/**
+ * @brief Splits text into runs by script, bidi level and font, in logical
+ * order.
+ *
+ * The bidi levels follow the implicit part of UAX #9 (rules P2-P3, W1-W7,
+ * N1-N2, I1-I2 and L1) for one line; explicit embeddings, overrides and
+ * isolates are ignored. Common and inherited characters take the script of
+ * the text around them, marks stay in the font of their base.
+ */
+std::vector<TextRun> Itemize(std::string_view utf8Text,
+                             const FontSelector &selectFont = {});
+
+/// Indices into `runs` in visual (left to right) order, rule L2.
+std::vector<size_t> VisualOrder(const std::vector<TextRun> &runs);
+
+#endif // FONT_ITEMIZE_HPP
@@ -0,0 +1,452 @@
+#include "layout.hpp"
+
+#include <hb.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <stdexcept>
+
+#include "render.hpp"
+#include "trace/trace.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+// Reduced set of UAX #14 line breaking classes.
+enum class LineClass : uint8_t {
+  AL, // alphabetic and everything not listed below
+  BK, // mandatory break
+  CR,
+  LF,
+  SP,
+  ZW,  // zero width space
+  ZWJ, // zero width joiner
+  GL,  // non-breaking (includes WJ)
+  CM,  // combining mark
+  BA,  // break after
+  HY,  // hyphen
+  BB,  // break before
+  OP,  // opening punctuation
+  CL,  // closing punctuation (includes CP)
+  EX,  // exclamation
+  IS,  // infix separator
+  SY,  // solidus
+  NS,  // non-starter
+  QU,  // quotation
+  NU,  // numeric
+  ID,  // ideographic, breaks on both sides
+};
+
+LineClass Classify(char32_t cp) {
+  switch (cp) {
+  case U'\n':
+    return LineClass::LF;
+  case U'\r':
+    return LineClass::CR;
+  case U'\v':
+  case U'\f':
+  case U'\u0085':
+  case U'\u2028':
+  case U'\u2029':
+    return LineClass::BK;
+  case U' ':
+    return LineClass::SP;
+  case U'\t':
+  case U'\u00AD':
+  case U'\u2010':
+  case U'\u2013':
+  case U'\u2014':
+    return LineClass::BA;
+  case U'\u200B':
+    return LineClass::ZW;
+  case U'\u200D':
+    return LineClass::ZWJ;
+  case U'\u00A0':
+  case U'\u2007':
+  case U'\u202F':
+  case U'\u2060':
+  case U'\uFEFF':
+    return LineClass::GL;
+  case U'-':
+    return LineClass::HY;
+  case U'(':
+  case U'[':
+  case U'{':
+  case U'\u00A1':
+  case U'\u00BF':
+  case U'\uFF08':
+    return LineClass::OP;
+  case U')':
+  case U']':
+  case U'}':
+  case U'\u3001':
+  case U'\u3002':
+  case U'\uFF09':
+  case U'\uFF0C':
+  case U'\uFF0E':
+    return LineClass::CL;
+  case U'!':
+  case U'?':
+  case U'\uFF01':
+  case U'\uFF1F':
+    return LineClass::EX;
+  case U',':
+  case U'.':
+  case U':':
+  case U';':
+    return LineClass::IS;
+  case U'/':
+    return LineClass::SY;
+  case U'"':
+  case U'\'':
+  case U'\u00AB':
+  case U'\u00BB':
+  case U'\u2018':
+  case U'\u2019':
+  case U'\u201C':
+  case U'\u201D':
+    return LineClass::QU;
+  case U'\u00B4':
+    return LineClass::BB;
+  case U'\u3005':
+  case U'\u30FB':
+  case U'\u30FC':
+    return LineClass::NS;
+  default:
+    break;
+  }
+
+  if (cp >= U'0' && cp <= U'9')
+    return LineClass::NU;
+  if (cp >= 0x3008 && cp <= 0x3011) // CJK brackets alternate open/close
+    return cp % 2 == 0 ? LineClass::OP : LineClass::CL;
+
+  // small kana must not start a line
+  if ((cp >= 0x3041 && cp <= 0x3049 && cp % 2 == 1) || cp == 0x3063 ||
+      cp == 0x3083 || cp == 0x3085 || cp == 0x3087 ||
+      (cp >= 0x30A1 && cp <= 0x30A9 && cp % 2 == 1) || cp == 0x30C3 ||
+      cp == 0x30E3 || cp == 0x30E5 || cp == 0x30E7)
+    return LineClass::NS;
+
+  if ((cp >= 0x2E80 && cp <= 0x9FFF) || (cp >= 0xAC00 && cp <= 0xD7A3) ||
+      (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0xFF00 && cp <= 0xFFEF) ||
+      (cp >= 0x20000 && cp <= 0x3FFFD) || (cp >= 0x2600 && cp <= 0x27BF) ||
+      (cp >= 0x1F000 && cp <= 0x1FAFF && !(cp >= 0x1F3FB && cp <= 0x1F3FF)))
+    return LineClass::ID;
+
+  switch (hb_unicode_general_category(hb_unicode_funcs_get_default(), cp)) {
+  case HB_UNICODE_GENERAL_CATEGORY_NON_SPACING_MARK:
+  case HB_UNICODE_GENERAL_CATEGORY_SPACING_MARK:
+  case HB_UNICODE_GENERAL_CATEGORY_ENCLOSING_MARK:
+    return LineClass::CM;
+  default:
+    break;
+  }
+  if (cp >= 0x1F3FB && cp <= 0x1F3FF) // emoji skin tone modifiers
+    return LineClass::CM;
+
+  return LineClass::AL;
+}
+
+bool IsWordClass(LineClass c) {
+  return c == LineClass::AL || c == LineClass::NU || c == LineClass::QU;
+}
+
+// Bytes of trailing white space and line terminators of a segment.
+size_t TrimmedEnd(std::string_view text, size_t begin, size_t end,
+                  bool spaces) {
+  for (;;) {
+    if (end > begin && (text[end - 1] == '\n' || text[end - 1] == '\r' ||
+                        text[end - 1] == '\v' || text[end - 1] == '\f' ||
+                        (spaces && (text[end - 1] == ' ' ||
+                                    text[end - 1] == '\t')))) {
+      --end;
+    } else if (end >= begin + 2 && text.substr(end - 2, 2) == "\xC2\x85") {
+      end -= 2; // U+0085
+    } else if (end >= begin + 3 && (text.substr(end - 3, 3) == "\xE2\x80\xA8" ||
+                                    text.substr(end - 3, 3) == "\xE2\x80\xA9")) {
+      end -= 3; // U+2028, U+2029
+    } else {
+      return end;
+    }
+  }
+}
+
+FT_Face SizedFace(FT_Face face) {
+  if (!face || !face->size) {
+    throw std::invalid_argument("ParagraphLayout needs a sized face");
+  }
+  return face;
+}
+
+int AdvanceWidth(const GlyphRun &run) {
+  float width = 0.0f;
+  for (const Glyph &g : run.glyphs)
+    width += g.advance.x;
+  return (int)std::lround(width);
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+std::vector<BreakAction> FindLineBreaks(std::string_view utf8Text) {
+  TRACE_SCOPE("layout/line_breaks");
+  std::vector<BreakAction> breaks(utf8Text.size() + 1, BreakAction::None);
+
+  LineClass before = LineClass::BK; // class directly before the position
+  LineClass base = LineClass::BK;   // last class that is not SP/CM/ZWJ
+  bool spaces = false;              // SP between `base` and the position
+
+  size_t offset = 0;
+  while (offset < utf8Text.size()) {
+    const size_t position = offset;
+    const LineClass cls = Classify(NextCodepoint(utf8Text, offset));
+
+    BreakAction action = BreakAction::Allowed;
+    if (position == 0) {
+      action = BreakAction::None; // LB2
+    } else if (before == LineClass::BK || before == LineClass::LF ||
+               (before == LineClass::CR && cls != LineClass::LF)) {
+      action = BreakAction::Mandatory; // LB4, LB5
+    } else if (cls == LineClass::BK || cls == LineClass::CR ||
+               cls == LineClass::LF || cls == LineClass::SP ||
+               cls == LineClass::ZW) {
+      action = BreakAction::None; // LB6, LB7
+    } else if (base == LineClass::ZW) {
+      action = BreakAction::Allowed; // LB8
+    } else if (before == LineClass::ZWJ || cls == LineClass::CM ||
+               cls == LineClass::ZWJ) {
+      action = BreakAction::None; // LB8a, LB9
+    } else if (cls == LineClass::CL || cls == LineClass::EX ||
+               cls == LineClass::IS || cls == LineClass::SY) {
+      action = BreakAction::None; // LB13
+    } else if (base == LineClass::OP) {
+      action = BreakAction::None; // LB14
+    } else if (cls == LineClass::QU || (base == LineClass::QU && !spaces)) {
+      action = BreakAction::None; // LB19
+    } else if (spaces) {
+      action = BreakAction::Allowed; // LB18
+    } else if (base == LineClass::GL || cls == LineClass::GL) {
+      action = BreakAction::None; // LB11, LB12, LB12a
+    } else if (cls == LineClass::BA || cls == LineClass::HY ||
+               cls == LineClass::NS || base == LineClass::BB) {
+      action = BreakAction::None; // LB21
+    } else if (base == LineClass::HY && cls == LineClass::NU) {
+      action = BreakAction::None; // LB25, "-5"
+    } else if ((IsWordClass(base) || base == LineClass::IS ||
+                base == LineClass::CL) &&
+               IsWordClass(cls)) {
+      action = BreakAction::None; // LB23, LB28, LB29, LB30
+    } else if (IsWordClass(base) && cls == LineClass::OP) {
+      action = BreakAction::None; // LB30, "f(x)"
+    }
+    breaks[position] = action;
+
+    // LB9: marks take the class of their base, except after spaces and breaks
+    const bool attaches = cls == LineClass::CM || cls == LineClass::ZWJ;
+    if (cls == LineClass::SP) {
+      spaces = true;
+    } else if (!attaches || base == LineClass::BK || spaces) {
+      base = attaches ? LineClass::AL : cls;
+      spaces = false;
+    }
+    before = cls;
+  }
+
+  breaks[utf8Text.size()] = BreakAction::Mandatory; // LB3
+  return breaks;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// checked before the measurer reads the face's metrics
+ParagraphLayout::ParagraphLayout(FT_Face face)
+    : _face(SizedFace(face)), _measurer(_face) {}
+
+void ParagraphLayout::setText(std::string text) {
+  _text = std::move(text);
+  _dirty = true;
+}
+
+void ParagraphLayout::replace(size_t pos, size_t length,
+                              std::string_view text) {
+  if (pos > _text.size()) {
+    throw std::out_of_range(
+        std::format("replace at {} past end of text ({})", pos, _text.size()));
+  }
+  _text.replace(pos, length, text);
+  _dirty = true;
+}
+
+void ParagraphLayout::setOptions(const LayoutOptions &options) {
+  if (options.maxWidth < 0 || !(options.lineSpacing > 0.0f)) {
+    throw std::invalid_argument(
+        std::format("bad layout options: width {}, line spacing {}",
+                    options.maxWidth, options.lineSpacing));
+  }
+  _options = options;
+  _dirty = true;
+}
+
+int ParagraphLayout::measure(std::string_view segment) {
+  if (segment.empty())
+    return 0;
+
+  auto it = _segments.find(segment);
+  if (it == _segments.end()) {
+    const int width = (int)std::lround(_measurer.measure(segment).advance);
+    it = _segments.emplace(std::string(segment), SegmentEntry{width, 0}).first;
+    ++_stats.shapedSegments;
+  }
+  it->second.used = _generation;
+  return it->second.width;
+}
+
+void ParagraphLayout::addLine(size_t begin, size_t end) {
+  const std::string_view text = std::string_view(_text).substr(begin, end - begin);
+
+  auto it = _runs.find(text);
+  if (it == _runs.end()) {
+    GlyphRun run = text.empty() ? GlyphRun{{}, {0, 0}} : shape(_face, text);
+    const int width = AdvanceWidth(run);
+    it = _runs.emplace(std::string(text), LineEntry{std::move(run), width, 0})
+             .first;
+    ++_stats.shapedLines;
+  } else {
+    ++_stats.reusedLines;
+  }
+  it->second.used = _generation;
+
+  Line line;
+  line.begin = begin;
+  line.end = end;
+  line.width = it->second.width;
+  line.run = &it->second.run;
+  _lines.push_back(line);
+}
+
+void ParagraphLayout::sweep() {
+  // keep one spare generation so toggling back and forth stays cheap
+  std::erase_if(_segments, [this](const auto &entry) {
+    return _generation - entry.second.used >= 2;
+  });
+  std::erase_if(_runs, [this](const auto &entry) {
+    return _generation - entry.second.used >= 2;
+  });
+}
+
+const std::vector<Line> &ParagraphLayout::layout() {
+  if (!_dirty)
+    return _lines;
+
+  TRACE_SCOPE("layout/paragraph");
+  ++_generation;
+  _stats = Stats{};
+  _lines.clear();
+
+  const auto &metrics = _face->size->metrics;
+  _ascender = (int)((metrics.ascender + 63) >> 6);
+  _descender = (int)((-metrics.descender + 63) >> 6);
+  _lineHeight = (int)std::lround((double)metrics.height / 64.0 *
+                                 _options.lineSpacing);
+
+  const std::vector<BreakAction> breaks = FindLineBreaks(_text);
+  const std::string_view text = _text;
+
+  size_t lineBegin = 0;
+  size_t lineEnd = 0;   // end of the last content, excludes trailing spaces
+  int lineWidth = 0;    // includes trailing spaces of earlier segments
+  bool lineEmpty = true;
+
+  size_t segmentBegin = 0;
+  for (size_t i = 1; i < breaks.size(); ++i) {
+    if (breaks[i] == BreakAction::None)
+      continue;
+
+    const size_t segmentEnd = i;
+    const size_t spaceEnd = TrimmedEnd(text, segmentBegin, segmentEnd, false);
+    size_t contentEnd = TrimmedEnd(text, segmentBegin, spaceEnd, true);
+    if (contentEnd == segmentBegin && lineEmpty)
+      contentEnd = spaceEnd; // keep indentation at the start of a line
+
+    const int contentWidth =
+        measure(text.substr(segmentBegin, contentEnd - segmentBegin));
+    const int spaceWidth =
+        measure(text.substr(contentEnd, spaceEnd - contentEnd));
+
+    if (!lineEmpty && _options.maxWidth > 0 &&
+        lineWidth + contentWidth > _options.maxWidth) {
+      addLine(lineBegin, lineEnd);
+      lineBegin = segmentBegin;
+      lineWidth = 0;
+    }
+
+    // an overlong word stays on a line of its own and overflows
+    lineEnd = contentEnd;
+    lineWidth += contentWidth + spaceWidth;
+    lineEmpty = false;
+
+    if (breaks[i] == BreakAction::Mandatory) {
+      addLine(lineBegin, lineEnd);
+      lineBegin = lineEnd = segmentEnd;
+      lineWidth = 0;
+      lineEmpty = true;
+    }
+    segmentBegin = segmentEnd;
+  }
+
+  int width = _options.maxWidth;
+  if (width == 0) {
+    for (const Line &line : _lines)
+      width = std::max(width, line.width);
+  }
+
+  for (size_t i = 0; i < _lines.size(); ++i) {
+    Line &line = _lines[i];
+    line.origin.y = _ascender + (int)i * _lineHeight;
+    switch (_options.align) {
+    case Align::Left:
+      line.origin.x = 0;
+      break;
+    case Align::Center:
+      line.origin.x = (width - line.width) / 2;
+      break;
+    case Align::Right:
+      line.origin.x = width - line.width;
+      break;
+    }
+  }
+
+  _size = _lines.empty()
+              ? glm::uvec2(0, 0)
+              : glm::uvec2((unsigned)std::max(width, 0),
+                           (unsigned)(_lines.back().origin.y + _descender));
+
+  sweep();
+  _dirty = false;
+
+  spdlog::debug("layout: {} lines, {} segments and {} lines shaped, {} reused",
+                _lines.size(), _stats.shapedSegments, _stats.shapedLines,
+                _stats.reusedLines);
+  return _lines;
+}
+
+glm::uvec2 ParagraphLayout::size() {
+  layout();
+  return _size;
+}
+
+std::vector<uint8_t> ParagraphLayout::render() {
+  layout();
+  TRACE_SCOPE("layout/render");
+
+  std::vector<uint8_t> img((size_t)_size.x * _size.y, 0);
+  for (const Line &line : _lines) {
+    RenderInto(_face, line.run->glyphs, line.origin, img, _size);
+  }
+  return img;
+}
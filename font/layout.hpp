@@ -0,0 +1,122 @@
+#ifndef FONT_LAYOUT_HPP
+#define FONT_LAYOUT_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "measure.hpp"
+#include "shaping.hpp"
+
+enum class Align { Left, Center, Right };
+
+struct LayoutOptions {
+  int maxWidth = 0; // px, 0 disables wrapping
+  Align align = Align::Left;
+  float lineSpacing = 1.0f; // multiple of the font's line height
+};
+
+enum class BreakAction : uint8_t { None, Allowed, Mandatory };
+
+/**
+ * @brief Line break opportunities after UAX #14. Element `i` tells whether a
+ * line may end before byte `i`; the vector has `text.size() + 1` entries and
+ * the last one is always mandatory.
+ *
+ * Implements the rules that matter for our corpora (mandatory breaks, spaces,
+ * ZW/WJ/GL, hyphens, punctuation, quotes, ideographs and combining marks) on a
+ * reduced class table, not the full pair table of the standard.
+ */
+std::vector<BreakAction> FindLineBreaks(std::string_view utf8Text);
+
+struct Line {
+  size_t begin = 0; // byte range in the paragraph text, trailing white space
+  size_t end = 0;   // and the line terminator are excluded
+  glm::ivec2 origin{0, 0}; // pen position of the baseline in px
+  int width = 0;           // advance width in px
+  const GlyphRun *run = nullptr; // owned by the layout, valid until next pass
+};
+
+/**
+ * @brief Multi-line layout of one paragraph with greedy line filling.
+ *
+ * Shaped results are cached by text: break candidates ("words") keep their
+ * measured width and every line keeps its GlyphRun. An edit or a resize
+ * therefore only shapes the words and lines whose text actually changed;
+ * entries unused for two passes are dropped.
+ */
+class ParagraphLayout {
+public:
+  struct Stats {
+    size_t shapedSegments = 0; // cache misses of the last pass
+    size_t shapedLines = 0;
+    size_t reusedLines = 0;
+  };
+
+  /// The face must stay alive and at the same pixel size.
+  explicit ParagraphLayout(FT_Face face);
+
+  void setText(std::string text);
+  void replace(size_t pos, size_t length, std::string_view text);
+  void setOptions(const LayoutOptions &options);
+
+  const std::string &text() const { return _text; }
+  const LayoutOptions &options() const { return _options; }
+
+  /// Lays out the paragraph if it changed since the last call.
+  const std::vector<Line> &layout();
+
+  /// Extent of the laid out paragraph in px.
+  glm::uvec2 size();
+
+  std::vector<uint8_t> render();
+
+  const Stats &stats() const { return _stats; }
+
+private:
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+
+  struct SegmentEntry {
+    int width;
+    unsigned used;
+  };
+
+  struct LineEntry {
+    GlyphRun run;
+    int width;
+    unsigned used;
+  };
+
+  int measure(std::string_view segment);
+  void addLine(size_t begin, size_t end);
+  void sweep();
+
+  FT_Face _face;
+  TextMeasurer _measurer; // segment widths, which are never drawn
+  std::string _text;
+  LayoutOptions _options;
+
+  bool _dirty = true;
+  unsigned _generation = 0;
+  int _lineHeight = 0;
+  int _ascender = 0;
+  int _descender = 0;
+  glm::uvec2 _size{0, 0};
+
+  std::vector<Line> _lines;
+  std::unordered_map<std::string, SegmentEntry, Hash, std::equal_to<>>
+      _segments;
+  std::unordered_map<std::string, LineEntry, Hash, std::equal_to<>> _runs;
+  Stats _stats;
+};
+
+#endif // FONT_LAYOUT_HPP
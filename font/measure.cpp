@@ -0,0 +1,234 @@
+#include "measure.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <hb-ft.h>
+
+#include <algorithm>
+#include <climits>
+#include <format>
+#include <stdexcept>
+
+#include "ascii_shaper.hpp"
+#include "itemize.hpp"
+#include "trace/trace.hpp"
+
+namespace {
+
+struct InkBounds {
+  int32_t left = INT32_MAX, right = INT32_MIN;
+  int32_t low = INT32_MAX, high = INT32_MIN;
+};
+
+#if defined(__SSE2__)
+
+// Signed 32-bit min and max on plain SSE2 (pminsd/pmaxsd are SSE4.1).
+__m128i Min32(__m128i a, __m128i b) {
+  const __m128i less = _mm_cmplt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(less, a), _mm_andnot_si128(less, b));
+}
+
+__m128i Max32(__m128i a, __m128i b) {
+  const __m128i greater = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(greater, a),
+                      _mm_andnot_si128(greater, b));
+}
+
+#endif
+
+/**
+ * @brief Union of the boxes in 26.6. Rounding to pixels commutes with min
+ * and max, so rounding once afterwards gives what rounding every glyph
+ * does.
+ */
+InkBounds ReduceInk(const int32_t *left, const int32_t *right,
+                    const int32_t *low, const int32_t *high, size_t count) {
+  InkBounds b;
+  size_t i = 0;
+#if defined(__SSE2__)
+  if (count >= 4) {
+    __m128i l = _mm_set1_epi32(INT32_MAX), r = _mm_set1_epi32(INT32_MIN);
+    __m128i lo = _mm_set1_epi32(INT32_MAX), hi = _mm_set1_epi32(INT32_MIN);
+    for (; i + 4 <= count; i += 4) {
+      l = Min32(l, _mm_loadu_si128((const __m128i *)(left + i)));
+      r = Max32(r, _mm_loadu_si128((const __m128i *)(right + i)));
+      lo = Min32(lo, _mm_loadu_si128((const __m128i *)(low + i)));
+      hi = Max32(hi, _mm_loadu_si128((const __m128i *)(high + i)));
+    }
+
+    alignas(16) int32_t lanes[4][4];
+    _mm_store_si128((__m128i *)lanes[0], l);
+    _mm_store_si128((__m128i *)lanes[1], r);
+    _mm_store_si128((__m128i *)lanes[2], lo);
+    _mm_store_si128((__m128i *)lanes[3], hi);
+    for (size_t j = 0; j < 4; ++j) {
+      b.left = std::min(b.left, lanes[0][j]);
+      b.right = std::max(b.right, lanes[1][j]);
+      b.low = std::min(b.low, lanes[2][j]);
+      b.high = std::max(b.high, lanes[3][j]);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    b.left = std::min(b.left, left[i]);
+    b.right = std::max(b.right, right[i]);
+    b.low = std::min(b.low, low[i]);
+    b.high = std::max(b.high, high[i]);
+  }
+  return b;
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+LineMetrics MeasureLine(FT_Face face) {
+  if (!face || !face->size) {
+    throw std::invalid_argument("measuring text needs a sized face");
+  }
+  const auto &metrics = face->size->metrics;
+  LineMetrics line;
+  line.ascender = (int)((metrics.ascender + 63) >> 6);
+  line.descender = (int)((-metrics.descender + 63) >> 6);
+  line.lineHeight = (float)metrics.height / 64.0f;
+  return line;
+}
+
+void TextMeasurer::InkBoxes::clear() {
+  left.clear();
+  right.clear();
+  low.clear();
+  high.clear();
+}
+
+TextMeasurer::TextMeasurer(FT_Face face)
+    : _face(face), _line(MeasureLine(face)) {}
+
+TextMeasurer::~TextMeasurer() {
+  if (_buffer)
+    hb_buffer_destroy(_buffer);
+  if (_font)
+    hb_font_destroy(_font);
+}
+
+hb_font_t *TextMeasurer::font() {
+  if (!_font) {
+    _font = hb_ft_font_create_referenced(_face);
+    _buffer = hb_buffer_create();
+  }
+  return _font;
+}
+
+template <typename ExtentsOf>
+void TextMeasurer::addGlyphs(const hb_glyph_position_t *pos, unsigned count,
+                             ExtentsOf extentsOf, glm::ivec2 &pen) {
+  for (unsigned i = 0; i < count; ++i) {
+    hb_glyph_extents_t ext{};
+    if (extentsOf(i, ext)) {
+      // as in CalculateBoundingRectPx(): y up, height usually negative
+      const int32_t x = pen.x + pos[i].x_offset + ext.x_bearing;
+      const int32_t y = pen.y + pos[i].y_offset + ext.y_bearing;
+      _boxes.left.push_back(x);
+      _boxes.right.push_back(x + ext.width);
+      _boxes.low.push_back(std::min(y, y + ext.height));
+      _boxes.high.push_back(std::max(y, y + ext.height));
+    }
+    pen.x += pos[i].x_advance;
+    pen.y += pos[i].y_advance;
+  }
+}
+
+int32_t TextMeasurer::addText(std::string_view utf8Text) {
+  glm::ivec2 pen(0); // 26.6
+
+  const AsciiShaper *ascii = AsciiShaper::IsSimpleText(utf8Text)
+                                 ? AsciiShaper::For(_face)
+                                 : nullptr;
+  if (ascii && ascii->accepts(utf8Text)) {
+    ascii->shape(utf8Text, _infos, _positions);
+    addGlyphs(
+        _positions.data(), (unsigned)_positions.size(),
+        [&](unsigned i, hb_glyph_extents_t &ext) {
+          return ascii->extents(utf8Text[_infos[i].cluster], ext);
+        },
+        pen);
+  } else if (!utf8Text.empty()) {
+    // ShapeWithFaces() for one face: runs in visual order, each shaped with
+    // the whole text as context
+    hb_font_t *hbFont = font();
+    const std::vector<TextRun> runs = Itemize(utf8Text);
+    for (size_t r : VisualOrder(runs)) {
+      const TextRun &run = runs[r];
+      hb_buffer_clear_contents(_buffer);
+      hb_buffer_add_utf8(_buffer, utf8Text.data(), (int)utf8Text.size(),
+                         (unsigned)run.begin, (int)(run.end - run.begin));
+      hb_buffer_set_direction(_buffer, run.level % 2 ? HB_DIRECTION_RTL
+                                                     : HB_DIRECTION_LTR);
+      hb_buffer_set_script(_buffer, (hb_script_t)run.script);
+      hb_buffer_guess_segment_properties(_buffer);
+      hb_shape(hbFont, _buffer, nullptr, 0);
+
+      unsigned count = 0;
+      const hb_glyph_info_t *infos =
+          hb_buffer_get_glyph_infos(_buffer, &count);
+      const hb_glyph_position_t *pos =
+          hb_buffer_get_glyph_positions(_buffer, &count);
+      addGlyphs(
+          pos, count,
+          [&](unsigned i, hb_glyph_extents_t &ext) {
+            return hb_font_get_glyph_extents(hbFont, infos[i].codepoint,
+                                             &ext);
+          },
+          pen);
+    }
+  }
+
+  return pen.x;
+}
+
+TextMetrics TextMeasurer::metricsOf(int32_t advance, size_t first,
+                                    size_t last) const {
+  TextMetrics metrics;
+  metrics.advance = (float)advance / 64.0f;
+  if (last > first) {
+    const InkBounds b = ReduceInk(
+        _boxes.left.data() + first, _boxes.right.data() + first,
+        _boxes.low.data() + first, _boxes.high.data() + first, last - first);
+    metrics.ink.min = {b.left >> 6, b.low >> 6};
+    metrics.ink.max = {(b.right + 63) >> 6, (b.high + 63) >> 6};
+  }
+  metrics.size = RunImageSize(metrics.ink, _face);
+  return metrics;
+}
+
+TextMetrics TextMeasurer::measure(std::string_view utf8Text) {
+  TRACE_SCOPE("shaping/measure");
+  _boxes.clear();
+  const int32_t advance = addText(utf8Text);
+  return metricsOf(advance, 0, _boxes.size());
+}
+
+void TextMeasurer::measure(std::span<const std::string_view> texts,
+                           std::span<TextMetrics> out) {
+  if (out.size() < texts.size()) {
+    throw std::invalid_argument(std::format(
+        "{} results for {} texts to measure", out.size(), texts.size()));
+  }
+  TRACE_SCOPE("shaping/measure_batch");
+  // every text's boxes go into _boxes back to back, then each range is
+  // reduced
+  _boxes.clear();
+  _ends.clear();
+  _advances.clear();
+  for (std::string_view text : texts) {
+    _advances.push_back(addText(text));
+    _ends.push_back(_boxes.size());
+  }
+  size_t first = 0;
+  for (size_t i = 0; i < texts.size(); ++i) {
+    out[i] = metricsOf(_advances[i], first, _ends[i]);
+    first = _ends[i];
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef FONT_MEASURE_HPP
+#define FONT_MEASURE_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <hb.h>
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "shaping.hpp"
+
+/// Vertical metrics of a face at its size, in px.
+struct LineMetrics {
+  int ascender = 0;  // above the baseline, rounded up
+  int descender = 0; // below the baseline, positive, rounded up
+  float lineHeight = 0.0f; // baseline to baseline
+};
+
+/// Throws std::invalid_argument for a null or unsized face.
+LineMetrics MeasureLine(FT_Face face);
+
+/// What shape() would tell about a text, without the glyphs.
+struct TextMetrics {
+  float advance = 0.0f; // pen advance in px, the sum of the glyph advances
+  RectI ink;            // as CalculateBoundingRectPx(): px, y up
+  glm::uvec2 size{0};   // the GlyphRun::size of shape()
+};
+
+/**
+ * @brief Measures strings with one face, for callers that need sizes but
+ * not glyphs. Text is shaped like shape() does it, through AsciiShaper or
+ * HarfBuzz, and the results match shape() exactly. No GlyphRun is built
+ * and nothing is rasterized.
+ *
+ * Each glyph's ink box goes into a reused structure of arrays, and the
+ * arrays are reduced four glyphs at a time with SSE2. Once the scratch
+ * space has grown, measuring plain ASCII does not allocate.
+ *
+ * Like the face it wraps, a measurer must not be shared between threads.
+ */
+class TextMeasurer {
+public:
+  /// The face must stay alive and at the same pixel size.
+  explicit TextMeasurer(FT_Face face);
+  ~TextMeasurer();
+
+  TextMeasurer(const TextMeasurer &) = delete;
+  TextMeasurer &operator=(const TextMeasurer &) = delete;
+
+  TextMetrics measure(std::string_view utf8Text);
+
+  /**
+   * @brief Measures `texts[i]` into `out[i]`; `out` must be at least as
+   * long. All texts are shaped first and their ink boxes reduced afterwards,
+   * one range per text.
+   */
+  void measure(std::span<const std::string_view> texts,
+               std::span<TextMetrics> out);
+
+  const LineMetrics &line() const { return _line; }
+
+private:
+  // the ink box of every inked glyph, 26.6 relative to the text's pen
+  struct InkBoxes {
+    std::vector<int32_t> left, right, low, high;
+
+    void clear();
+    size_t size() const { return left.size(); }
+  };
+
+  hb_font_t *font();
+
+  // moves `pen` past the glyphs, adding the inked ones to _boxes;
+  // extentsOf(i, ext) is false for glyphs without ink
+  template <typename ExtentsOf>
+  void addGlyphs(const hb_glyph_position_t *pos, unsigned count,
+                 ExtentsOf extentsOf, glm::ivec2 &pen);
+
+  // shapes the text, adding its inked glyphs to _boxes; returns the pen
+  // advance in 26.6
+  int32_t addText(std::string_view utf8Text);
+
+  // the metrics of a text whose ink boxes are _boxes[first, last)
+  TextMetrics metricsOf(int32_t advance, size_t first, size_t last) const;
+
+  FT_Face _face;
+  LineMetrics _line;
+  hb_font_t *_font = nullptr; // created on the first text HarfBuzz shapes
+  hb_buffer_t *_buffer = nullptr;
+  InkBoxes _boxes;
+  std::vector<hb_glyph_info_t> _infos;
+  std::vector<hb_glyph_position_t> _positions;
+  std::vector<size_t> _ends;       // batch: end of each text in _boxes
+  std::vector<int32_t> _advances;  // batch: pen advance of each text
+};
+
+#endif // FONT_MEASURE_HPP
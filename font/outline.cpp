@@ -0,0 +1,149 @@
+#include "outline.hpp"
+
+#include FT_OUTLINE_H
+
+#include <format>
+#include <limits>
+#include <stdexcept>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+struct Decomposer {
+  GlyphOutline &out;
+  glm::vec2 current{0.0f};
+
+  static glm::vec2 Point(const FT_Vector *v) {
+    return {(float)v->x, (float)v->y};
+  }
+
+  static Decomposer &Self(void *user) {
+    return *static_cast<Decomposer *>(user);
+  }
+
+  static int MoveTo(const FT_Vector *to, void *user) {
+    auto &self = Self(user);
+    self.current = Point(to);
+    if (self.out.contours++)
+      self.out.contourEnds.push_back((uint32_t)self.out.order.size());
+    return 0;
+  }
+
+  static int LineTo(const FT_Vector *to, void *user) {
+    auto &self = Self(user);
+    const glm::vec2 p = Point(to);
+    if (p != self.current) { // degenerate lines add nothing but work
+      self.out.lines.push({self.current, p});
+      self.out.order.push_back(0);
+    }
+    self.current = p;
+    return 0;
+  }
+
+  static int ConicTo(const FT_Vector *control, const FT_Vector *to,
+                     void *user) {
+    auto &self = Self(user);
+    const glm::vec2 p = Point(to);
+    self.out.quads.push({self.current, Point(control), p});
+    self.out.order.push_back(1);
+    self.current = p;
+    return 0;
+  }
+
+  static int CubicTo(const FT_Vector *control1, const FT_Vector *control2,
+                     const FT_Vector *to, void *user) {
+    auto &self = Self(user);
+    const glm::vec2 p = Point(to);
+    self.out.cubics.push({self.current, Point(control1), Point(control2), p});
+    self.out.order.push_back(2);
+    self.current = p;
+    return 0;
+  }
+};
+
+template <size_t Points>
+void GrowBounds(const SegmentBuffer<Points> &buffer, glm::vec2 &min,
+                glm::vec2 &max) {
+  for (size_t i = 0; i < buffer.size(); ++i) {
+    min = glm::min(min, glm::vec2(buffer.minX[i], buffer.minY[i]));
+    max = glm::max(max, glm::vec2(buffer.maxX[i], buffer.maxY[i]));
+  }
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+GlyphOutline DecomposeOutline(const FT_Outline &outline) {
+  GlyphOutline out;
+  out.evenOdd = outline.flags & FT_OUTLINE_EVEN_ODD_FILL;
+
+  static const FT_Outline_Funcs funcs = {
+      Decomposer::MoveTo, Decomposer::LineTo, Decomposer::ConicTo,
+      Decomposer::CubicTo, 0, 0};
+
+  Decomposer decomposer{out};
+  if (FT_Outline_Decompose(const_cast<FT_Outline *>(&outline), &funcs,
+                           &decomposer)) {
+    throw std::runtime_error("FT_Outline_Decompose failed");
+  }
+
+  if (out.contours)
+    out.contourEnds.push_back((uint32_t)out.order.size());
+
+  if (!out.empty()) {
+    out.min = glm::vec2(std::numeric_limits<float>::max());
+    out.max = glm::vec2(std::numeric_limits<float>::lowest());
+    GrowBounds(out.lines, out.min, out.max);
+    GrowBounds(out.quads, out.min, out.max);
+    GrowBounds(out.cubics, out.min, out.max);
+  }
+  return out;
+}
+
+GlyphOutline GlyphOutline::scaled(float s) const {
+  GlyphOutline copy = *this;
+  copy.lines.scale(s);
+  copy.quads.scale(s);
+  copy.cubics.scale(s);
+  copy.min *= s;
+  copy.max *= s;
+  copy.advance *= s;
+  return copy;
+}
+
+/* ------------------------------------------------------------------------- */
+
+OutlineCache::OutlineCache(FT_Face face) : _face(face) {
+  if (!FT_IS_SCALABLE(face)) {
+    throw std::invalid_argument(
+        std::format("font '{}' has no outlines", face->family_name));
+  }
+}
+
+const GlyphOutline &OutlineCache::get(FT_UInt glyphIndex) {
+  std::lock_guard lock(_mutex);
+
+  auto &slot = _outlines[glyphIndex];
+  if (!slot) {
+    TRACE_SCOPE("outline/decompose");
+    // unscaled and unhinted: coordinates come out in font units
+    if (FT_Load_Glyph(_face, glyphIndex, FT_LOAD_NO_SCALE)) {
+      _outlines.erase(glyphIndex);
+      throw std::runtime_error(
+          std::format("FT_Load_Glyph failed (glyphIndex={})", glyphIndex));
+    }
+
+    auto outline = std::make_unique<GlyphOutline>(
+        DecomposeOutline(_face->glyph->outline));
+    outline->advance = (float)_face->glyph->advance.x;
+    slot = std::move(outline);
+  }
+  return *slot;
+}
+
+size_t OutlineCache::size() const {
+  std::lock_guard lock(_mutex);
+  return _outlines.size();
+}
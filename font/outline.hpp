@@ -0,0 +1,110 @@
+#ifndef FONT_OUTLINE_HPP
+#define FONT_OUTLINE_HPP
+
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * @brief Segments of one kind as structure of arrays: `x[i]`/`y[i]` hold the
+ * i-th control point of every segment, followed by the control point bounds.
+ * Only the first `Points` coordinate arrays are used.
+ */
+template <size_t Points> struct SegmentBuffer {
+  std::array<std::vector<float>, Points> x;
+  std::array<std::vector<float>, Points> y;
+  std::vector<float> minX, minY, maxX, maxY;
+
+  size_t size() const { return minX.size(); }
+
+  void push(const std::array<glm::vec2, Points> &p) {
+    glm::vec2 lo = p[0], hi = p[0];
+    for (size_t i = 0; i < Points; ++i) {
+      x[i].push_back(p[i].x);
+      y[i].push_back(p[i].y);
+      lo = glm::min(lo, p[i]);
+      hi = glm::max(hi, p[i]);
+    }
+    minX.push_back(lo.x);
+    minY.push_back(lo.y);
+    maxX.push_back(hi.x);
+    maxY.push_back(hi.y);
+  }
+
+  void scale(float s) {
+    for (auto *arrays : {&x, &y})
+      for (auto &v : *arrays)
+        for (float &f : v)
+          f *= s;
+    for (auto *v : {&minX, &minY, &maxX, &maxY})
+      for (float &f : *v)
+        f *= s;
+  }
+};
+
+/**
+ * @brief A glyph outline decomposed into lines, quadratic and cubic Béziers,
+ * in font units with y up. Independent of any pixel size.
+ */
+struct GlyphOutline {
+  SegmentBuffer<2> lines;
+  SegmentBuffer<3> quads;
+  SegmentBuffer<4> cubics;
+
+  /// Segment kinds in outline order (points - 2, so 0 is a line) and where
+  /// each contour ends in that sequence; lets contours be walked in order.
+  std::vector<uint8_t> order;
+  std::vector<uint32_t> contourEnds;
+
+  glm::vec2 min{0.0f}; // bounds of all control points
+  glm::vec2 max{0.0f};
+  float advance = 0.0f;
+  unsigned contours = 0;
+  bool evenOdd = false; // fill rule, non-zero otherwise
+
+  size_t segments() const {
+    return lines.size() + quads.size() + cubics.size();
+  }
+  bool empty() const { return segments() == 0; }
+
+  /// A copy with every coordinate multiplied by `s`, e.g. px per font unit.
+  GlyphOutline scaled(float s) const;
+};
+
+/**
+ * @brief Decomposes every glyph once with FT_Outline_Decompose and keeps it in
+ * font units, so SDF generation or GPU upload at any size and spread never
+ * goes through FT_Load_Glyph again.
+ *
+ * get() is thread-safe; while it loads, nothing else may use the face.
+ */
+class OutlineCache {
+public:
+  explicit OutlineCache(FT_Face face);
+
+  const GlyphOutline &get(FT_UInt glyphIndex);
+
+  /// Pixels per font unit at a given pixel size.
+  float scaleFor(float pixelSize) const {
+    return pixelSize / (float)_face->units_per_EM;
+  }
+
+  size_t size() const;
+
+private:
+  FT_Face _face;
+  mutable std::mutex _mutex;
+  std::unordered_map<FT_UInt, std::unique_ptr<GlyphOutline>> _outlines;
+};
+
+/// Decomposes an outline as is, in whatever units it was loaded in.
+GlyphOutline DecomposeOutline(const FT_Outline &outline);
+
+#endif // FONT_OUTLINE_HPP
@@ -0,0 +1,477 @@
+#include "output.hpp"
+
+#include <png.h>
+#include <zlib.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+
+#include "exec/executor.hpp"
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr size_t kMinStripRows = 64;
+constexpr size_t kIdatChunkSize = 1 << 20;
+constexpr size_t kZlibChunkSize = (size_t)1 << 30; // zlib counts in uInt
+constexpr size_t kWindowSize = 32768; // deflate dictionary size
+
+/* ------------------------------------------------------------------------- */
+
+struct File {
+  FILE *handle;
+
+  explicit File(const std::filesystem::path &path)
+      : handle(fopen(path.string().c_str(), "wb")) {
+    if (!handle) {
+      throw std::runtime_error(std::format("could not open '{}' for writing: {}",
+                                           path.string(), strerror(errno)));
+    }
+  }
+  // only reached without close(), i.e. when writing already failed
+  ~File() {
+    if (handle)
+      fclose(handle);
+  }
+
+  void write(const void *data, size_t size, const std::filesystem::path &path) {
+    if (fwrite(data, 1, size, handle) != size) {
+      throw std::runtime_error(std::format("could not write '{}': {}",
+                                           path.string(), strerror(errno)));
+    }
+  }
+
+  // flushes what is still buffered, which may fail as well (ENOSPC, EIO)
+  void close(const std::filesystem::path &path) {
+    const int status = fclose(handle);
+    handle = nullptr;
+    if (status != 0) {
+      throw std::runtime_error(std::format("could not write '{}': {}",
+                                           path.string(), strerror(errno)));
+    }
+  }
+};
+
+/* ------------------------------------------------------------------------- */
+
+inline uint8_t paeth(int a, int b, int c) {
+  const int p = a + b - c;
+  const int pa = std::abs(p - a);
+  const int pb = std::abs(p - b);
+  const int pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return (uint8_t)a;
+  return (uint8_t)(pb <= pc ? b : c);
+}
+
+// Applies all five PNG filters to one row and keeps the one with the smallest
+// sum of absolute (signed) residuals, the heuristic libpng uses as well.
+void FilterRow(const uint8_t *row, const uint8_t *prev, size_t length,
+               unsigned bpp, uint8_t *out, std::vector<uint8_t> &scratch) {
+  scratch.resize(length);
+
+  uint64_t bestSum = UINT64_MAX;
+  for (uint8_t type = 0; type < 5; ++type) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+      const int a = i >= bpp ? row[i - bpp] : 0;
+      const int b = prev ? prev[i] : 0;
+      const int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+
+      uint8_t v = row[i];
+      switch (type) {
+      case 1:
+        v -= (uint8_t)a;
+        break;
+      case 2:
+        v -= (uint8_t)b;
+        break;
+      case 3:
+        v -= (uint8_t)((a + b) >> 1);
+        break;
+      case 4:
+        v -= paeth(a, b, c);
+        break;
+      }
+
+      scratch[i] = v;
+      sum += v < 128 ? v : 256 - v;
+    }
+
+    if (sum < bestSum) {
+      bestSum = sum;
+      out[0] = type;
+      std::copy(scratch.begin(), scratch.end(), out + 1);
+    }
+  }
+}
+
+struct Strip {
+  std::vector<uint8_t> deflated;
+  uLong adler = 1;
+  size_t length = 0;
+};
+
+// Filters and deflates rows [first, last). Every strip but the last ends on a
+// byte boundary (Z_SYNC_FLUSH), so the raw deflate outputs can simply be
+// concatenated. The tail of the previous strip primes the dictionary to keep
+// the ratio close to a single-threaded encode.
+Strip EncodeStrip(const OutputImage &image, size_t first, size_t last,
+                  int level, bool final) {
+  TRACE_SCOPE("output/png_strip");
+  const size_t stride = (size_t)image.size.x * image.channels;
+  const uint8_t *pixels = image.pixels.data();
+
+  std::vector<uint8_t> filtered((last - first) * (stride + 1));
+  std::vector<uint8_t> scratch;
+  for (size_t y = first; y < last; ++y) {
+    const uint8_t *prev = y > 0 ? pixels + (y - 1) * stride : nullptr;
+    FilterRow(pixels + y * stride, prev, stride, image.channels,
+              filtered.data() + (y - first) * (stride + 1), scratch);
+  }
+
+  z_stream z{};
+  if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK) {
+    throw std::runtime_error("deflateInit2 failed");
+  }
+
+  if (first > 0) {
+    // the dictionary must match the bytes the decoder saw right before this
+    // strip, i.e. the filtered tail of the previous one
+    const size_t dictRows =
+        std::min(first, (kWindowSize + stride) / (stride + 1));
+    std::vector<uint8_t> dict(dictRows * (stride + 1));
+    for (size_t y = first - dictRows; y < first; ++y) {
+      const uint8_t *prev = y > 0 ? pixels + (y - 1) * stride : nullptr;
+      FilterRow(pixels + y * stride, prev, stride, image.channels,
+                dict.data() + (y - (first - dictRows)) * (stride + 1), scratch);
+    }
+    const size_t dictSize = std::min(dict.size(), kWindowSize);
+    deflateSetDictionary(&z, dict.data() + dict.size() - dictSize,
+                         (uInt)dictSize);
+  }
+
+  Strip strip;
+  strip.length = filtered.size();
+  for (size_t offset = 0; offset < filtered.size(); offset += kZlibChunkSize) {
+    const size_t length = std::min(kZlibChunkSize, filtered.size() - offset);
+    strip.adler = adler32(strip.adler, filtered.data() + offset, (uInt)length);
+  }
+  strip.deflated.resize(deflateBound(&z, (uLong)filtered.size()) + 16);
+
+  // fed in pieces zlib's counters can hold; only the last one flushes
+  int status = Z_OK;
+  size_t consumed = 0;
+  for (bool last = false; !last;) {
+    const size_t length = std::min(kZlibChunkSize, filtered.size() - consumed);
+    last = consumed + length == filtered.size();
+    z.next_in = filtered.data() + consumed;
+    z.avail_in = (uInt)length;
+    consumed += length;
+
+    const int flush = !last ? Z_NO_FLUSH : final ? Z_FINISH : Z_SYNC_FLUSH;
+    do {
+      z.next_out = strip.deflated.data() + z.total_out;
+      z.avail_out = (uInt)std::min<size_t>(
+          kZlibChunkSize, strip.deflated.size() - z.total_out);
+      status = deflate(&z, flush);
+    } while (status == Z_OK && (z.avail_in > 0 || z.avail_out == 0));
+  }
+  const bool ok = final ? status == Z_STREAM_END : status == Z_OK;
+  strip.deflated.resize(z.total_out);
+  deflateEnd(&z);
+
+  if (!ok) {
+    throw std::runtime_error(std::format("deflate failed ({})", status));
+  }
+  return strip;
+}
+
+int PngColorType(unsigned channels) {
+  switch (channels) {
+  case 1:
+    return PNG_COLOR_TYPE_GRAY;
+  case 2:
+    return PNG_COLOR_TYPE_GRAY_ALPHA;
+  case 3:
+    return PNG_COLOR_TYPE_RGB;
+  case 4:
+    return PNG_COLOR_TYPE_RGBA;
+  }
+  throw std::runtime_error(std::format("unsupported channel count {}", channels));
+}
+
+void WritePngData(png_structp png, png_bytep data, png_size_t length) {
+  auto *out = static_cast<std::vector<uint8_t> *>(png_get_io_ptr(png));
+  out->insert(out->end(), data, data + length);
+}
+
+void FlushPngData(png_structp) {}
+
+[[noreturn]] void OnPngError(png_structp png, png_const_charp message) {
+  spdlog::error("libpng: {}", message);
+  png_longjmp(png, 1);
+}
+
+std::string PgmHeader(glm::uvec2 size) {
+  return std::format("P5\n{} {}\n255\n", size.x, size.y);
+}
+
+void CheckPgmChannels(const OutputImage &image) {
+  if (image.channels != 1) {
+    throw std::runtime_error(std::format(
+        "PGM needs a single channel image, got {}", image.channels));
+  }
+}
+
+void WritePgm(const std::filesystem::path &path,
+              std::span<const uint8_t> pixels, glm::uvec2 size) {
+  const auto header = PgmHeader(size);
+  File file(path);
+  file.write(header.data(), header.size(), path);
+  file.write(pixels.data(), pixels.size(), path);
+  file.close(path);
+}
+
+void ValidateImage(const OutputImage &image) {
+  const size_t expected = (size_t)image.size.x * image.size.y * image.channels;
+  if (image.pixels.size() < expected) {
+    throw std::runtime_error(std::format(
+        "image buffer too small ({} bytes, expected {} for {}x{}x{})",
+        image.pixels.size(), expected, image.size.x, image.size.y,
+        image.channels));
+  }
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+ImageFormat ImageFormatFromPath(const std::filesystem::path &path) {
+  const auto ext = path.extension();
+  if (ext == ".pgm")
+    return ImageFormat::PGM;
+  if (ext == ".png")
+    return ImageFormat::PNG;
+  return ImageFormat::Raw;
+}
+
+std::vector<uint8_t> EncodePng(const OutputImage &image, int level,
+                               Executor *executor) {
+  ValidateImage(image);
+  const int colorType = PngColorType(image.channels);
+
+  // split into strips, one per worker but never thinner than kMinStripRows
+  const size_t rows = image.size.y;
+  const unsigned workers = executor ? executor->size() : 1;
+  size_t strips = std::clamp<size_t>(rows / kMinStripRows, 1,
+                                     std::max(workers, 1u));
+  const size_t rowsPerStrip = (rows + strips - 1) / strips;
+  if (rows > 0) // rounding up may leave the last strips empty
+    strips = (rows + rowsPerStrip - 1) / rowsPerStrip;
+
+  std::vector<Strip> encoded(strips);
+  const auto encode = [&](size_t i) {
+    const size_t first = i * rowsPerStrip;
+    const size_t last = std::min(rows, first + rowsPerStrip);
+    encoded[i] = EncodeStrip(image, first, last, level, i + 1 == strips);
+  };
+  if (strips == 1)
+    encode(0);
+  else
+    executor->parallelFor(strips, encode);
+
+  // zlib stream: header, concatenated raw deflate strips, combined adler32
+  std::vector<uint8_t> idat{0x78, 0x9C};
+  uLong adler = 1;
+  for (const Strip &strip : encoded) {
+    idat.insert(idat.end(), strip.deflated.begin(), strip.deflated.end());
+    adler = adler32_combine(adler, strip.adler, (z_off_t)strip.length);
+  }
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    idat.push_back((uint8_t)(adler >> shift));
+  }
+
+  // libpng takes care of signature, IHDR and chunk framing
+  std::vector<uint8_t> out;
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                            OnPngError, nullptr);
+  png_infop info = png ? png_create_info_struct(png) : nullptr;
+  if (!info) {
+    png_destroy_write_struct(&png, nullptr);
+    throw std::runtime_error("could not create PNG write struct");
+  }
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    throw std::runtime_error("PNG encoding failed");
+  }
+
+  png_set_write_fn(png, &out, WritePngData, FlushPngData);
+  png_set_IHDR(png, info, image.size.x, image.size.y, 8, colorType,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+               PNG_FILTER_TYPE_BASE);
+  png_write_info(png, info);
+
+  for (size_t offset = 0; offset < idat.size(); offset += kIdatChunkSize) {
+    const size_t length = std::min(kIdatChunkSize, idat.size() - offset);
+    png_write_chunk(png, (png_const_bytep) "IDAT", idat.data() + offset,
+                    length);
+  }
+  png_write_chunk(png, (png_const_bytep) "IEND", nullptr, 0);
+  png_destroy_write_struct(&png, &info);
+
+  return out;
+}
+
+std::vector<uint8_t> EncodeImage(const OutputImage &image, ImageFormat format,
+                                 Executor *executor) {
+  ValidateImage(image);
+  const size_t size = (size_t)image.size.x * image.size.y * image.channels;
+
+  switch (format) {
+  case ImageFormat::PGM: {
+    CheckPgmChannels(image);
+    const auto header = PgmHeader(image.size);
+    std::vector<uint8_t> out(header.begin(), header.end());
+    out.insert(out.end(), image.pixels.begin(), image.pixels.begin() + size);
+    return out;
+  }
+  case ImageFormat::PNG:
+    return EncodePng(image, 6, executor);
+  case ImageFormat::Raw:
+    return {image.pixels.begin(), image.pixels.begin() + size};
+  }
+  throw std::runtime_error("unknown image format");
+}
+
+void WriteImage(const std::filesystem::path &path, const OutputImage &image,
+                ImageFormat format, Executor *executor) {
+  TRACE_SCOPE("output/write_image");
+  ValidateImage(image);
+  const size_t size = (size_t)image.size.x * image.size.y * image.channels;
+
+  switch (format) {
+  case ImageFormat::PGM: {
+    CheckPgmChannels(image);
+    WritePgm(path, {image.pixels.data(), size}, image.size);
+    break;
+  }
+  case ImageFormat::PNG: {
+    const auto encoded = EncodePng(image, 6, executor);
+    File file(path);
+    file.write(encoded.data(), encoded.size(), path);
+    file.close(path);
+    break;
+  }
+  case ImageFormat::Raw: {
+    File file(path);
+    file.write(image.pixels.data(), size, path);
+    file.close(path);
+    break;
+  }
+  }
+
+  spdlog::info("Saved image '{}'", path.string());
+}
+
+void save_pgm(const std::filesystem::path &path,
+              std::span<const uint8_t> image, const glm::uvec2 &size) {
+  TRACE_SCOPE("output/write_image");
+  if (image.size() < (size_t)size.x * size.y) {
+    throw std::runtime_error(
+        std::format("image buffer too small ({} bytes, expected {} for {}x{})",
+                    image.size(), (size_t)size.x * size.y, size.x, size.y));
+  }
+  WritePgm(path, image.first((size_t)size.x * size.y), size);
+  spdlog::info("Saved image '{}'", path.string());
+}
+
+/* ------------------------------------------------------------------------- */
+
+ImageWriter::ImageWriter(unsigned threads, size_t capacity,
+                         unsigned encodeThreads)
+    : _capacity(std::max<size_t>(capacity, 1)),
+      _encoder(std::make_unique<Executor>(
+          encodeThreads ? encodeThreads
+                        : std::thread::hardware_concurrency())) {
+  threads = std::max(threads, 1u);
+  for (unsigned i = 0; i < threads; ++i) {
+    _threads.emplace_back([this] { work(); });
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  {
+    std::lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _notEmpty.notify_all();
+  _threads.clear(); // joins after the queue has been drained
+}
+
+std::future<void> ImageWriter::submit(std::filesystem::path path,
+                                      OutputImage image) {
+  const auto format = ImageFormatFromPath(path);
+  return submit(std::move(path), std::move(image), format);
+}
+
+std::future<void> ImageWriter::submit(std::filesystem::path path,
+                                      OutputImage image, ImageFormat format) {
+  Job job{std::move(path), std::move(image), format, {}};
+  auto future = job.done.get_future();
+
+  {
+    std::unique_lock lock(_mutex);
+    _notFull.wait(lock, [this] { return _queue.size() < _capacity; });
+    _queue.push_back(std::move(job));
+  }
+  _notEmpty.notify_one();
+
+  return future;
+}
+
+void ImageWriter::flush() {
+  std::unique_lock lock(_mutex);
+  _idle.wait(lock, [this] { return _queue.empty() && _busy == 0; });
+}
+
+void ImageWriter::work() {
+  TRACE_THREAD_NAME("image writer");
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock lock(_mutex);
+      _notEmpty.wait(lock, [this] { return _stop || !_queue.empty(); });
+      if (_queue.empty())
+        return; // stopped and drained
+
+      job = std::move(_queue.front());
+      _queue.pop_front();
+      ++_busy;
+    }
+    _notFull.notify_one();
+
+    try {
+      WriteImage(job.path, job.image, job.format, _encoder.get());
+      job.done.set_value();
+    } catch (...) {
+      job.done.set_exception(std::current_exception());
+    }
+
+    {
+      std::lock_guard lock(_mutex);
+      --_busy;
+    }
+    _idle.notify_all();
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef FONT_OUTPUT_HPP
+#define FONT_OUTPUT_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class Executor;
+
+enum class ImageFormat { PGM, PNG, Raw };
+
+/**
+ * @brief Derives the output format from the file extension (.pgm, .png,
+ * anything else is written raw).
+ */
+ImageFormat ImageFormatFromPath(const std::filesystem::path &path);
+
+struct OutputImage {
+  std::vector<uint8_t> pixels; // tightly packed rows
+  glm::uvec2 size;
+  unsigned channels = 1; // 1 = gray, 2 = gray+alpha, 3 = rgb, 4 = rgba
+};
+
+/**
+ * @brief Encodes an image as PNG. Row filtering and deflate run on up to one
+ * strip per worker of `executor` in parallel; the strips are joined into one
+ * zlib stream. Without an executor, or for short images, the calling thread
+ * encodes a single strip. The strip count changes the bytes, not the image.
+ */
+std::vector<uint8_t> EncodePng(const OutputImage &image, int level = 6,
+                               Executor *executor = nullptr);
+
+/// Encodes into memory in the given container format.
+std::vector<uint8_t> EncodeImage(const OutputImage &image, ImageFormat format,
+                                 Executor *executor = nullptr);
+
+void WriteImage(const std::filesystem::path &path, const OutputImage &image,
+                ImageFormat format, Executor *executor = nullptr);
+
+/// Writes a single channel image as PGM straight from the caller's memory.
+void save_pgm(const std::filesystem::path &path,
+              std::span<const uint8_t> image, const glm::uvec2 &size);
+
+/**
+ * @brief Writes images on background threads so rendering never waits on
+ * disk.
+ *
+ * The queue is bounded: submit() blocks once `capacity` images are pending,
+ * which keeps memory in check when rendering outpaces the disk. PNG strips
+ * of all writer threads are encoded on one pool of `encodeThreads` workers
+ * (0 = one per core).
+ */
+class ImageWriter {
+public:
+  explicit ImageWriter(unsigned threads = 2, size_t capacity = 8,
+                       unsigned encodeThreads = 0);
+  ~ImageWriter();
+
+  ImageWriter(const ImageWriter &) = delete;
+  ImageWriter &operator=(const ImageWriter &) = delete;
+
+  std::future<void> submit(std::filesystem::path path, OutputImage image);
+  std::future<void> submit(std::filesystem::path path, OutputImage image,
+                           ImageFormat format);
+
+  /// Blocks until every submitted image has been written.
+  void flush();
+
+private:
+  struct Job {
+    std::filesystem::path path;
+    OutputImage image;
+    ImageFormat format;
+    std::promise<void> done;
+  };
+
+  void work();
+
+  std::mutex _mutex;
+  std::condition_variable _notEmpty;
+  std::condition_variable _notFull;
+  std::condition_variable _idle;
+  std::deque<Job> _queue;
+  size_t _capacity;
+  size_t _busy = 0;
+  std::unique_ptr<Executor> _encoder; // shared by the writer threads
+  bool _stop = false;
+  std::vector<std::jthread> _threads;
+};
+
+#endif // FONT_OUTPUT_HPP
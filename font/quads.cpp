@@ -0,0 +1,184 @@
+#include "quads.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+// Scalar reference; rounds to nearest even like cvtps2dq.
+GlyphQuad PackQuad(float x, float y, const AtlasGlyph &glyph,
+                   const Label &label) {
+  const float s = label.scale * kQuadSubpixel;
+  const float x0 = label.origin.x * kQuadSubpixel + (x + glyph.bearing.x) * s;
+  const float y0 = label.origin.y * kQuadSubpixel + (y - glyph.bearing.y) * s;
+
+  const auto i16 = [](float v) {
+    return (int16_t)std::nearbyint(std::clamp(v, -32768.0f, 32767.0f));
+  };
+  const auto u16 = [](float v) {
+    return (uint16_t)std::nearbyint(std::clamp(v, 0.0f, 65535.0f));
+  };
+
+  GlyphQuad quad;
+  quad.x = i16(x0);
+  quad.y = i16(y0);
+  quad.width = u16(glyph.size.x * s);
+  quad.height = u16(glyph.size.y * s);
+  quad.u0 = glyph.u0;
+  quad.v0 = glyph.v0;
+  quad.u1 = glyph.u1;
+  quad.v1 = glyph.v1;
+  quad.color = label.color;
+  return quad;
+}
+
+#if defined(__SSE2__)
+
+// Unsigned 16-bit saturation on plain SSE2 (packus_epi32 is SSE4.1).
+__m128i PackUnsigned16(__m128 a, __m128 b) {
+  const __m128 lo = _mm_setzero_ps();
+  const __m128 hi = _mm_set1_ps(65535.0f);
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i ia =
+      _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, lo), hi)), bias);
+  const __m128i ib =
+      _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, lo), hi)), bias);
+  return _mm_xor_si128(_mm_packs_epi32(ia, ib), _mm_set1_epi16(-32768));
+}
+
+__m128i PackSigned16(__m128 a, __m128 b) {
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+  return _mm_packs_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, lo), hi)),
+                         _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, lo), hi)));
+}
+
+// Four glyphs per step; the gathers stay scalar, the arithmetic and the
+// saturating conversions do not.
+size_t PackQuadsSse2(const GlyphBatch &batch, std::span<const Label> labels,
+                     const AtlasGlyph *entries, GlyphQuad *out) {
+  const size_t count = batch.size() & ~size_t{3};
+  const __m128 k = _mm_set1_ps(kQuadSubpixel);
+
+  for (size_t i = 0; i < count; i += 4) {
+    const AtlasGlyph *g[4];
+    const Label *l[4];
+    for (size_t j = 0; j < 4; ++j) {
+      g[j] = &entries[batch.entry[i + j]];
+      l[j] = &labels[batch.label[i + j]];
+    }
+
+    const __m128 bx = _mm_setr_ps(g[0]->bearing.x, g[1]->bearing.x,
+                                  g[2]->bearing.x, g[3]->bearing.x);
+    const __m128 by = _mm_setr_ps(g[0]->bearing.y, g[1]->bearing.y,
+                                  g[2]->bearing.y, g[3]->bearing.y);
+    const __m128 w = _mm_setr_ps(g[0]->size.x, g[1]->size.x, g[2]->size.x,
+                                 g[3]->size.x);
+    const __m128 h = _mm_setr_ps(g[0]->size.y, g[1]->size.y, g[2]->size.y,
+                                 g[3]->size.y);
+    const __m128 ox = _mm_setr_ps(l[0]->origin.x, l[1]->origin.x,
+                                  l[2]->origin.x, l[3]->origin.x);
+    const __m128 oy = _mm_setr_ps(l[0]->origin.y, l[1]->origin.y,
+                                  l[2]->origin.y, l[3]->origin.y);
+    const __m128 s = _mm_mul_ps(
+        _mm_setr_ps(l[0]->scale, l[1]->scale, l[2]->scale, l[3]->scale), k);
+
+    const __m128 px = _mm_loadu_ps(&batch.x[i]);
+    const __m128 py = _mm_loadu_ps(&batch.y[i]);
+    const __m128 x0 =
+        _mm_add_ps(_mm_mul_ps(ox, k), _mm_mul_ps(_mm_add_ps(px, bx), s));
+    const __m128 y0 =
+        _mm_add_ps(_mm_mul_ps(oy, k), _mm_mul_ps(_mm_sub_ps(py, by), s));
+
+    alignas(16) int16_t xy[8];
+    alignas(16) uint16_t wh[8];
+    _mm_store_si128((__m128i *)xy, PackSigned16(x0, y0));
+    _mm_store_si128((__m128i *)wh,
+                    PackUnsigned16(_mm_mul_ps(w, s), _mm_mul_ps(h, s)));
+
+    for (size_t j = 0; j < 4; ++j) {
+      GlyphQuad &quad = out[i + j];
+      quad.x = xy[j];
+      quad.y = xy[4 + j];
+      quad.width = wh[j];
+      quad.height = wh[4 + j];
+      std::memcpy(&quad.u0, &g[j]->u0, 4 * sizeof(uint16_t));
+      quad.color = l[j]->color;
+    }
+  }
+  return count;
+}
+
+#endif
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+void GlyphBatch::clear() {
+  x.clear();
+  y.clear();
+  entry.clear();
+  label.clear();
+}
+
+void FlattenLabels(std::span<const Label> labels, const GlyphAtlas &atlas,
+                   GlyphBatch &batch) {
+  TRACE_SCOPE("quads/flatten");
+  batch.clear();
+
+  size_t total = 0;
+  for (const Label &label : labels)
+    total += label.run ? label.run->glyphs.size() : 0;
+  batch.x.reserve(total);
+  batch.y.reserve(total);
+  batch.entry.reserve(total);
+  batch.label.reserve(total);
+
+  for (size_t l = 0; l < labels.size(); ++l) {
+    if (!labels[l].run)
+      continue;
+
+    glm::vec2 pen(0.0f);
+    for (const Glyph &g : labels[l].run->glyphs) {
+      const uint32_t entry = atlas.find(g.font, g.glyphIndex);
+      if (entry != GlyphAtlas::kMissing) {
+        const glm::vec2 place = pen + g.offset;
+        batch.x.push_back(place.x);
+        batch.y.push_back(place.y);
+        batch.entry.push_back(entry);
+        batch.label.push_back((uint32_t)l);
+      }
+      pen += g.advance;
+    }
+  }
+}
+
+void PackGlyphQuads(const GlyphBatch &batch, std::span<const Label> labels,
+                    const GlyphAtlas &atlas, std::vector<GlyphQuad> &out) {
+  TRACE_SCOPE("quads/pack");
+  out.resize(batch.size());
+  const AtlasGlyph *entries = atlas.entries().data();
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  i = PackQuadsSse2(batch, labels, entries, out.data());
+#endif
+  for (; i < batch.size(); ++i) {
+    out[i] = PackQuad(batch.x[i], batch.y[i], entries[batch.entry[i]],
+                      labels[batch.label[i]]);
+  }
+}
+
+void BuildGlyphQuads(std::span<const Label> labels, const GlyphAtlas &atlas,
+                     GlyphBatch &batch, std::vector<GlyphQuad> &out) {
+  FlattenLabels(labels, atlas, batch);
+  PackGlyphQuads(batch, labels, atlas, out);
+}
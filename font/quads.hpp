@@ -0,0 +1,69 @@
+#ifndef FONT_QUADS_HPP
+#define FONT_QUADS_HPP
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "atlas.hpp"
+#include "shaping.hpp"
+
+/// Quad positions and sizes are stored in 1/kQuadSubpixel px.
+constexpr float kQuadSubpixel = 8.0f;
+
+/**
+ * @brief One instanced glyph quad, 20 bytes. Positions are 13.3 fixed point
+ * (±4096 px), the texture rect is unorm16. Matches `struct GlyphQuad` in
+ * glyph_quads.cl.
+ */
+struct GlyphQuad {
+  int16_t x, y;           // top-left corner
+  uint16_t width, height; // extent, same units
+  uint16_t u0, v0, u1, v1;
+  uint32_t color; // RGBA8, red in the lowest byte
+};
+static_assert(sizeof(GlyphQuad) == 20);
+
+/**
+ * @brief A shaped string placed on screen. The run must have been shaped at
+ * the atlas em size; `scale` maps it to the label's size.
+ */
+struct Label {
+  const GlyphRun *run = nullptr;
+  glm::vec2 origin{0.0f}; // baseline start, px, y down
+  float scale = 1.0f;
+  uint32_t color = 0xFFFFFFFF;
+};
+
+/**
+ * @brief The glyphs of a batch of labels flattened into arrays: pen position
+ * in label units, atlas entry and label of every glyph. Glyphs without an
+ * atlas entry (e.g. spaces) are left out.
+ */
+struct GlyphBatch {
+  std::vector<float> x, y;
+  std::vector<uint32_t> entry;
+  std::vector<uint32_t> label;
+
+  size_t size() const { return entry.size(); }
+  void clear();
+};
+
+/// Walks all labels once, accumulating pens and resolving atlas entries.
+void FlattenLabels(std::span<const Label> labels, const GlyphAtlas &atlas,
+                   GlyphBatch &batch);
+
+/**
+ * @brief Turns a flattened batch into quads, four glyphs per step with SSE2
+ * where available. `out` is resized to the batch size.
+ */
+void PackGlyphQuads(const GlyphBatch &batch, std::span<const Label> labels,
+                    const GlyphAtlas &atlas, std::vector<GlyphQuad> &out);
+
+/// Flatten and pack in one call, reusing `batch` between frames.
+void BuildGlyphQuads(std::span<const Label> labels, const GlyphAtlas &atlas,
+                     GlyphBatch &batch, std::vector<GlyphQuad> &out);
+
+#endif // FONT_QUADS_HPP
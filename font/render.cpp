@@ -5,82 +5,293 @@
 #include FT_TRUETYPE_TABLES_H
 #include FT_SFNT_NAMES_H
 
+#include "render.hpp"
+#include "face.hpp"
+#include "fallback.hpp"
+#include "measure.hpp"
 #include "shaping.hpp"
 
 #include <glm/glm.hpp>
 #include <spdlog/spdlog.h>
 #include <string>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
 #include <fmt/core.h>
+#include <format>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 
-glm::ivec2 RenderGlyphByIndex(FT_Face face, FT_UInt glyphIndex,
-                              const glm::ivec2 &pen, uint8_t *img,
-                              const glm::uvec2 &size);
+#include "exec/executor.hpp"
+#include "trace/trace.hpp"
 
-glm::ivec2 CalculateBoundingRect(FT_Face face, std::string_view utf8Text);
 GlyphRun CreateGlyphRun(FT_Face face, std::string_view utf8Text);
 
 /**--------------------------------------------------------------------------------------------------
  */
 
-FT_UInt get_glyph(FT_Face face, FT_ULong cp) {
-  FT_UInt glyph = FT_Get_Char_Index(face, cp);
+namespace {
 
-  if (glyph == 0) {
-    FT_UInt fallback = FT_Get_Char_Index(
-        face, (FT_ULong)'?'); // Fallback: '?' (wenn vorhanden)
-    if (fallback == 0) {
-      throw std::runtime_error(fmt::format(
-          "No glyph for codepoint U+{:04X} and no fallback '?'", cp));
-    }
+int Baseline(FT_Face face) {
+  return (int)((face->size->metrics.ascender + 63) >> 6); // px
+}
 
-    glyph = fallback;
-  }
+void BlendGlyph(std::span<uint8_t> img, const glm::uvec2 &size,
+                const GlyphBitmap &glyph, int x, int y) {
+  FT_Bitmap bitmap{};
+  bitmap.rows = (unsigned)glyph.rows;
+  bitmap.width = (unsigned)glyph.width;
+  bitmap.pitch = glyph.width;
+  bitmap.buffer = const_cast<unsigned char *>(glyph.coverage.data());
+  bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+  blend_glyph_bitmap(img.data(), size.x, size.y, &bitmap, x + glyph.left,
+                     y - glyph.top);
+}
 
-  return glyph;
+// unique glyphs per extra worker before one is worth its face copy
+constexpr size_t kGlyphsPerWorker = 32;
+
+struct Placement {
+  int x, y;
+  int phase;
+};
+
+// applies HarfBuzz offsets, then splits x into whole pixels and one of
+// kSubpixelPhases fractions; y stays on the pixel grid
+Placement Place(glm::vec2 pen, const Glyph &g) {
+  const glm::vec2 place = pen + g.offset;
+  int x = (int)std::floor(place.x);
+  int phase = (int)std::lround((place.x - (float)x) * kSubpixelPhases);
+  if (phase == kSubpixelPhases) {
+    ++x;
+    phase = 0;
+  }
+  return {x, (int)std::lround(place.y), phase};
 }
 
-std::vector<uint8_t> Render(FT_Face face, GlyphRun run) {
-  auto glyphs = run.glyphs;
+void CheckImage(std::span<const uint8_t> img, const glm::uvec2 &size) {
+  if (img.size() < (size_t)size.x * size.y) {
+    throw std::invalid_argument(
+        std::format("image of {} bytes is too small for {}x{}", img.size(),
+                    size.x, size.y));
+  }
+}
 
-  std::vector<uint8_t> img((size_t)run.size.x * run.size.y, 0);
+template <typename FaceOf>
+void RenderGlyphs(FaceOf faceOf, std::span<const Glyph> glyphs,
+                  glm::ivec2 origin, std::span<uint8_t> img,
+                  const glm::uvec2 &size, GlyphBitmapCache *cache) {
+  CheckImage(img, size);
 
-  glm::ivec2 pen;
-  pen.x = 0;                                        // 50;
-  pen.y = (face->size->metrics.ascender + 63) >> 6; // baseline in px
+  std::optional<GlyphBitmapCache> local;
+  if (!cache)
+    cache = &local.emplace();
 
+  glm::vec2 pen(origin);
   for (const Glyph &g : glyphs) {
-#if 0
-    if (pen.x >= (int)size.x) {
-      spdlog::info("reached end of line, stopping rendering.");
-      break;
-    }
-#endif
-
     spdlog::trace("glyph index: {}, offset: ({},{}), advance: ({},{})",
                   g.glyphIndex, g.offset.x, g.offset.y, g.advance.x,
                   g.advance.y);
 
-    // apply HarfBuzz offsets (positions are in pixels already)
-    const glm::ivec2 place = pen + g.offset;
-    // render the glyph at the positioned pen
-    RenderGlyphByIndex(face, g.glyphIndex, place, img.data(), run.size);
+    const Placement p = Place(pen, g);
+    BlendGlyph(img, size, cache->get(faceOf(g), g.glyphIndex, p.phase), p.x,
+               p.y);
 
-    // advance pen by the shaped advance (use HarfBuzz-provided advance)
     pen += g.advance;
   }
+}
+
+/**
+ * @brief RenderGlyphs() in three passes: place every glyph, rasterize each
+ * distinct (face, glyph, phase) once on the workers of `executor`, each with
+ * its ThreadFace() copy since FT_Face must not be shared, then blend the
+ * placements in order so the image is the same as the serial one.
+ */
+void RenderGlyphsParallel(std::span<const FT_Face> faces,
+                          std::span<const Glyph> glyphs, glm::ivec2 origin,
+                          std::span<uint8_t> img, const glm::uvec2 &size,
+                          Executor &executor) {
+  CheckImage(img, size);
+
+  struct Key {
+    uint16_t font;
+    int phase;
+    FT_UInt glyph;
+    auto operator<=>(const Key &) const = default;
+  };
+  std::vector<Key> keys(glyphs.size());
+  std::vector<Placement> placements(glyphs.size());
+  glm::vec2 pen(origin);
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+    placements[i] = Place(pen, glyphs[i]);
+    keys[i] = {glyphs[i].font, placements[i].phase, glyphs[i].glyphIndex};
+    pen += glyphs[i].advance;
+  }
+
+  std::vector<Key> unique = keys;
+  std::sort(unique.begin(), unique.end());
+  unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+  std::vector<GlyphBitmap> bitmaps(unique.size());
 
+  const size_t workers = std::clamp<size_t>(unique.size() / kGlyphsPerWorker,
+                                            1, executor.size());
+
+  // fonts without an sfnt file cannot be copied, those render serially
+  bool copyable = workers > 1;
+  for (size_t f = 0; copyable && f < faces.size(); ++f)
+    copyable = CanCopyFace(faces[f]);
+
+  if (!copyable) {
+    TRACE_SCOPE("raster/glyphs");
+    for (size_t k = 0; k < unique.size(); ++k) {
+      bitmaps[k] = RasterizeGlyph(faces[unique[k].font], unique[k].glyph,
+                                  unique[k].phase);
+    }
+  } else {
+    // keys are sorted by font, so interleaving spreads every font's glyphs
+    // over all workers
+    executor.parallelFor(workers, [&](size_t w) {
+      TRACE_SCOPE("raster/glyphs");
+      std::vector<FT_Face> copies(faces.size(), nullptr);
+      for (size_t k = w; k < unique.size(); k += workers) {
+        const Key &key = unique[k];
+        FT_Face &copy = copies[key.font];
+        if (!copy)
+          copy = ThreadFace(faces[key.font]);
+        bitmaps[k] = RasterizeGlyph(copy, key.glyph, key.phase);
+      }
+    });
+  }
+
+  TRACE_SCOPE("raster/composite");
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+    const auto k = std::lower_bound(unique.begin(), unique.end(), keys[i]) -
+                   unique.begin();
+    BlendGlyph(img, size, bitmaps[k], placements[i].x, placements[i].y);
+  }
+}
+
+} // namespace
+
+std::vector<uint8_t> Render(FT_Face face, const GlyphRun &run) {
+  TRACE_SCOPE("raster/render");
+
+  std::vector<uint8_t> img((size_t)run.size.x * run.size.y, 0);
+  GlyphBitmapCache cache; // glyphs repeat within a run
+  RenderInto(face, run.glyphs, {0, Baseline(face)}, img, run.size, &cache);
   return img;
 }
 
+void Render(FT_Face face, const GlyphRun &run, GlyphBitmapCache &cache,
+            std::pmr::vector<uint8_t> &image) {
+  TRACE_SCOPE("raster/render");
+
+  image.assign((size_t)run.size.x * run.size.y, 0);
+  RenderInto(face, run.glyphs, {0, Baseline(face)}, image, run.size, &cache);
+}
+
+void RenderInto(FT_Face face, std::span<const Glyph> glyphs, glm::ivec2 pen,
+                std::span<uint8_t> image, glm::uvec2 size,
+                GlyphBitmapCache *cache) {
+  RenderGlyphs([face](const Glyph &) { return face; }, glyphs, pen, image,
+               size, cache);
+}
+
+std::vector<uint8_t> Render(FT_Face face, const GlyphRun &run,
+                            Executor &executor) {
+  TRACE_SCOPE("raster/render");
+
+  // single face runs may still carry font indices, they all mean `face`
+  uint16_t fonts = 1;
+  for (const Glyph &g : run.glyphs)
+    fonts = std::max<uint16_t>(fonts, g.font + 1);
+  const std::vector<FT_Face> faces(fonts, face);
+
+  std::vector<uint8_t> img((size_t)run.size.x * run.size.y, 0);
+  RenderGlyphsParallel(faces, run.glyphs, {0, Baseline(face)}, img, run.size,
+                       executor);
+  return img;
+}
+
+std::vector<uint8_t> Render(const FontChain &fonts, const GlyphRun &run) {
+  TRACE_SCOPE("raster/render");
+
+  std::vector<uint8_t> img((size_t)run.size.x * run.size.y, 0);
+  GlyphBitmapCache cache;
+  RenderInto(fonts, run.glyphs, {0, Baseline(fonts.face(0))}, img, run.size,
+             &cache);
+  return img;
+}
+
+void Render(const FontChain &fonts, const GlyphRun &run,
+            GlyphBitmapCache &cache, std::pmr::vector<uint8_t> &image) {
+  TRACE_SCOPE("raster/render");
+
+  image.assign((size_t)run.size.x * run.size.y, 0);
+  RenderInto(fonts, run.glyphs, {0, Baseline(fonts.face(0))}, image,
+             run.size, &cache);
+}
+
+void RenderInto(const FontChain &fonts, std::span<const Glyph> glyphs,
+                glm::ivec2 pen, std::span<uint8_t> image, glm::uvec2 size,
+                GlyphBitmapCache *cache) {
+  RenderGlyphs([&fonts](const Glyph &g) { return fonts.face(g.font); },
+               glyphs, pen, image, size, cache);
+}
+
+std::vector<uint8_t> Render(const FontChain &fonts, const GlyphRun &run,
+                            Executor &executor) {
+  TRACE_SCOPE("raster/render");
+
+  std::vector<FT_Face> faces(fonts.size());
+  for (size_t i = 0; i < faces.size(); ++i)
+    faces[i] = fonts.face(i);
+
+  std::vector<uint8_t> img((size_t)run.size.x * run.size.y, 0);
+  RenderGlyphsParallel(faces, run.glyphs, {0, Baseline(fonts.face(0))}, img,
+                       run.size, executor);
+  return img;
+}
+
+/* ------------------------------------------------------------------------- */
+
+size_t GlyphBitmapCache::KeyHash::operator()(const Key &key) const {
+  size_t h = std::hash<const void *>{}(key.face);
+  const auto mix = [&h](uint64_t value) {
+    h ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ull + (h << 6) +
+         (h >> 2);
+  };
+  mix(((uint64_t)(uint32_t)key.xScale << 32) | (uint32_t)key.yScale);
+  mix(((uint64_t)key.glyph << 8) | (uint64_t)key.phase);
+  return h;
+}
+
+const GlyphBitmap &GlyphBitmapCache::get(FT_Face face, FT_UInt glyphIndex,
+                                         int phase) {
+  const Key key{face, face->size->metrics.x_scale,
+                face->size->metrics.y_scale, glyphIndex, phase};
+  auto it = _bitmaps.find(key);
+  if (it == _bitmaps.end()) {
+    auto *memory = _bitmaps.get_allocator().resource();
+    it = _bitmaps.emplace(key, RasterizeGlyph(face, glyphIndex, phase, memory))
+             .first;
+  }
+  return it->second;
+}
+
+glm::ivec2 CalculateBoundingRect(FT_Face face, std::string_view utf8Text) {
+  return glm::ivec2(TextMeasurer(face).measure(utf8Text).size);
+}
+
 // -------------------------------------------------------------------------------------
 
 // Blend a FreeType 8-bit coverage bitmap onto an 8-bit grayscale image (white
 // text on black).
-static void blend_glyph_bitmap(unsigned char *img, int w, int h,
-                               const FT_Bitmap *bm, int x0, int y0) {
+void blend_glyph_bitmap(unsigned char *img, int w, int h, const FT_Bitmap *bm,
+                        int x0, int y0) {
   // FreeType bitmap buffer contains coverage values 0..255 (for
   // FT_PIXEL_MODE_GRAY)
   for (int row = 0; row < (int)bm->rows; ++row) {
@@ -102,46 +313,39 @@ static void blend_glyph_bitmap(unsigned char *img, int w, int h,
   }
 }
 
-glm::ivec2 RenderGlyphByIndex(FT_Face face, FT_UInt glyphIndex,
-                              const glm::ivec2 &pen, uint8_t *img,
-                              const glm::uvec2 &size) {
-  if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT)) {
+GlyphBitmap RasterizeGlyph(FT_Face face, FT_UInt glyphIndex, int phase,
+                           std::pmr::memory_resource *memory) {
+  TRACE_SCOPE("raster/glyph");
+  // light hinting snaps vertically only, horizontal positions stay exact
+  if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_TARGET_LIGHT)) {
     throw std::runtime_error(
         std::format("FT_Load_Glyph failed (glyphIndex={})", glyphIndex));
   }
 
-  if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) {
-    throw std::runtime_error("FT_Render_Glyph failed");
-  }
-
   FT_GlyphSlot g = face->glyph;
+  if (phase != 0 && g->format == FT_GLYPH_FORMAT_OUTLINE) {
+    FT_Outline_Translate(&g->outline, phase * 64 / kSubpixelPhases, 0);
+  }
 
-  const int x0 = pen.x + g->bitmap_left;
-  const int y0 = pen.y - g->bitmap_top;
-  // spdlog::info("placed glypth at ({},{})", x0, y0);
+  if (FT_Render_Glyph(g, FT_RENDER_MODE_NORMAL)) {
+    throw std::runtime_error("FT_Render_Glyph failed");
+  }
 
-  if (g->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY) {
-    // WICHTIG: blend_glyph_bitmap MUSS clippen (x0/y0 und bitmap bounds)
-    blend_glyph_bitmap(img, size.x, size.y, &g->bitmap, x0, y0);
-  } else {
+  if (g->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
     throw std::runtime_error(
         std::format("Unsupported pixel mode {}", (int)g->bitmap.pixel_mode));
   }
 
-  return {(int)(g->advance.x >> 6), (int)(g->advance.y >> 6)};
+  GlyphBitmap bitmap{std::pmr::vector<uint8_t>(memory)};
+  bitmap.width = (int)g->bitmap.width;
+  bitmap.rows = (int)g->bitmap.rows;
+  bitmap.left = g->bitmap_left;
+  bitmap.top = g->bitmap_top;
+  bitmap.coverage.resize((size_t)bitmap.width * bitmap.rows);
+  for (int row = 0; row < bitmap.rows; ++row) {
+    std::memcpy(bitmap.coverage.data() + (size_t)row * bitmap.width,
+                g->bitmap.buffer + (ptrdiff_t)row * g->bitmap.pitch,
+                (size_t)bitmap.width);
+  }
+  return bitmap;
 }
-
-/***************************************************************** */
-
-void save_pgm(const std::filesystem::path &path, std::vector<uint8_t> image,
-              const glm::uvec2 &size) {
-  FILE *f = fopen(path.string().c_str(), "wb");
-  if (!f)
-    throw std::runtime_error("");
-
-  fprintf(f, "P5\n%d %d\n255\n", size.x, size.y);
-  fwrite(image.data(), 1, (size_t)(size.x * size.y), f);
-  fclose(f);
-
-  spdlog::info("Saved image '{}'", path.string());
-}
\ No newline at end of file
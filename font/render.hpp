@@ -3,16 +3,115 @@
 
 #include "shaping.hpp" // GlyphRun
 
-#include <filesystem>
+#include <memory_resource>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 #include <glm/glm.hpp>
 
-void save_pgm(const std::filesystem::path &path, std::vector<uint8_t> image,
-              const glm::uvec2 &size);
+class Executor;
 
-std::vector<uint8_t> Render(FT_Face face, GlyphRun run);
+/// Horizontal subpixel positions a glyph is rasterized at.
+constexpr int kSubpixelPhases = 4;
 
+struct GlyphBitmap {
+  std::pmr::vector<uint8_t> coverage; // tightly packed rows
+  int width = 0;
+  int rows = 0;
+  int left = 0; // bitmap origin relative to the pen, y up
+  int top = 0;
+};
+
+/// Rasterizes a glyph shifted right by `phase / kSubpixelPhases` pixels,
+/// the coverage is allocated from `memory`.
+GlyphBitmap RasterizeGlyph(
+    FT_Face face, FT_UInt glyphIndex, int phase,
+    std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+
+/**
+ * @brief Rasterized glyphs by face, size, glyph and subpixel phase, so each
+ * glyph is rendered at most kSubpixelPhases times per size however it is
+ * positioned. Resizing a face does not return stale bitmaps. Not
+ * thread-safe.
+ *
+ * Entries and bitmaps come from `memory`; with one cache per thread on a
+ * std::pmr::unsynchronized_pool_resource, render threads never contend in
+ * the global allocator.
+ */
+class GlyphBitmapCache {
+public:
+  explicit GlyphBitmapCache(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : _bitmaps(memory) {}
+
+  const GlyphBitmap &get(FT_Face face, FT_UInt glyphIndex, int phase);
+
+  size_t size() const { return _bitmaps.size(); }
+  void clear() { _bitmaps.clear(); }
+
+private:
+  struct Key {
+    FT_Face face;
+    FT_Fixed xScale, yScale; // the size; unlike the ppem, exact
+    FT_UInt glyph;
+    int phase;
+    bool operator==(const Key &) const = default;
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  std::pmr::unordered_map<Key, GlyphBitmap, KeyHash> _bitmaps;
+};
+
+/// Renders `run` into a new `run.size` image with a cache of its own.
+std::vector<uint8_t> Render(FT_Face face, const GlyphRun &run);
+
+/**
+ * @brief Steady-state rendering: `image` is resized to `run.size` and
+ * cleared, bitmaps come from `cache`. Once the cache holds the run's glyphs
+ * and `image` has the capacity, nothing is allocated; otherwise both
+ * allocate from their own memory resources.
+ */
+void Render(FT_Face face, const GlyphRun &run, GlyphBitmapCache &cache,
+            std::pmr::vector<uint8_t> &image);
+
+/**
+ * @brief Renders `run` rasterizing each distinct glyph once, spread over the
+ * workers of `executor`, which keep their copies of the face (ThreadFace())
+ * from call to call. The image is identical to the serial one. Short runs,
+ * and fonts LoadFontData() cannot copy, are rasterized on the calling thread.
+ */
+std::vector<uint8_t> Render(FT_Face face, const GlyphRun &run,
+                            Executor &executor);
+
+/**
+ * @brief Draws `glyphs` into an existing 8-bit image of `size` pixels, `pen`
+ * is the baseline origin. Without a cache, bitmaps are only reused within
+ * this call. Allocates nothing when the cache holds every glyph.
+ */
+void RenderInto(FT_Face face, std::span<const Glyph> glyphs, glm::ivec2 pen,
+                std::span<uint8_t> image, glm::uvec2 size,
+                GlyphBitmapCache *cache = nullptr);
+
+/// Same for runs shaped with a FontChain, each glyph drawn with its face.
+std::vector<uint8_t> Render(const FontChain &fonts, const GlyphRun &run);
+std::vector<uint8_t> Render(const FontChain &fonts, const GlyphRun &run,
+                            Executor &executor);
+void Render(const FontChain &fonts, const GlyphRun &run,
+            GlyphBitmapCache &cache, std::pmr::vector<uint8_t> &image);
+void RenderInto(const FontChain &fonts, std::span<const Glyph> glyphs,
+                glm::ivec2 pen, std::span<uint8_t> image, glm::uvec2 size,
+                GlyphBitmapCache *cache = nullptr);
+
+// Blend a FreeType 8-bit coverage bitmap onto an 8-bit grayscale image (white
+// text on black), clipped to the image.
+void blend_glyph_bitmap(unsigned char *img, int w, int h, const FT_Bitmap *bm,
+                        int x0, int y0);
+
+/// shape(face, utf8Text).size, measured with a TextMeasurer, so without
+/// building the run; use one TextMeasurer directly for many strings.
 glm::ivec2 CalculateBoundingRect(FT_Face face, std::string_view utf8Text);
 
 #endif // FONT_RENDER_HPP
\ No newline at end of file
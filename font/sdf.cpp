@@ -0,0 +1,436 @@
+#include "sdf.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "trace/trace.hpp"
+
+namespace {
+
+constexpr unsigned kTile = SdfTextSetup::kTile;
+constexpr unsigned kTilePixels = kTile * kTile;
+
+// Signed distance stored for pixels outside a quad; clamps to zero coverage
+// whatever the outline width.
+constexpr float kOutside = -1.0e4f;
+
+struct Premultiplied {
+  float r, g, b, a;
+};
+
+Premultiplied Unpack(uint32_t rgba) {
+  const float a = (float)(rgba >> 24) / 255.0f;
+  return {(float)(rgba & 0xFF) / 255.0f * a,
+          (float)((rgba >> 8) & 0xFF) / 255.0f * a,
+          (float)((rgba >> 16) & 0xFF) / 255.0f * a, a};
+}
+
+/// Float copy of one tile of the target, one array per channel.
+struct TileAccumulator {
+  alignas(16) float r[kTilePixels];
+  alignas(16) float g[kTilePixels];
+  alignas(16) float b[kTilePixels];
+  alignas(16) float a[kTilePixels];
+};
+
+/// Distances of every tile pixel to one quad's glyph, in image pixels.
+struct TileDistances {
+  alignas(16) float fill[kTilePixels];
+  alignas(16) float edge[kTilePixels]; // true distance, for outline/shadow
+};
+
+float Texel(const SdfAtlasView &atlas, int x, int y, int channel) {
+  x = std::clamp(x, 0, (int)atlas.size.x - 1);
+  y = std::clamp(y, 0, (int)atlas.size.y - 1);
+  const size_t channels = (size_t)atlas.kind;
+  return atlas.texels[((size_t)y * atlas.size.x + x) * channels + channel];
+}
+
+/// Bilinear sample; returns {median, true distance} in 0..1.
+glm::vec2 Sample(const SdfAtlasView &atlas, glm::vec2 texel) {
+  const glm::vec2 p = texel - 0.5f;
+  const glm::vec2 base = glm::floor(p);
+  const glm::vec2 f = p - base;
+  const int x = (int)base.x;
+  const int y = (int)base.y;
+  const int channels = (int)atlas.kind;
+
+  float c[4];
+  if (x >= 0 && y >= 0 && x + 1 < (int)atlas.size.x &&
+      y + 1 < (int)atlas.size.y) {
+    // interior: no clamping, both rows straight from the texture
+    const size_t pitch = (size_t)atlas.size.x * channels;
+    const uint8_t *t0 = atlas.texels + (size_t)y * pitch + (size_t)x * channels;
+    const uint8_t *t1 = t0 + pitch;
+    for (int i = 0; i < channels; ++i) {
+      const float top = t0[i] + (t0[channels + i] - t0[i]) * f.x;
+      const float bottom = t1[i] + (t1[channels + i] - t1[i]) * f.x;
+      c[i] = (top + (bottom - top) * f.y) / 255.0f;
+    }
+  } else {
+    for (int i = 0; i < channels; ++i) {
+      const float t00 = Texel(atlas, x, y, i), t10 = Texel(atlas, x + 1, y, i);
+      const float t01 = Texel(atlas, x, y + 1, i);
+      const float t11 = Texel(atlas, x + 1, y + 1, i);
+      const float top = t00 + (t10 - t00) * f.x;
+      const float bottom = t01 + (t11 - t01) * f.x;
+      c[i] = (top + (bottom - top) * f.y) / 255.0f;
+    }
+  }
+
+  switch (atlas.kind) {
+  case SdfKind::Sdf:
+    return {c[0], c[0]};
+  case SdfKind::Msdf: {
+    const float median =
+        std::max(std::min(c[0], c[1]), std::min(std::max(c[0], c[1]), c[2]));
+    return {median, median};
+  }
+  case SdfKind::Mtsdf: {
+    const float median =
+        std::max(std::min(c[0], c[1]), std::min(std::max(c[0], c[1]), c[2]));
+    return {median, c[3]};
+  }
+  }
+  return {0.0f, 0.0f};
+}
+
+/**
+ * @brief Maps the pixel centers of the tile that lie in the quad's bounding
+ * box into the quad and samples where inside. Returns the range of pixel
+ * indices written; the rest of `out` is left as is.
+ */
+std::pair<unsigned, unsigned> SampleTile(const SdfQuad &quad,
+                                         const SdfStyle &style,
+                                         const SdfAtlasView &atlas,
+                                         glm::uvec2 tile, glm::vec2 shift,
+                                         TileDistances &out) {
+  // forward transform back from the inverse, for the quad's image bounds
+  const float det = style.invX.x * style.invY.y - style.invY.x * style.invX.y;
+  const glm::vec2 axisX = glm::vec2(style.invY.y, -style.invX.y) / det;
+  const glm::vec2 axisY = glm::vec2(-style.invY.x, style.invX.x) / det;
+  const glm::vec2 size = 1.0f / quad.invSize;
+  const glm::vec2 tileOrigin(tile * kTile);
+
+  glm::vec2 lo(INFINITY), hi(-INFINITY);
+  for (int c = 0; c < 4; ++c) {
+    const glm::vec2 corner =
+        quad.origin + shift + size * glm::vec2(c & 1, c >> 1);
+    const glm::vec2 p = axisX * corner.x + axisY * corner.y + style.offset;
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  lo = glm::clamp(glm::floor(lo - tileOrigin), 0.0f, (float)kTile);
+  hi = glm::clamp(glm::ceil(hi - tileOrigin) + 1.0f, 0.0f, (float)kTile);
+  const glm::uvec2 begin(lo), end(hi);
+  if (begin.x >= end.x || begin.y >= end.y)
+    return {0, 0};
+
+  const float toImage = atlas.distanceRange * quad.scale;
+  for (unsigned y = begin.y; y < end.y; ++y) {
+    std::fill_n(out.fill + y * kTile, kTile, kOutside);
+    std::fill_n(out.edge + y * kTile, kTile, kOutside);
+
+    const glm::vec2 p = tileOrigin + glm::vec2(begin.x + 0.5f, y + 0.5f) -
+                        style.offset;
+    glm::vec2 q = style.invX * p.x + style.invY * p.y - shift;
+    for (unsigned x = begin.x; x < end.x; ++x, q += style.invX) {
+      const glm::vec2 local = (q - quad.origin) * quad.invSize;
+      if (local.x < 0.0f || local.y < 0.0f || local.x > 1.0f ||
+          local.y > 1.0f) {
+        continue;
+      }
+      const unsigned i = y * kTile + x;
+      const glm::vec2 d = Sample(atlas, quad.uv0 + local * quad.uvSize);
+      out.fill[i] = (d.x - 0.5f) * toImage;
+      out.edge[i] = (d.y - 0.5f) * toImage;
+    }
+  }
+  return {begin.y * kTile, end.y * kTile};
+}
+
+/**
+ * @brief Blends `color` with coverage clamp((distance + add) · mul + 0.5)
+ * over the accumulator, premultiplied "over".
+ */
+void BlendLayer(TileAccumulator &acc, const float *distance,
+                std::pair<unsigned, unsigned> range, float add, float mul,
+                Premultiplied color) {
+  unsigned i = range.first;
+  const unsigned end = range.second;
+#if defined(__SSE2__)
+  const __m128 vAdd = _mm_set1_ps(add);
+  const __m128 vMul = _mm_set1_ps(mul);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 cr = _mm_set1_ps(color.r), cg = _mm_set1_ps(color.g),
+               cb = _mm_set1_ps(color.b), ca = _mm_set1_ps(color.a);
+
+  for (; i < end; i += 4) {
+    const __m128 d = _mm_load_ps(distance + i);
+    const __m128 coverage = _mm_min_ps(
+        _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(d, vAdd), vMul), half),
+                   zero),
+        one);
+    if (_mm_movemask_ps(_mm_cmpgt_ps(coverage, zero)) == 0)
+      continue;
+
+    const __m128 alpha = _mm_mul_ps(ca, coverage);
+    const __m128 keep = _mm_sub_ps(one, alpha);
+    _mm_store_ps(acc.r + i,
+                 _mm_add_ps(_mm_mul_ps(cr, coverage),
+                            _mm_mul_ps(_mm_load_ps(acc.r + i), keep)));
+    _mm_store_ps(acc.g + i,
+                 _mm_add_ps(_mm_mul_ps(cg, coverage),
+                            _mm_mul_ps(_mm_load_ps(acc.g + i), keep)));
+    _mm_store_ps(acc.b + i,
+                 _mm_add_ps(_mm_mul_ps(cb, coverage),
+                            _mm_mul_ps(_mm_load_ps(acc.b + i), keep)));
+    _mm_store_ps(acc.a + i,
+                 _mm_add_ps(alpha, _mm_mul_ps(_mm_load_ps(acc.a + i), keep)));
+  }
+#endif
+  for (; i < end; ++i) {
+    const float coverage =
+        std::clamp((distance[i] + add) * mul + 0.5f, 0.0f, 1.0f);
+    if (coverage <= 0.0f)
+      continue;
+    const float keep = 1.0f - color.a * coverage;
+    acc.r[i] = color.r * coverage + acc.r[i] * keep;
+    acc.g[i] = color.g * coverage + acc.g[i] * keep;
+    acc.b[i] = color.b * coverage + acc.b[i] * keep;
+    acc.a[i] = color.a * coverage + acc.a[i] * keep;
+  }
+}
+
+void CompositeTile(const SdfTextSetup &setup, const SdfAtlasView &atlas,
+                   uint8_t *rgba, unsigned tileIndex, TileAccumulator &acc,
+                   TileDistances &dist) {
+  const uint32_t begin = setup.tileOffsets[tileIndex];
+  const uint32_t end = setup.tileOffsets[tileIndex + 1];
+  if (begin == end)
+    return;
+
+  const glm::uvec2 tile(tileIndex % setup.tiles.x, tileIndex / setup.tiles.x);
+  const glm::uvec2 origin = tile * kTile;
+  const glm::uvec2 extent = glm::min(glm::uvec2(kTile), setup.image - origin);
+
+  std::fill_n(acc.r, kTilePixels, 0.0f);
+  std::fill_n(acc.g, kTilePixels, 0.0f);
+  std::fill_n(acc.b, kTilePixels, 0.0f);
+  std::fill_n(acc.a, kTilePixels, 0.0f);
+  for (unsigned y = 0; y < extent.y; ++y) {
+    const uint8_t *row = rgba + ((size_t)(origin.y + y) * setup.image.x +
+                                 origin.x) * 4;
+    for (unsigned x = 0; x < extent.x; ++x) {
+      const unsigned i = y * kTile + x;
+      acc.r[i] = row[x * 4 + 0] / 255.0f;
+      acc.g[i] = row[x * 4 + 1] / 255.0f;
+      acc.b[i] = row[x * 4 + 2] / 255.0f;
+      acc.a[i] = row[x * 4 + 3] / 255.0f;
+    }
+  }
+
+  // all shadows first, so no shadow darkens a neighbouring glyph's fill
+  for (uint32_t q = begin; q < end; ++q) {
+    const SdfQuad &quad = setup.quads[setup.tileQuads[q]];
+    const SdfStyle &style = setup.styles[quad.style];
+    if (!style.shadowColor)
+      continue;
+
+    const auto rows =
+        SampleTile(quad, style, atlas, tile, style.shadowShift, dist);
+    const float width = std::max(style.shadowSoftness * quad.scale, 1.0f);
+    BlendLayer(acc, dist.edge, rows, style.outlineWidth * quad.scale,
+               1.0f / width, Unpack(style.shadowColor));
+  }
+
+  for (uint32_t q = begin; q < end; ++q) {
+    const SdfQuad &quad = setup.quads[setup.tileQuads[q]];
+    const SdfStyle &style = setup.styles[quad.style];
+
+    const auto rows =
+        SampleTile(quad, style, atlas, tile, glm::vec2(0.0f), dist);
+    if (style.outlineColor) {
+      BlendLayer(acc, dist.edge, rows, style.outlineWidth * quad.scale, 1.0f,
+                 Unpack(style.outlineColor));
+    }
+    BlendLayer(acc, dist.fill, rows, 0.0f, 1.0f, Unpack(quad.fill));
+  }
+
+  const auto store = [](float v) {
+    return (uint8_t)std::nearbyint(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+  };
+  for (unsigned y = 0; y < extent.y; ++y) {
+    uint8_t *row =
+        rgba + ((size_t)(origin.y + y) * setup.image.x + origin.x) * 4;
+    for (unsigned x = 0; x < extent.x; ++x) {
+      const unsigned i = y * kTile + x;
+      row[x * 4 + 0] = store(acc.r[i]);
+      row[x * 4 + 1] = store(acc.g[i]);
+      row[x * 4 + 2] = store(acc.b[i]);
+      row[x * 4 + 3] = store(acc.a[i]);
+    }
+  }
+}
+
+void CompositeTiles(const SdfTextSetup &setup, const SdfAtlasView &atlas,
+                    uint8_t *rgba, unsigned begin, unsigned end) {
+  auto acc = std::make_unique<TileAccumulator>();
+  auto dist = std::make_unique<TileDistances>();
+  for (unsigned t = begin; t < end; ++t)
+    CompositeTile(setup, atlas, rgba, t, *acc, *dist);
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+TextStyle TextStyle::Placed(glm::vec2 origin, float scale, float angle) {
+  TextStyle style;
+  const float c = std::cos(angle) * scale;
+  const float s = std::sin(angle) * scale;
+  style.axisX = {c, s};
+  style.axisY = {-s, c};
+  style.offset = origin;
+  return style;
+}
+
+void PrepareSdfText(const SdfTextBatch &batch, const SdfAtlasView &atlas,
+                    glm::uvec2 image, SdfTextSetup &setup) {
+  TRACE_SCOPE("sdf/prepare");
+  if (batch.style.size() != batch.quads.size()) {
+    throw std::invalid_argument(
+        std::format("{} quads but {} style indices", batch.quads.size(),
+                    batch.style.size()));
+  }
+  if (!atlas.texels || atlas.size.x == 0 || atlas.size.y == 0)
+    throw std::invalid_argument("empty SDF atlas");
+
+  setup.image = image;
+  setup.tiles = (image + kTile - 1u) / kTile;
+  setup.styles.clear();
+  setup.quads.clear();
+
+  std::vector<float> determinants;
+  for (const TextStyle &style : batch.styles) {
+    const glm::vec2 ax = style.axisX, ay = style.axisY;
+    const float det = ax.x * ay.y - ay.x * ax.y;
+    if (std::abs(det) < 1e-12f)
+      throw std::invalid_argument("degenerate text transform");
+
+    SdfStyle out;
+    out.invX = glm::vec2(ay.y, -ax.y) / det;
+    out.invY = glm::vec2(-ay.x, ax.x) / det;
+    out.offset = style.offset;
+    out.shadowShift = out.invX * style.shadowOffset.x +
+                      out.invY * style.shadowOffset.y;
+    out.outlineColor = style.outlineColor;
+    out.shadowColor = style.shadowColor;
+    out.outlineWidth = style.outlineWidth;
+    out.shadowSoftness = style.shadowSoftness;
+    setup.styles.push_back(out);
+    determinants.push_back(std::sqrt(std::abs(det)));
+  }
+
+  // per quad: tile rectangle, min.x == max.x + 1 if it misses the image
+  std::vector<glm::uvec4> rects;
+  std::vector<uint32_t> counts((size_t)setup.tiles.x * setup.tiles.y, 0);
+  const glm::vec2 texels(atlas.size);
+
+  for (size_t i = 0; i < batch.quads.size(); ++i) {
+    const GlyphQuad &quad = batch.quads[i];
+    const uint32_t s = batch.style[i];
+    if (s >= batch.styles.size()) {
+      throw std::out_of_range(
+          std::format("quad {} uses style {} of {}", i, s,
+                      batch.styles.size()));
+    }
+    if (quad.width == 0 || quad.height == 0 || quad.u1 == quad.u0)
+      continue;
+
+    SdfQuad out;
+    out.origin = glm::vec2(quad.x, quad.y) / kQuadSubpixel;
+    const glm::vec2 size = glm::vec2(quad.width, quad.height) / kQuadSubpixel;
+    out.invSize = 1.0f / size;
+    out.uv0 = glm::vec2(quad.u0, quad.v0) / 65535.0f * texels;
+    out.uvSize = glm::vec2(quad.u1 - quad.u0, quad.v1 - quad.v0) / 65535.0f *
+                 texels;
+    out.scale = determinants[s] * size.x / out.uvSize.x;
+    out.style = s;
+    out.fill = quad.color;
+
+    // image bounds of the quad and its shadow, plus a pixel of filter fringe
+    const TextStyle &style = batch.styles[s];
+    glm::vec2 lo(INFINITY), hi(-INFINITY);
+    for (int c = 0; c < 4; ++c) {
+      const glm::vec2 corner =
+          out.origin + size * glm::vec2(c & 1, c >> 1);
+      const glm::vec2 p =
+          style.axisX * corner.x + style.axisY * corner.y + style.offset;
+      lo = glm::min(lo, p);
+      hi = glm::max(hi, p);
+      if (style.shadowColor) {
+        lo = glm::min(lo, p + style.shadowOffset);
+        hi = glm::max(hi, p + style.shadowOffset);
+      }
+    }
+    lo = glm::max(glm::floor(lo) - 1.0f, glm::vec2(0.0f));
+    hi = glm::min(glm::ceil(hi) + 1.0f, glm::vec2(image) - 1.0f);
+    if (lo.x > hi.x || lo.y > hi.y)
+      continue;
+
+    const glm::uvec4 rect(glm::uvec2(lo) / kTile, glm::uvec2(hi) / kTile);
+    for (unsigned ty = rect.y; ty <= rect.w; ++ty)
+      for (unsigned tx = rect.x; tx <= rect.z; ++tx)
+        ++counts[(size_t)ty * setup.tiles.x + tx];
+    rects.push_back(rect);
+    setup.quads.push_back(out);
+  }
+
+  setup.tileOffsets.assign(counts.size() + 1, 0);
+  for (size_t t = 0; t < counts.size(); ++t)
+    setup.tileOffsets[t + 1] = setup.tileOffsets[t] + counts[t];
+
+  // stable fill: quads keep their submission order within every tile
+  setup.tileQuads.resize(setup.tileOffsets.back());
+  std::vector<uint32_t> cursor(setup.tileOffsets.begin(),
+                               setup.tileOffsets.end() - 1);
+  for (uint32_t q = 0; q < rects.size(); ++q) {
+    const glm::uvec4 &rect = rects[q];
+    for (unsigned ty = rect.y; ty <= rect.w; ++ty)
+      for (unsigned tx = rect.x; tx <= rect.z; ++tx)
+        setup.tileQuads[cursor[(size_t)ty * setup.tiles.x + tx]++] = q;
+  }
+}
+
+void CompositeSdfText(const SdfTextSetup &setup, const SdfAtlasView &atlas,
+                      uint8_t *rgba, unsigned threads) {
+  TRACE_SCOPE("sdf/composite");
+  const unsigned tiles = setup.tiles.x * setup.tiles.y;
+  threads = std::clamp(threads, 1u, std::max(tiles, 1u));
+  if (threads == 1) {
+    CompositeTiles(setup, atlas, rgba, 0, tiles);
+    return;
+  }
+
+  std::vector<std::future<void>> pending;
+  const unsigned perThread = (tiles + threads - 1) / threads;
+  for (unsigned begin = 0; begin < tiles; begin += perThread) {
+    pending.push_back(std::async(std::launch::async, CompositeTiles,
+                                 std::cref(setup), std::cref(atlas), rgba,
+                                 begin, std::min(begin + perThread, tiles)));
+  }
+  for (auto &job : pending)
+    job.get();
+}
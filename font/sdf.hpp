@@ -0,0 +1,116 @@
+#ifndef FONT_SDF_HPP
+#define FONT_SDF_HPP
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "quads.hpp"
+
+/// Channel layout of a distance field atlas; the value is the channel count.
+enum class SdfKind : uint8_t {
+  Sdf = 1,   // one true distance channel
+  Msdf = 3,  // median of three channels
+  Mtsdf = 4, // msdf plus a true distance in alpha for outline and shadow
+};
+
+/**
+ * @brief Read-only view of an atlas texture: `size.x * channels` bytes per
+ * row, 0.5 on the glyph edge. `distanceRange` is the distance in atlas
+ * pixels covered by the full 0..1 value range (msdfgen's pxRange).
+ */
+struct SdfAtlasView {
+  const uint8_t *texels = nullptr;
+  glm::uvec2 size{0};
+  SdfKind kind = SdfKind::Sdf;
+  float distanceRange = 4.0f;
+};
+
+/**
+ * @brief How the quads of one string are placed and decorated. The transform
+ * maps quad (layout) pixels to image pixels: p' = axisX·x + axisY·y + offset.
+ * Outline and shadow widths are in atlas pixels and scale with the text;
+ * together they must stay within the atlas' distance range.
+ */
+struct TextStyle {
+  glm::vec2 axisX{1.0f, 0.0f};
+  glm::vec2 axisY{0.0f, 1.0f};
+  glm::vec2 offset{0.0f};
+  uint32_t outlineColor = 0; // RGBA8 like GlyphQuad::color, 0 = no outline
+  uint32_t shadowColor = 0;  // 0 = no shadow
+  float outlineWidth = 0.0f;
+  float shadowSoftness = 0.0f;
+  glm::vec2 shadowOffset{0.0f}; // image pixels, not rotated with the text
+
+  /// Rotation by `angle` radians and uniform scale about `origin`.
+  static TextStyle Placed(glm::vec2 origin, float scale = 1.0f,
+                          float angle = 0.0f);
+};
+
+/// The quads to draw and, per quad, which style applies (e.g. the label
+/// index from GlyphBatch). Later quads are drawn over earlier ones.
+struct SdfTextBatch {
+  std::span<const GlyphQuad> quads;
+  std::span<const uint32_t> style;
+  std::span<const TextStyle> styles;
+};
+
+/* ------------------------------------------------------------------------- */
+
+/// Per-quad constants, shared with sdf_text.cl.
+struct SdfQuad {
+  glm::vec2 origin;  // layout px
+  glm::vec2 invSize; // 1 / layout px
+  glm::vec2 uv0;     // atlas texels
+  glm::vec2 uvSize;  // atlas texels
+  float scale;       // image px per atlas px
+  uint32_t style;
+  uint32_t fill;
+  uint32_t padding = 0;
+};
+static_assert(sizeof(SdfQuad) == 48);
+
+/// Per-style constants with the inverse transform, shared with sdf_text.cl.
+struct SdfStyle {
+  glm::vec2 invX; // image px -> layout px
+  glm::vec2 invY;
+  glm::vec2 offset;      // image space, subtracted first
+  glm::vec2 shadowShift; // shadow offset in layout px
+  uint32_t outlineColor;
+  uint32_t shadowColor;
+  float outlineWidth;
+  float shadowSoftness;
+};
+static_assert(sizeof(SdfStyle) == 48);
+
+/**
+ * @brief Everything a compositor needs besides the atlas and the target:
+ * prepared quads and styles, and a CSR list of the quads touching each
+ * kTile² tile, in submission order so blending stays deterministic.
+ */
+struct SdfTextSetup {
+  static constexpr unsigned kTile = 16;
+
+  std::vector<SdfQuad> quads;
+  std::vector<SdfStyle> styles;
+  glm::uvec2 image{0};
+  glm::uvec2 tiles{0};
+  std::vector<uint32_t> tileOffsets; // tiles.x * tiles.y + 1
+  std::vector<uint32_t> tileQuads;
+};
+
+/// Validates the batch, precomputes the per-quad constants and bins the quads.
+void PrepareSdfText(const SdfTextBatch &batch, const SdfAtlasView &atlas,
+                    glm::uvec2 image, SdfTextSetup &setup);
+
+/**
+ * @brief CPU compositor: draws all shadows, then outline and fill of every
+ * quad, over `rgba` (premultiplied RGBA8, tightly packed, `setup.image`
+ * sized). Tiles are independent and split across `threads`.
+ */
+void CompositeSdfText(const SdfTextSetup &setup, const SdfAtlasView &atlas,
+                      uint8_t *rgba, unsigned threads = 1);
+
+#endif // FONT_SDF_HPP
@@ -7,21 +7,33 @@
 #include <limits.h>
 #include <spdlog/spdlog.h>
 
-namespace {
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "ascii_shaper.hpp"
+#include "face.hpp"
+#include "fallback.hpp"
+#include "itemize.hpp"
+#include "exec/executor.hpp"
+#include "trace/trace.hpp"
 
-struct RectI {
-  glm::ivec2 min{0, 0};
-  glm::ivec2 max{0, 0};
-};
+namespace {
 
 static inline int floor26(int32_t v) { return (int)(v >> 6); }
 static inline int ceil26(int32_t v) { return (int)((v + 63) >> 6); }
 
-RectI CalculateBoundingRectPx(hb_font_t *hbFont, hb_buffer_t *buf) {
-  unsigned count = 0;
-  auto *infos = hb_buffer_get_glyph_infos(buf, &count);
-  auto *pos = hb_buffer_get_glyph_positions(buf, &count);
+} // namespace
+
+namespace {
 
+// `extentsOf(i, ext)` gives the extents of glyph i, false if it has none.
+template <typename ExtentsOf>
+RectI BoundingRectPx(ExtentsOf extentsOf, const hb_glyph_position_t *pos,
+                     unsigned count) {
   RectI r;
   r.min = {INT32_MAX, INT32_MAX};
   r.max = {INT32_MIN, INT32_MIN};
@@ -31,7 +43,7 @@ RectI CalculateBoundingRectPx(hb_font_t *hbFont, hb_buffer_t *buf) {
 
   for (unsigned i = 0; i < count; ++i) {
     hb_glyph_extents_t ext{};
-    if (!hb_font_get_glyph_extents(hbFont, infos[i].codepoint, &ext)) {
+    if (!extentsOf(i, ext)) {
       x += pos[i].x_advance;
       y += pos[i].y_advance;
       continue;
@@ -73,6 +85,21 @@ RectI CalculateBoundingRectPx(hb_font_t *hbFont, hb_buffer_t *buf) {
   return r;
 }
 
+} // namespace
+
+RectI CalculateBoundingRectPx(hb_font_t *hbFont, hb_buffer_t *buf) {
+  unsigned count = 0;
+  auto *infos = hb_buffer_get_glyph_infos(buf, &count);
+  auto *pos = hb_buffer_get_glyph_positions(buf, &count);
+  return BoundingRectPx(
+      [&](unsigned i, hb_glyph_extents_t &ext) {
+        return hb_font_get_glyph_extents(hbFont, infos[i].codepoint, &ext);
+      },
+      pos, count);
+}
+
+namespace {
+
 static inline RectI TranslateRect(const RectI &r, const glm::ivec2 &pen) {
   return RectI{r.min + pen, r.max + pen};
 }
@@ -103,23 +130,165 @@ static inline glm::uvec2 RequiredImageSize(const RectI &bboxWithoutPen,
 
 } // namespace
 
+glm::uvec2 RunImageSize(const RectI &ink, FT_Face face) {
+  // the baseline in px
+  const glm::ivec2 pen(0, (int)((face->size->metrics.ascender + 63) >> 6));
+
+  // a glyph drawn at a subpixel phase can reach one column further right
+  RectI shifted = ink;
+  if (shifted.max.x > shifted.min.x)
+    ++shifted.max.x;
+
+  glm::uvec2 imgSize = RequiredImageSize(shifted, pen);
+  spdlog::debug("Bounding size: ({}, {})", imgSize.x, imgSize.y);
+  return imgSize;
+}
+
 /** -------------------------------------------------------------------------------------------  */
 
-GlyphRun shape(FT_Face face, std::string_view utf8Text) {
-  hb_font_t *hb_font = hb_ft_font_create_referenced(face);
+namespace {
+
+// Glyphs of one run, kept in HarfBuzz units until the runs are joined.
+struct ShapedRun {
+  std::vector<hb_glyph_info_t> infos;
+  std::vector<hb_glyph_position_t> positions;
+};
+
+ShapedRun ShapeRun(hb_font_t *font, hb_buffer_t *buf, std::string_view text,
+                   const TextRun &run) {
+  hb_buffer_clear_contents(buf);
+  // the rest of the text is context, joining across run edges stays intact
+  hb_buffer_add_utf8(buf, text.data(), (int)text.size(), (unsigned)run.begin,
+                     (int)(run.end - run.begin));
+  hb_buffer_set_direction(buf, run.level % 2 ? HB_DIRECTION_RTL
+                                             : HB_DIRECTION_LTR);
+  hb_buffer_set_script(buf, (hb_script_t)run.script);
+  hb_buffer_guess_segment_properties(buf); // language only
+
+  hb_shape(font, buf, nullptr, 0);
+
+  unsigned count = 0;
+  const hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(buf, &count);
+  const hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buf, &count);
+  return ShapedRun{{infos, infos + count}, {pos, pos + count}};
+}
+
+/**
+ * @brief HarfBuzz fonts for the faces of a chain, created on first use. With
+ * `threadCopies`, the fonts use the calling thread's ThreadFace() copies, so
+ * they can be used on a worker thread.
+ */
+class ShapingFonts {
+public:
+  explicit ShapingFonts(std::span<const FT_Face> faces,
+                        bool threadCopies = false)
+      : _faces(faces), _threadCopies(threadCopies),
+        _fonts(faces.size(), nullptr) {}
+
+  ~ShapingFonts() {
+    for (hb_font_t *font : _fonts) {
+      if (font)
+        hb_font_destroy(font);
+    }
+  }
+
+  ShapingFonts(const ShapingFonts &) = delete;
+  ShapingFonts &operator=(const ShapingFonts &) = delete;
+
+  hb_font_t *get(size_t i) {
+    if (!_fonts[i]) {
+      FT_Face face = _threadCopies ? ThreadFace(_faces[i]) : _faces[i];
+      if (!face) {
+        throw std::logic_error("shaping with a face that cannot be copied");
+      }
+      _fonts[i] = hb_ft_font_create_referenced(face);
+    }
+    return _fonts[i];
+  }
+
+  hb_font_t *const *all() {
+    for (size_t i = 0; i < _fonts.size(); ++i)
+      get(i);
+    return _fonts.data();
+  }
+
+private:
+  std::span<const FT_Face> _faces;
+  bool _threadCopies;
+  std::vector<hb_font_t *> _fonts;
+};
+
+void ShapeRange(ShapingFonts &fonts, std::string_view text,
+                const std::vector<TextRun> &runs, size_t first, size_t last,
+                std::vector<ShapedRun> &shaped) {
   hb_buffer_t *buf = hb_buffer_create();
+  try {
+    for (size_t i = first; i < last; ++i) {
+      shaped[i] = ShapeRun(fonts.get(runs[i].font), buf, text, runs[i]);
+    }
+  } catch (...) {
+    hb_buffer_destroy(buf);
+    throw;
+  }
+  hb_buffer_destroy(buf);
+}
+
+std::vector<ShapedRun> ShapeRuns(std::span<const FT_Face> faces,
+                                 ShapingFonts &fonts, std::string_view text,
+                                 const std::vector<TextRun> &runs,
+                                 Executor *executor) {
+  std::vector<ShapedRun> shaped(runs.size());
+  const size_t chunks =
+      executor ? std::min<size_t>(executor->size(), runs.size()) : 1;
+
+  // hb-ft calls into the FT_Face, which must not be shared between threads,
+  // so every worker shapes with its own copy of the faces; fonts without an
+  // sfnt file cannot be copied and are shaped here
+  bool copyable = chunks > 1;
+  for (const TextRun &run : runs) {
+    if (copyable && !CanCopyFace(faces[run.font])) {
+      spdlog::debug("shaping serially: '{}' cannot be copied",
+                    faces[run.font]->family_name);
+      copyable = false;
+    }
+  }
+  if (!copyable) {
+    ShapeRange(fonts, text, runs, 0, runs.size(), shaped);
+    return shaped;
+  }
 
-  hb_buffer_add_utf8(buf, utf8Text.data(), (int)utf8Text.size(), 0,
-                     (int)utf8Text.size());
-  hb_buffer_guess_segment_properties(buf);
+  // contiguous ranges of about the same number of bytes
+  std::vector<std::pair<size_t, size_t>> ranges;
+  size_t first = 0;
+  for (size_t c = 0; c < chunks && first < runs.size(); ++c) {
+    const size_t target = text.size() * (c + 1) / chunks;
+    size_t last = first;
+    while (last < runs.size() && (last == first || runs[last].end <= target))
+      ++last;
+    if (c + 1 == chunks)
+      last = runs.size();
+    ranges.emplace_back(first, last);
+    first = last;
+  }
 
-  // Shaping: macht aus Text -> Glyph IDs + Positioning
-  hb_shape(hb_font, buf, nullptr, 0);
+  executor->parallelFor(ranges.size(), [&](size_t c) {
+    TRACE_SCOPE("harfbuzz/shape_runs");
+    ShapingFonts local(faces, true);
+    ShapeRange(local, text, runs, ranges[c].first, ranges[c].second, shaped);
+  });
+  return shaped;
+}
 
-  unsigned int count = 0;
-  hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(buf, &count);
-  hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buf, &count);
-  spdlog::info("glyph count: {}", count);
+/**
+ * @brief The GlyphRun of shaped glyphs in visual order; `fontOf` holds the
+ * font of every glyph, null means all are from `primary`.
+ */
+template <typename ExtentsOf>
+GlyphRun MakeGlyphRun(FT_Face primary,
+                      const std::vector<hb_glyph_info_t> &infos,
+                      const std::vector<hb_glyph_position_t> &pos,
+                      const uint16_t *fontOf, ExtentsOf extentsOf) {
+  const unsigned count = (unsigned)infos.size();
 
   // I want to store the glyphs and their positions in a struct
   std::vector<Glyph> glyphs;
@@ -128,8 +297,10 @@ GlyphRun shape(FT_Face face, std::string_view utf8Text) {
   for (unsigned int i = 0; i < count; ++i) {
     Glyph g;
     g.glyphIndex = infos[i].codepoint;
-    g.offset = {pos[i].x_offset >> 6, pos[i].y_offset >> 6}; // from 26.6 to int
-    g.advance = {pos[i].x_advance >> 6, pos[i].y_advance >> 6};
+    // from 26.6 to fractional pixels, y flipped to point down like the image
+    g.offset = {pos[i].x_offset / 64.0f, -pos[i].y_offset / 64.0f};
+    g.advance = {pos[i].x_advance / 64.0f, -pos[i].y_advance / 64.0f};
+    g.font = fontOf ? fontOf[i] : 0;
 
     glyphs.push_back(g);
   }
@@ -137,22 +308,89 @@ GlyphRun shape(FT_Face face, std::string_view utf8Text) {
   GlyphRun run;
   run.glyphs = std::move(glyphs);
 
-  auto boundingRect = CalculateBoundingRectPx(hb_font, buf);
+  auto boundingRect = BoundingRectPx(extentsOf, pos.data(), count);
+  run.size = RunImageSize(boundingRect, primary);
+  return run;
+}
 
-  const int padding = 0;
-  glm::ivec2 pen(
-      50,
-      0); //= glm::ivec2(padding) - boundingRect.min; // bbox.min is without pen
-  pen.x = 0;
-  pen.y = (face->size->metrics.ascender + 63) >> 6; // baseline in px
+GlyphRun ShapeWithFaces(std::span<const FT_Face> faces,
+                        const FontSelector &select, std::string_view utf8Text,
+                        Executor *executor) {
+  TRACE_SCOPE("harfbuzz/shape");
+  ShapingFonts fonts(faces);
+
+  const std::vector<TextRun> runs = Itemize(utf8Text, select);
+  const std::vector<ShapedRun> shaped =
+      ShapeRuns(faces, fonts, utf8Text, runs, executor);
+
+  // HarfBuzz emits every run in visual order already, only the runs
+  // themselves need reordering
+  std::vector<hb_glyph_info_t> infos;
+  std::vector<hb_glyph_position_t> pos;
+  std::vector<uint16_t> fontOf;
+  for (size_t i : VisualOrder(runs)) {
+    infos.insert(infos.end(), shaped[i].infos.begin(), shaped[i].infos.end());
+    pos.insert(pos.end(), shaped[i].positions.begin(),
+               shaped[i].positions.end());
+    fontOf.resize(infos.size(), (uint16_t)runs[i].font);
+  }
 
-  glm::uvec2 imgSize = RequiredImageSize(boundingRect, pen, padding);
-  spdlog::info("Bounding size: ({}, {})", imgSize.x, imgSize.y);
+  spdlog::debug("glyph count: {} in {} runs", infos.size(), runs.size());
 
-  run.size = imgSize;
+  hb_font_t *const *hbFonts = fonts.all();
+  return MakeGlyphRun(
+      faces[0], infos, pos, fontOf.data(),
+      [&](unsigned i, hb_glyph_extents_t &ext) {
+        return hb_font_get_glyph_extents(hbFonts[fontOf[i]],
+                                         infos[i].codepoint, &ext);
+      });
+}
 
-  hb_buffer_destroy(buf);
-  hb_font_destroy(hb_font);
+// The run shaped by HarfBuzz if AsciiShaper gives the same, or nothing.
+std::optional<GlyphRun> ShapeAscii(FT_Face face, std::string_view utf8Text) {
+  if (!AsciiShaper::IsSimpleText(utf8Text))
+    return std::nullopt;
+  const AsciiShaper *shaper = AsciiShaper::For(face);
+  if (!shaper || !shaper->accepts(utf8Text))
+    return std::nullopt;
+
+  TRACE_SCOPE("shaping/ascii");
+  std::vector<hb_glyph_info_t> infos;
+  std::vector<hb_glyph_position_t> pos;
+  shaper->shape(utf8Text, infos, pos);
+  return MakeGlyphRun(face, infos, pos, nullptr,
+                      [&](unsigned i, hb_glyph_extents_t &ext) {
+                        return shaper->extents(utf8Text[infos[i].cluster],
+                                               ext);
+                      });
+}
 
-  return run;
+} // namespace
+
+GlyphRun shape(FT_Face face, std::string_view utf8Text, Executor *executor) {
+  if (auto run = ShapeAscii(face, utf8Text))
+    return std::move(*run);
+  return shapeWithHarfBuzz(face, utf8Text, executor);
+}
+
+GlyphRun shapeWithHarfBuzz(FT_Face face, std::string_view utf8Text,
+                           Executor *executor) {
+  return ShapeWithFaces(std::span<const FT_Face>(&face, 1), {}, utf8Text,
+                        executor);
+}
+
+GlyphRun shape(const FontChain &fonts, std::string_view utf8Text,
+               Executor *executor) {
+  if (fonts.empty()) {
+    throw std::invalid_argument("cannot shape with an empty font chain");
+  }
+  // only if itemizing would put every character in the primary face
+  if (std::all_of(utf8Text.begin(), utf8Text.end(),
+                  [&fonts](char c) { return fonts.select((uint8_t)c) == 0; })) {
+    if (auto run = ShapeAscii(fonts.face(0), utf8Text))
+      return std::move(*run);
+  }
+  return ShapeWithFaces(
+      fonts.faces(), [&fonts](char32_t cp) { return fonts.select(cp); },
+      utf8Text, executor);
 }
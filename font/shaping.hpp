@@ -8,14 +8,16 @@
 #include FT_TRUETYPE_TABLES_H
 #include FT_SFNT_NAMES_H
 
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
 struct Glyph {
   FT_UInt glyphIndex;
-  glm::ivec2 offset;
-  glm::ivec2 advance;
+  glm::vec2 offset;  // fractional pixels, y down; rounded only when
+  glm::vec2 advance; // rasterizing so spacing error does not accumulate
+  uint16_t font = 0; // index into the FontChain, 0 for single faces
 };
 
 struct GlyphRun {
@@ -23,6 +25,41 @@ struct GlyphRun {
   glm::uvec2 size;
 };
 
-GlyphRun shape(FT_Face face, std::string_view utf8Text);
+struct RectI {
+  glm::ivec2 min{0, 0};
+  glm::ivec2 max{0, 0};
+};
+
+struct hb_font_t;
+struct hb_buffer_t;
+class Executor;
+class FontChain;
+
+/**
+ * @brief Shapes text of any script mix. The text is itemized by script, bidi
+ * level and font; with an `executor` the runs are shaped in parallel on its
+ * workers, each on its ThreadFace() copy of the face, and fonts that cannot
+ * be copied are shaped on the calling thread. Glyphs come out in visual
+ * order.
+ *
+ * Plain ASCII the face shapes without substitutions skips HarfBuzz and is
+ * laid out from per-face tables (AsciiShaper), with the same result.
+ */
+GlyphRun shape(FT_Face face, std::string_view utf8Text,
+               Executor *executor = nullptr);
+
+/// shape() always through HarfBuzz, to check and compare the ASCII path.
+GlyphRun shapeWithHarfBuzz(FT_Face face, std::string_view utf8Text,
+                           Executor *executor = nullptr);
+
+/// As above, every code point drawn by the first face of `fonts` covering it.
+GlyphRun shape(const FontChain &fonts, std::string_view utf8Text,
+               Executor *executor = nullptr);
+
+/// Ink bounds of a shaped buffer in pixels (y up, pen at the origin).
+RectI CalculateBoundingRectPx(hb_font_t *hbFont, hb_buffer_t *buf);
+
+/// GlyphRun::size that shape() gives a run of `face` with ink bounds `ink`.
+glm::uvec2 RunImageSize(const RectI &ink, FT_Face face);
 
 #endif // FONT_SHAPING_HPP
\ No newline at end of file
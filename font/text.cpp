@@ -15,68 +15,87 @@
 #include <exception>
 #include <filesystem>
 
+#include "config.hpp"
+#include "face.hpp"
+#include "fallback.hpp"
+#include "output.hpp"
 #include "render.hpp"
 #include "shaping.hpp"
-
-std::string find_font(const std::string &query);
-
-namespace {
-
-/* ------------------------------------------------------------------------- */
-
-FT_Library Initialize() {
-  FT_Library ft;
-  if (FT_Init_FreeType(&ft)) {
-    throw std::runtime_error("FT_Init_FreeType failed");
-  }
-  return ft;
+#include "text.hpp"
+
+struct TextJob::State {
+  std::filesystem::path imagePath;
+  std::string text;
+  std::string fontQuery;
+  int pixelSize;
+
+  std::vector<std::string> fontPaths; // fallback order
+  FT_Library ft = nullptr;
+  FontChain fonts;
+  GlyphRun run;
+  std::vector<uint8_t> image;
+};
+
+TextJob::TextJob(std::filesystem::path imagePath, std::string text,
+                 std::string fontQuery, int pixelSize)
+    : _state(std::make_unique<State>()) {
+  _state->imagePath = std::move(imagePath);
+  _state->text = std::move(text);
+  _state->fontQuery = std::move(fontQuery);
+  _state->pixelSize = pixelSize;
 }
 
-FT_Face LoadFace(FT_Library ft, std::string fontPath, int size = 64) {
-  FT_Face face;
-
-  if (FT_New_Face(ft, fontPath.c_str(), 0, &face)) {
-    throw new std::runtime_error(
-        std::format("FT_New_Face failed (font: {})", fontPath));
-  }
-
-  // Set font size in pixels
-  if (FT_Set_Pixel_Sizes(face, 0, size)) {
+TextJob::~TextJob() {
+  for (FT_Face face : _state->fonts.faces())
     FT_Done_Face(face);
-    throw std::runtime_error("FT_Set_Pixel_Sizes failed");
+  if (_state->ft) {
+    FT_Done_FreeType(_state->ft);
+    spdlog::info("shutdown FreeType");
   }
-
-  spdlog::info("Loaded {}", fontPath);
-  return face;
 }
 
-} // namespace
-
-void RunFreetype(const std::filesystem::path &imagePath,
-                 std::string_view text) {
-  const std::string font_path = find_font("sans:weight=bold");
+void TextJob::findFont() {
+  _state->fontPaths = find_fonts_for_text(_state->fontQuery, _state->text);
+}
 
-  FT_Library ft;
-  FT_Face face;
+void TextJob::loadFace() {
+  _state->ft = InitializeFreeType();
+  spdlog::info("initialize FreeType");
+
+  for (size_t i = 0; i < _state->fontPaths.size(); ++i) {
+    try {
+      _state->fonts.add(
+          LoadFace(_state->ft, _state->fontPaths[i], _state->pixelSize));
+    } catch (const std::exception &e) {
+      if (i == 0)
+        throw; // a fallback may fail (e.g. bitmap-only), the primary not
+      spdlog::warn("skipping fallback font: {}", e.what());
+    }
+  }
+}
 
-  try {
-    ft = Initialize();
-    face = LoadFace(ft, font_path);
-    spdlog::info("initialize FreeType");
+void TextJob::shape() { _state->run = ::shape(_state->fonts, _state->text); }
 
-    GlyphRun run = shape(face, text);
-    const auto image{Render(face, run)};
+void TextJob::rasterize(Executor &executor) {
+  _state->image = Render(_state->fonts, _state->run, executor);
+  spdlog::info("rendered text to image");
+}
 
-    save_pgm(imagePath, image, run.size);
-    spdlog::info("rendered text to image");
+std::future<void> TextJob::encode(ImageWriter &writer) {
+  // encoding and disk I/O happen on the writer's threads
+  return writer.submit(_state->imagePath,
+                       OutputImage{std::move(_state->image), _state->run.size});
+}
 
-  } catch (const std::exception &e) {
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
-    throw;
-  }
+/* ------------------------------------------------------------------------- */
 
-  FT_Done_Face(face);
-  FT_Done_FreeType(ft);
-  spdlog::info("shutdown FreeType");
+std::future<void> RunFreetype(Executor &executor, ImageWriter &writer,
+                              const std::filesystem::path &imagePath,
+                              std::string_view text) {
+  TextJob job(imagePath, std::string(text));
+  job.findFont();
+  job.loadFace();
+  job.shape();
+  job.rasterize(executor);
+  return job.encode(writer);
 }
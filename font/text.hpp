@@ -2,43 +2,46 @@
 #define FONT_FONT_HPP
 
 #include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
 #include <string_view>
-#include <glm/vec2.hpp>
 
-void RunFreetype(const std::filesystem::path &imagePath, std::string_view text);
+class Executor;
+class ImageWriter;
 
-// TODO:
-class Font {};
-class FontFace {};
-
-class Bitmap {};
-
-class GlyphCache {
-  struct key_type {
-    FontFace face;
-    uint size;
-    uint32_t codepoint;
-  };
-};
-
-class Glyph {
-  Bitmap bitmap;
-  glm::ivec2 bearing; 
-  glm::ivec2 advance;
-};
-
-class TextRenderer {
+/**
+ * @brief One text-to-image job split into its pipeline stages, so a
+ * scheduler can interleave the stages of many jobs. Stages must be called in
+ * declaration order; each may run on a different thread.
+ */
+class TextJob {
 public:
-  TextRenderer();
-  ~TextRenderer();
+  TextJob(std::filesystem::path imagePath, std::string text,
+          std::string fontQuery = "sans:weight=bold", int pixelSize = 64);
+  ~TextJob();
 
-  Bitmap render(FontFace face, int size, const std::string_view text);
+  TextJob(const TextJob &) = delete;
+  TextJob &operator=(const TextJob &) = delete;
 
-private:
-  Glyph renderGlyph(FontFace face, int size, uint32_t codepoint);
-  void cacheGlyph(Glyph glyph, uint size, uint32_t codepoint);
+  void findFont();
+  void loadFace();
+  void shape();
+  /// Rasterizes the distinct glyphs on `executor`'s workers.
+  void rasterize(Executor &executor);
+  std::future<void> encode(ImageWriter &writer);
 
-  GlyphCache glyphCache;
+private:
+  struct State;
+  std::unique_ptr<State> _state;
 };
 
+/**
+ * @brief Renders `text` on `executor` and queues the image on `writer`. The
+ * returned future becomes ready once the file has been written.
+ */
+std::future<void> RunFreetype(Executor &executor, ImageWriter &writer,
+                              const std::filesystem::path &imagePath,
+                              std::string_view text);
+
 #endif // FONT_FONT_HPP
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef FONT_UTF8_HPP
+#define FONT_UTF8_HPP
+
+#include <cstddef>
+#include <string_view>
+
+/**
+ * @brief Decodes the code point starting at `text[offset]` and advances
+ * `offset` past it. Malformed sequences yield U+FFFD and consume one byte.
+ */
+inline char32_t NextCodepoint(std::string_view text, size_t &offset) {
+  const auto byte = [&](size_t i) { return (unsigned char)text[offset + i]; };
+  const unsigned char lead = byte(0);
+
+  if (lead < 0x80) {
+    ++offset;
+    return lead;
+  }
+
+  size_t length = 0;
+  char32_t cp = 0;
+  if (lead >= 0xC2 && lead < 0xE0) {
+    length = 2;
+    cp = lead & 0x1F;
+  } else if (lead >= 0xE0 && lead < 0xF0) {
+    length = 3;
+    cp = lead & 0x0F;
+  } else if (lead >= 0xF0 && lead < 0xF5) {
+    length = 4;
+    cp = lead & 0x07;
+  }
+
+  if (length == 0 || offset + length > text.size()) {
+    ++offset;
+    return U'\uFFFD';
+  }
+
+  for (size_t i = 1; i < length; ++i) {
+    if ((byte(i) & 0xC0) != 0x80) {
+      ++offset;
+      return U'\uFFFD';
+    }
+    cp = (cp << 6) | (byte(i) & 0x3F);
+  }
+
+  // overlong forms, surrogates and values past U+10FFFF
+  if ((length == 3 && cp < 0x800) || (length == 4 && cp < 0x10000) ||
+      (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+    ++offset;
+    return U'\uFFFD';
+  }
+
+  offset += length;
+  return cp;
+}
+
+#endif // FONT_UTF8_HPP
@@ -1,10 +1,88 @@
-#include <future>
 #include <spdlog/spdlog.h>
 
+#include <csignal>
+#include <format>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "cl/GltfExport.hpp"
 #include "cl/Program.hpp"
+#include "cl/Terrain.hpp"
+#include "exec/executor.hpp"
+#include "font/output.hpp"
 #include "font/text.hpp"
+#include "server/server.hpp"
+#include "trace/trace.hpp"
+
+namespace {
+
+RenderServer *server = nullptr;
+
+void OnSignal(int) {
+  if (server)
+    server->stop();
+}
+
+// ft_hello --serve [socket]: keep everything warm and render on request
+int Serve(int argc, char **argv) {
+  const std::filesystem::path socketPath =
+      argc >= 3 ? argv[2] : "/tmp/bgl-render.sock";
+
+  try {
+    RenderServer::Options options;
+    options.assetsDir = std::filesystem::path(argv[0]).parent_path() / "assets";
+
+    RenderServer instance(socketPath, options);
+    server = &instance;
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
 
-int RunOpenCL(int argc, char **argv);
+    instance.serve();
+    server = nullptr;
+  } catch (const std::exception &e) {
+    server = nullptr;
+    spdlog::error("Exception: {}", e.what());
+    return EXIT_FAILURE;
+  }
+
+  spdlog::info("server stopped");
+  return EXIT_SUCCESS;
+}
+
+// ft_hello --terrain out.glb [--quantize] [--chunk <quads>]: the heightmap
+// asset as a glTF mesh for downstream tools
+int ExportTerrain(int argc, char **argv) {
+  if (argc < 3) {
+    spdlog::error("usage: {} --terrain <out.glb|out.gltf> [--quantize] "
+                  "[--chunk <quads>]",
+                  argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    GltfExportOptions options;
+    for (int i = 3; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg == "--quantize") {
+        options.quantize = true;
+      } else if (arg == "--chunk" && i + 1 < argc) {
+        options.chunkSize = (unsigned)std::stoul(argv[++i]);
+      } else {
+        throw std::invalid_argument(std::format("unknown option '{}'", arg));
+      }
+    }
+
+    const auto assets = std::filesystem::path(argv[0]).parent_path() / "assets";
+    ExportHeightmapGltf(assets / "heightmap.png", argv[2], options);
+  } catch (const std::exception &e) {
+    spdlog::error("Exception: {}", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+} // namespace
 
 int main(int argc, char **argv) {
   if (argc < 1) {
@@ -13,20 +91,76 @@ int main(int argc, char **argv) {
   }
 
   ProgramCache sha;
+  TRACE_THREAD_NAME("main");
+
+  if (argc >= 2 && std::string_view(argv[1]) == "--serve") {
+    return Serve(argc, argv);
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "--terrain") {
+    return ExportTerrain(argc, argv);
+  }
 
   try {
-    const char *text = (argc >= 3) ? argv[2] : "Hello beautiful, BGL!";
-    const auto path = std::filesystem::path(argv[0]).parent_path() / "out.pgm";
+    const auto outDir = std::filesystem::path(argv[0]).parent_path();
+
+    // every argument after the first is rendered to its own image
+    std::vector<std::string> texts;
+    for (int i = 2; i < argc; ++i)
+      texts.emplace_back(argv[i]);
+    if (texts.empty())
+      texts.emplace_back("Hello beautiful, BGL!");
+
+    ImageWriter writer;
+    Executor executor;
+    TaskGraph graph;
 
-    auto task1 = std::async(std::launch::async, RunFreetype, path, text);
-    auto task2 = std::async(std::launch::async, RunOpenCL, argc, argv);
+    // find font -> load face -> shape -> rasterize -> encode, per text
+    std::vector<std::unique_ptr<TextJob>> jobs;
+    std::vector<std::future<void>> written(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+      const auto name = i == 0 ? std::string("out.pgm")
+                               : std::format("out_{}.pgm", i);
+      auto &job = *jobs.emplace_back(
+          std::make_unique<TextJob>(outDir / name, texts[i]));
 
-    task1.get();
-    task2.get();
+      graph.chain({
+          graph.add("find font", [&job] { job.findFont(); }),
+          graph.add("load face", [&job] { job.loadFace(); }),
+          graph.add("shape", [&job] { job.shape(); }),
+          graph.add("rasterize",
+                    [&job, &executor] { job.rasterize(executor); }),
+          graph.add("encode",
+                    [&job, &writer, &written, i] {
+                      written[i] = job.encode(writer);
+                    }),
+      });
+    }
+
+    // setup -> build -> upload -> kernel -> download
+    TerrainJob terrain(outDir / "assets");
+    graph.chain({
+        graph.add("opencl setup", [&] { terrain.setup(); }),
+        graph.add("opencl build", [&] { terrain.build(); }),
+        graph.add("upload", [&] { terrain.upload(); }),
+        graph.add("kernel", [&] { terrain.dispatch(); }),
+        graph.add("download", [&] { terrain.download(); }),
+    });
+
+    executor.run(graph);
+
+    for (auto &future : written)
+      future.get();
   } catch (const std::exception &e) {
     spdlog::error("Exception: {}", e.what());
     return EXIT_FAILURE;
   }
 
+#ifdef USE_TRACE
+  // BGL_TRACE=trace.json ./ft_hello -> open in ui.perfetto.dev
+  if (const char *tracePath = std::getenv("BGL_TRACE")) {
+    trace::WriteChromeTrace(tracePath);
+  }
+#endif
+
   return EXIT_SUCCESS;
 }
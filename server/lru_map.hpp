@@ -0,0 +1,49 @@
+#ifndef SERVER_LRU_MAP_HPP
+#define SERVER_LRU_MAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <utility>
+
+/**
+ * @brief A map that keeps at most `capacity` entries and drops the least
+ * recently used one when a new key would exceed that. Not thread-safe.
+ */
+template <typename Key, typename Value> class LruMap {
+public:
+  explicit LruMap(size_t capacity)
+      : _capacity(std::max<size_t>(capacity, 1)) {}
+
+  /// The value of `key`, which becomes the most recent, or null.
+  Value *find(const Key &key) {
+    const auto it = _index.find(key);
+    if (it == _index.end())
+      return nullptr;
+    _items.splice(_items.begin(), _items, it->second);
+    return &it->second->second;
+  }
+
+  /// Adds `key`, which must not be present yet, as the most recent.
+  Value &insert(Key key, Value value) {
+    _items.emplace_front(std::move(key), std::move(value));
+    _index.emplace(_items.front().first, _items.begin());
+    if (_items.size() > _capacity) {
+      _index.erase(_items.back().first);
+      _items.pop_back();
+    }
+    return _items.front().second;
+  }
+
+  size_t size() const { return _items.size(); }
+
+private:
+  using Items = std::list<std::pair<Key, Value>>;
+
+  size_t _capacity;
+  Items _items; // most recent at the front
+  std::map<Key, typename Items::iterator> _index;
+};
+
+#endif // SERVER_LRU_MAP_HPP
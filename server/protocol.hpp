@@ -0,0 +1,127 @@
+#ifndef SERVER_PROTOCOL_HPP
+#define SERVER_PROTOCOL_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Wire format of the render daemon. All integers are little-endian, there is
+ * no padding. A client may write any number of requests without waiting;
+ * responses come back in request order and carry the request id.
+ *
+ * Request  (24 bytes): magic 'BGLR', id, kind u8, format u8, pixelSize u16,
+ *                      queryLength u32, textLength u32, reserved u32,
+ *                      followed by query and text (UTF-8, no terminator).
+ * Response (24 bytes): magic 'BGLA', id, status u16, channels u16,
+ *                      width u32, height u32, payloadLength u32,
+ *                      followed by the payload (encoded image or, for errors,
+ *                      a UTF-8 message).
+ */
+namespace protocol {
+
+constexpr uint32_t kRequestMagic = 0x524C4742;  // "BGLR"
+constexpr uint32_t kResponseMagic = 0x414C4742; // "BGLA"
+constexpr size_t kHeaderSize = 24;
+
+constexpr uint32_t kMaxQueryLength = 4 << 10;
+constexpr uint32_t kMaxTextLength = 1 << 20;
+constexpr uint64_t kMaxPayloadLength = UINT32_MAX; // payloadLength is a u32
+
+enum class Kind : uint8_t { Text = 0, Terrain = 1 };
+enum class Format : uint8_t { PGM = 0, PNG = 1, Raw = 2 };
+enum class Status : uint16_t { Ok = 0, BadRequest = 1, Failed = 2 };
+
+struct RequestHeader {
+  uint32_t id = 0;
+  Kind kind = Kind::Text;
+  Format format = Format::PGM;
+  uint16_t pixelSize = 64;
+  uint32_t queryLength = 0;
+  uint32_t textLength = 0;
+};
+
+struct Request {
+  RequestHeader header;
+  std::string query; // fontconfig pattern, empty = "sans"
+  std::string text;
+};
+
+struct ResponseHeader {
+  uint32_t id = 0;
+  Status status = Status::Ok;
+  uint16_t channels = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t payloadLength = 0;
+};
+
+namespace detail {
+
+inline void Put(uint8_t *p, uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint32_t Get(const uint8_t *p, int bytes) {
+  uint32_t v = 0;
+  for (int i = 0; i < bytes; ++i)
+    v |= (uint32_t)p[i] << (8 * i);
+  return v;
+}
+
+} // namespace detail
+
+inline std::array<uint8_t, kHeaderSize> Encode(const RequestHeader &h) {
+  std::array<uint8_t, kHeaderSize> out{};
+  detail::Put(&out[0], kRequestMagic, 4);
+  detail::Put(&out[4], h.id, 4);
+  out[8] = (uint8_t)h.kind;
+  out[9] = (uint8_t)h.format;
+  detail::Put(&out[10], h.pixelSize, 2);
+  detail::Put(&out[12], h.queryLength, 4);
+  detail::Put(&out[16], h.textLength, 4);
+  return out;
+}
+
+/// Returns false if the magic does not match, i.e. the stream is out of sync.
+inline bool Decode(const uint8_t *in, RequestHeader &h) {
+  if (detail::Get(&in[0], 4) != kRequestMagic)
+    return false;
+  h.id = detail::Get(&in[4], 4);
+  h.kind = (Kind)in[8];
+  h.format = (Format)in[9];
+  h.pixelSize = (uint16_t)detail::Get(&in[10], 2);
+  h.queryLength = detail::Get(&in[12], 4);
+  h.textLength = detail::Get(&in[16], 4);
+  return true;
+}
+
+inline std::array<uint8_t, kHeaderSize> Encode(const ResponseHeader &h) {
+  std::array<uint8_t, kHeaderSize> out{};
+  detail::Put(&out[0], kResponseMagic, 4);
+  detail::Put(&out[4], h.id, 4);
+  detail::Put(&out[8], (uint16_t)h.status, 2);
+  detail::Put(&out[10], h.channels, 2);
+  detail::Put(&out[12], h.width, 4);
+  detail::Put(&out[16], h.height, 4);
+  detail::Put(&out[20], h.payloadLength, 4);
+  return out;
+}
+
+inline bool Decode(const uint8_t *in, ResponseHeader &h) {
+  if (detail::Get(&in[0], 4) != kResponseMagic)
+    return false;
+  h.id = detail::Get(&in[4], 4);
+  h.status = (Status)detail::Get(&in[8], 2);
+  h.channels = (uint16_t)detail::Get(&in[10], 2);
+  h.width = detail::Get(&in[12], 4);
+  h.height = detail::Get(&in[16], 4);
+  h.payloadLength = detail::Get(&in[20], 4);
+  return true;
+}
+
+} // namespace protocol
+
+#endif // SERVER_PROTOCOL_HPP
@@ -0,0 +1,389 @@
+#include "server.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "cl/Terrain.hpp"
+#include "exec/executor.hpp"
+#include "font/config.hpp"
+#include "font/face.hpp"
+#include "font/output.hpp"
+#include "font/render.hpp"
+#include "font/shaping.hpp"
+#include "trace/trace.hpp"
+
+namespace {
+
+bool ReadExact(int fd, void *data, size_t size) {
+  auto *p = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    const ssize_t n = ::read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false; // closed or failed
+    p += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const void *header, size_t headerSize,
+              const void *payload, size_t payloadSize) {
+  iovec parts[2] = {{const_cast<void *>(header), headerSize},
+                    {const_cast<void *>(payload), payloadSize}};
+  iovec *iov = parts;
+  int count = payloadSize ? 2 : 1;
+
+  while (count > 0) {
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)count;
+    ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+  return true;
+}
+
+ImageFormat ToImageFormat(protocol::Format format) {
+  switch (format) {
+  case protocol::Format::PGM:
+    return ImageFormat::PGM;
+  case protocol::Format::PNG:
+    return ImageFormat::PNG;
+  case protocol::Format::Raw:
+    return ImageFormat::Raw;
+  }
+  throw std::invalid_argument(std::format("unknown format {}", (int)format));
+}
+
+} // namespace
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief A loaded face plus the runs shaped with it. FreeType faces are not
+ * thread-safe, so all use of one entry is serialized by its mutex; distinct
+ * entries have their own FT_Library and render in parallel.
+ */
+struct RenderServer::FaceEntry {
+  FT_Library ft = nullptr;
+  FT_Face face = nullptr;
+  std::mutex mutex;
+
+  // LRU of shaped runs keyed by text, most recent at the front
+  std::list<std::pair<std::string, GlyphRun>> runs;
+  std::unordered_map<std::string_view,
+                     std::list<std::pair<std::string, GlyphRun>>::iterator>
+      index;
+
+  // bounded by glyph count times kSubpixelPhases, kept for the face's life
+  GlyphBitmapCache bitmaps;
+
+  FaceEntry(const std::string &path, unsigned pixelSize)
+      : ft(InitializeFreeType()) {
+    try {
+      face = LoadFace(ft, path, (int)pixelSize);
+    } catch (...) {
+      FT_Done_FreeType(ft);
+      throw;
+    }
+  }
+
+  ~FaceEntry() {
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+  }
+
+  const GlyphRun &shaped(const std::string &text, size_t capacity) {
+    if (auto it = index.find(text); it != index.end()) {
+      runs.splice(runs.begin(), runs, it->second);
+      return it->second->second;
+    }
+
+    runs.emplace_front(text, shape(face, text));
+    index.emplace(runs.front().first, runs.begin());
+    if (runs.size() > capacity) {
+      index.erase(runs.back().first);
+      runs.pop_back();
+    }
+    return runs.front().second;
+  }
+};
+
+/* ------------------------------------------------------------------------- */
+
+RenderServer::RenderServer(std::filesystem::path socketPath, Options options)
+    : _socketPath(std::move(socketPath)), _options(std::move(options)),
+      _fontPaths(_options.fontQueryCacheSize),
+      _faces(_options.faceCacheSize),
+      _encoder(std::make_unique<Executor>(
+          std::max(_options.encodeThreads, 1u))) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  const auto path = _socketPath.string();
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error(std::format("socket path too long: {}", path));
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  _listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (_listenFd < 0) {
+    throw std::runtime_error(
+        std::format("socket() failed: {}", strerror(errno)));
+  }
+
+  ::unlink(path.c_str()); // stale socket of a previous run
+  if (::bind(_listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+      ::listen(_listenFd, SOMAXCONN) < 0) {
+    const auto error = strerror(errno);
+    ::close(_listenFd);
+    throw std::runtime_error(
+        std::format("could not listen on '{}': {}", path, error));
+  }
+
+  // compile kernels once up front instead of on the first terrain request
+  if (!_options.assetsDir.empty()) {
+    try {
+      auto terrain = std::make_unique<TerrainJob>(_options.assetsDir);
+      terrain->setup();
+      terrain->build();
+      _terrain = std::move(terrain);
+    } catch (const std::exception &e) {
+      spdlog::warn("OpenCL unavailable, terrain requests disabled: {}",
+                   e.what());
+    }
+  }
+
+  // last, so a constructor that throws leaves no thread waiting
+  const unsigned threads = std::max(_options.connectionThreads, 1u);
+  for (unsigned i = 0; i < threads; ++i)
+    _workers.emplace_back([this] { work(); });
+
+  spdlog::info("listening on '{}'", path);
+}
+
+RenderServer::~RenderServer() {
+  stop();
+  {
+    std::lock_guard lock(_clientsMutex);
+    for (int fd : _clients)
+      ::shutdown(fd, SHUT_RDWR); // unblocks the connection threads
+    for (int fd : _pending)
+      ::close(fd);
+    _pending.clear();
+  }
+  _pendingReady.notify_all();
+  _workers.clear();
+
+  ::close(_listenFd);
+  ::unlink(_socketPath.string().c_str());
+}
+
+void RenderServer::serve() {
+  while (!_stop) {
+    pollfd pfd{_listenFd, POLLIN, 0};
+    const int ready = ::poll(&pfd, 1, 200); // wake up regularly to see _stop
+    if (ready < 0 && errno != EINTR) {
+      throw std::runtime_error(
+          std::format("poll() failed: {}", strerror(errno)));
+    }
+    if (ready <= 0)
+      continue;
+
+    const int fd = ::accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR && errno != EAGAIN)
+        spdlog::warn("accept() failed: {}", strerror(errno));
+      continue;
+    }
+
+    {
+      std::lock_guard lock(_clientsMutex);
+      if (_pending.size() < _options.connectionBacklog) {
+        _pending.push_back(fd);
+        _pendingReady.notify_one();
+        continue;
+      }
+    }
+    spdlog::warn("{} connections waiting, refusing another one",
+                 _options.connectionBacklog);
+    ::close(fd);
+  }
+}
+
+void RenderServer::work() {
+  TRACE_THREAD_NAME("connection");
+  for (;;) {
+    int fd;
+    {
+      std::unique_lock lock(_clientsMutex);
+      _pendingReady.wait(lock, [this] { return _stop || !_pending.empty(); });
+      if (_stop)
+        return; // the destructor closes what is still pending
+      fd = _pending.front();
+      _pending.pop_front();
+      _clients.insert(fd);
+    }
+
+    handle(fd);
+
+    {
+      std::lock_guard lock(_clientsMutex);
+      _clients.erase(fd);
+    }
+    ::close(fd);
+  }
+}
+
+void RenderServer::handle(int fd) {
+  uint8_t header[protocol::kHeaderSize];
+
+  while (!_stop && ReadExact(fd, header, sizeof(header))) {
+    protocol::Request request;
+    if (!protocol::Decode(header, request.header)) {
+      spdlog::warn("client sent a bad magic, closing connection");
+      return;
+    }
+
+    const auto &h = request.header;
+    if (h.queryLength > protocol::kMaxQueryLength ||
+        h.textLength > protocol::kMaxTextLength) {
+      spdlog::warn("request {} exceeds size limits, closing connection", h.id);
+      return;
+    }
+
+    request.query.resize(h.queryLength);
+    request.text.resize(h.textLength);
+    if (!ReadExact(fd, request.query.data(), h.queryLength) ||
+        !ReadExact(fd, request.text.data(), h.textLength))
+      return;
+
+    protocol::ResponseHeader response;
+    response.id = h.id;
+
+    std::vector<uint8_t> payload;
+    try {
+      TRACE_SCOPE("server/request");
+      payload = render(request, response);
+    } catch (const std::invalid_argument &e) {
+      response.status = protocol::Status::BadRequest;
+      payload.assign(e.what(), e.what() + std::strlen(e.what()));
+    } catch (const std::exception &e) {
+      response.status = protocol::Status::Failed;
+      payload.assign(e.what(), e.what() + std::strlen(e.what()));
+    }
+
+    // a truncated length would desync every later response on the stream
+    if (payload.size() > protocol::kMaxPayloadLength) {
+      const auto message =
+          std::format("response of {} bytes exceeds the protocol limit",
+                      payload.size());
+      response = {};
+      response.id = h.id;
+      response.status = protocol::Status::Failed;
+      payload.assign(message.begin(), message.end());
+    }
+
+    response.payloadLength = (uint32_t)payload.size();
+    const auto encoded = protocol::Encode(response);
+    if (!WriteAll(fd, encoded.data(), encoded.size(), payload.data(),
+                  payload.size()))
+      return;
+  }
+}
+
+std::vector<uint8_t> RenderServer::render(const protocol::Request &request,
+                                          protocol::ResponseHeader &response) {
+  const auto &h = request.header;
+
+  if (h.kind == protocol::Kind::Terrain) {
+    if (!_terrain)
+      throw std::runtime_error("OpenCL is not available");
+
+    std::lock_guard lock(_terrainMutex);
+    _terrain->upload();
+    _terrain->dispatch();
+    _terrain->download();
+
+    const auto &vertices = _terrain->vertices();
+    response.width = (uint32_t)vertices.size();
+    response.height = 1;
+    const auto *bytes = reinterpret_cast<const uint8_t *>(vertices.data());
+    return {bytes, bytes + vertices.size() * sizeof(float)};
+  }
+
+  if (h.kind != protocol::Kind::Text)
+    throw std::invalid_argument(std::format("unknown kind {}", (int)h.kind));
+  if (h.pixelSize == 0 || h.pixelSize > 1024)
+    throw std::invalid_argument(std::format("bad pixel size {}", h.pixelSize));
+  const auto format = ToImageFormat(h.format);
+
+  const std::shared_ptr<FaceEntry> held =
+      face(request.query.empty() ? "sans" : request.query, h.pixelSize);
+  FaceEntry &entry = *held;
+
+  OutputImage image;
+  {
+    std::lock_guard lock(entry.mutex);
+    const GlyphRun &run = entry.shaped(request.text, _options.shapeCacheSize);
+    // refused before the pixels are allocated
+    const size_t bytes = (size_t)run.size.x * run.size.y * image.channels;
+    if (bytes > _options.maxImageBytes) {
+      throw std::invalid_argument(
+          std::format("a {}x{} image exceeds the limit of {} bytes",
+                      run.size.x, run.size.y, _options.maxImageBytes));
+    }
+    image.size = run.size;
+    image.pixels.assign((size_t)run.size.x * run.size.y, 0);
+    const int baseline = (int)((entry.face->size->metrics.ascender + 63) >> 6);
+    RenderInto(entry.face, run.glyphs, {0, baseline}, image.pixels, run.size,
+               &entry.bitmaps);
+  }
+
+  response.width = image.size.x;
+  response.height = image.size.y;
+  response.channels = (uint16_t)image.channels;
+  return EncodeImage(image, format, _encoder.get());
+}
+
+std::shared_ptr<RenderServer::FaceEntry>
+RenderServer::face(const std::string &query, unsigned pixelSize) {
+  std::lock_guard lock(_facesMutex);
+
+  const std::string *path = _fontPaths.find(query);
+  if (!path)
+    path = &_fontPaths.insert(query, find_font(query));
+
+  std::pair<std::string, unsigned> key{*path, pixelSize};
+  if (std::shared_ptr<FaceEntry> *entry = _faces.find(key))
+    return *entry;
+  return _faces.insert(std::move(key),
+                       std::make_shared<FaceEntry>(*path, pixelSize));
+}
@@ -0,0 +1,89 @@
+#ifndef SERVER_SERVER_HPP
+#define SERVER_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lru_map.hpp"
+#include "protocol.hpp"
+
+class Executor;
+class TerrainJob;
+
+/**
+ * @brief Resident render daemon listening on a Unix domain socket.
+ *
+ * Fonts, faces, shaped runs and the OpenCL context with its built program
+ * stay loaded between requests, so a request only pays for the actual
+ * rendering. Connections are served by a fixed pool of threads, one
+ * connection per thread at a time; accepted connections wait in a bounded
+ * queue for a free thread and are refused once it is full. Requests on one
+ * connection may be pipelined and are answered in order.
+ */
+class RenderServer {
+public:
+  struct Options {
+    std::filesystem::path assetsDir;  // empty = no OpenCL warm-up
+    size_t shapeCacheSize = 1024;     // shaped runs kept per face
+    size_t faceCacheSize = 16;        // (font, pixel size) faces kept loaded
+    size_t fontQueryCacheSize = 256;  // font queries kept resolved
+    size_t maxImageBytes = 256 << 20; // larger text images are refused
+    unsigned connectionThreads = 8;   // connections served at once
+    size_t connectionBacklog = 64;    // accepted connections left waiting
+    unsigned encodeThreads = 2;       // PNG strip encoders of all requests
+  };
+
+  RenderServer(std::filesystem::path socketPath, Options options);
+  ~RenderServer();
+
+  RenderServer(const RenderServer &) = delete;
+  RenderServer &operator=(const RenderServer &) = delete;
+
+  /// Accepts connections until stop() is called.
+  void serve();
+
+  /// Async-signal-safe, may be called from a signal handler.
+  void stop() { _stop = true; }
+
+private:
+  struct FaceEntry;
+
+  void work();
+  void handle(int fd);
+  std::vector<uint8_t> render(const protocol::Request &request,
+                              protocol::ResponseHeader &response);
+  std::shared_ptr<FaceEntry> face(const std::string &query,
+                                  unsigned pixelSize);
+
+  std::filesystem::path _socketPath;
+  Options _options;
+  int _listenFd = -1;
+  std::atomic<bool> _stop{false};
+
+  // a face evicted while rendering lives on until the render lets go
+  std::mutex _facesMutex;
+  LruMap<std::string, std::string> _fontPaths; // query -> file
+  LruMap<std::pair<std::string, unsigned>, std::shared_ptr<FaceEntry>> _faces;
+
+  std::unique_ptr<Executor> _encoder; // PNG strips of all connections
+
+  std::mutex _terrainMutex;
+  std::unique_ptr<TerrainJob> _terrain;
+
+  std::mutex _clientsMutex;
+  std::condition_variable _pendingReady;
+  std::deque<int> _pending; // accepted, waiting for a thread
+  std::set<int> _clients;   // being served, shut down on stop
+  std::vector<std::jthread> _workers;
+};
+
+#endif // SERVER_SERVER_HPP
@@ -0,0 +1,193 @@
+#include "trace.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+constexpr size_t kCapacity = 1 << 16; // events per thread, power of two
+constexpr size_t kRetired = 8; // exited threads whose events are kept
+
+/**
+ * @brief Single producer ring buffer. Only the owning thread writes; the
+ * exporter reads `head` before and after copying to detect overwritten slots.
+ * Buffers outlive their threads and are handed to new threads later, so a
+ * process that keeps creating threads keeps a bounded number of them.
+ */
+struct ThreadBuffer {
+  std::array<Event, kCapacity> events;
+  std::atomic<uint64_t> head{0};
+  std::mutex mutex; // guards the owner's identity below
+  uint32_t id = 0;
+  uint64_t start = 0; // first event of the current owner
+  std::string name;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers; // every one, exported
+  // buffers of exited threads, oldest first; their events stay exported
+  // until a new thread takes the buffer over
+  std::array<ThreadBuffer *, kRetired> retired{};
+  size_t retiredFirst = 0, retiredCount = 0;
+  std::vector<ThreadBuffer *> spare; // reserved for all, never allocates
+  uint32_t nextId = 1;
+
+  static Registry &instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  ThreadBuffer *acquire() {
+    std::lock_guard lock(mutex);
+    ThreadBuffer *buffer = nullptr;
+    if (!spare.empty()) {
+      buffer = spare.back();
+      spare.pop_back();
+    } else if (retiredCount == kRetired) {
+      buffer = retired[retiredFirst];
+      retiredFirst = (retiredFirst + 1) % kRetired;
+      --retiredCount;
+    } else {
+      buffers.push_back(std::make_shared<ThreadBuffer>());
+      spare.reserve(buffers.size());
+      buffer = buffers.back().get();
+    }
+
+    std::lock_guard owner(buffer->mutex);
+    buffer->id = nextId++;
+    buffer->start = buffer->head.load(std::memory_order_relaxed);
+    buffer->name.clear();
+    return buffer;
+  }
+
+  void retire(ThreadBuffer *buffer) {
+    std::lock_guard lock(mutex);
+    if (retiredCount == kRetired) {
+      spare.push_back(retired[retiredFirst]);
+      retiredFirst = (retiredFirst + 1) % kRetired;
+      --retiredCount;
+    }
+    retired[(retiredFirst + retiredCount++) % kRetired] = buffer;
+  }
+};
+
+// Hands the thread's buffer back when the thread exits.
+struct LocalSlot {
+  ThreadBuffer *buffer = Registry::instance().acquire();
+  ~LocalSlot() { Registry::instance().retire(buffer); }
+};
+
+ThreadBuffer &LocalBuffer() {
+  thread_local LocalSlot slot;
+  return *slot.buffer;
+}
+
+std::string Escape(std::string_view s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    if ((unsigned char)c >= 0x20)
+      out += c;
+  }
+  return out;
+}
+
+} // namespace
+
+void Record(const char *name, uint64_t begin, uint64_t end) {
+  ThreadBuffer &buffer = LocalBuffer();
+  const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  buffer.events[head & (kCapacity - 1)] = Event{name, begin, end};
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void SetThreadName(std::string name) {
+  ThreadBuffer &buffer = LocalBuffer();
+  std::lock_guard lock(buffer.mutex);
+  buffer.name = std::move(name);
+}
+
+void WriteChromeTrace(const std::filesystem::path &path) {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    auto &registry = Registry::instance();
+    std::lock_guard lock(registry.mutex);
+    buffers = registry.buffers;
+  }
+
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error("Failed to write: " + path.string());
+  }
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  bool first = true;
+  size_t written = 0;
+
+  for (const auto &buffer : buffers) {
+    uint32_t id;
+    uint64_t start;
+    {
+      std::lock_guard lock(buffer->mutex);
+      id = buffer->id;
+      start = buffer->start;
+      const auto name =
+          buffer->name.empty() ? std::format("thread {}", id) : buffer->name;
+      out << (first ? "" : ",\n")
+          << std::format("{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                         "\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                         id, Escape(name));
+      first = false;
+    }
+
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    const uint64_t tail =
+        std::max(start, head > kCapacity ? head - kCapacity : 0);
+
+    std::vector<Event> events;
+    events.reserve(head - tail);
+    for (uint64_t i = tail; i < head; ++i) {
+      events.push_back(buffer->events[i & (kCapacity - 1)]);
+    }
+
+    // everything the owner wrote meanwhile may have replaced our oldest
+    // copies, and the slot it is writing now may be torn
+    const uint64_t after = buffer->head.load(std::memory_order_acquire);
+    const uint64_t overwritten =
+        after + 1 > kCapacity ? std::min(after + 1 - kCapacity, head) : 0;
+    size_t skip = overwritten > tail ? overwritten - tail : 0;
+    {
+      // taken over by a new thread while copying: none of it is ours
+      std::lock_guard lock(buffer->mutex);
+      if (buffer->id != id)
+        skip = events.size();
+    }
+
+    for (size_t i = skip; i < events.size(); ++i) {
+      const Event &e = events[i];
+      out << std::format(",\n{{\"ph\":\"X\",\"name\":\"{}\",\"pid\":1,"
+                         "\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                         Escape(e.name), id, (double)e.begin / 1000.0,
+                         (double)(e.end - e.begin) / 1000.0);
+      ++written;
+    }
+  }
+
+  out << "\n]}\n";
+  spdlog::info("Saved {} trace events to '{}'", written, path.string());
+}
+
+} // namespace trace
@@ -0,0 +1,70 @@
+#ifndef TRACE_TRACE_HPP
+#define TRACE_TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace trace {
+
+/**
+ * @brief A completed zone. `name` must point to a string literal, only the
+ * pointer is stored.
+ */
+struct Event {
+  const char *name;
+  uint64_t begin; // ns since process start
+  uint64_t end;
+};
+
+inline uint64_t Now() {
+  static const auto start = std::chrono::steady_clock::now();
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/// Appends to the calling thread's ring buffer; never blocks.
+void Record(const char *name, uint64_t begin, uint64_t end);
+
+/// Label shown for the calling thread in the trace viewer.
+void SetThreadName(std::string name);
+
+/**
+ * @brief Writes all buffered events as Chrome trace JSON (loads in
+ * chrome://tracing and ui.perfetto.dev). Safe to call while other threads
+ * keep recording; zones overwritten during the export are dropped.
+ */
+void WriteChromeTrace(const std::filesystem::path &path);
+
+/**
+ * @brief RAII zone, records [construction, destruction) on scope exit.
+ */
+class Zone {
+public:
+  explicit Zone(const char *name) : _name(name), _begin(Now()) {}
+  ~Zone() { Record(_name, _begin, Now()); }
+
+  Zone(const Zone &) = delete;
+  Zone &operator=(const Zone &) = delete;
+
+private:
+  const char *_name;
+  uint64_t _begin;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef USE_TRACE
+#define TRACE_SCOPE(name) ::trace::Zone TRACE_CONCAT(traceZone_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) ::trace::SetThreadName(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+#endif // TRACE_TRACE_HPP